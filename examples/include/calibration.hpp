@@ -19,7 +19,15 @@
 #else
 #include <unistd.h>
 #include <sys/vfs.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
 #endif
+#include <future>
+#include <utility>
+#include <cstdlib>
 
 
 
@@ -4098,72 +4106,266 @@ static inline std::string getHiddenDir() {
     return filename;
 }
 
-bool downloadCalibrationFile(unsigned int serial_number, std::string &calibration_file) {
+/*!
+ * \brief Name of the calibration file of a camera
+ * \param serial_number the serial number of the camera
+ * \return the file name `SN<serial_number>.conf`
+ */
+static inline std::string calibrationFileName(unsigned int serial_number) {
+    return std::string("SN") + std::to_string(serial_number) + ".conf";
+}
+
+/*!
+ * \brief Create a folder and its missing parents, like `mkdir -p`
+ * \param path the folder to create
+ * \return true if the folder exists at the end of the call
+ */
+static inline bool makeDirs(const std::string& path) {
 #ifndef _WIN32
-    std::string path = getHiddenDir();
-    char specific_name[128];
-    sprintf(specific_name, "SN%d.conf", serial_number);
-    calibration_file = path + specific_name;
-    if (!checkFile(calibration_file)) {
-        std::string cmd;
-        int res;
+    std::string partial;
+    std::stringstream ss(path);
+    std::string item;
+    if (!path.empty() && path[0] == '/')
+        partial = "/";
+    while (std::getline(ss, item, '/')) {
+        if (item.empty())
+            continue;
+        partial += item + "/";
+        if (mkdir(partial.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+#else
+    return SHCreateDirectoryExA(NULL, path.c_str(), NULL) == ERROR_SUCCESS ||
+           GetLastError() == ERROR_ALREADY_EXISTS;
+#endif
+}
 
-        // Create download folder
-        cmd = "mkdir -p " + path;
-        res = system(cmd.c_str());
+/*!
+ * \brief A calibration file compiled in the application (see \ref CalibrationProvider)
+ */
+struct EmbeddedCalibration {
+    unsigned int serial_number; //!< Serial number of the camera
+    const char* conf;           //!< Content of the calibration file
+};
 
-        // Download the file
-        std::string url("'https://calib.stereolabs.com/?SN=");
+#ifdef SL_OC_CALIBRATION_BUNDLE
+#include SL_OC_CALIBRATION_BUNDLE
+#endif
 
-        cmd = "wget " + url + std::to_string(serial_number) + "' -O " + calibration_file;
-        std::cout << cmd << std::endl;
-        res = system(cmd.c_str());
+/*!
+ * \brief The CalibrationProvider class resolves the calibration file of a camera, offline first
+ *
+ * The calibration file `SN<serial>.conf` is searched, in order:
+ *  1. in the folders of the search path: the folders listed in the `ZED_OC_CALIBRATION_PATH` environment variable
+ *     (separated by `:`), the folders added with \ref addSearchDir, the ZED settings folder (`~/zed/settings/`)
+ *     and the ZED SDK settings folder (`/usr/local/zed/settings/`);
+ *  2. in the embedded bundle: the calibrations added with \ref addEmbedded and, if the
+ *     `SL_OC_CALIBRATION_BUNDLE` macro is defined, the calibrations of the header it names. The header must
+ *     define `static const sl_oc::tools::EmbeddedCalibration sl_oc_calibration_bundle[]`;
+ *  3. on the Stereolabs servers, only if enabled. The download runs asynchronously: the capture can start while
+ *     the calibration is resolved. `curl` or `wget` is executed directly, without a shell.
+ *
+ * The embedded and downloaded calibrations are stored in the ZED settings folder, so that the next lookup is local.
+ */
+class CalibrationProvider {
+public:
+    /*!
+     * \brief The default constructor
+     * \param allow_download enable the download from the Stereolabs servers when the calibration is not found locally
+     */
+    CalibrationProvider(bool allow_download = true) : allow_download_(allow_download) {
+        const char* env = getenv("ZED_OC_CALIBRATION_PATH");
+        if (env)
+            split(env, ':', env_dirs_);
+
+#ifdef SL_OC_CALIBRATION_BUNDLE
+        for (const EmbeddedCalibration& calib : sl_oc_calibration_bundle)
+            addEmbedded(calib.serial_number, calib.conf);
+#endif
+    }
 
-        if( res == EXIT_FAILURE )
-        {
-            std::cerr << "Error downloading the calibration file" << std::endl;
-            return false;
+    /*!
+     * \brief Add a folder to the search path, after the ones of `ZED_OC_CALIBRATION_PATH`
+     * \param dir the folder
+     */
+    void addSearchDir(const std::string& dir) {
+        user_dirs_.push_back(dir);
+    }
+
+    /*!
+     * \brief Add a calibration to the embedded bundle
+     * \param serial_number the serial number of the camera
+     * \param conf the content of the calibration file
+     */
+    void addEmbedded(unsigned int serial_number, const std::string& conf) {
+        embedded_.push_back(std::make_pair(serial_number, conf));
+    }
+
+    /*!
+     * \brief Search the calibration in the search path and in the embedded bundle, with no network access
+     * \param serial_number the serial number of the camera
+     * \param calibration_file the path of the calibration file, if found
+     * \return true if the calibration is found
+     */
+    bool findLocal(unsigned int serial_number, std::string& calibration_file) {
+        const std::string name = calibrationFileName(serial_number);
+
+        // ----> Search path
+        for (const std::string& dir : searchPath()) {
+            if (dir.empty())
+                continue;
+            std::string path = dir;
+            if (path.back() != '/' && path.back() != '\\')
+                path += "/";
+            path += name;
+            if (checkFile(path)) {
+                calibration_file = path;
+                return true;
+            }
         }
+        // <---- Search path
 
-        if (!checkFile(calibration_file)) {
-            std::cerr << "Invalid calibration file" << std::endl;
-            return false;
+        // ----> Embedded bundle
+        for (const auto& calib : embedded_) {
+            if (calib.first != serial_number)
+                continue;
+
+            // The calibration parser reads files
+            std::string path = getHiddenDir() + name;
+            if (!makeDirs(getHiddenDir()) || !writeFileAtomic(path, calib.second))
+                return false;
+            calibration_file = path;
+            return true;
         }
+        // <---- Embedded bundle
+
+        return false;
     }
+
+    /*!
+     * \brief Resolve the calibration of a camera
+     * \param serial_number the serial number of the camera
+     * \return the path of the calibration file, empty on failure. The future is ready immediately when the
+     *         calibration is found locally, otherwise it is set by the download thread
+     */
+    std::shared_future<std::string> resolve(unsigned int serial_number) {
+        std::string calibration_file;
+        if (findLocal(serial_number, calibration_file) || !allow_download_) {
+            if (calibration_file.empty())
+                std::cerr << "Calibration file " << calibrationFileName(serial_number) << " not found locally" << std::endl;
+
+            std::promise<std::string> ready;
+            ready.set_value(calibration_file);
+            return ready.get_future().share();
+        }
+
+        return std::async(std::launch::async, [serial_number]() {
+            std::string path;
+            return download(serial_number, path) ? path : std::string();
+        }).share();
+    }
+
+    /*!
+     * \brief Download the calibration of a camera from the Stereolabs servers to the ZED settings folder
+     * \param serial_number the serial number of the camera
+     * \param calibration_file the path of the downloaded calibration file
+     * \return true on success
+     */
+    static bool download(unsigned int serial_number, std::string& calibration_file) {
+        std::string dir = getHiddenDir();
+        calibration_file = dir + calibrationFileName(serial_number);
+        if (!makeDirs(dir)) {
+            std::cerr << "Cannot create the folder " << dir << std::endl;
+            return false;
+        }
+
+        std::string url = std::string("https://calib.stereolabs.com/?SN=") + std::to_string(serial_number);
+        std::cout << "Downloading " << url << std::endl;
+
+        // Downloaded to a temporary file: an interrupted download never leaves an invalid calibration file
+        std::string tmp_file = calibration_file + ".download";
+        bool ok = false;
+#ifndef _WIN32
+        ok = runDownloader({"curl", "-sfL", "-o", tmp_file, url}) ||
+             runDownloader({"wget", "-q", "-O", tmp_file, url});
 #else
-    std::string path = getHiddenDir();
-    char specific_name[128];
-    sprintf(specific_name, "SN%d.conf", serial_number);
-    calibration_file = path + specific_name;
-    if (!checkFile(calibration_file)) {
-        TCHAR *settingFolder = new TCHAR[path.size() + 1];
-        settingFolder[path.size()] = 0;
-        std::copy(path.begin(), path.end(), settingFolder);
-        SHCreateDirectoryEx(NULL, settingFolder, NULL); //recursive creation
-
-        std::string url("https://calib.stereolabs.com/?SN=");
-        url += std::to_string(serial_number);
-        TCHAR *address = new TCHAR[url.size() + 1];
-        address[url.size()] = 0;
-        std::copy(url.begin(), url.end(), address);
-        TCHAR *calibPath = new TCHAR[calibration_file.size() + 1];
-        calibPath[calibration_file.size()] = 0;
-        std::copy(calibration_file.begin(), calibration_file.end(), calibPath);
-
-        HRESULT hr = URLDownloadToFile(NULL, address, calibPath, 0, NULL);
-        if (hr != 0) {
-            std::cout << "Fail to download calibration file" << std::endl;
+        ok = URLDownloadToFileA(NULL, url.c_str(), tmp_file.c_str(), 0, NULL) == S_OK;
+#endif
+        if (!ok || !ConfManager(tmp_file).isOpened() || std::rename(tmp_file.c_str(), calibration_file.c_str()) != 0) {
+            std::remove(tmp_file.c_str());
+            std::cerr << "Error downloading the calibration file" << std::endl;
             return false;
         }
 
-        if (!checkFile(calibration_file)) {
-            std::cout << "Invalid calibration file" << std::endl;
+        return true;
+    }
+
+private:
+    std::vector<std::string> searchPath() const {
+        std::vector<std::string> dirs = env_dirs_;
+        dirs.insert(dirs.end(), user_dirs_.begin(), user_dirs_.end());
+        dirs.push_back(getHiddenDir());
+#ifndef _WIN32
+        dirs.push_back("/usr/local/zed/settings/");
+#endif
+        return dirs;
+    }
+
+    static bool writeFileAtomic(const std::string& path, const std::string& content) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp.c_str(), std::ios::binary | std::ios::trunc);
+            f << content;
+            if (!f.good())
+                return false;
+        }
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+#ifndef _WIN32
+    // Execute a download tool without a shell. Returns false if the tool is missing or fails
+    static bool runDownloader(const std::vector<std::string>& args) {
+        std::vector<char*> argv;
+        for (const std::string& arg : args)
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid < 0)
             return false;
+        if (pid == 0) {
+            execvp(argv[0], argv.data());
+            _exit(127); // Tool not installed
+        }
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR)
+                return false;
         }
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
     }
 #endif
 
-    return true;
+private:
+    bool allow_download_;
+    std::vector<std::string> env_dirs_;
+    std::vector<std::string> user_dirs_;
+    std::vector<std::pair<unsigned int, std::string>> embedded_;
+};
+
+/*!
+ * \brief Get the calibration file of a camera, from the local folders, the embedded bundle or the Stereolabs servers
+ *        (see \ref CalibrationProvider)
+ * \param serial_number the serial number of the camera
+ * \param calibration_file the path of the calibration file
+ * \return true on success
+ * \note Blocks until the download is completed if the calibration is not found locally.
+ */
+bool downloadCalibrationFile(unsigned int serial_number, std::string &calibration_file) {
+    calibration_file = CalibrationProvider().resolve(serial_number).get();
+    return !calibration_file.empty();
 }
 
 // OpenCV includes
@@ -4282,6 +4484,241 @@ bool initCalibration(std::string calibration_file, cv::Size2i image_size, cv::Ma
     return 1;
 }
 
+/*!
+ * \brief 64-bit FNV-1a hash of the content of a file
+ * \param path the file
+ * \param hash the hash of the file
+ * \return false if the file cannot be read
+ */
+inline bool hashFile(const std::string& path, uint64_t& hash) {
+    std::ifstream f(path.c_str(), std::ios::binary);
+    if (!f.good())
+        return false;
+
+    hash = 14695981039346656037ULL;
+    char buf[4096];
+    while (f.read(buf, sizeof(buf)) || f.gcount() > 0) {
+        for (std::streamsize i = 0; i < f.gcount(); i++) {
+            hash ^= static_cast<uint8_t>(buf[i]);
+            hash *= 1099511628211ULL;
+        }
+    }
+    return true;
+}
+
+/*!
+ * \brief The RectificationMaps class provides the rectification maps of a camera, from a persistent cache when possible
+ *
+ * The maps are stored in the compact fixed-point form of `cv::convertMaps`: `map_*_1` is `CV_16SC2` (integer
+ * coordinates) and `map_*_2` is `CV_16UC1` (interpolation table index). They are passed to `cv::remap` like the
+ * floating point maps, with 6 bytes per pixel instead of 8.
+ *
+ * The cache file `SN<serial>_<width>x<height>.rmap`, in the ZED settings folder, is valid only for the hash of the
+ * calibration file it was computed from. On a cache hit the maps point directly into the read-only memory mapping
+ * of the file: nothing is computed nor copied, and the pages are shared by all the processes using the camera.
+ *
+ * \note The maps are valid while the RectificationMaps object exists.
+ */
+class RectificationMaps {
+public:
+    RectificationMaps() {}
+    ~RectificationMaps() {
+        unmap();
+    }
+
+    RectificationMaps(const RectificationMaps&) = delete;
+    RectificationMaps& operator=(const RectificationMaps&) = delete;
+
+    /*!
+     * \brief Get the rectification maps from the cache, or compute them and update the cache
+     * \param serial_number the serial number of the camera
+     * \param calibration_file the calibration file of the camera
+     * \param image_size the size of a single image (half the side-by-side frame width)
+     * \return true on success
+     */
+    bool load(unsigned int serial_number, const std::string& calibration_file, cv::Size2i image_size) {
+        unmap();
+        from_cache_ = false;
+
+        uint64_t hash = 0;
+        if (!hashFile(calibration_file, hash)) {
+            std::cout << "Calibration file missing." << std::endl;
+            return false;
+        }
+
+        char name[128];
+        sprintf(name, "SN%u_%dx%d.rmap", serial_number, image_size.width, image_size.height);
+        std::string cache_file = getHiddenDir() + name;
+
+        if (mapCache(cache_file, hash, image_size)) {
+            from_cache_ = true;
+            return true;
+        }
+
+        // ----> Compute the maps
+        cv::Mat map_left_x, map_left_y, map_right_x, map_right_y;
+        if (!initCalibration(calibration_file, image_size, map_left_x, map_left_y, map_right_x, map_right_y,
+                             cameraMatrix_left, cameraMatrix_right, &baseline))
+            return false;
+
+        cv::convertMaps(map_left_x, map_left_y, map_left_1, map_left_2, CV_16SC2);
+        cv::convertMaps(map_right_x, map_right_y, map_right_1, map_right_2, CV_16SC2);
+        // <---- Compute the maps
+
+        // The computed maps stay in memory if the cache cannot be written
+        if (writeCache(cache_file, hash, serial_number, image_size)) {
+            std::cout << "Rectification maps stored in " << cache_file << std::endl;
+        }
+
+        return true;
+    }
+
+    inline bool fromCache() const { return from_cache_; } //!< Indicates if the maps come from the cache
+
+    cv::Mat map_left_1, map_left_2;         //!< Left rectification maps (`CV_16SC2`, `CV_16UC1`)
+    cv::Mat map_right_1, map_right_2;       //!< Right rectification maps (`CV_16SC2`, `CV_16UC1`)
+    cv::Mat cameraMatrix_left;              //!< Left projection matrix after rectification (3x4, `CV_64F`)
+    cv::Mat cameraMatrix_right;             //!< Right projection matrix after rectification (3x4, `CV_64F`)
+    double baseline = 0;                    //!< Stereo baseline
+
+private:
+#pragma pack(push,1)
+    struct CacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t serial_number;
+        int32_t width;
+        int32_t height;
+        uint64_t calib_hash;                // Hash of the calibration file of the maps
+        double baseline;
+        double P_left[12];
+        double P_right[12];
+    };
+#pragma pack(pop)
+
+    static const uint32_t CACHE_VERSION = 1;
+    static const size_t DATA_OFFSET = 256;  // Start of the maps, aligned for the remap loads
+
+    static inline const char* cacheMagic() { return "SLOCRMAP"; }
+
+    static size_t cacheSize(cv::Size2i size) {
+        size_t px = static_cast<size_t>(size.width) * size.height;
+        return DATA_OFFSET + 2 * (px * 2 * sizeof(int16_t) + px * sizeof(uint16_t));
+    }
+
+    bool mapCache(const std::string& cache_file, uint64_t hash, cv::Size2i size) {
+#ifndef _WIN32
+        int fd = open(cache_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        size_t len = cacheSize(size);
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != len) {
+            close(fd);
+            return false;
+        }
+
+        void* ptr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // The mapping keeps the file open
+        if (ptr == MAP_FAILED)
+            return false;
+
+        CacheHeader hdr;
+        memcpy(&hdr, ptr, sizeof(hdr));
+        if (memcmp(hdr.magic, cacheMagic(), sizeof(hdr.magic)) != 0 || hdr.version != CACHE_VERSION ||
+                hdr.width != size.width || hdr.height != size.height || hdr.calib_hash != hash) {
+            munmap(ptr, len);
+            return false;
+        }
+
+        map_ = ptr;
+        map_len_ = len;
+
+        // ----> Matrices pointing into the mapping, never written
+        uint8_t* data = static_cast<uint8_t*>(ptr) + DATA_OFFSET;
+        size_t px = static_cast<size_t>(size.width) * size.height;
+        map_left_1 = cv::Mat(size, CV_16SC2, data);
+        data += px * 2 * sizeof(int16_t);
+        map_left_2 = cv::Mat(size, CV_16UC1, data);
+        data += px * sizeof(uint16_t);
+        map_right_1 = cv::Mat(size, CV_16SC2, data);
+        data += px * 2 * sizeof(int16_t);
+        map_right_2 = cv::Mat(size, CV_16UC1, data);
+        // <---- Matrices pointing into the mapping, never written
+
+        // Copied out of the packed header to be aligned
+        double P_left[12], P_right[12];
+        memcpy(P_left, hdr.P_left, sizeof(P_left));
+        memcpy(P_right, hdr.P_right, sizeof(P_right));
+        cameraMatrix_left = cv::Mat(3, 4, CV_64F, P_left).clone();
+        cameraMatrix_right = cv::Mat(3, 4, CV_64F, P_right).clone();
+        baseline = hdr.baseline;
+
+        return true;
+#else
+        (void)cache_file; (void)hash; (void)size;
+        return false;
+#endif
+    }
+
+    bool writeCache(const std::string& cache_file, uint64_t hash, unsigned int serial_number, cv::Size2i size) {
+        CacheHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, cacheMagic(), sizeof(hdr.magic));
+        hdr.version = CACHE_VERSION;
+        hdr.serial_number = serial_number;
+        hdr.width = size.width;
+        hdr.height = size.height;
+        hdr.calib_hash = hash;
+        hdr.baseline = baseline;
+        for (int i = 0; i < 12; i++) {
+            hdr.P_left[i] = cameraMatrix_left.at<double>(i / 4, i % 4);
+            hdr.P_right[i] = cameraMatrix_right.at<double>(i / 4, i % 4);
+        }
+
+        if (!makeDirs(getHiddenDir()))
+            return false;
+
+        // Written to a temporary file and renamed: a concurrent reader never maps a partial file
+        std::string tmp_file = cache_file + ".tmp";
+        {
+            std::ofstream f(tmp_file.c_str(), std::ios::binary | std::ios::trunc);
+            std::vector<char> pad(DATA_OFFSET - sizeof(hdr), 0);
+            f.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+            f.write(pad.data(), pad.size());
+            for (const cv::Mat* m : {&map_left_1, &map_left_2, &map_right_1, &map_right_2}) {
+                cv::Mat c = m->isContinuous() ? *m : m->clone();
+                f.write(reinterpret_cast<const char*>(c.data), c.total() * c.elemSize());
+            }
+            if (!f.good()) {
+                std::remove(tmp_file.c_str());
+                return false;
+            }
+        }
+
+        return std::rename(tmp_file.c_str(), cache_file.c_str()) == 0;
+    }
+
+    void unmap() {
+#ifndef _WIN32
+        if (map_) {
+            map_left_1.release();
+            map_left_2.release();
+            map_right_1.release();
+            map_right_2.release();
+            munmap(map_, map_len_);
+            map_ = nullptr;
+            map_len_ = 0;
+        }
+#endif
+    }
+
+    void* map_ = nullptr;
+    size_t map_len_ = 0;
+    bool from_cache_ = false;
+};
+
 } // namespace oc_tools
 } // namespace sl_oc
 
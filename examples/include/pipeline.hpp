@@ -0,0 +1,255 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace sl_oc {
+namespace tools {
+
+/*!
+ * \brief Counters of a \ref LatestQueue (see \ref LatestQueue::getStats)
+ */
+struct QueueStats
+{
+    uint64_t pushed = 0;            //!< Number of items pushed by the producer
+    uint64_t popped = 0;            //!< Number of items delivered to the consumer
+    uint64_t dropped_full = 0;      //!< Number of oldest items discarded because the queue was full
+    uint64_t dropped_stale = 0;     //!< Number of items discarded because a newer one was already delivered
+    uint64_t max_occupancy = 0;     //!< Maximum number of items in the queue
+    double mean_occupancy = 0.0;    //!< Average number of items in the queue after a push
+};
+
+/*!
+ * \brief The LatestQueue class is a bounded lock-free queue between two pipeline stages, one producer and one consumer
+ *
+ * When the consumer falls behind and the queue is full, the oldest item is discarded to make room for the new one:
+ * the consumer always gets the freshest data (latency first). The items are delivered in the order they were
+ * pushed: an item older than the last delivered one is discarded.
+ *
+ * Push and pop never take a lock. The mutex is only used to put the consumer to sleep when the queue is empty, and
+ * the producer locks it only when the consumer is sleeping.
+ */
+template<class T>
+class LatestQueue
+{
+public:
+    /*!
+     * \brief Constructor
+     * \param capacity maximum number of items in the queue (minimum 1)
+     */
+    explicit LatestQueue(size_t capacity=2)
+        : mCapacity(capacity>0?capacity:1)
+        , mSlots(new std::atomic<Node*>[mCapacity])
+    {
+        for(size_t i=0; i<mCapacity; i++)
+            mSlots[i].store(nullptr);
+    }
+
+    ~LatestQueue()
+    {
+        for(size_t i=0; i<mCapacity; i++)
+            delete mSlots[i].exchange(nullptr);
+    }
+
+    LatestQueue(const LatestQueue&) = delete;
+    LatestQueue& operator=(const LatestQueue&) = delete;
+
+    /*!
+     * \brief Add an item. Called by the producer thread only
+     * \param item the item to be delivered to the consumer
+     * \return false if the oldest item has been discarded to make room
+     */
+    bool push(std::unique_ptr<T> item)
+    {
+        Node* node = new Node;
+        node->seq = mPushSeq++;
+        node->item = std::move(item);
+
+        bool dropped = false;
+        uint64_t tail = mTail.load(std::memory_order_relaxed);
+        uint64_t head = mHead.load(std::memory_order_acquire);
+
+        // ----> Full: the oldest item is discarded
+        // If the consumer advances the head first the CAS fails, and there is room
+        if( tail-head>=mCapacity && mHead.compare_exchange_strong(head, head+1, std::memory_order_acq_rel) )
+        {
+            // `nullptr` if the consumer took the item in the meantime
+            Node* oldest = mSlots[head%mCapacity].exchange(nullptr, std::memory_order_acq_rel);
+            if(oldest)
+            {
+                delete oldest;
+                mDroppedFull.fetch_add(1, std::memory_order_relaxed);
+                dropped = true;
+            }
+        }
+        // <---- Full: the oldest item is discarded
+
+        mSlots[tail%mCapacity].store(node, std::memory_order_release);
+        mTail.store(tail+1);
+
+        // ----> Statistics
+        uint64_t occupancy = tail+1-mHead.load(std::memory_order_relaxed);
+        mPushed.fetch_add(1, std::memory_order_relaxed);
+        mOccupancySum.fetch_add(occupancy, std::memory_order_relaxed);
+        if(occupancy>mMaxOccupancy.load(std::memory_order_relaxed))
+            mMaxOccupancy.store(occupancy, std::memory_order_relaxed);
+        // <---- Statistics
+
+        // Wake the consumer only if sleeping
+        if(mWaiting.load())
+        {
+            { std::lock_guard<std::mutex> lock(mWaitMutex); }
+            mWaitCond.notify_one();
+        }
+
+        return !dropped;
+    }
+
+    /*!
+     * \brief Get the oldest item, waiting for it if the queue is empty. Called by the consumer thread only
+     * \param timeout_msec maximum wait time in milliseconds
+     * \return the item, `nullptr` on timeout or if the queue has been closed
+     */
+    std::unique_ptr<T> pop(uint64_t timeout_msec=100)
+    {
+        std::unique_ptr<T> item = tryPop();
+        if(item || timeout_msec==0)
+            return item;
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_msec);
+        while(!item && !mClosed.load())
+        {
+            {
+                std::unique_lock<std::mutex> lock(mWaitMutex);
+                mWaiting.store(true);
+                bool ready = mWaitCond.wait_until(lock, deadline, [this] {
+                    return mClosed.load() || mHead.load()!=mTail.load();
+                });
+                mWaiting.store(false);
+                if(!ready)
+                    return nullptr;
+            }
+            item = tryPop();
+        }
+
+        return item;
+    }
+
+    /*!
+     * \brief Wake the consumer: \ref pop returns `nullptr` as soon as the queue is empty
+     */
+    void close()
+    {
+        mClosed.store(true);
+        { std::lock_guard<std::mutex> lock(mWaitMutex); }
+        mWaitCond.notify_all();
+    }
+
+    inline size_t getCapacity() const {return mCapacity;}                   //!< Maximum number of items
+    inline size_t size() const {return static_cast<size_t>(mTail.load()-mHead.load());} //!< Current number of items
+    inline bool isClosed() const {return mClosed.load();}                   //!< The producer has closed the queue
+
+    /*!
+     * \brief Get the queue counters
+     * \return the counters since the creation of the queue
+     */
+    QueueStats getStats() const
+    {
+        QueueStats stats;
+        stats.pushed = mPushed.load();
+        stats.popped = mPopped.load();
+        stats.dropped_full = mDroppedFull.load();
+        stats.dropped_stale = mDroppedStale.load();
+        stats.max_occupancy = mMaxOccupancy.load();
+        stats.mean_occupancy = stats.pushed ? static_cast<double>(mOccupancySum.load())/stats.pushed : 0.0;
+        return stats;
+    }
+
+private:
+    struct Node
+    {
+        uint64_t seq = 0;           // Push order of the item
+        std::unique_ptr<T> item;
+    };
+
+    std::unique_ptr<T> tryPop()
+    {
+        for(;;)
+        {
+            uint64_t head = mHead.load(std::memory_order_acquire);
+            if(head==mTail.load(std::memory_order_acquire))
+                return nullptr;
+
+            // The producer can discard the same item: the one that gets it out of the slot owns it
+            Node* node = mSlots[head%mCapacity].exchange(nullptr, std::memory_order_acq_rel);
+            mHead.compare_exchange_strong(head, head+1, std::memory_order_acq_rel);
+            if(!node)
+                continue;
+
+            // A slot reused by the producer while the consumer was reading it delivers a newer item first
+            if(node->seq<mPopSeq)
+            {
+                delete node;
+                mDroppedStale.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            mPopSeq = node->seq+1;
+            std::unique_ptr<T> item = std::move(node->item);
+            delete node;
+            mPopped.fetch_add(1, std::memory_order_relaxed);
+            return item;
+        }
+    }
+
+private:
+    const size_t mCapacity;                     // Maximum number of items
+    std::unique_ptr<std::atomic<Node*>[]> mSlots; // Ring of items, `nullptr` when empty
+
+    std::atomic<uint64_t> mHead{0};             // Position of the oldest item, advanced by both sides
+    std::atomic<uint64_t> mTail{0};             // Position of the next push, producer only
+    uint64_t mPushSeq = 0;                      // Order of the next pushed item, producer only
+    uint64_t mPopSeq = 0;                       // Minimum order of the next delivered item, consumer only
+
+    std::atomic<bool> mClosed{false};           // The queue has been closed
+    std::atomic<bool> mWaiting{false};          // The consumer is sleeping
+    std::mutex mWaitMutex;                      // Used only to sleep
+    std::condition_variable mWaitCond;          // Signaled on push and close
+
+    std::atomic<uint64_t> mPushed{0};
+    std::atomic<uint64_t> mPopped{0};
+    std::atomic<uint64_t> mDroppedFull{0};
+    std::atomic<uint64_t> mDroppedStale{0};
+    std::atomic<uint64_t> mMaxOccupancy{0};
+    std::atomic<uint64_t> mOccupancySum{0};
+};
+
+} // namespace tools
+} // namespace sl_oc
+
+#endif // PIPELINE_HPP
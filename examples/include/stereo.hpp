@@ -1,9 +1,13 @@
 #ifndef STEREO_HPP
 #define STEREO_HPP
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <vector>
 #include <opencv2/opencv.hpp>
 #include "calibration.hpp"
+#include "censusmatcher.hpp"
 
 namespace sl_oc {
 namespace tools {
@@ -13,6 +17,46 @@ namespace tools {
  */
 const std::string STEREO_PAR_FILENAME = "zed_oc_stereo.yaml";
 
+/*!
+ * \brief The STEREO_ENGINE enum lists the stereo matchers available with \ref createStereoMatcher
+ */
+enum class STEREO_ENGINE
+{
+    SGBM = 0,   //!< OpenCV semi-global block matching, the most accurate
+    BM = 1,     //!< OpenCV block matching, fast but sensitive to the exposure differences
+    CENSUS = 2  //!< Census transform and Hamming distance (see sl_oc::video::CensusMatcher)
+};
+
+/*!
+ * \brief Name of a stereo engine, as stored in the configuration file
+ */
+std::string stereoEngineToString(STEREO_ENGINE engine)
+{
+    switch(engine)
+    {
+    case STEREO_ENGINE::BM: return "bm";
+    case STEREO_ENGINE::CENSUS: return "census";
+    default: return "sgbm";
+    }
+}
+
+/*!
+ * \brief Get a stereo engine from its name (see \ref stereoEngineToString)
+ * \return false if the name is unknown, `engine` is not modified
+ */
+bool stereoEngineFromString(const std::string& name, STEREO_ENGINE& engine)
+{
+    for(STEREO_ENGINE e : {STEREO_ENGINE::SGBM, STEREO_ENGINE::BM, STEREO_ENGINE::CENSUS})
+    {
+        if(name==stereoEngineToString(e))
+        {
+            engine = e;
+            return true;
+        }
+    }
+    return false;
+}
+
 /*!
  * \brief The StereoSgbmPar class is used to store/retrieve the stereo matching parameters
  */
@@ -64,6 +108,13 @@ public:
 
     double minDepth_mm; //!< [default: 300] Minimum value of depth for the extracted depth map
     double maxDepth_mm; //!< [default: 10000] Maximum value of depth for the extracted depth map
+
+    int wallBandDisparities; //!< [default: 32] Disparities searched around the wall plane when the wall is known (see \ref WallPlanePrior). It must be divisible by 16: rounded up by \ref load. Set it to 0 to always search the full range.
+    int wallBandMargin; //!< [default: 4] Disparities searched behind the wall plane, to absorb the error of the plane fitting. The others are in front of the wall.
+    int roiMargin; //!< [default: 32] Margin in pixels around the wall polygon when the stereo matching is restricted to the wall (see \ref getStereoMatchingRegion). No margin when the wall band is searched: the disparities outside the wall are invalid. Set it to a negative value to always match the whole image.
+
+    STEREO_ENGINE engine; //!< [default: SGBM] Stereo matcher created by \ref createStereoMatcher. Stored as "sgbm", "bm" or "census".
+    int textureThreshold; //!< [default: 10] BM only: minimum texture of the block to consider its disparity valid.
 };
 
 void StereoSgbmPar::setDefaultValues()
@@ -82,6 +133,13 @@ void StereoSgbmPar::setDefaultValues()
 
     minDepth_mm = 300.;
     maxDepth_mm = 10000.;
+
+    wallBandDisparities = 32;
+    wallBandMargin = 4;
+    roiMargin = 32;
+
+    engine = STEREO_ENGINE::SGBM;
+    textureThreshold = 10;
 }
 
 bool StereoSgbmPar::load()
@@ -112,6 +170,36 @@ bool StereoSgbmPar::load()
     fs["minDepth_mm"] >> minDepth_mm;
     fs["maxDepth_mm"] >> maxDepth_mm;
 
+    // Not available in the files saved by the previous versions
+    if(!fs["wallBandDisparities"].empty())
+        fs["wallBandDisparities"] >> wallBandDisparities;
+    if(!fs["wallBandMargin"].empty())
+        fs["wallBandMargin"] >> wallBandMargin;
+    if(!fs["roiMargin"].empty())
+        fs["roiMargin"] >> roiMargin;
+    if(!fs["stereoEngine"].empty())
+    {
+        std::string name;
+        fs["stereoEngine"] >> name;
+        if(!stereoEngineFromString(name, engine))
+            std::cerr << "Unknown stereo engine '" << name << "'. Using " << stereoEngineToString(engine) << std::endl;
+    }
+    if(!fs["textureThreshold"].empty())
+        fs["textureThreshold"] >> textureThreshold;
+
+    // ----> The matchers require multiples of 16 disparities
+    auto roundDisparities = [](int& value, int min_value, const char* name) {
+        int rounded = std::max(min_value, ((value+15)/16)*16);
+        if(rounded!=value)
+        {
+            std::cerr << name << " must be divisible by 16: " << value << " rounded to " << rounded << std::endl;
+            value = rounded;
+        }
+    };
+    roundDisparities(numDisparities, 16, "numDisparities");
+    roundDisparities(wallBandDisparities, 0, "wallBandDisparities");
+    // <---- The matchers require multiples of 16 disparities
+
     std::cout << "Stereo parameters load done: " << par_file << std::endl << std::endl;
 
     return true;
@@ -142,6 +230,13 @@ bool StereoSgbmPar::save()
     fs << "minDepth_mm" << minDepth_mm;
     fs << "maxDepth_mm" << maxDepth_mm;
 
+    fs << "wallBandDisparities" << wallBandDisparities;
+    fs << "wallBandMargin" << wallBandMargin;
+    fs << "roiMargin" << roiMargin;
+
+    fs << "stereoEngine" << stereoEngineToString(engine);
+    fs << "textureThreshold" << textureThreshold;
+
     std::cout << "Stereo parameters write done: " << par_file << std::endl << std::endl;
 
     return true;
@@ -165,9 +260,385 @@ void StereoSgbmPar::print()
 
     std::cout << "minDepth_mm:\t" << minDepth_mm << std::endl;
     std::cout << "maxDepth_mm:\t" << maxDepth_mm << std::endl;
+
+    std::cout << "wallBandDisparities:\t" << wallBandDisparities << std::endl;
+    std::cout << "wallBandMargin:\t" << wallBandMargin << std::endl;
+    std::cout << "roiMargin:\t" << roiMargin << std::endl;
+
+    std::cout << "stereoEngine:\t" << stereoEngineToString(engine) << std::endl;
+    std::cout << "textureThreshold:\t" << textureThreshold << std::endl;
     std::cout << "------------------------------------------" << std::endl << std::endl;
 }
 
+/*!
+ * \brief The WallPlanePrior class stores the disparity plane of the playing wall
+ *
+ * The disparity of a plane is an affine function of the rectified pixel coordinates: `d(x,y) = a*x + b*y + c`.
+ * Once the plane is known, the right image is warped by the disparity of the plane, so that the stereo matcher
+ * searches only a narrow band of residual disparities around the wall, instead of the full range, and the plane
+ * disparity is added back to the result.
+ */
+class WallPlanePrior
+{
+public:
+    /*!
+     * \brief Fit the plane to the valid disparities inside the wall polygon
+     * \param disparity full size disparity map in float32, in pixels
+     * \param polygon corners of the wall in the left rectified image
+     * \param step sampling step of the disparity map, in pixels
+     * \return true if the plane has been fitted
+     */
+    bool fit(const cv::Mat& disparity, const std::vector<cv::Point>& polygon, int step=4);
+
+    /*!
+     * \brief Create the images used to match the wall band at the given scale of the stereo images
+     * \param size size of the images processed by the stereo matcher
+     * \param scale scale of the images processed by the stereo matcher w.r.t. the rectified images
+     * \param warp_1 first remap table to warp the right image on the plane (CV_16SC2)
+     * \param warp_2 second remap table to warp the right image on the plane (CV_16UC1)
+     * \param plane_disp disparity of the plane for each pixel (CV_32FC1)
+     * \param outside mask of the pixels outside the wall polygon (CV_8UC1)
+     */
+    void buildMaps(cv::Size size, double scale, cv::Mat& warp_1, cv::Mat& warp_2, cv::Mat& plane_disp, cv::Mat& outside) const;
+
+    inline double disparityAt(double x, double y) const {return mA*x+mB*y+mC;} //!< Disparity of the plane at the given full size coordinates
+    inline const std::vector<cv::Point>& getPolygon() const {return mPolygon;}  //!< Corners of the wall
+    inline int getInliers() const {return mInliers;}                            //!< Number of disparities used by the last fit
+    inline double getRmsError() const {return mRmsError;}                       //!< RMS residual of the last fit, in pixels
+
+private:
+    double mA = 0.0;                    // Disparity increment along x
+    double mB = 0.0;                    // Disparity increment along y
+    double mC = 0.0;                    // Disparity at the origin
+    std::vector<cv::Point> mPolygon;    // Corners of the wall
+    int mInliers = 0;
+    double mRmsError = 0.0;
+};
+
+bool WallPlanePrior::fit(const cv::Mat& disparity, const std::vector<cv::Point>& polygon, int step)
+{
+    if(disparity.empty() || disparity.type()!=CV_32FC1 || polygon.size()<3)
+        return false;
+
+    cv::Mat inside = cv::Mat::zeros(disparity.size(), CV_8UC1);
+    cv::fillConvexPoly(inside, polygon, cv::Scalar(255));
+
+    // ----> Least squares, the second pass discards the disparities far from the first plane (the ball, the
+    // matching errors)
+    bool fitted = false;
+    double max_residual = -1.0;
+    for(int pass=0; pass<2; pass++)
+    {
+        // Normal equations of `d = a*x + b*y + c`
+        double sxx=0, sxy=0, sx=0, syy=0, sy=0, n=0, sxd=0, syd=0, sd=0;
+        for(int y=0; y<disparity.rows; y+=step)
+        {
+            const float* d_row = disparity.ptr<float>(y);
+            const uint8_t* in_row = inside.ptr<uint8_t>(y);
+            for(int x=0; x<disparity.cols; x+=step)
+            {
+                double d = d_row[x];
+                if(!in_row[x] || !std::isfinite(d) || d<=0.0)
+                    continue;
+                if(max_residual>0.0 && std::fabs(d-disparityAt(x,y))>max_residual)
+                    continue;
+
+                sxx+=x*x; sxy+=x*y; sx+=x; syy+=y*y; sy+=y; n+=1;
+                sxd+=x*d; syd+=y*d; sd+=d;
+            }
+        }
+
+        if(n<3)
+            break;
+
+        // Cramer's rule
+        double det = sxx*(syy*n-sy*sy) - sxy*(sxy*n-sy*sx) + sx*(sxy*sy-syy*sx);
+        if(std::fabs(det)<1e-9)
+            break;
+
+        mA = (sxd*(syy*n-sy*sy) - sxy*(syd*n-sy*sd) + sx*(syd*sy-syy*sd))/det;
+        mB = (sxx*(syd*n-sd*sy) - sxd*(sxy*n-sy*sx) + sx*(sxy*sd-syd*sx))/det;
+        mC = (sxx*(syy*sd-syd*sy) - sxy*(sxy*sd-syd*sx) + sxd*(sxy*sy-syy*sx))/det;
+        mInliers = static_cast<int>(n);
+        fitted = true;
+
+        max_residual = 2.0;
+    }
+    // <---- Least squares
+
+    if(!fitted)
+        return false;
+
+    // ----> Residual of the inliers
+    double sq_sum = 0.0;
+    for(int y=0; y<disparity.rows; y+=step)
+    {
+        const float* d_row = disparity.ptr<float>(y);
+        const uint8_t* in_row = inside.ptr<uint8_t>(y);
+        for(int x=0; x<disparity.cols; x+=step)
+        {
+            double d = d_row[x];
+            if(!in_row[x] || !std::isfinite(d) || d<=0.0)
+                continue;
+            double res = d-disparityAt(x,y);
+            if(std::fabs(res)<=max_residual)
+                sq_sum += res*res;
+        }
+    }
+    mRmsError = std::sqrt(sq_sum/mInliers);
+    // <---- Residual of the inliers
+
+    mPolygon = polygon;
+    return true;
+}
+
+void WallPlanePrior::buildMaps(cv::Size size, double scale, cv::Mat& warp_1, cv::Mat& warp_2, cv::Mat& plane_disp, cv::Mat& outside) const
+{
+    // At scale `s` the plane is `d_s(x,y) = s*d(x/s,y/s) = a*x + b*y + s*c`
+    cv::Mat map_x(size, CV_32FC1), map_y(size, CV_32FC1);
+    plane_disp.create(size, CV_32FC1);
+    for(int y=0; y<size.height; y++)
+    {
+        float* mx = map_x.ptr<float>(y);
+        float* my = map_y.ptr<float>(y);
+        float* pd = plane_disp.ptr<float>(y);
+        for(int x=0; x<size.width; x++)
+        {
+            double d = mA*x + mB*y + scale*mC;
+            pd[x] = static_cast<float>(d);
+            mx[x] = static_cast<float>(x-d); // The right pixel matching the plane
+            my[x] = static_cast<float>(y);
+        }
+    }
+    cv::convertMaps(map_x, map_y, warp_1, warp_2, CV_16SC2);
+
+    std::vector<cv::Point> polygon;
+    for(const cv::Point& pt : mPolygon)
+        polygon.push_back(cv::Point(cvRound(pt.x*scale), cvRound(pt.y*scale)));
+    outside.create(size, CV_8UC1);
+    outside.setTo(cv::Scalar(255));
+    cv::fillConvexPoly(outside, polygon, cv::Scalar(0));
+}
+
+/*!
+ * \brief Get the region of the stereo images to be processed by the matcher to get the disparities of a list of ROIs
+ *
+ * The bounding box of the ROIs is padded by half the matching block on each side, and by the disparity range on
+ * the left (positive disparities) and on the right (negative disparities): the matcher leaves these borders invalid.
+ * \param rois the regions whose disparities are required
+ * \param size the size of the stereo images
+ * \param blockSize the matched block size
+ * \param minDisparity the minimum disparity searched by the matcher
+ * \param numDisparities the number of disparities searched by the matcher
+ * \param valid returns the bounding box of the ROIs inside the image, where the disparities are valid
+ * \return the region to be processed by the matcher, the whole image if `rois` is empty
+ */
+cv::Rect getStereoMatchingRegion(const std::vector<cv::Rect>& rois, cv::Size size, int blockSize, int minDisparity,
+                                 int numDisparities, cv::Rect& valid)
+{
+    cv::Rect image(0, 0, size.width, size.height);
+    if(rois.empty())
+    {
+        valid = image;
+        return image;
+    }
+
+    valid = rois[0];
+    for(const cv::Rect& roi : rois)
+        valid |= roi;
+    valid &= image;
+
+    int half_block = blockSize/2;
+    int pad_left = std::max(0, minDisparity+numDisparities) + half_block;
+    int pad_right = std::max(0, -minDisparity) + half_block;
+
+    cv::Rect region(valid.x-pad_left, valid.y-half_block,
+                    valid.width+pad_left+pad_right, valid.height+2*half_block);
+    return region & image;
+}
+
+/*!
+ * \brief The IStereoMatcher class is the interface of the stereo matchers created by \ref createStereoMatcher
+ *
+ * The disparity maps have the format of `cv::StereoMatcher`: CV_16SC1 disparities multiplied by 16,
+ * `(minDisparity-1)*16` for the invalid pixels.
+ */
+class IStereoMatcher
+{
+public:
+    virtual ~IStereoMatcher() {}
+
+    /*!
+     * \brief Compute the disparity map of the left image
+     * \param left left rectified image, gray or BGR
+     * \param right right rectified image, same size and type as `left`
+     * \param disparity output disparity map (CV_16SC1)
+     */
+    virtual void compute(cv::InputArray left, cv::InputArray right, cv::OutputArray disparity) = 0;
+
+    virtual int getMinDisparity() const = 0;    //!< Minimum disparity searched
+    virtual int getNumDisparities() const = 0;  //!< Number of disparities searched
+    virtual int getBlockSize() const = 0;       //!< Size of the image block supporting a disparity
+    virtual std::string getName() const = 0;    //!< Name of the engine, for the logs
+};
+
+/*!
+ * \brief The OcvStereoMatcher class wraps the OpenCV SGBM and BM matchers
+ */
+class OcvStereoMatcher : public IStereoMatcher
+{
+public:
+    /*!
+     * \brief Constructor
+     * \param matcher the configured OpenCV matcher
+     * \param name name of the engine
+     * \param grayOnly the matcher accepts only gray images (BM): the BGR images are converted
+     */
+    OcvStereoMatcher(cv::Ptr<cv::StereoMatcher> matcher, const std::string& name, bool grayOnly)
+        : mMatcher(matcher), mName(name), mGrayOnly(grayOnly) {}
+
+    void compute(cv::InputArray left, cv::InputArray right, cv::OutputArray disparity) override;
+
+    int getMinDisparity() const override {return mMatcher->getMinDisparity();}
+    int getNumDisparities() const override {return mMatcher->getNumDisparities();}
+    int getBlockSize() const override {return mMatcher->getBlockSize();}
+    std::string getName() const override {return mName;}
+
+    inline cv::Ptr<cv::StereoMatcher> getMatcher() const {return mMatcher;} //!< The OpenCV matcher, to change its parameters
+
+private:
+    cv::Ptr<cv::StereoMatcher> mMatcher;
+    std::string mName;
+    bool mGrayOnly;
+    cv::UMat mLeftGray;     // Gray conversion of the BGR inputs
+    cv::UMat mRightGray;
+};
+
+void OcvStereoMatcher::compute(cv::InputArray left, cv::InputArray right, cv::OutputArray disparity)
+{
+    if(!mGrayOnly || left.channels()==1)
+    {
+        mMatcher->compute(left, right, disparity);
+        return;
+    }
+
+    cv::cvtColor(left, mLeftGray, cv::COLOR_BGR2GRAY);
+    cv::cvtColor(right, mRightGray, cv::COLOR_BGR2GRAY);
+    mMatcher->compute(mLeftGray, mRightGray, disparity);
+}
+
+/*!
+ * \brief The CensusStereoMatcher class wraps sl_oc::video::CensusMatcher
+ *
+ * The speckles are filtered as with SGBM (`speckleWindowSize`, `speckleRange`).
+ */
+class CensusStereoMatcher : public IStereoMatcher
+{
+public:
+    /*!
+     * \brief Constructor
+     * \param par the stereo parameters: the block size is clamped to the range supported by the census matcher
+     */
+    explicit CensusStereoMatcher(const StereoSgbmPar& par);
+
+    void compute(cv::InputArray left, cv::InputArray right, cv::OutputArray disparity) override;
+
+    int getMinDisparity() const override {return mMatcher.getMinDisparity();}
+    int getNumDisparities() const override {return mMatcher.getNumDisparities();}
+    int getBlockSize() const override {return mMatcher.getBlockSize()+2*sl_oc::video::CensusMatcher::CENSUS_RADIUS;}
+    std::string getName() const override {return std::string("census (") + mMatcher.getKernelName() + ")";}
+
+    inline sl_oc::video::CensusMatcher& getMatcher() {return mMatcher;} //!< The census matcher, to change its settings
+
+private:
+    sl_oc::video::CensusMatcher mMatcher;
+    int mSpeckleWindowSize;
+    int mSpeckleRange;
+    cv::Mat mLeftGray;
+    cv::Mat mRightGray;
+    cv::Mat mDisparity;
+};
+
+CensusStereoMatcher::CensusStereoMatcher(const StereoSgbmPar& par)
+    : mSpeckleWindowSize(par.speckleWindowSize)
+    , mSpeckleRange(par.speckleRange)
+{
+    int block_size = std::min(sl_oc::video::CensusMatcher::MAX_BLOCK_SIZE, std::max(1, par.blockSize|1));
+    mMatcher.setParams(par.minDisparity, par.numDisparities, block_size, par.uniquenessRatio);
+}
+
+void CensusStereoMatcher::compute(cv::InputArray left, cv::InputArray right, cv::OutputArray disparity)
+{
+    // ----> 8 bit gray inputs
+    cv::Mat left_mat = left.getMat();
+    cv::Mat right_mat = right.getMat();
+    if(left_mat.channels()==3)
+    {
+        cv::cvtColor(left_mat, mLeftGray, cv::COLOR_BGR2GRAY);
+        cv::cvtColor(right_mat, mRightGray, cv::COLOR_BGR2GRAY);
+        left_mat = mLeftGray;
+        right_mat = mRightGray;
+    }
+
+    // The census matcher needs both images with the same stride
+    if(!left_mat.isContinuous())
+        left_mat = left_mat.clone();
+    if(!right_mat.isContinuous())
+        right_mat = right_mat.clone();
+    // <---- 8 bit gray inputs
+
+    CV_Assert(left_mat.type()==CV_8UC1 && right_mat.type()==CV_8UC1 && left_mat.size()==right_mat.size());
+
+    mDisparity.create(left_mat.size(), CV_16SC1);
+    mMatcher.compute(left_mat.data, right_mat.data, left_mat.cols, left_mat.rows, left_mat.step,
+                     mDisparity.ptr<int16_t>(), mDisparity.step1());
+
+    if(mSpeckleWindowSize>0)
+    {
+        int invalid = (mMatcher.getMinDisparity()-1)*sl_oc::video::CensusMatcher::DISP_SCALE;
+        cv::filterSpeckles(mDisparity, invalid, mSpeckleWindowSize,
+                           mSpeckleRange*sl_oc::video::CensusMatcher::DISP_SCALE);
+    }
+
+    mDisparity.copyTo(disparity);
+}
+
+/*!
+ * \brief Create the stereo matcher selected by the parameters (see \ref StereoSgbmPar::engine)
+ * \param par the stereo parameters
+ * \return the configured matcher
+ */
+cv::Ptr<IStereoMatcher> createStereoMatcher(const StereoSgbmPar& par)
+{
+    if(par.engine==STEREO_ENGINE::CENSUS)
+        return cv::makePtr<CensusStereoMatcher>(par);
+
+    if(par.engine==STEREO_ENGINE::BM)
+    {
+        // BM requires an odd block size in the range [5,255]
+        cv::Ptr<cv::StereoBM> bm = cv::StereoBM::create(par.numDisparities, std::max(5, par.blockSize|1));
+        bm->setMinDisparity(par.minDisparity);
+        bm->setPreFilterCap(std::min(63, std::max(1, par.preFilterCap)));
+        bm->setTextureThreshold(par.textureThreshold);
+        bm->setUniquenessRatio(par.uniquenessRatio);
+        bm->setDisp12MaxDiff(par.disp12MaxDiff);
+        bm->setSpeckleWindowSize(par.speckleWindowSize);
+        bm->setSpeckleRange(par.speckleRange);
+        return cv::makePtr<OcvStereoMatcher>(bm, "bm", true);
+    }
+
+    cv::Ptr<cv::StereoSGBM> sgbm = cv::StereoSGBM::create(par.minDisparity, par.numDisparities, par.blockSize);
+    sgbm->setP1(par.P1);
+    sgbm->setP2(par.P2);
+    sgbm->setDisp12MaxDiff(par.disp12MaxDiff);
+    sgbm->setMode(par.mode);
+    sgbm->setPreFilterCap(par.preFilterCap);
+    sgbm->setUniquenessRatio(par.uniquenessRatio);
+    sgbm->setSpeckleWindowSize(par.speckleWindowSize);
+    sgbm->setSpeckleRange(par.speckleRange);
+    return cv::makePtr<OcvStereoMatcher>(sgbm, "sgbm", false);
+}
+
 } // namespace tools
 } // namespace sl_oc
 
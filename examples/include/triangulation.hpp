@@ -0,0 +1,208 @@
+#ifndef TRIANGULATION_HPP
+#define TRIANGULATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace sl_oc {
+namespace tools {
+
+/*!
+ * \brief The BallMatchPar struct stores the parameters used to match the balls detected in the left and right images
+ */
+struct BallMatchPar
+{
+    float maxRowDiff = 2.f;         //!< [default: 2] Maximum difference of the rows of the centers in pixels, increased by 10% of the radius
+    float maxRadiusRatio = 0.3f;    //!< [default: 0.3] Maximum difference of the radii, relative to the largest one
+    float minDisparity = 1.f;       //!< [default: 1] Minimum disparity of a ball, in pixels
+    float maxDisparity = 96.f;      //!< [default: 96] Maximum disparity of a ball, in pixels
+    int refineRange = 2;            //!< [default: 2] Integer disparities tested on each side of the circle disparity by the sub-pixel refinement
+};
+
+/*!
+ * \brief The BallObservation struct stores a ball seen by both cameras and its triangulated position
+ */
+struct BallObservation
+{
+    size_t left_index = 0;          //!< Index of the circle in the left list
+    size_t right_index = 0;         //!< Index of the circle in the right list
+    cv::Point2f left;               //!< Center in the left rectified image
+    cv::Point2f right;              //!< Center in the right rectified image
+    float radius = 0.f;             //!< Radius in the left rectified image
+    float disparity = 0.f;          //!< Refined disparity in pixels
+    float cost = 0.f;               //!< Mean absolute difference of the matched patches, negative if not refined
+    cv::Point3f position;           //!< Position of the center in the left camera frame, in the unit of the baseline
+};
+
+/*!
+ * \brief Refine the disparity of a ball by block matching along the epipolar row
+ *
+ * The patch around the left center is compared with the right image at the integer disparities around `disparity`;
+ * the minimum of the mean absolute difference is refined by fitting a parabola on its neighbors.
+ * \param left left rectified gray image
+ * \param right right rectified gray image
+ * \param center center of the ball in the left image
+ * \param radius radius of the ball, used for the patch size
+ * \param disparity initial disparity, from the circle centers
+ * \param range integer disparities tested on each side of `disparity`
+ * \param cost returns the mean absolute difference at the minimum, can be `nullptr`
+ * \return the refined disparity, `disparity` if the patches do not fit in the images
+ */
+float refineDisparity(const cv::Mat& left, const cv::Mat& right, cv::Point2f center, float radius, float disparity,
+                      int range, float* cost=nullptr)
+{
+    if(cost)
+        *cost = -1.f;
+    if(left.type()!=CV_8UC1 || right.type()!=CV_8UC1 || range<1)
+        return disparity;
+
+    int half = std::min(15, std::max(3, cvRound(radius)));
+    int cx = cvRound(center.x);
+    int cy = cvRound(center.y);
+    int d0 = cvRound(disparity);
+
+    if(cy-half<0 || cy+half>=left.rows || cx-half<0 || cx+half>=left.cols ||
+            cx-d0-range-half<0 || cx-d0+range+half>=right.cols)
+        return disparity;
+
+    // ----> Mean absolute difference for each integer disparity
+    std::vector<float> costs(2*range+1);
+    float norm = 1.f/((2*half+1)*(2*half+1));
+    for(int i=0; i<=2*range; i++)
+    {
+        int xr = cx-(d0-range+i);
+        int sad = 0;
+        for(int y=cy-half; y<=cy+half; y++)
+        {
+            const uint8_t* l_row = left.ptr<uint8_t>(y);
+            const uint8_t* r_row = right.ptr<uint8_t>(y);
+            for(int dx=-half; dx<=half; dx++)
+                sad += std::abs(l_row[cx+dx]-r_row[xr+dx]);
+        }
+        costs[i] = sad*norm;
+    }
+    // <---- Mean absolute difference for each integer disparity
+
+    size_t best = std::min_element(costs.begin(), costs.end())-costs.begin();
+    float refined = static_cast<float>(d0-range+static_cast<int>(best));
+
+    // Parabola through the minimum and its neighbors
+    if(best>0 && best<costs.size()-1)
+    {
+        float c_m = costs[best-1], c_0 = costs[best], c_p = costs[best+1];
+        float den = c_m-2.f*c_0+c_p;
+        if(den>0.f)
+            refined += 0.5f*(c_m-c_p)/den;
+    }
+
+    if(cost)
+        *cost = costs[best];
+    return refined;
+}
+
+/*!
+ * \brief Match the balls detected in the left and right rectified images and triangulate their centers
+ *
+ * A left circle is matched with the right circles on the same row (epipolar constraint), with a similar radius and a
+ * disparity in the allowed range. The pairs are assigned one to one, closest rows first, then the disparity is
+ * refined with \ref refineDisparity and the center is triangulated.
+ * \param left_circles circles `(x, y, radius)` detected in the left image
+ * \param right_circles circles `(x, y, radius)` detected in the right image
+ * \param left left rectified gray image
+ * \param right right rectified gray image
+ * \param cameraMatrix rectified camera matrix of the left camera
+ * \param baseline distance between the cameras, which gives the unit of the positions
+ * \param par matching parameters
+ * \return the balls seen by both cameras
+ */
+std::vector<BallObservation> matchBalls(const std::vector<cv::Vec3f>& left_circles,
+                                        const std::vector<cv::Vec3f>& right_circles,
+                                        const cv::Mat& left, const cv::Mat& right,
+                                        const cv::Mat& cameraMatrix, double baseline,
+                                        const BallMatchPar& par=BallMatchPar())
+{
+    double fx = cameraMatrix.at<double>(0,0);
+    double fy = cameraMatrix.at<double>(1,1);
+    double cx = cameraMatrix.at<double>(0,2);
+    double cy = cameraMatrix.at<double>(1,2);
+
+    // ----> Candidate pairs
+    struct Candidate
+    {
+        size_t l, r;
+        float row_diff;
+    };
+    std::vector<Candidate> candidates;
+    for(size_t l=0; l<left_circles.size(); l++)
+    {
+        const cv::Vec3f& lc = left_circles[l];
+        for(size_t r=0; r<right_circles.size(); r++)
+        {
+            const cv::Vec3f& rc = right_circles[r];
+
+            float row_diff = std::fabs(lc[1]-rc[1]);
+            if(row_diff>par.maxRowDiff+0.1f*lc[2])
+                continue;
+            if(std::fabs(lc[2]-rc[2])>par.maxRadiusRatio*std::max(lc[2],rc[2]))
+                continue;
+            float disparity = lc[0]-rc[0];
+            if(disparity<par.minDisparity || disparity>par.maxDisparity)
+                continue;
+
+            candidates.push_back({l, r, row_diff});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.row_diff<b.row_diff;
+    });
+    // <---- Candidate pairs
+
+    // ----> One to one assignment and triangulation
+    std::vector<bool> left_used(left_circles.size(), false);
+    std::vector<bool> right_used(right_circles.size(), false);
+    std::vector<BallObservation> balls;
+    for(const Candidate& cand : candidates)
+    {
+        if(left_used[cand.l] || right_used[cand.r])
+            continue;
+        left_used[cand.l] = true;
+        right_used[cand.r] = true;
+
+        const cv::Vec3f& lc = left_circles[cand.l];
+        const cv::Vec3f& rc = right_circles[cand.r];
+
+        BallObservation ball;
+        ball.left_index = cand.l;
+        ball.right_index = cand.r;
+        ball.left = cv::Point2f(lc[0], lc[1]);
+        ball.right = cv::Point2f(rc[0], rc[1]);
+        ball.radius = lc[2];
+        ball.disparity = refineDisparity(left, right, ball.left, ball.radius, lc[0]-rc[0], par.refineRange,
+                                         &ball.cost);
+        if(ball.disparity<=0.f)
+            continue;
+
+        // The refined disparity is measured at the integer center
+        double x = (ball.cost<0.f) ? lc[0] : cvRound(lc[0]);
+        double y = (ball.cost<0.f) ? lc[1] : cvRound(lc[1]);
+        double z = fx*baseline/ball.disparity;
+        ball.position = cv::Point3f(static_cast<float>((x-cx)*z/fx),
+                                    static_cast<float>((y-cy)*z/fy),
+                                    static_cast<float>(z));
+        balls.push_back(ball);
+    }
+    // <---- One to one assignment and triangulation
+
+    std::sort(balls.begin(), balls.end(), [](const BallObservation& a, const BallObservation& b) {
+        return a.left_index<b.left_index;
+    });
+
+    return balls;
+}
+
+} // namespace tools
+} // namespace sl_oc
+
+#endif // TRIANGULATION_HPP
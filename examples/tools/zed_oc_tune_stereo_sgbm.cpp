@@ -47,7 +47,7 @@ std::string preFiltDispWinName = "Pre-filtered disparity";
 
 sl_oc::tools::StereoSgbmPar stereoPar;
 
-cv::Ptr<cv::StereoSGBM> left_matcher;
+cv::Ptr<sl_oc::tools::IStereoMatcher> left_matcher;
 
 cv::Mat frameBGR, left_raw, left_rect, right_raw, right_rect, frameYUV, right_for_matcher, left_for_matcher, left_disp, left_disp_vis;
 int maxMaxDisp=0;
@@ -58,6 +58,7 @@ bool params_initialized=false;
 // ----> Global functions
 void applyStereoMatching();
 
+void on_trackbar_engine( int newEngine, void* );
 void on_trackbar_block_size( int newBlockSize, void* );
 void on_trackbar_min_disparities( int newMinDisparities, void* );
 void on_trackbar_num_disparities( int newNumDisparities, void* );
@@ -170,6 +171,9 @@ int main(int argc, char *argv[])
 
     cv::namedWindow(preFiltDispWinName, cv::WINDOW_AUTOSIZE); // Create Window
 
+    cv::createTrackbar( "engine", preFiltDispWinName, nullptr, 2, on_trackbar_engine ); // SGBM, BM, census
+    cv::setTrackbarMin( "engine", preFiltDispWinName, 0 );
+
     cv::createTrackbar( "blockSize", preFiltDispWinName, nullptr, 255, on_trackbar_block_size );
     cv::setTrackbarMin( "blockSize", preFiltDispWinName, 1 );
 
@@ -202,18 +206,7 @@ int main(int argc, char *argv[])
     // ----> Stereo matcher initialization
     stereoPar.load();
 
-    left_matcher = cv::StereoSGBM::create(stereoPar.minDisparity,stereoPar.numDisparities,stereoPar.blockSize);
-    left_matcher->setMinDisparity(stereoPar.minDisparity);
-    left_matcher->setNumDisparities(stereoPar.numDisparities);
-    left_matcher->setBlockSize(stereoPar.blockSize);
-    left_matcher->setP1(stereoPar.P1);
-    left_matcher->setP2(stereoPar.P2);
-    left_matcher->setDisp12MaxDiff(stereoPar.disp12MaxDiff);
-    left_matcher->setMode(stereoPar.mode);
-    left_matcher->setPreFilterCap(stereoPar.preFilterCap);
-    left_matcher->setUniquenessRatio(stereoPar.uniquenessRatio);
-    left_matcher->setSpeckleWindowSize(stereoPar.speckleWindowSize);
-    left_matcher->setSpeckleRange(stereoPar.speckleRange);
+    left_matcher = sl_oc::tools::createStereoMatcher(stereoPar);
 
     stereoPar.print();
 
@@ -221,6 +214,7 @@ int main(int argc, char *argv[])
     // <---- Stereo matcher initialization
 
     // ----> Update GUI value
+    cv::setTrackbarPos( "engine", preFiltDispWinName, static_cast<int>(stereoPar.engine) );
     cv::setTrackbarPos( "blockSize", preFiltDispWinName, stereoPar.blockSize );
     cv::setTrackbarPos( "numDisparities", preFiltDispWinName, stereoPar.numDisparities );
     cv::setTrackbarPos( "minDisparity", preFiltDispWinName, stereoPar.minDisparity );
@@ -252,19 +246,8 @@ int main(int argc, char *argv[])
         {
             if(stereoPar.load())
             {
-                left_matcher->setMinDisparity(stereoPar.minDisparity);
-                left_matcher->setNumDisparities(stereoPar.numDisparities);
-                left_matcher->setBlockSize(stereoPar.blockSize);
-                left_matcher->setP1(stereoPar.P1);
-                left_matcher->setP2(stereoPar.P2);
-                left_matcher->setDisp12MaxDiff(-(stereoPar.disp12MaxDiff-1));
-                left_matcher->setMode(stereoPar.mode);
-                left_matcher->setPreFilterCap(stereoPar.preFilterCap);
-                left_matcher->setUniquenessRatio(stereoPar.uniquenessRatio);
-                left_matcher->setSpeckleWindowSize(stereoPar.speckleWindowSize);
-                left_matcher->setSpeckleRange(stereoPar.speckleRange);
-
                 // ----> Update GUI value
+                cv::setTrackbarPos( "engine", preFiltDispWinName, static_cast<int>(stereoPar.engine) );
                 cv::setTrackbarPos( "blockSize", preFiltDispWinName, stereoPar.blockSize );
                 cv::setTrackbarPos( "numDisparities", preFiltDispWinName, stereoPar.numDisparities );
                 cv::setTrackbarPos( "minDisparity", preFiltDispWinName, stereoPar.minDisparity );
@@ -289,6 +272,7 @@ int main(int argc, char *argv[])
         {
             stereoPar.setDefaultValues();
             // ----> Update GUI value
+            cv::setTrackbarPos( "engine", preFiltDispWinName, static_cast<int>(stereoPar.engine) );
             cv::setTrackbarPos( "blockSize", preFiltDispWinName, stereoPar.blockSize );
             cv::setTrackbarPos( "numDisparities", preFiltDispWinName, stereoPar.numDisparities );
             cv::setTrackbarPos( "minDisparity", preFiltDispWinName, stereoPar.minDisparity );
@@ -324,22 +308,13 @@ void applyStereoMatching()
     right_for_matcher = right_rect.clone();
 #endif
 
-    left_matcher->setMinDisparity(stereoPar.minDisparity);
-    left_matcher->setNumDisparities(stereoPar.numDisparities);
-    left_matcher->setBlockSize(stereoPar.blockSize);
-    left_matcher->setP1(stereoPar.P1);
-    left_matcher->setP2(stereoPar.P2);
-    left_matcher->setDisp12MaxDiff(stereoPar.disp12MaxDiff);
-    left_matcher->setMode(stereoPar.mode);
-    left_matcher->setPreFilterCap(stereoPar.preFilterCap);
-    left_matcher->setUniquenessRatio(stereoPar.uniquenessRatio);
-    left_matcher->setSpeckleWindowSize(stereoPar.speckleWindowSize);
-    left_matcher->setSpeckleRange(stereoPar.speckleRange);
+    // The engine can change: the matcher is created again with the current parameters
+    left_matcher = sl_oc::tools::createStereoMatcher(stereoPar);
 #ifdef USE_HALF_SIZE_DISPARITY
     left_disp*=2;
 #endif
 
-    std::cout << "Start stereo matching..." << std::endl;
+    std::cout << "Start stereo matching [" << left_matcher->getName() << "]..." << std::endl;
     left_matcher->compute(left_for_matcher, right_for_matcher, left_disp);
     std::cout << "... finished stereo matching" << std::endl;
 
@@ -358,6 +333,17 @@ void applyStereoMatching()
 }
 
 
+void on_trackbar_engine( int newEngine, void* )
+{
+    if(newEngine==static_cast<int>(stereoPar.engine))
+        return;
+
+    stereoPar.engine = static_cast<sl_oc::tools::STEREO_ENGINE>(newEngine);
+
+    std::cout << "New 'engine' value: " << sl_oc::tools::stereoEngineToString(stereoPar.engine) << std::endl;
+    applyStereoMatching();
+}
+
 void on_trackbar_block_size( int newBlockSize, void* )
 {
     bool fixed = false;
@@ -96,12 +96,20 @@ int main(int argc, char *argv[])
     // <---- Frame size
 
     // ----> Initialize calibration
-    cv::Mat map_left_x, map_left_y;
-    cv::Mat map_right_x, map_right_y;
-    cv::Mat cameraMatrix_left, cameraMatrix_right;
-    double baseline=0;
-    sl_oc::tools::initCalibration(calibration_file, cv::Size(w/2,h), map_left_x, map_left_y, map_right_x, map_right_y,
-                                  cameraMatrix_left, cameraMatrix_right, &baseline);
+    // Fixed-point rectification maps, mapped from the cache file or computed on the first run
+    sl_oc::tools::RectificationMaps rect_maps;
+    if( !rect_maps.load(serial_number, calibration_file, cv::Size(w/2,h)) )
+    {
+        std::cerr << "Could not initialize the rectification maps" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if( rect_maps.fromCache() )
+        std::cout << "Rectification maps loaded from the cache" << std::endl;
+
+    cv::Mat map_left_x = rect_maps.map_left_1, map_left_y = rect_maps.map_left_2;
+    cv::Mat map_right_x = rect_maps.map_right_1, map_right_y = rect_maps.map_right_2;
+    cv::Mat cameraMatrix_left = rect_maps.cameraMatrix_left, cameraMatrix_right = rect_maps.cameraMatrix_right;
+    double baseline = rect_maps.baseline;
 
     double fx = cameraMatrix_left.at<double>(0,0);
     double fy = cameraMatrix_left.at<double>(1,1);
@@ -148,20 +156,11 @@ int main(int argc, char *argv[])
         stereoPar.save(); // Save default parameters.
     }
 
-    cv::Ptr<cv::StereoSGBM> left_matcher = cv::StereoSGBM::create(stereoPar.minDisparity,stereoPar.numDisparities,stereoPar.blockSize);
-    left_matcher->setMinDisparity(stereoPar.minDisparity);
-    left_matcher->setNumDisparities(stereoPar.numDisparities);
-    left_matcher->setBlockSize(stereoPar.blockSize);
-    left_matcher->setP1(stereoPar.P1);
-    left_matcher->setP2(stereoPar.P2);
-    left_matcher->setDisp12MaxDiff(stereoPar.disp12MaxDiff);
-    left_matcher->setMode(stereoPar.mode);
-    left_matcher->setPreFilterCap(stereoPar.preFilterCap);
-    left_matcher->setUniquenessRatio(stereoPar.uniquenessRatio);
-    left_matcher->setSpeckleWindowSize(stereoPar.speckleWindowSize);
-    left_matcher->setSpeckleRange(stereoPar.speckleRange);
+    // The engine (SGBM, BM or census) is selected by `stereoEngine`
+    cv::Ptr<sl_oc::tools::IStereoMatcher> left_matcher = sl_oc::tools::createStereoMatcher(stereoPar);
 
     stereoPar.print();
+    std::cout << "Stereo matcher: " << left_matcher->getName() << std::endl;
     // <---- Stereo matcher initialization
 
 
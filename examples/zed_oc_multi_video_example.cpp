@@ -20,6 +20,7 @@
 
 //// ----> Includes
 #include "videocapture.hpp"
+#include "capturegroup.hpp"
 #include "ocv_display.hpp"
 
 #include <iostream>
@@ -42,9 +43,10 @@ int main(int argc, char *argv[])
     params.res = sl_oc::video::RESOLUTION::HD720;
     params.fps = sl_oc::video::FPS::FPS_60;
 
-    // ----> Create Video Capture 0
-    sl_oc::video::VideoCapture cap_0(params);
-    if( !cap_0.initializeVideo(0) )
+    // ----> Create the capture group
+    // The frames of the two cameras are matched by timestamp, within half a frame period
+    sl_oc::video::CaptureGroup group(params);
+    if( group.addCamera(0)<0 || group.addCamera(2)<0 )
     {
         std::cerr << "Cannot open camera video capture" << std::endl;
         std::cerr << "See verbosity level for more details." << std::endl;
@@ -52,21 +54,15 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    std::cout << "Connected to camera sn: " << cap_0.getSerialNumber() << " [" << cap_0.getDeviceName() << "]" << std::endl;
-    // <---- Create Video Capture 0
-
-    // ----> Create Video Capture 1
-    sl_oc::video::VideoCapture cap_1(params);
-    if( !cap_1.initializeVideo(2) )
+    for( size_t i=0; i<group.getCameraCount(); i++ )
     {
-        std::cerr << "Cannot open camera video capture" << std::endl;
-        std::cerr << "See verbosity level for more details." << std::endl;
-
-        return EXIT_FAILURE;
+        sl_oc::video::VideoCapture& cap = group.getCamera(i);
+        std::cout << "Connected to camera sn: " << cap.getSerialNumber() << " [" << cap.getDeviceName() << "]" << std::endl;
     }
+    // <---- Create the capture group
 
-    std::cout << "Connected to camera sn: " << cap_1.getSerialNumber() << " [" << cap_1.getDeviceName() << "]" << std::endl;
-    // <---- Create Video Capture 1
+    sl_oc::video::VideoCapture& cap_0 = group.getCamera(0);
+    sl_oc::video::VideoCapture& cap_1 = group.getCamera(1);
 
     // Set video parameters
     bool autoSettingEnable = true;
@@ -76,6 +72,12 @@ int main(int argc, char *argv[])
     cap_1.setAutoWhiteBalance(autoSettingEnable);
     cap_1.setAECAGC(autoSettingEnable);
 
+    if( !group.start() )
+    {
+        std::cerr << "Cannot start the capture group" << std::endl;
+        return EXIT_FAILURE;
+    }
+
 #ifdef TEST_FPS
     // Timestamp to check FPS
     double lastTime = static_cast<double>(getSteadyTimestamp())/1e9;
@@ -83,16 +85,17 @@ int main(int argc, char *argv[])
     uint64_t lastFrameTs = 0;
 #endif
 
+    sl_oc::video::FrameGroup frames;
+
     // Infinite video grabbing loop
     while (1)
     {
-        // Get last available frame
-        const sl_oc::video::Frame frame_0 = cap_0.getLastFrame();
-        const sl_oc::video::Frame frame_1 = cap_1.getLastFrame();
-
-        // ----> If the frame is valid we can display it
-        if(frame_0.data!=nullptr && frame_1.data!=nullptr)
+        // ----> If a matched pair of frames is available we can display it
+        if( group.grab(frames) )
         {
+            const sl_oc::video::Frame& frame_0 = frames.frames[0].frame();
+            const sl_oc::video::Frame& frame_1 = frames.frames[1].frame();
+
 #ifdef TEST_FPS
             if(lastFrameTs!=0)
             {
@@ -104,11 +107,12 @@ int main(int argc, char *argv[])
                 // <---- System time
 
                 // ----> Frame time
-                double frame_dT = static_cast<double>(frame.timestamp-lastFrameTs)/1e9;
+                double frame_dT = static_cast<double>(frames.timestamp-lastFrameTs)/1e9;
                 std::cout << "[Camera] Frame period: " << frame_dT << "sec - Freq: " << 1./frame_dT << " Hz" << std::endl;
+                std::cout << "[Camera] Pair skew: " << frames.skew/1000 << " usec" << std::endl;
                 // <---- Frame time
             }
-            lastFrameTs = frame.timestamp;
+            lastFrameTs = frames.timestamp;
 #endif
 
             // ----> Conversion from YUV 4:2:2 to BGR for visualization
@@ -124,9 +128,9 @@ int main(int argc, char *argv[])
             sl_oc::tools::showImage( "Stream RGB #0", frameBGR_0, params.res  );
             sl_oc::tools::showImage( "Stream RGB #1", frameBGR_1, params.res  );
         }
-        // <---- If the frame is valid we can display it
+        // <---- If a matched pair of frames is available we can display it
 
-        // ----> Keyboard handling
+    // ----> Keyboard handling
         int key = cv::waitKey( 5 );
         if(key=='q' || key=='Q') // Quit
             break;
@@ -144,6 +148,20 @@ int main(int argc, char *argv[])
         // <---- Keyboard handling
     }
 
+    // ----> Matching report
+    // The pair must be released before the group is destroyed
+    frames = sl_oc::video::FrameGroup();
+
+    sl_oc::video::CaptureGroupStats stats = group.getStats();
+    std::cout << "Matched pairs: " << stats.groups << " - Dropped pairs: " << stats.dropped_groups << std::endl;
+    for( size_t i=0; i<stats.unmatched_frames.size(); i++ )
+    {
+        std::cout << "Camera #" << i << " unmatched frames: " << stats.unmatched_frames[i] << std::endl;
+    }
+    std::cout << "Pair skew [usec] - mean: " << stats.skew.mean_usec() << " - p99: " << stats.skew.percentile_usec(99)
+              << " - max: " << stats.skew.max_usec << std::endl;
+    // <---- Matching report
+
     return EXIT_SUCCESS;
 }
 
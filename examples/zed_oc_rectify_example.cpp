@@ -19,11 +19,13 @@
 ///////////////////////////////////////////////////////////////////////////
 
 // ----> Includes
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
 
 #include "videocapture.hpp"
+#include "stereorectifier.hpp"
 
 // OpenCV includes
 #include <opencv2/opencv.hpp>
@@ -81,17 +83,38 @@ int main(int argc, char *argv[])
     // <---- Frame size
 
     // ----> Initialize calibration
-    cv::Mat map_left_x, map_left_y;
-    cv::Mat map_right_x, map_right_y;
-    cv::Mat cameraMatrix_left, cameraMatrix_right;
-    sl_oc::tools::initCalibration(calibration_file, cv::Size(w/2,h), map_left_x, map_left_y, map_right_x, map_right_y,
-                    cameraMatrix_left, cameraMatrix_right);
-
-    std::cout << " Camera Matrix L: \n" << cameraMatrix_left << std::endl << std::endl;
-    std::cout << " Camera Matrix R: \n" << cameraMatrix_right << std::endl << std::endl;
+    sl_oc::tools::RectificationMaps maps;
+    if( !maps.load(serial_number, calibration_file, cv::Size(w/2,h)) )
+    {
+        std::cerr << "Could not load the calibration" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << " Camera Matrix L: \n" << maps.cameraMatrix_left << std::endl << std::endl;
+    std::cout << " Camera Matrix R: \n" << maps.cameraMatrix_right << std::endl << std::endl;
     // ----> Initialize calibration
 
-    cv::Mat frameBGR, left_raw, left_rect, right_raw, right_rect;
+    // ----> Initialize rectification
+    // The fixed-point maps are used in place: `maps` must live as long as the rectifier
+    sl_oc::video::RectifyMap rect_map_left, rect_map_right;
+    rect_map_left.xy = maps.map_left_1.ptr<int16_t>();
+    rect_map_left.frac = maps.map_left_2.ptr<uint16_t>();
+    rect_map_right.xy = maps.map_right_1.ptr<int16_t>();
+    rect_map_right.frac = maps.map_right_2.ptr<uint16_t>();
+
+    sl_oc::video::StereoRectifier rectifier(sl_oc::video::RECTIFY_FORMAT::BGR, verbose);
+    if( !rectifier.setMaps(w/2, h, rect_map_left, rect_map_right) )
+    {
+        std::cerr << "Could not initialize the rectification" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Rectified images wrapping the buffers of the rectifier, no copy
+    cv::Mat left_rect( h, w/2, CV_8UC3, const_cast<uint8_t*>(rectifier.getLeft()) );
+    cv::Mat right_rect( h, w/2, CV_8UC3, const_cast<uint8_t*>(rectifier.getRight()) );
+    // <---- Initialize rectification
+
+    cv::Mat frameBGR, left_raw, right_raw;
 
     uint64_t last_ts=0;
 
@@ -120,11 +143,18 @@ int main(int argc, char *argv[])
             // <---- Extract left and right images from side-by-side
 
             // ----> Apply rectification
-            cv::remap(left_raw, left_rect, map_left_x, map_left_y, cv::INTER_LINEAR );
-            cv::remap(right_raw, right_rect, map_right_x, map_right_y, cv::INTER_LINEAR );
-
-            sl_oc::tools::showImage("right RECT", right_rect, params.res);
-            sl_oc::tools::showImage("left RECT", left_rect, params.res);
+            // Conversion, split and remap of both images, left and right in parallel
+            rectifier.rectify(frame);
+
+            sl_oc::video::RectifierStats stats = rectifier.getStats();
+            std::stringstream rectInfo;
+            rectInfo << std::fixed << std::setprecision(2)
+                     << "Rectif. [msec] conversion: " << stats.convert[0].mean_usec()/1e3
+                     << " - remap: " << stats.remap[0].mean_usec()/1e3
+                     << " - total: " << stats.total.mean_usec()/1e3;
+
+            sl_oc::tools::showImage("right RECT", right_rect, params.res, true, rectInfo.str());
+            sl_oc::tools::showImage("left RECT", left_rect, params.res, true, rectInfo.str());
             // <---- Apply rectification
         }
 
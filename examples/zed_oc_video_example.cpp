@@ -67,8 +67,9 @@ int main(int argc, char *argv[])
     // Infinite video grabbing loop
     while (1)
     {
-        // Get last available frame
-        const sl_oc::video::Frame frame = cap_0.getLastFrame();
+        // Get a lease on the last available frame (no data copy)
+        sl_oc::video::FrameLease lease = cap_0.acquireFrame();
+        const sl_oc::video::Frame& frame = lease.frame();
 
         // ----> If the frame is valid we can display it
         if(frame.data!=nullptr)
@@ -95,6 +96,9 @@ int main(int argc, char *argv[])
             cv::Mat frameYUV = cv::Mat( frame.height, frame.width, CV_8UC2, frame.data );
             cv::Mat frameBGR;
             cv::cvtColor(frameYUV,frameBGR,cv::COLOR_YUV2BGR_YUYV);
+
+            // The UVC buffer is not required anymore: give it back to the camera
+            lease.release();
             // <---- Conversion from YUV 4:2:2 to BGR for visualization
 
             // Show frame
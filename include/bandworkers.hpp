@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BANDWORKERS_HPP
+#define BANDWORKERS_HPP
+
+#include "defines.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef VIDEO_MOD_AVAILABLE
+
+namespace sl_oc {
+
+namespace video {
+
+/*!
+ * \brief Check if the CPU supports the AVX2 instructions
+ * \return true on a x86 CPU with AVX2, false otherwise
+ */
+SL_OC_EXPORT bool cpuSupportsAvx2();
+
+/*!
+ * \brief Select the implementation of a kernel among the ones available on the running CPU
+ *
+ * The SIMD implementations of the library give the same result as their scalar implementation: the scalar one is
+ * selected only to measure the gain of the SIMD ones.
+ *
+ * \param enable false to select the scalar implementation
+ * \param scalar the scalar implementation
+ * \param avx2 the AVX2 implementation, selected if the CPU supports AVX2. `nullptr` if not built
+ * \param neon the NEON implementation. `nullptr` if not built
+ * \param name set to the name of the selected implementation: "AVX2", "NEON" or "scalar"
+ * \return the selected implementation
+ */
+template<class K>
+K selectSimdKernel(bool enable, K scalar, K avx2, K neon, const char*& name)
+{
+    if( enable && avx2 && cpuSupportsAvx2() )
+    {
+        name = "AVX2";
+        return avx2;
+    }
+    if( enable && neon )
+    {
+        name = "NEON";
+        return neon;
+    }
+    name = "scalar";
+    return scalar;
+}
+
+/*!
+ * \brief The BandWorkers class splits the rows of an image in bands processed in parallel
+ *
+ * The first band is processed by the calling thread, each other band by a worker thread started once by
+ * \ref setThreads and kept for all the following calls: \ref run neither creates threads nor allocates memory.
+ */
+class SL_OC_EXPORT BandWorkers
+{
+public:
+    /*!
+     * \brief The default constructor: a single band, processed by the calling thread
+     */
+    BandWorkers() = default;
+
+    /*!
+     * \brief The destructor stops the worker threads
+     */
+    ~BandWorkers();
+
+    BandWorkers(const BandWorkers&) = delete;
+    BandWorkers& operator=(const BandWorkers&) = delete;
+
+    /*!
+     * \brief Set the number of threads sharing the rows and start the worker threads
+     * \param threads number of threads, the calling thread included. `0` for the number of CPU cores, up to 4
+     * \note Not to be called during \ref run
+     */
+    void setThreads(int threads);
+
+    inline int getThreads() const {return mThreads;}   //!< Number of threads sharing the rows, the calling thread included
+
+    /*!
+     * \brief Process the rows in parallel and wait for all the bands
+     * \param rows number of rows, split in up to \ref getThreads bands
+     * \param job function called as `job(band, y0, y1)` for the rows [y0,y1) of each band. `band` is in
+     *        [0,getThreads()), to select buffers owned by each thread
+     * \note A single call at a time
+     */
+    template<class F>
+    void run(int rows, F&& job)
+    {
+        typedef typename std::remove_reference<F>::type Func;
+        runJob(rows, &callJob<Func>, const_cast<void*>(static_cast<const void*>(&job)));
+    }
+
+private:
+    typedef void (*Job)(void* ctx, int band, int y0, int y1);
+
+    template<class Func>
+    static void callJob(void* ctx, int band, int y0, int y1) {(*static_cast<Func*>(ctx))(band, y0, y1);}
+
+    void runJob(int rows, Job job, void* ctx);  //!< Post a job to the workers and process the first band
+    void workerFunc(int band);                  //!< Worker thread processing the band `band` of each job
+    void stopWorkers();                         //!< Stop and join the worker threads
+
+private:
+    int mThreads = 1;                   //!< Threads sharing the rows, the calling thread included
+    std::vector<std::thread> mWorkers;  //!< Worker threads, one per band after the first one
+
+    std::mutex mJobMutex;               //!< Protects the current job
+    std::condition_variable mJobCond;   //!< Signaled when a job is posted or a band completed
+    uint64_t mJobPosted = 0;            //!< Number of jobs posted to the workers
+    int mPending = 0;                   //!< Workers still processing the current job
+    bool mStop = false;                 //!< Stop request for the workers
+
+    // ----> Current job, set by `runJob`
+    Job mJob = nullptr;
+    void* mCtx = nullptr;
+    int mRows = 0;
+    int mBands = 1;
+    // <---- Current job, set by `runJob`
+};
+
+}
+
+}
+
+#endif // VIDEO_MOD_AVAILABLE
+
+#endif // BANDWORKERS_HPP
@@ -0,0 +1,154 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef CAPTUREGROUP_HPP
+#define CAPTUREGROUP_HPP
+
+#include "videocapture.hpp"
+
+#include <vector>
+
+#ifdef VIDEO_MOD_AVAILABLE
+
+namespace sl_oc {
+
+namespace video {
+
+/*!
+ * \brief A set of frames, one per camera of a \ref CaptureGroup, grabbed at the same time
+ */
+struct SL_OC_EXPORT FrameGroup
+{
+    std::vector<FrameLease> frames; //!< One frame per camera, in the order the cameras were added to the group
+    uint64_t group_id = 0;          //!< Increasing index of the groups
+    uint64_t timestamp = 0;         //!< Latest timestamp of the frames of the group in nanoseconds
+    uint64_t skew = 0;              //!< Difference between the latest and the earliest timestamp in nanoseconds
+};
+
+/*!
+ * \brief Statistics of the frame matching of a \ref CaptureGroup (see \ref CaptureGroup::getStats)
+ */
+struct CaptureGroupStats
+{
+    uint64_t groups = 0;            //!< Number of matched groups
+    uint64_t dropped_groups = 0;    //!< Number of matched groups discarded because not retrieved in time with \ref CaptureGroup::grab
+    std::vector<uint64_t> unmatched_frames; //!< Number of frames of each camera discarded without a match within the tolerance
+    std::vector<uint64_t> subscriber_dropped; //!< Number of frames of each camera dropped before reaching the matcher
+    LatencyHistogram skew;          //!< Timestamp skew of the matched groups
+};
+
+/*!
+ * \brief The CaptureGroup class owns several cameras and emits their frames grouped by nearest timestamp
+ *
+ * Each camera is read through a \ref VideoCapture::subscribe callback: the frames are matched as soon as they
+ * arrive, in the subscriber threads, and the grabbing threads are never delayed. A group is emitted when the
+ * timestamps of one frame per camera are within the tolerance. A frame that can no longer be part of a group is
+ * discarded and counted as unmatched.
+ *
+ * \note The tolerance must be lower than half the frame period, otherwise a frame could be matched with the
+ *       wrong frame of another camera. The default tolerance is half the frame period.
+ * \note The frames of the groups are leases on the UVC buffers of the cameras: the groups must be released before
+ *       the CaptureGroup is destroyed.
+ */
+class SL_OC_EXPORT CaptureGroup
+{
+public:
+    /*!
+     * \brief The default constructor
+     * \param params the parameters of all the cameras of the group. `buffer_count` is raised to
+     *        \ref GROUP_MIN_BUFFERS if lower, since the frames waiting for a match hold UVC buffers
+     * \param tolerance_usec maximum skew of the timestamps of a group in microseconds. `0` for half the frame period
+     * \param queue_depth maximum number of matched groups waiting for \ref grab. The oldest group is discarded
+     *        when a new one is matched and the queue is full
+     */
+    CaptureGroup(VideoParams params = VideoParams(), uint64_t tolerance_usec=0, size_t queue_depth=1);
+
+    /*!
+     * \brief The destructor stops the capture and closes all the cameras
+     */
+    virtual ~CaptureGroup();
+
+    /*!
+     * \brief Open a camera and add it to the group. Cameras cannot be added while the group is started
+     * \param devId Id of the camera (see `/dev/video*`). Use `-1` to open the first available camera
+     * \return the index of the camera in the group, `-1` on error
+     */
+    int addCamera( int devId=-1 );
+
+    inline size_t getCameraCount(){return mCameras.size();}     //!< Number of cameras of the group
+    inline VideoCapture& getCamera(size_t idx){return *mCameras.at(idx);} //!< Camera at index `idx` of the group
+    inline uint64_t getTolerance(){return mToleranceNsec/1000;} //!< Matching tolerance in microseconds
+
+    /*!
+     * \brief Start matching the frames of the cameras
+     * \return true on success
+     */
+    bool start();
+
+    /*!
+     * \brief Stop matching the frames and discard the pending frames and groups
+     */
+    void stop();
+
+    /*!
+     * \brief Get the oldest matched group, waiting for it if none is available
+     * \param group the matched group. Its previous frames are released
+     * \param timeout_msec maximum wait time in milliseconds
+     * \return true if a group has been retrieved, false on timeout or if the group is not started
+     */
+    bool grab(FrameGroup& group, uint64_t timeout_msec=100);
+
+    /*!
+     * \brief Get the statistics of the frame matching
+     * \return the statistics since \ref start
+     */
+    CaptureGroupStats getStats();
+
+    static const int GROUP_MIN_BUFFERS = 8; //!< Minimum number of UVC buffers of each camera
+
+private:
+    void onFrame(size_t cam, const FrameLease& lease);   //!< Subscriber callback of camera `cam`
+    void matchPending(std::vector<FrameLease>& released); //!< Emit the groups available in the pending frames. Requires `mMutex`
+
+private:
+    VideoParams mParams;                            //!< Parameters of the cameras
+    uint64_t mToleranceNsec;                        //!< Matching tolerance, `0` until computed by \ref start
+    uint64_t mToleranceParam;                       //!< Tolerance requested by the user in nanoseconds
+    size_t mQueueDepth;                             //!< Maximum number of groups waiting for \ref grab
+
+    std::vector<std::unique_ptr<VideoCapture>> mCameras; //!< Cameras of the group
+    std::vector<int> mSubIds;                       //!< Subscriptions to the frames of the cameras
+
+    std::mutex mMutex;                              //!< Protects the pending frames, the groups and the statistics
+    std::condition_variable mGroupCond;             //!< Signaled when a new group is available
+    std::vector<std::deque<FrameLease>> mPending;   //!< Frames of each camera waiting for a match
+    std::deque<FrameGroup> mGroups;                 //!< Matched groups waiting for \ref grab
+    uint64_t mGroupCount = 0;                       //!< Index of the next group
+    bool mStarted = false;                          //!< The frames are being matched
+    CaptureGroupStats mStats;                       //!< Matching statistics
+};
+
+}
+
+}
+
+#endif // VIDEO_MOD_AVAILABLE
+
+#endif // CAPTUREGROUP_HPP
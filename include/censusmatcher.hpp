@@ -0,0 +1,156 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef CENSUSMATCHER_HPP
+#define CENSUSMATCHER_HPP
+
+#include "bandworkers.hpp"
+
+#include <vector>
+
+#ifdef VIDEO_MOD_AVAILABLE
+
+namespace sl_oc {
+
+namespace video {
+
+/*!
+ * \brief The CensusMatcher class computes the disparity map of a rectified gray stereo pair
+ *
+ * Each pixel is described by the census transform of its 5x5 neighbourhood (24 bits: neighbour darker than the
+ * center). The matching cost of a disparity is the Hamming distance of the left and right descriptors, summed on a
+ * `blockSize x blockSize` window; the disparity with the minimum cost wins and is refined to 1/16 pixel by fitting a
+ * parabola on its neighbours. Unlike SGBM there is no smoothness term and no left-right check: the census cost is
+ * robust to the exposure differences of the two sensors and cheap to compute.
+ *
+ * The output has the format of `cv::StereoMatcher`: `int16_t` disparities multiplied by 16 (see \ref DISP_SCALE),
+ * `(minDisparity-1)*16` for the invalid pixels. The pixels whose window or disparity range exceeds the image are
+ * invalid.
+ *
+ * The Hamming cost kernel uses AVX2 or NEON when available, the AVX2 support being detected at runtime (see
+ * \ref setSimd). The rows of the image are split among persistent worker threads (see \ref setThreads).
+ */
+class SL_OC_EXPORT CensusMatcher
+{
+public:
+    /*!
+     * \brief The default constructor
+     * \param verbose_lvl verbosity level
+     */
+    CensusMatcher(VERBOSITY verbose_lvl=VERBOSITY::ERROR);
+
+    /*!
+     * \brief Set the matching parameters
+     * \param minDisparity minimum disparity, can be negative
+     * \param numDisparities number of disparities searched, starting from `minDisparity`
+     * \param blockSize size of the cost aggregation window, odd number in the range [1,\ref MAX_BLOCK_SIZE]
+     * \param uniquenessRatio margin in percentage by which the best cost must win over the costs of the non adjacent
+     *        disparities, `0` to disable the check
+     * \return true if the parameters are valid
+     */
+    bool setParams(int minDisparity, int numDisparities, int blockSize, int uniquenessRatio);
+
+    /*!
+     * \brief Compute the disparity map of the left image
+     * \param left left rectified image, 8 bit gray
+     * \param right right rectified image, 8 bit gray
+     * \param width width of the images
+     * \param height height of the images
+     * \param stride row size of the images in bytes
+     * \param disparity output disparity map, `width*height` elements
+     * \param disp_stride row size of the disparity map in elements
+     * \return true on success
+     */
+    bool compute(const uint8_t* left, const uint8_t* right, int width, int height, size_t stride,
+                 int16_t* disparity, size_t disp_stride);
+
+    inline int getMinDisparity() const {return mMinDisparity;}         //!< Minimum disparity
+    inline int getNumDisparities() const {return mNumDisparities;}     //!< Number of disparities searched
+    inline int getBlockSize() const {return mBlockSize;}               //!< Size of the cost aggregation window
+    inline int getUniquenessRatio() const {return mUniquenessRatio;}   //!< Uniqueness margin in percentage
+
+    /*!
+     * \brief Enable the SIMD kernel of the Hamming cost. Enabled by default
+     * \param enable use the AVX2 kernel if supported by the CPU, or the NEON kernel on ARM. The scalar kernel otherwise
+     *        (see \ref selectSimdKernel)
+     * \note Not to be called during \ref compute
+     */
+    void setSimd(bool enable);
+
+    inline const char* getKernelName() const {return mKernelName;}     //!< Name of the cost kernel in use: "AVX2", "NEON" or "scalar"
+
+    /*!
+     * \brief Set the number of threads sharing the rows of the image
+     * \param threads number of threads, the calling thread included. `0` for the number of CPU cores, up to 4
+     * \note Not to be called during \ref compute
+     */
+    void setThreads(int threads);
+
+    inline int getThreads() const {return mWorkers.getThreads();}      //!< Number of threads sharing the rows
+
+    static const int DISP_SHIFT = 4;                    //!< Fractional bits of the disparities
+    static const int DISP_SCALE = 1<<DISP_SHIFT;        //!< Disparity scale factor (as `cv::StereoMatcher::DISP_SCALE`)
+    static const int CENSUS_RADIUS = 2;                 //!< Radius of the census window, 5x5
+    static const int MAX_BLOCK_SIZE = 21;               //!< Maximum aggregation window, the aggregated cost must fit 16 bits
+
+private:
+    //! Add the Hamming costs of a row entering the window and remove the ones of the row leaving it
+    typedef void (*CostKernel)(const uint32_t* l_add, const uint32_t* r_add, const uint32_t* l_sub,
+                               const uint32_t* r_sub, int count, uint16_t* colsum);
+
+    //! Buffers of the rows processed by one thread
+    struct Scratch
+    {
+        std::vector<uint16_t> colsum;   //!< Costs summed over the window rows, one row per disparity
+        std::vector<uint16_t> cost;     //!< Aggregated costs of the current row, one row per disparity
+        std::vector<uint16_t> best;     //!< Minimum cost
+        std::vector<uint16_t> second;   //!< Minimum cost of the disparities not adjacent to the best one
+        std::vector<int16_t> best_idx;  //!< Index of the best disparity, `-1` if none
+    };
+
+    void censusRows(const uint8_t* src, size_t stride, int y0, int y1, uint32_t* dst);  //!< Census transform of rows [y0,y1)
+    void matchRows(int y0, int y1, Scratch& scratch, int16_t* disparity, size_t disp_stride); //!< Disparities of rows [y0,y1)
+
+private:
+    VERBOSITY mVerbose;             //!< Verbosity level
+
+    int mMinDisparity = 0;          //!< Minimum disparity
+    int mNumDisparities = 64;       //!< Number of disparities
+    int mBlockSize = 7;             //!< Aggregation window
+    int mUniquenessRatio = 10;      //!< Uniqueness margin in percentage
+
+    CostKernel mCostKernel = nullptr; //!< Kernel of the Hamming costs
+    const char* mKernelName = "";   //!< Name of the cost kernel
+    BandWorkers mWorkers;           //!< Threads sharing the rows
+
+    int mWidth = 0;                 //!< Width of the current images
+    int mHeight = 0;                //!< Height of the current images
+    std::vector<uint32_t> mCensus[2]; //!< Census descriptors of the left and right images
+    std::vector<uint32_t> mZero;    //!< Null descriptors, used for the rows outside the image
+    std::vector<Scratch> mScratch;  //!< Buffers of each thread
+};
+
+}
+
+}
+
+#endif // VIDEO_MOD_AVAILABLE
+
+#endif // CENSUSMATCHER_HPP
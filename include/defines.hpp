@@ -28,6 +28,12 @@
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <mutex>
+#include <cmath>
+#include <errno.h>
+#include <atomic>
+#include <algorithm>
+#include <thread>
 
 #if defined _WIN32
 #if defined(SL_OC_COMPIL)
@@ -89,6 +95,123 @@ enum VERBOSITY {
     INFO = 3
 };
 
+/*!
+ * \brief Set the scheduling policy and the CPU affinity of a thread
+ * \param thread the running thread
+ * \param rt_priority `SCHED_FIFO` priority in the range [1,99]. Use `0` to keep the default scheduling
+ * \param cpu_affinity_mask bit `i` set to allow the thread to run on CPU `i`. Use `0` to keep the default affinity
+ * \return 0 if successful, the error code of the first failed call otherwise (`EPERM` if the process is not allowed
+ * to use the real-time scheduling, see `CAP_SYS_NICE` and `RLIMIT_RTPRIO`). `ENOSYS` on the systems other than Linux
+ */
+SL_OC_EXPORT int setThreadScheduling(std::thread& thread, int rt_priority, uint64_t cpu_affinity_mask);
+
+/*!
+ * \brief Statistics about the arrival period of the data received by a grabbing thread
+ */
+struct JitterStats
+{
+    uint64_t samples = 0;           //!< Number of measured periods
+    double nominal_period_usec = 0; //!< Expected period
+    double mean_period_usec = 0;    //!< Average period
+    double stddev_usec = 0;         //!< Standard deviation of the period (the jitter)
+    double min_period_usec = 0;     //!< Shortest period
+    double max_period_usec = 0;     //!< Longest period
+    uint64_t late_count = 0;        //!< Number of periods longer than 1.5 times the nominal period
+};
+
+/*!
+ * \brief The JitterMeter class accumulates the arrival periods of a data stream, updated by the grabbing thread
+ *
+ * Lock-free: a single writer, the grabbing thread, and any number of readers.
+ */
+class JitterMeter
+{
+public:
+    /*!
+     * \brief Restart the statistics. Not to be called while the grabbing thread adds samples
+     * \param nominal_period_usec the expected period, used to count the late arrivals
+     */
+    inline void reset(double nominal_period_usec)
+    {
+        mLateNsec.store(static_cast<uint64_t>(1.5*nominal_period_usec*1000.), std::memory_order_relaxed);
+        mNominalUsec.store(nominal_period_usec, std::memory_order_relaxed);
+        mLastTs.store(0, std::memory_order_relaxed);
+        mSamples.store(0, std::memory_order_relaxed);
+        mSumNsec.store(0, std::memory_order_relaxed);
+        mSumSqUsec.store(0, std::memory_order_relaxed);
+        mMinNsec.store(0, std::memory_order_relaxed);
+        mMaxNsec.store(0, std::memory_order_relaxed);
+        mLateCount.store(0, std::memory_order_relaxed);
+    }
+
+    /*!
+     * \brief Add a data arrival
+     * \param ts_nsec steady timestamp of the arrival in nanoseconds
+     */
+    inline void addSample(uint64_t ts_nsec)
+    {
+        // Single writer: plain loads and stores, no read-modify-write
+        uint64_t last = mLastTs.load(std::memory_order_relaxed);
+        if(last!=0 && ts_nsec>last)
+        {
+            uint64_t period = ts_nsec-last;
+            uint64_t period_usec = (period+500)/1000;
+            uint64_t samples = mSamples.load(std::memory_order_relaxed);
+
+            mSumNsec.store(mSumNsec.load(std::memory_order_relaxed)+period, std::memory_order_relaxed);
+            mSumSqUsec.store(mSumSqUsec.load(std::memory_order_relaxed)+period_usec*period_usec, std::memory_order_relaxed);
+
+            if(samples==0 || period<mMinNsec.load(std::memory_order_relaxed))
+                mMinNsec.store(period, std::memory_order_relaxed);
+            if(period>mMaxNsec.load(std::memory_order_relaxed))
+                mMaxNsec.store(period, std::memory_order_relaxed);
+            uint64_t late = mLateNsec.load(std::memory_order_relaxed);
+            if(late>0 && period>late)
+                mLateCount.store(mLateCount.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+
+            // Published last: the readers never see more samples than accumulated periods
+            mSamples.store(samples+1, std::memory_order_release);
+        }
+        mLastTs.store(ts_nsec, std::memory_order_relaxed);
+    }
+
+    /*!
+     * \brief Get the current statistics
+     * \return a copy of the statistics
+     */
+    inline JitterStats getStats() const
+    {
+        JitterStats stats;
+        stats.samples = mSamples.load(std::memory_order_acquire);
+        stats.nominal_period_usec = mNominalUsec.load(std::memory_order_relaxed);
+        if(stats.samples==0)
+            return stats;
+
+        double n = static_cast<double>(stats.samples);
+        double sum_usec = mSumNsec.load(std::memory_order_relaxed)/1000.;
+        double sum_sq = static_cast<double>(mSumSqUsec.load(std::memory_order_relaxed));
+
+        stats.mean_period_usec = sum_usec/n;
+        if(stats.samples>1)
+            stats.stddev_usec = std::sqrt(std::max(0.0, (sum_sq-sum_usec*sum_usec/n)/(n-1)));
+        stats.min_period_usec = mMinNsec.load(std::memory_order_relaxed)/1000.;
+        stats.max_period_usec = mMaxNsec.load(std::memory_order_relaxed)/1000.;
+        stats.late_count = mLateCount.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    std::atomic<double> mNominalUsec{0.0};  //!< Expected period [usec]
+    std::atomic<uint64_t> mLateNsec{0};     //!< Periods longer than this are late [nsec]
+    std::atomic<uint64_t> mLastTs{0};       //!< Timestamp of the previous sample [nsec]
+    std::atomic<uint64_t> mSamples{0};      //!< Number of measured periods
+    std::atomic<uint64_t> mSumNsec{0};      //!< Sum of the periods [nsec]
+    std::atomic<uint64_t> mSumSqUsec{0};    //!< Sum of the squared periods [usec^2]
+    std::atomic<uint64_t> mMinNsec{0};      //!< Shortest period [nsec]
+    std::atomic<uint64_t> mMaxNsec{0};      //!< Longest period [nsec]
+    std::atomic<uint64_t> mLateCount{0};    //!< Number of late periods
+};
+
 }
 
 #endif //DEFINES_HPP
@@ -0,0 +1,199 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef DEPTHCONVERTER_HPP
+#define DEPTHCONVERTER_HPP
+
+#include "bandworkers.hpp"
+
+#include <vector>
+
+#ifdef VIDEO_MOD_AVAILABLE
+
+namespace sl_oc {
+
+namespace video {
+
+/*!
+ * \brief Disparity added to each pixel before the conversion, e.g. the disparity of a plane when the matcher searched
+ * only the residual disparities around it (see \ref DepthConverter::convert)
+ */
+struct SL_OC_EXPORT DisparityOffset
+{
+    const float* offset = nullptr;  //!< Disparity added to each pixel, in pixels of the input map
+    size_t offset_stride = 0;       //!< Row size of `offset` in elements
+    const uint8_t* invalid = nullptr; //!< Non zero for the pixels to be reported as invalid, can be `nullptr`
+    size_t invalid_stride = 0;      //!< Row size of `invalid` in bytes
+};
+
+/*!
+ * \brief Images written by \ref DepthConverter::convert. Each image is optional: `nullptr` to skip it
+ */
+struct SL_OC_EXPORT DepthOutput
+{
+    float* depth = nullptr;         //!< Depth in the unit of the focal-baseline product, `0` for the invalid pixels
+    size_t depth_stride = 0;        //!< Row size of `depth` in elements
+    float* disparity = nullptr;     //!< Disparity in pixels of the output map, `0` for the invalid pixels
+    size_t disparity_stride = 0;    //!< Row size of `disparity` in elements
+    uint8_t* color = nullptr;       //!< Disparity visualization, 3 channels (see \ref DepthConverter::setColorMap)
+    size_t color_stride = 0;        //!< Row size of `color` in bytes
+};
+
+/*!
+ * \brief The DepthConverter class turns the disparity map of a stereo matcher into a metric depth map in one pass
+ *
+ * The input has the format of `cv::StereoMatcher`: `int16_t` disparities multiplied by 16, `(minDisparity-1)*16` for
+ * the invalid pixels. For each pixel the disparity is scaled to the output resolution, the optional offset is added
+ * (see \ref DisparityOffset), and the depth `focal*baseline/disparity`, the float disparity and the color of the
+ * disparity are written at once, with no intermediate image. The output is `scale` times larger than the input:
+ * each disparity is replicated on a `scale x scale` block (nearest neighbor), so that the invalid pixels are never
+ * blended with the valid ones.
+ *
+ * The arithmetic uses AVX2 or NEON (AArch64) when available, the AVX2 support being detected at runtime (see
+ * \ref setSimd). The rows of the image are split among persistent worker threads (see \ref setThreads).
+ */
+class SL_OC_EXPORT DepthConverter
+{
+public:
+    /*!
+     * \brief The default constructor
+     * \param verbose_lvl verbosity level
+     */
+    DepthConverter(VERBOSITY verbose_lvl=VERBOSITY::ERROR);
+
+    /*!
+     * \brief Set the conversion parameters
+     * \param focalBaseline product of the focal length in pixels of the output map and of the baseline: it gives the
+     *        unit of the depth
+     * \param scale integer scale factor of the output map w.r.t. the input disparity map, in the range [1,8]
+     * \return true if the parameters are valid
+     */
+    bool setParams(float focalBaseline, int scale);
+
+    /*!
+     * \brief Set the colors of the disparity visualization
+     * \param palette 256 BGR colors, e.g. the result of `cv::applyColorMap` on a 0..255 ramp. It is copied
+     * \param minDisparity disparity, in pixels of the output map, mapped to the first color. The invalid pixels get the
+     *        first color too
+     * \param maxDisparity disparity, in pixels of the output map, mapped to the last color
+     * \return true if the range is valid
+     */
+    bool setColorMap(const uint8_t* palette, float minDisparity, float maxDisparity);
+
+    /*!
+     * \brief Convert a disparity map
+     * \param disparity disparity map of the matcher, `int16_t` with 4 fractional bits
+     * \param width width of the disparity map
+     * \param height height of the disparity map
+     * \param stride row size of the disparity map in elements
+     * \param minDisparity minimum disparity of the matcher: the pixels at `(minDisparity-1)*16` or less are invalid
+     * \param out the output images, `width*scale x height*scale` pixels
+     * \param offset disparity added to each pixel, `nullptr` for none
+     * \return true on success
+     */
+    bool convert(const int16_t* disparity, int width, int height, size_t stride, int minDisparity,
+                 const DepthOutput& out, const DisparityOffset* offset=nullptr);
+
+    inline float getFocalBaseline() const {return mFocalBaseline;}     //!< Focal-baseline product
+    inline int getScale() const {return mScale;}                       //!< Scale factor of the output map
+
+    /*!
+     * \brief Enable the SIMD kernel. Enabled by default
+     * \param enable use the AVX2 kernel if supported by the CPU, or the NEON kernel on AArch64. The scalar kernel otherwise
+     *        (see \ref selectSimdKernel)
+     * \note Not to be called during \ref convert
+     */
+    void setSimd(bool enable);
+
+    inline const char* getKernelName() const {return mKernelName;}     //!< Name of the kernel in use: "AVX2", "NEON" or "scalar"
+
+    /*!
+     * \brief Set the number of threads sharing the rows of the image
+     * \param threads number of threads, the calling thread included. `0` for the number of CPU cores, up to 4
+     * \note Not to be called during \ref convert
+     */
+    void setThreads(int threads);
+
+    inline int getThreads() const {return mWorkers.getThreads();}      //!< Number of threads sharing the rows
+
+    static const int DISP_SHIFT = 4;                    //!< Fractional bits of the input disparities
+    static const int MAX_SCALE = 8;                     //!< Maximum scale factor of the output map
+
+    //! Constants of a conversion, shared by the kernels
+    struct RowParams
+    {
+        int invalid;                //!< Input disparities up to this value are invalid
+        float dispScale;            //!< Input disparity to output pixels: `scale/16`
+        float offsetScale;          //!< Offset to output pixels: `scale`
+        float focalBaseline;        //!< Numerator of the depth
+        float colorMin;             //!< Disparity of the first color
+        float colorScale;           //!< Colors per disparity pixel
+    };
+
+private:
+    //! Depth, disparity and color index of `count` pixels of an input row
+    typedef void (*RowKernel)(const int16_t* disparity, const float* offset, const uint8_t* invalid, int count,
+                              const RowParams& par, float* depth, float* disp, uint8_t* color_idx);
+
+    //! Buffers of the rows processed by one thread, at the input resolution
+    struct Scratch
+    {
+        std::vector<float> depth;       //!< Depth of the row
+        std::vector<float> disp;        //!< Disparity of the row
+        std::vector<uint8_t> color_idx; //!< Palette index of the row
+    };
+
+    void convertRows(int y0, int y1, Scratch& scratch);   //!< Convert the input rows [y0,y1)
+
+private:
+    VERBOSITY mVerbose;             //!< Verbosity level
+
+    float mFocalBaseline = 1.f;     //!< Focal-baseline product
+    int mScale = 1;                 //!< Scale factor of the output map
+    uint8_t mPalette[256*3];        //!< Colors of the disparity visualization
+    float mColorMin = 0.f;          //!< Disparity of the first color
+    float mColorScale = 1.f;        //!< Colors per disparity pixel
+
+    RowKernel mRowKernel = nullptr; //!< Kernel of the rows
+    const char* mKernelName = "";   //!< Name of the kernel
+    BandWorkers mWorkers;           //!< Threads sharing the rows
+
+    int mWidth = 0;                 //!< Width of the current input map
+    std::vector<float> mZeroOffset; //!< Null offsets, used when there is no \ref DisparityOffset
+    std::vector<uint8_t> mZeroMask; //!< Null invalid mask
+    std::vector<Scratch> mScratch;  //!< Buffers of each thread
+
+    // ----> Current conversion, set by `convert`
+    const int16_t* mDisp = nullptr;
+    size_t mDispStride = 0;
+    int mHeight = 0;
+    DisparityOffset mOffset;
+    DepthOutput mOut;
+    RowParams mPar;
+    // <---- Current conversion, set by `convert`
+};
+
+}
+
+}
+
+#endif // VIDEO_MOD_AVAILABLE
+
+#endif // DEPTHCONVERTER_HPP
@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAMERECORDER_HPP
+#define FRAMERECORDER_HPP
+
+#include "videocapture.hpp"
+
+#include <string>
+#include <vector>
+
+#ifdef VIDEO_MOD_AVAILABLE
+
+namespace sl_oc {
+
+namespace video {
+
+/*!
+ * \brief The FrameRecorder class stores the frames grabbed by a \ref VideoCapture into a recording file
+ *
+ * The frames are received through a \ref VideoCapture::subscribe callback, so the file I/O runs in the subscriber
+ * thread and never blocks the grabbing thread. The file grows by chunks that are memory mapped: each frame is
+ * copied once, straight from the UVC buffer into the page cache. On \ref close the seek index is appended to the
+ * file (see \ref RecordFileHeader for the layout).
+ *
+ * \note If the writer cannot keep up, the oldest queued frames are dropped (see \ref getDroppedFrames).
+ */
+class SL_OC_EXPORT FrameRecorder
+{
+public:
+    FrameRecorder();
+    virtual ~FrameRecorder();
+
+    /*!
+     * \brief Create the recording file and start recording the frames grabbed by a camera
+     * \param filename path of the recording file, overwritten if it exists
+     * \param cap the initialized \ref VideoCapture to be recorded. It must not be destroyed before \ref close
+     * \param queue_depth maximum number of frames waiting to be written. It must be lower than
+     *        \ref VideoParams::buffer_count since each queued frame holds a UVC buffer
+     * \return true on success
+     */
+    bool open(const std::string& filename, VideoCapture& cap, size_t queue_depth=2);
+
+    /*!
+     * \brief Stop recording and write the seek index at the end of the file
+     */
+    void close();
+
+    inline bool isRecording(){return mCap!=nullptr;}  //!< Indicates if a recording is in progress
+    inline uint64_t getRecordedFrames(){return mRecordedFrames;} //!< Number of frames written to the file
+
+    /*!
+     * \brief Get the number of frames dropped because the writer could not keep up with the camera
+     * \return the number of dropped frames
+     */
+    uint64_t getDroppedFrames();
+
+private:
+    void writeFrame(const Frame& frame);    //!< Append a frame to the file. Called by the subscriber thread
+    bool mapChunk(uint64_t offset, size_t min_size); //!< Map the file region starting from `offset`, growing the file
+    void unmapChunk();                      //!< Unmap the current chunk
+
+private:
+    VideoCapture* mCap = nullptr;           //!< Recorded camera
+    int mSubId = -1;                        //!< Subscription to the frames of the camera
+    int mFd = -1;                           //!< File descriptor of the recording file
+    std::string mFilename;                  //!< Path of the recording file
+    VERBOSITY mVerbose = VERBOSITY::ERROR;  //!< Verbosity level, copied from the camera by `open`
+
+    uint8_t* mChunk = nullptr;              //!< Current memory mapped chunk
+    uint64_t mChunkOffset = 0;              //!< File offset of the current chunk (page aligned)
+    size_t mChunkLen = 0;                   //!< Length of the current chunk
+    size_t mChunkSize = 0;                  //!< Default length of the chunks
+    uint64_t mWriteOffset = 0;              //!< File offset of the next frame
+    uint32_t mFrameSize = 0;                //!< Expected size of the frame data
+    bool mWriteError = false;               //!< A write failed: the following frames are discarded
+
+    std::vector<RecordIndexEntry> mIndex;   //!< Seek index, written on \ref close
+    std::atomic<uint64_t> mRecordedFrames;  //!< Number of frames written to the file
+};
+
+/*!
+ * \brief The RecordingReader class gives random access to the frames of a recording file
+ *
+ * The whole file is memory mapped read-only: the frames returned by \ref getFrame point directly into the mapping
+ * and remain valid until \ref close. \ref seek finds a frame by timestamp with a binary search on the seek index.
+ * If the index is missing (interrupted recording) it is rebuilt by scanning the frame headers on \ref open.
+ */
+class SL_OC_EXPORT RecordingReader
+{
+public:
+    RecordingReader(VERBOSITY verbose_lvl=VERBOSITY::ERROR);
+    virtual ~RecordingReader();
+
+    /*!
+     * \brief Map a recording file and load its seek index
+     * \param filename path of the recording file
+     * \return true on success
+     */
+    bool open(const std::string& filename);
+
+    /*!
+     * \brief Unmap the recording file. The frames previously returned are no longer valid
+     */
+    void close();
+
+    inline bool isOpened(){return mMap!=nullptr;}   //!< Indicates if a recording file is mapped
+    inline size_t getFrameCount(){return mFrameCount;} //!< Number of frames in the recording
+    inline const RecordFileHeader& getHeader(){return mHeader;} //!< Header of the recording file
+
+    /*!
+     * \brief Find the first frame whose timestamp is not earlier than `timestamp`, in O(log n)
+     * \param timestamp the timestamp in nanoseconds
+     * \return the index of the frame, or -1 if all the frames are earlier
+     */
+    long seek(uint64_t timestamp);
+
+    /*!
+     * \brief Get a frame without copying its data
+     * \param index index of the frame in the recording, in [0, \ref getFrameCount)
+     * \param frame the frame, whose `data` points into the mapped file
+     * \return true on success
+     * \note The mapping is read-only: the frame data must not be modified.
+     */
+    bool getFrame(size_t index, Frame& frame);
+
+private:
+    bool rebuildIndex();    //!< Scan the frame headers to build the index of an interrupted recording
+
+private:
+    VERBOSITY mVerbose;                     //!< Verbosity level
+    int mFd = -1;                           //!< File descriptor of the recording file
+    uint8_t* mMap = nullptr;                //!< Mapping of the whole file
+    size_t mMapLen = 0;                     //!< Length of the mapping
+    RecordFileHeader mHeader;               //!< Header of the recording file
+
+    const RecordIndexEntry* mIndex = nullptr; //!< Seek index, in the mapping or in \ref mRebuiltIndex
+    size_t mFrameCount = 0;                 //!< Number of entries of the seek index
+    std::vector<RecordIndexEntry> mRebuiltIndex; //!< Index rebuilt by scanning the file
+};
+
+}
+
+}
+
+#endif // VIDEO_MOD_AVAILABLE
+
+#endif // FRAMERECORDER_HPP
@@ -224,6 +224,32 @@ public:
      */
     static bool resetVideoModule(int serial_number=0);
 
+    /*!
+     * \brief Set the scheduling of the sensor data grabbing thread, to receive the 400 Hz data on time under load
+     * \param rt_priority `SCHED_FIFO` priority in the range [1,99]. Use `0` to keep the default scheduling
+     * \param cpu_affinity_mask bit `i` set to allow the thread to run on CPU `i`. Use `0` for no restriction
+     * \return true if successful, or if the settings will be applied when the grabbing thread is started
+     *
+     * \note The settings can be changed before calling \ref initializeSensors or while grabbing
+     */
+    bool setThreadScheduling(int rt_priority, uint64_t cpu_affinity_mask=0);
+
+    /*!
+     * \brief Lock the sensor data buffers in RAM with `mlock` so that they are never paged out
+     * \param enable true to lock the buffers, false to unlock them
+     * \return true if successful, or if the setting will be applied when the grabbing thread is started
+     *
+     * \note The locked buffers are the last received data and the timestamp synchronization queues.
+     * The locked memory is limited by `RLIMIT_MEMLOCK` (`ulimit -l`)
+     */
+    bool setBufferLock(bool enable);
+
+    /*!
+     * \brief Get the statistics about the arrival period of the sensor data, measured by the grabbing thread
+     * \return the period statistics since the start of the capture (see \ref JitterStats)
+     */
+    inline JitterStats getJitterStats(){return mJitter.getStats();}
+
 #ifdef VIDEO_MOD_AVAILABLE
     void updateTimestampOffset(uint64_t frame_ts);                                 //!< Called by  VideoCapture to update timestamp offset
     inline void setStartTimestamp(uint64_t start_ts){mStartSysTs=start_ts;}        //!< Called by  VideoCapture to sync timestamps reference point
@@ -237,6 +263,9 @@ private:
 
     bool startCapture();                //!< Start data capture thread
 
+    bool lockBuffers();                 //!< Lock the data buffers in RAM
+    void unlockBuffers();               //!< Unlock the data buffers
+
     bool open(uint16_t pid, int serial_number); //!< Open the USB connection
     void close();                       //!< Close the USB connection
 
@@ -274,6 +303,11 @@ private:
     data::Temperature mLastCamTempData; //!< Contains the last received camera sensors temperature data
 
     std::thread mGrabThread;            //!< The grabbing thread
+    int mRtPriority = 0;                //!< SCHED_FIFO priority of the grabbing thread (0: default scheduling)
+    uint64_t mCpuAffinityMask = 0;      //!< CPU affinity mask of the grabbing thread (0: no restriction)
+    JitterMeter mJitter;                //!< Data arrival period statistics
+    bool mLockBuffers = false;          //!< Indicates if the data buffers must be locked in RAM
+    bool mBuffersLocked = false;        //!< Indicates if the data buffers are locked in RAM
 
     std::mutex mIMUMutex;               //!< Mutex for safe access to IMU data buffer
     std::mutex mMagMutex;               //!< Mutex for safe access to MAG data buffer
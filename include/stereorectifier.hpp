@@ -0,0 +1,192 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef STEREORECTIFIER_HPP
+#define STEREORECTIFIER_HPP
+
+#include "videocapture.hpp"
+#include "bandworkers.hpp"
+
+#include <vector>
+
+#ifdef VIDEO_MOD_AVAILABLE
+
+namespace sl_oc {
+
+namespace video {
+
+/*!
+ * \brief Pixel format of the images produced by \ref StereoRectifier
+ */
+enum class RECTIFY_FORMAT {
+    GRAY,   //!< 8 bit luma, sampled from the Y channel of the frame with no color conversion
+    BGR     //!< 8 bit BGR, BT.601 conversion of the YUV 4:2:2 frame (as `cv::COLOR_YUV2BGR_YUYV`)
+};
+
+/*!
+ * \brief Fixed-point rectification map of one image, as generated by `cv::convertMaps` with `CV_16SC2`
+ *
+ * The map is not copied by \ref StereoRectifier: it must remain valid while the rectifier uses it. This allows the
+ * maps to be memory mapped from a cache file and shared between processes.
+ */
+struct SL_OC_EXPORT RectifyMap
+{
+    const int16_t* xy = nullptr;    //!< Integer source coordinates, `x` and `y` interleaved, one pair per rectified pixel
+    const uint16_t* frac = nullptr; //!< Fractional part of the source coordinates: `fy*RECTIFY_INTER_TAB + fx`
+};
+
+/*!
+ * \brief Duration of the stages of \ref StereoRectifier::rectify (see \ref StereoRectifier::getStats)
+ */
+struct SL_OC_EXPORT RectifierStats
+{
+    uint64_t frames = 0;            //!< Number of rectified frames
+    LatencyHistogram convert[2];    //!< Color conversion of the left `[0]` and right `[1]` halves of the frame. `0` with \ref RECTIFY_FORMAT::GRAY, fused with the remap
+    LatencyHistogram remap[2];      //!< Remapping of the left `[0]` and right `[1]` images
+    LatencyHistogram total;         //!< Whole \ref StereoRectifier::rectify call, both halves in parallel
+};
+
+/*!
+ * \brief The StereoRectifier class converts side-by-side YUV 4:2:2 frames into rectified left and right images
+ *
+ * The chain of every stereo consumer (color conversion, split of the side-by-side frame, one remap per image) is
+ * done in a single call. The two halves of the frame are processed in parallel: the left image by the calling
+ * thread, the right image by a worker thread owned by the rectifier. The remap is a bilinear interpolation with
+ * precomputed fixed-point maps (see \ref RectifyMap) and constant black border, as `cv::remap` with `INTER_LINEAR`.
+ *
+ * With \ref RECTIFY_FORMAT::GRAY the conversion and the remap are fused in a single pass: the Y channel of the frame
+ * is sampled through the maps straight into the rectified images. The kernel uses AVX2 or NEON when available, the
+ * AVX2 support being detected at runtime (see \ref setSimd).
+ *
+ * The images are written in buffers owned by the rectifier, allocated once: they are valid until the next call to
+ * \ref rectify or \ref setMaps. With OpenCV they can be wrapped with no copy:
+ * `cv::Mat(rect.getHeight(), rect.getWidth(), CV_8UC3, rect.getLeft())`.
+ */
+class SL_OC_EXPORT StereoRectifier
+{
+public:
+    /*!
+     * \brief The default constructor
+     * \param format pixel format of the rectified images
+     * \param verbose_lvl verbosity level
+     */
+    StereoRectifier(RECTIFY_FORMAT format=RECTIFY_FORMAT::BGR, VERBOSITY verbose_lvl=VERBOSITY::ERROR);
+
+    /*!
+     * \brief The destructor stops the worker thread
+     */
+    virtual ~StereoRectifier();
+
+    /*!
+     * \brief Set the rectification maps and allocate the image buffers
+     * \param width width of a single image (half of the side-by-side frame)
+     * \param height height of the images
+     * \param left fixed-point map of the left image, `width*height` elements
+     * \param right fixed-point map of the right image, `width*height` elements
+     * \return true on success
+     */
+    bool setMaps(uint16_t width, uint16_t height, const RectifyMap& left, const RectifyMap& right);
+
+    /*!
+     * \brief Rectify a side-by-side frame
+     * \param yuyv the frame data in YUV 4:2:2 format
+     * \param width width of the side-by-side frame, twice the width of the maps
+     * \param height height of the frame, equal to the height of the maps
+     * \return true on success
+     */
+    bool rectify(const uint8_t* yuyv, uint16_t width, uint16_t height);
+
+    /*!
+     * \brief Rectify a frame grabbed by \ref VideoCapture or read from a recording
+     * \param frame the frame in YUV 4:2:2 format
+     * \return true on success
+     */
+    inline bool rectify(const Frame& frame){return rectify(frame.data, frame.width, frame.height);}
+
+    inline const uint8_t* getLeft() const {return mRect[0].data();}     //!< Left rectified image
+    inline const uint8_t* getRight() const {return mRect[1].data();}    //!< Right rectified image
+    inline uint16_t getWidth() const {return mWidth;}                   //!< Width of the rectified images
+    inline uint16_t getHeight() const {return mHeight;}                 //!< Height of the rectified images
+    inline int getChannels() const {return mFormat==RECTIFY_FORMAT::BGR?3:1;} //!< Number of channels of the rectified images
+    inline RECTIFY_FORMAT getFormat() const {return mFormat;}           //!< Pixel format of the rectified images
+
+    /*!
+     * \brief Enable the SIMD kernel of the gray images. Enabled by default
+     * \param enable use the AVX2 kernel if supported by the CPU, or the NEON kernel on ARM. The scalar kernel otherwise
+     *        (see \ref selectSimdKernel)
+     * \note Not to be called during \ref rectify
+     */
+    void setSimd(bool enable);
+
+    inline const char* getKernelName() const {return mKernelName;}     //!< Name of the gray kernel in use: "AVX2", "NEON" or "scalar"
+
+    /*!
+     * \brief Get the duration of the rectification stages
+     * \return the statistics since the creation of the rectifier or the last \ref resetStats
+     */
+    RectifierStats getStats();
+
+    /*!
+     * \brief Reset the rectification statistics
+     */
+    void resetStats();
+
+    static const int RECTIFY_INTER_BITS = 5;                        //!< Bits of the fractional coordinates (`cv::INTER_BITS`)
+    static const int RECTIFY_INTER_TAB = 1<<RECTIFY_INTER_BITS;     //!< Fractional steps per pixel (`cv::INTER_TAB_SIZE`)
+
+private:
+    //! Fused rectification of the luma of a half frame
+    typedef void (*LumaKernel)(const uint8_t* src, size_t stride, int width, int height, const RectifyMap& map, uint8_t* dst);
+
+    void processSide(int side);     //!< Convert and remap one half of the current frame
+    void convertSide(int side);     //!< Convert one half of the current frame to BGR
+    void remapSide(int side);       //!< Remap one converted BGR half into its rectified buffer
+
+private:
+    RECTIFY_FORMAT mFormat;         //!< Format of the rectified images
+    VERBOSITY mVerbose;             //!< Verbosity level
+
+    uint16_t mWidth = 0;            //!< Width of the rectified images
+    uint16_t mHeight = 0;           //!< Height of the rectified images
+    RectifyMap mMap[2];             //!< Maps of the left and right images
+    LumaKernel mLumaKernel = nullptr; //!< Kernel of the gray images
+    const char* mKernelName = "";   //!< Name of the kernel of the gray images
+
+    std::vector<uint8_t> mRaw[2];   //!< Converted left and right halves, before the remap. Not used for the gray images
+    std::vector<uint8_t> mRect[2];  //!< Rectified left and right images
+
+    const uint8_t* mSrc = nullptr;  //!< Frame being rectified
+    size_t mSrcStride = 0;          //!< Row size of the frame being rectified in bytes
+    uint64_t mConvertUsec[2] = {0}; //!< Conversion time of each half of the current frame
+    uint64_t mRemapUsec[2] = {0};   //!< Remap time of each half of the current frame
+
+    BandWorkers mWorkers;           //!< The calling thread and the worker processing the right half
+
+    std::mutex mStatsMutex;         //!< Protects the statistics
+    RectifierStats mStats;          //!< Stage durations
+};
+
+}
+
+}
+
+#endif // VIDEO_MOD_AVAILABLE
+
+#endif // STEREORECTIFIER_HPP
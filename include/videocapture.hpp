@@ -24,6 +24,13 @@
 #include "defines.hpp"
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <cstdio>
 #include <fstream>      // std::ofstream
 #include <iomanip>
 
@@ -56,6 +63,128 @@ struct SL_OC_EXPORT Frame
     uint16_t width = 0;             //!< Frame width
     uint16_t height = 0;            //!< Frame height
     uint8_t channels = 0;           //!< Number of channels per pixel
+    uint32_t sequence = 0;          //!< V4L2 sequence number of the frame. A gap indicates frames lost by the driver
+};
+
+class VideoCapture;
+
+/*!
+ * \brief The FrameLease class gives direct access to a frame still stored in the UVC buffer it was grabbed into
+ *
+ * The buffer is not given back to the driver while at least one lease on it is alive, so its data is never
+ * overwritten under the consumer. Leases are reference counted: copying a lease adds a reference to the same buffer.
+ *
+ * \note Leases must be released quickly: a buffer owned by the application cannot be filled by the camera.
+ * \note All the leases must be released before the VideoCapture object that generated them is destroyed.
+ */
+class SL_OC_EXPORT FrameLease
+{
+public:
+    FrameLease() = default;
+    FrameLease(const FrameLease& other);
+    FrameLease(FrameLease&& other);
+    FrameLease& operator=(const FrameLease& other);
+    FrameLease& operator=(FrameLease&& other);
+
+    /*!
+     * \brief The destructor releases the lease
+     */
+    ~FrameLease();
+
+    /*!
+     * \brief Indicates if the lease refers to a valid frame
+     * \return true if the lease is valid
+     */
+    inline bool isValid() const {return mCap!=nullptr;}
+
+    /*!
+     * \brief Get the leased frame. `Frame::data` points directly to the UVC buffer
+     * \return a reference to the leased frame
+     */
+    inline const Frame& frame() const {return mFrame;}
+
+    /*!
+     * \brief Release the lease. The UVC buffer is given back to the driver when its last lease is released
+     */
+    void release();
+
+private:
+    friend class VideoCapture;
+
+    VideoCapture* mCap = nullptr;   //!< The VideoCapture owning the buffer
+    int mBufIdx = -1;               //!< Index of the leased UVC buffer
+    uint64_t mStreamGen = 0;        //!< Streaming session the buffer belongs to
+    Frame mFrame;                   //!< The leased frame
+};
+
+/*!
+ * \brief Timing and transfer count of a register batch applied with \ref VideoCapture::applyRegisterBatch
+ */
+struct SL_OC_EXPORT RegisterBatchStats
+{
+    int accesses = 0;               //!< Number of register accesses in the batch
+    int transfers = 0;              //!< Number of vendor control transfers used to apply the batch
+    int fallbacks = 0;              //!< Number of burst transfers not applied and retried one register at a time
+    uint64_t latency_usec = 0;      //!< Time spent applying the batch, including the wait for the control mutex
+};
+
+/*!
+ * \brief The RegisterBatch class collects camera register accesses to be applied in a single transaction
+ *
+ * Accesses are executed in the order they are added, one register per vendor control transfer, all in the same
+ * transaction. When enabled with \ref VideoCapture::setRegisterBurst, consecutive writes to contiguous ISP
+ * registers are coalesced in a single burst transfer.
+ */
+class SL_OC_EXPORT RegisterBatch
+{
+public:
+    /*!
+     * \brief Add the write of an ISP register
+     * \param address register address
+     * \param value value to be written
+     */
+    void writeSystemRegister(uint64_t address, uint8_t value);
+
+    /*!
+     * \brief Add the read of an ISP register
+     * \param address register address
+     * \param value destination of the value read. It must be valid until the batch is applied
+     */
+    void readSystemRegister(uint64_t address, uint8_t* value);
+
+    /*!
+     * \brief Add the write of a sensor register
+     * \param side sensor index (0: left, 1: right)
+     * \param address register address
+     * \param value value to be written
+     */
+    void writeSensorRegister(int side, uint64_t address, uint8_t value);
+
+    /*!
+     * \brief Add the read of a sensor register
+     * \param side sensor index (0: left, 1: right)
+     * \param address register address
+     * \param value destination of the value read. It must be valid until the batch is applied
+     */
+    void readSensorRegister(int side, uint64_t address, uint8_t* value);
+
+    inline size_t size() const {return mAccesses.size();}   //!< Number of register accesses in the batch
+    inline void clear() {mAccesses.clear();}                //!< Remove all the register accesses
+
+private:
+    friend class VideoCapture;
+
+    struct Access
+    {
+        bool sensor = false;        //!< Sensor register if true, ISP register otherwise
+        bool read = false;          //!< Read access if true, write access otherwise
+        int side = 0;               //!< Sensor index, for sensor registers
+        uint64_t address = 0;       //!< Register address
+        uint8_t value = 0;          //!< Value to be written
+        uint8_t* dest = nullptr;    //!< Destination of the value read
+    };
+
+    std::vector<Access> mAccesses;  //!< The register accesses, in execution order
 };
 
 /*!
@@ -65,6 +194,8 @@ class SL_OC_EXPORT VideoCapture
 {
     ZED_OC_VERSION_ATTRIBUTE;
 
+    friend class FrameLease;
+
 public:
     /*!
      * \brief The default constructor
@@ -84,6 +215,77 @@ public:
      */
     bool initializeVideo( int devId=-1 );
 
+    /*!
+     * \brief Open the ZED camera with the specified serial number
+     * \param sn the serial number of the camera
+     * \return returns true if the camera is correctly opened
+     *
+     * \note The device is found immediately if its serial number is in the device cache, otherwise the ZED
+     *       cameras are probed until the right one is found. The serial number of a probed camera is checked right
+     *       after opening it: the other cameras are closed with no streaming and no control reset.
+     */
+    bool initializeVideoBySerial( int sn );
+
+    /*!
+     * \brief Get the serial number of a camera from the device cache, without opening it
+     * \param devId Id of the camera (see `/dev/video*`)
+     * \return the serial number, `-1` if not in the cache or if the cache entry is no longer valid
+     *
+     * \note The device cache (`~/.cache/zed-open-capture/devices`, or the file set by the `ZED_OC_DEVICE_CACHE`
+     *       environment variable) stores the serial number of each opened camera with the identity of its USB
+     *       device. An entry is valid while the camera is not unplugged and the system not rebooted.
+     */
+    static int lookupSerialNumber( int devId );
+
+    /*!
+     * \brief Get the device of a camera from the device cache, without opening it
+     * \param sn the serial number of the camera
+     * \return the Id of the device (see `/dev/video*`), `-1` if not in the cache or if the cache entry is no longer valid
+     */
+    static int lookupDeviceId( int sn );
+
+    /*!
+     * \brief Wait for the end of the camera controls reset started by \ref initializeVideo when
+     *        \ref VideoParams::async_control_reset is enabled
+     * \param timeout_msec maximum wait time in milliseconds
+     * \return true if the reset is completed
+     *
+     * \note A synchronous setter called before the end of the reset can be overwritten by the reset. The asynchronous
+     *       setters are always executed after it.
+     */
+    bool waitControlReset( uint64_t timeout_msec=1000 );
+
+    /*!
+     * \brief Get the duration of the phases of the last \ref initializeVideo
+     * \return the startup timing report
+     */
+    StartupReport getStartupReport();
+
+    /*!
+     * \brief Open a recording file instead of a camera: the recorded frames are published with their original
+     * timestamps through the same functions used to get the camera frames
+     * \param filename the recording file (see \ref RecordFileHeader)
+     * \param mode publish the frames at their original rate or as fast as possible (see \ref REPLAY_MODE)
+     * \param loop restart from the first frame when the end of the file is reached
+     * \return returns true if the file is correctly opened
+     *
+     * \note The camera settings are not available while replaying. \ref getSerialNumber returns the serial number
+     * of the recording camera.
+     */
+    bool initializeReplay( const std::string& filename, REPLAY_MODE mode=REPLAY_MODE::REALTIME, bool loop=false );
+
+    /*!
+     * \brief Indicates if the frames are read from a recording file
+     * \return true if replaying a recording file
+     */
+    inline bool isReplay(){return mReplay;}
+
+    /*!
+     * \brief Indicates that all the frames of the recording file have been published
+     * \return true if replaying a recording file without loop and its end has been reached
+     */
+    inline bool isReplayFinished(){return mReplayFinished;}
+
     /*!
      * \brief Get the last received camera image
      * \param timeout_msec frame grabbing timeout in millisecond.
@@ -94,9 +296,133 @@ public:
      *
      * \note Frame received will contains the RAW buffer from the camera, in YUV4:2:2 color format and in side by side mode.
      * Images must then be converted to RGB for proper display and will not be rectified.
+     *
+     * \note The returned frame is a copy shared by all the callers of \ref getLastFrame and \ref waitForFrameAfter:
+     * the copies are serialized, but the content is replaced by the next call of any consumer. With several
+     * consumers use \ref acquireFrame or \ref subscribe, which give each consumer its own reference on the frame.
      */
     const Frame& getLastFrame(uint64_t timeout_msec=100);
 
+    /*!
+     * \brief Wait for a camera image newer than the given one
+     * \param frame_id the id of the last frame already processed by the caller
+     * \param timeout_msec frame grabbing timeout in millisecond.
+     * \return returns a reference to the last received frame. Its `frame_id` is not greater than `frame_id` only if
+     * the timeout expired.
+     *
+     * \note Using the `frame_id` of the previous returned frame guarantees that the same frame is never processed twice,
+     * even if other consumers call \ref getLastFrame.
+     */
+    const Frame& waitForFrameAfter(uint64_t frame_id, uint64_t timeout_msec=100);
+
+    /*!
+     * \brief Get a lease on the last received camera image, with no data copy
+     * \param timeout_msec frame grabbing timeout in millisecond.
+     * \return returns a lease on the last received frame, invalid if no new frame has been received since the
+     * previous call before the timeout expired.
+     *
+     * \note The data of the leased frame is the mmap'd UVC buffer, in YUV4:2:2 color format and in side by side mode.
+     * The buffer is given back to the driver only when the lease is released.
+     */
+    FrameLease acquireFrame(uint64_t timeout_msec=100);
+
+    /*!
+     * \brief Release a frame lease obtained with \ref acquireFrame. Equivalent to `FrameLease::release`
+     * \param lease the lease to be released
+     */
+    inline void releaseFrame(FrameLease& lease){lease.release();}
+
+    /*!
+     * \brief Get a lease on the oldest frame stored in the capture ring, so that frames are consumed in grabbing order
+     * \param timeout_msec frame grabbing timeout in millisecond.
+     * \return returns a lease on the oldest frame of the ring, invalid if the ring is still empty when the timeout expires.
+     *
+     * \note The ring size and its behavior when full are set with \ref VideoParams::buffer_count and
+     * \ref VideoParams::frame_policy. Use \ref Frame::sequence to detect frames lost before reaching the ring.
+     * \note The first call enables the ring (see \ref enableCaptureRing): the frames grabbed before are not stored.
+     */
+    FrameLease acquireNextFrame(uint64_t timeout_msec=100);
+
+    /*!
+     * \brief Enable or disable the capture ring. The ring is disabled when the camera is opened and stores no frame,
+     * it is enabled by the first call to \ref acquireNextFrame
+     * \param enable true to store the grabbed frames from now on, e.g. before \ref initializeReplay so that no frame is
+     *        missed. false to release the stored frames, and to never block the grabbing thread with
+     *        \ref FRAME_POLICY::BLOCK_PRODUCER when \ref acquireNextFrame is no longer called
+     * \note The setting is kept when the camera is opened again
+     */
+    void enableCaptureRing(bool enable);
+
+    /*!
+     * \brief Get the number of frames discarded by the capture ring because it was full
+     * \return the number of discarded frames since the camera has been opened
+     */
+    uint64_t getRingDroppedFrames();
+
+    /*!
+     * \brief Get the statistics about the arrival period of the frames, measured by the grabbing thread
+     * \return the period statistics since the start of the capture (see \ref JitterStats)
+     *
+     * \note Use \ref VideoParams::rt_priority and \ref VideoParams::cpu_affinity_mask to reduce the jitter
+     */
+    inline JitterStats getJitterStats(){return mJitter.getStats();}
+
+    /*!
+     * \brief Get the telemetry of the grabbing thread: lost frames, re-queue failures and latency histograms
+     * \return the statistics since the start of the capture (see \ref CaptureStats)
+     *
+     * \note The statistics are updated with atomic counters only: the grabbing thread never waits for this function.
+     * The returned counters are not sampled all at the same instant.
+     */
+    CaptureStats getCaptureStats();
+
+    // ----> Frame subscriptions
+    /*!
+     * \brief Subscribe to the grabbed frames with a private queue, consumed with \ref popFrame
+     * \param queue_depth maximum number of frames waiting in the queue. When the queue is full the oldest frame is
+     * dropped.
+     * \return the subscription identifier, `-1` if `queue_depth` is zero
+     *
+     * \note Each subscriber receives a lease on every grabbed frame: the frames are shared, never copied. A queued
+     * frame keeps its UVC buffer busy, so \ref VideoParams::buffer_count must be larger than the deepest queue.
+     */
+    int subscribe(size_t queue_depth);
+
+    /*!
+     * \brief Subscribe to the grabbed frames with a callback, called by a thread dedicated to the subscriber
+     * \param callback function called for each grabbed frame. The lease can be copied to keep the frame.
+     * \param queue_depth maximum number of frames waiting for the callback. When the queue is full the oldest frame
+     * is dropped.
+     * \return the subscription identifier, `-1` if `queue_depth` is zero or the callback is empty
+     *
+     * \note A slow callback never delays the grabbing thread or the other subscribers.
+     */
+    int subscribe(std::function<void(const FrameLease&)> callback, size_t queue_depth=2);
+
+    /*!
+     * \brief Cancel a subscription and release its queued frames
+     * \param sub_id the subscription identifier
+     * \return false if the subscription does not exist
+     */
+    bool unsubscribe(int sub_id);
+
+    /*!
+     * \brief Get the oldest frame from the queue of a subscription created with \ref subscribe(size_t)
+     * \param sub_id the subscription identifier
+     * \param timeout_msec frame waiting timeout in millisecond.
+     * \return a lease on the frame, invalid if the queue is still empty when the timeout expires or if the
+     * subscription does not exist.
+     */
+    FrameLease popFrame(int sub_id, uint64_t timeout_msec=100);
+
+    /*!
+     * \brief Get the number of frames dropped from the queue of a subscription because it was full
+     * \param sub_id the subscription identifier
+     * \return the number of dropped frames, 0 if the subscription does not exist
+     */
+    uint64_t getSubscriberDroppedFrames(int sub_id);
+    // <---- Frame subscriptions
+
     /*!
      * \brief Get the size of the camera frame
      * \param width the frame width
@@ -104,6 +430,14 @@ public:
      */
     inline void getFrameSize( int& width, int& height ){width=mWidth;height=mHeight;}
 
+    inline int getVerbosity(){return mParams.verbose;}    //!< Verbosity level set by \ref VideoParams::verbose
+
+    /*!
+     * \brief Get the frame rate of the camera, or of the recording while replaying
+     * \return the frames per second
+     */
+    inline int getFPS(){return mFps;}
+
     // ----> Led Control
     /*!
      * \brief Set the status of the camera led
@@ -305,6 +639,26 @@ public:
      */
     bool getROIforAECAGC(CAM_SENS_POS side,uint16_t& x, uint16_t& y, uint16_t& w, uint16_t& h);
 
+    /*!
+     * \brief Apply a batch of register accesses with the fewest vendor control transfers
+     * \param batch the register accesses (see \ref RegisterBatch)
+     * \param stats if not null, filled with the number of transfers and the latency of the batch
+     * \return 0 if all the accesses succeeded, a negative value otherwise
+     *
+     * \note The control mutex is held for the whole batch: no other control request is executed in between.
+     */
+    int applyRegisterBatch(const RegisterBatch& batch, RegisterBatchStats* stats=nullptr);
+
+    /*!
+     * \brief Enable the burst transfers of \ref applyRegisterBatch. Disabled by default
+     * \param enable true to write contiguous ISP registers with a single transfer
+     *
+     * \note Experimental: the burst command is not validated on all the firmware versions. The last register of each
+     * burst is read back, and the registers are written one at a time if it does not have the expected value. The
+     * burst transfers are then disabled until enabled again.
+     */
+    void setRegisterBurst(bool enable);
+
     /*!
      * \brief Set the Gain value (disable Exposure and Gain control if active)
      * \param cam position of the camera sensor (see  CAM_SENS_POS)
@@ -315,7 +669,7 @@ public:
     /*!
      * \brief Get the current Gain value
      * \param cam position of the camera sensor (see  CAM_SENS_POS)
-     * \return the current Gain value
+     * \return the current Gain value, -1 if `cam` is not `LEFT` or `RIGHT`
      */
     int getGain(CAM_SENS_POS cam);
 
@@ -329,17 +683,82 @@ public:
     /*!
      * \brief Get the current Exposure value
      * \param cam position of the camera sensor (see  CAM_SENS_POS)
-     * \return the current Exposure value
+     * \return the current Exposure value, -1 if `cam` is not `LEFT` or `RIGHT`
      */
     int getExposure(CAM_SENS_POS cam);
+
+    /*!
+     * \brief Get the values of all the camera controls from the control cache, without any USB transfer
+     * \return the cached control values (see \ref ControlSnapshot)
+     *
+     * \note The cache is write-through: it is updated by the setters and filled by the getters. The controls driven
+     * by an active automatic mode are not cached and are reported as `-1`.
+     */
+    ControlSnapshot getControlSnapshot();
     // <---- Camera Settings control
 
+    // ----> Asynchronous camera settings control
+    // The requests are executed in order by a dedicated thread, so that the caller never waits for the USB
+    // control transfers. The returned future contains the result of the corresponding synchronous function.
+
+    /*!
+     * \brief Asynchronous version of \ref setLEDstatus
+     */
+    std::future<int> setLEDstatusAsync(bool status);
+
+    /*!
+     * \brief Asynchronous version of \ref setBrightness
+     */
+    std::future<void> setBrightnessAsync(int brightness);
+
+    /*!
+     * \brief Asynchronous version of \ref setWhiteBalance
+     */
+    std::future<void> setWhiteBalanceAsync(int wb);
+
+    /*!
+     * \brief Asynchronous version of \ref setGamma
+     */
+    std::future<void> setGammaAsync(int gamma);
+
+    /*!
+     * \brief Asynchronous version of \ref setAECAGC
+     */
+    std::future<int> setAECAGCAsync(bool active);
+
+    /*!
+     * \brief Asynchronous version of \ref setROIforAECAGC
+     */
+    std::future<bool> setROIforAECAGCAsync(CAM_SENS_POS side, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+
+    /*!
+     * \brief Asynchronous version of \ref resetROIforAECAGC
+     */
+    std::future<bool> resetROIforAECAGCAsync(CAM_SENS_POS side);
+
+    /*!
+     * \brief Asynchronous version of \ref setGain
+     */
+    std::future<void> setGainAsync(CAM_SENS_POS cam, int gain);
+
+    /*!
+     * \brief Asynchronous version of \ref setExposure
+     */
+    std::future<void> setExposureAsync(CAM_SENS_POS cam, int exposure);
+    // <---- Asynchronous camera settings control
+
     /*!
      * \brief Retrieve the serial number of the connected camera
      * \return the serial number of the connected camera
      */
     int getSerialNumber();
 
+    /*!
+     * \brief Retrieve the model of the connected camera, detected when the device is opened
+     * \return the camera model
+     */
+    inline SL_DEVICE getCameraModel(){return mCameraModel;}
+
     /*!
      * \brief Utils fct to set Color Bars on Image
      */
@@ -357,6 +776,17 @@ public:
      */
     inline int getDeviceId(){return mDevId;}
 
+    /*!
+     * \brief Get a file descriptor that becomes readable when a new frame is available, to add the camera to an
+     * application event loop (`poll`, `epoll`, `select`, ...)
+     * \return the file descriptor of an `eventfd` counter. Reading it returns the number of frames received since the
+     * previous read and resets the counter.
+     *
+     * \note The file descriptor is valid for the whole life of the VideoCapture object, also across
+     * \ref initializeVideo calls. It must not be closed by the application.
+     */
+    inline int getFd(){return mFrameEventFd;}
+
 #ifdef SENSOR_LOG_AVAILABLE
     /*!
      * \brief Start logging to file of AEG/AGC camera registers
@@ -401,9 +831,60 @@ public:
 
 private:
     void grabThreadFunc();  //!< The frame grabbing thread function
+    void replayThreadFunc();  //!< The recording file reading thread function
+    bool publishFrame(int idx, uint64_t frame_ts, uint32_t sequence, uint64_t dequeue_ts); //!< Make a filled buffer available to the consumers
+    void initBufferRefs();  //!< Initialize the buffer references and the capture ring for `mBufCount` buffers
+    void controlThreadFunc();  //!< The asynchronous control requests thread function
+
+    // ----> Frame subscriptions
+    struct Subscriber
+    {
+        int id = 0;                     //!< Subscription identifier
+        size_t depth = 1;               //!< Maximum number of queued frames
+        std::deque<FrameLease> queue;   //!< Frames not yet consumed
+        uint64_t dropped = 0;           //!< Number of frames dropped because the queue was full
+        bool stop = false;              //!< Indicates that the subscription has been cancelled
+        std::condition_variable cond;   //!< Signals a new frame or the cancellation
+        std::function<void(const FrameLease&)> callback; //!< Callback, if not a queue subscription
+        std::thread thread;             //!< Thread calling the callback
+    };
+
+    std::shared_ptr<Subscriber> getSubscriber(int sub_id); //!< Find a subscription. Requires `mSubMutex`
+    void subscriberThreadFunc(std::shared_ptr<Subscriber> sub); //!< Callback dispatching thread function
+    void publishToSubscribers(int idx, uint64_t gen, const Frame& frame); //!< Push a new frame to all the subscribers
+    void clearSubscriberQueues();       //!< Release the frames queued by all the subscribers
+    // <---- Frame subscriptions
+
+    template<typename R>
+    std::future<R> postControlRequest( std::function<R()> request ); //!< Queue a request for the control thread
+
+    // ----> Capture telemetry
+    struct AtomicHistogram
+    {
+        std::atomic<uint64_t> count[CAPTURE_HIST_BUCKETS]; //!< Number of values in each bucket
+        std::atomic<uint64_t> samples;  //!< Total number of values
+        std::atomic<uint64_t> sum_usec; //!< Sum of the values
+        std::atomic<uint64_t> max_usec; //!< Largest value
+
+        void add(uint64_t usec);        //!< Add a value. Single writer: the grabbing thread
+        void reset();                   //!< Clear the histogram
+        void copyTo(LatencyHistogram& hist) const; //!< Get a copy of the histogram
+    };
+
+    void resetCaptureStats();           //!< Clear the telemetry at the start of the capture
+    // <---- Capture telemetry
+
+    // ----> UVC buffer ownership
+    int queueBuffer(int idx);                           //!< Give a UVC buffer back to the driver
+    void retainBuffer(int idx, uint64_t gen);           //!< Add a reference to a dequeued UVC buffer
+    void releaseBuffer(int idx, uint64_t gen);          //!< Remove a reference, re-queue the buffer on the last one
+    // <---- UVC buffer ownership
 
     // ----> Low level functions
     int ll_VendorControl(uint8_t *buf, int len, int readMode, bool safe = false, bool force=false);
+    int ll_VendorQueryLen();                                                //!< Get the XU transfer length. Requires `mCtrlMutex`
+    int ll_VendorTransfer(uint8_t *buf, int len, int readMode, bool safe);  //!< Send an XU command. Requires `mCtrlMutex`
+    int ll_RegisterTransfer(int xuLen, const RegisterBatch::Access* acc, int count); //!< Execute a run of register accesses. Requires `mCtrlMutex`
     int ll_get_gpio_value(int gpio_number, uint8_t* value);
     int ll_set_gpio_value(int gpio_number, uint8_t value);
     int ll_set_gpio_direction(int gpio_number, int direction);
@@ -428,10 +909,15 @@ private:
     // <---- Low level functions
 
     // ----> Mid level functions
-    void setCameraControlSettings(int ctrl_id, int ctrl_val);
-    void resetCameraControlSettings(int ctrl_id);
+    int setCameraControlSettings(int ctrl_id, int ctrl_val);    // Returns 0 if the value has been applied
+    int resetCameraControlSettings(int ctrl_id);                // Returns the default value, -1 on error
     int getCameraControlSettings(int ctrl_id);
 
+    int getCachedControl(const int& entry);             // Read a control cache entry
+    void setCachedControl(int& entry, int value);       // Write a control cache entry
+    bool isSensorPosValid(CAM_SENS_POS cam);            // Check that `cam` is the left or the right sensor
+    int getCachedCameraControl(int& entry, int ctrl_id);  // Read a UVC control through the cache
+
     int setGammaPreset(int side, int value);
 
     int calcRawGainValue(int gain); // Convert "user gain" to "ISP gain"
@@ -439,14 +925,17 @@ private:
     // <---- Mid level functions
 
     // ----> Connection control functions
-    bool openCamera( uint8_t devId );                           //!< Open camera
+    bool openCamera( uint8_t devId, int sn=-1 );                //!< Open camera, only if its serial number is `sn` when positive
+    bool initializeDevice( int devId, int sn );                 //!< Open the camera, start the capture and reset the controls
     bool startCapture();                                        //!< Start video capture thread
     void reset();                                               //!< Reset camera connection
-    inline void stopCapture(){mStopCapture=true;}               //!< Stop video capture thread
+    void stopCapture();                                         //!< Stop video capture thread
     int input_set_framerate(int fps);                           //!< Set UVC framerate
     int xioctl(int fd, uint64_t IOCTL_X, void *arg);            //!< Send ioctl command
     void checkResFps();                                         //!< Check if the Framerate is correct for the selected resolution
     SL_DEVICE getCameraModel(std::string dev_name);     //!< Get the connected camera model
+    int readSerialNumber();                             //!< Read the serial number from the camera flash memory
+    void resetControls();                               //!< Switch the LED on and reset the camera controls to their default values
     // <---- Connection control functions
 
     typedef enum _date_time
@@ -477,7 +966,6 @@ private:
 
 private:
     // Flags
-    bool mNewFrame=false;               //!< Indicates if a new frame is available
     bool mInitialized=false;            //!< Inficates if the camera has been initialized
     bool mStopCapture=true;             //!< Indicates if the grabbing thread must be stopped
     bool mGrabRunning=false;            //!< Indicates if the grabbing thread is running
@@ -487,9 +975,21 @@ private:
     int mDevId = 0;                     //!< ID of the camera device
     std::string mDevName;               //!< The file descriptor path name (e.g. /dev/video0)
     int mFileDesc=-1;                   //!< The file descriptor handler
+    int mWakeFd=-1;                     //!< eventfd used to wake up the grabbing thread on shutdown
+    int mFrameEventFd=-1;               //!< eventfd signaled for each new frame (see getFd)
 
     std::mutex mBufMutex;               //!< Mutex for safe access to data buffer
-    std::mutex mComMutex;               //!< Mutex for safe access to UVC communication
+    std::mutex mLastFrameMutex;         //!< Mutex for safe access to `mLastFrame`, the copy shared by the `getLastFrame` callers
+    std::mutex mCtrlMutex;              //!< Mutex for safe access to UVC control transfers (not used by the streaming path)
+    bool mRegisterBurst = false;        //!< Burst register transfers enabled (see \ref setRegisterBurst). Requires `mCtrlMutex`
+
+    // ----> Asynchronous control requests
+    std::thread mCtrlThread;            //!< The thread executing the asynchronous control requests
+    std::mutex mCtrlQueueMutex;         //!< Mutex for safe access to the control request queue
+    std::condition_variable mCtrlQueueCond; //!< Signals a new control request to the control thread
+    std::deque<std::function<void()>> mCtrlQueue; //!< Pending control requests
+    bool mCtrlStop=false;               //!< Indicates if the control thread must be stopped
+    // <---- Asynchronous control requests
 
     int mWidth = 0;                     //!< Frame width
     int mHeight = 0;                    //!< Frame height
@@ -497,19 +997,82 @@ private:
     int mFps=0;                         //!< Frames per seconds
 
     SL_DEVICE mCameraModel = SL_DEVICE::NONE; //!< The camera model
-
-    Frame mLastFrame;                   //!< Last grabbed frame
-    uint8_t mBufCount = 2;              //!< UVC buffer count
+    int mSerialNumber = -1;             //!< Serial number of the opened camera, `-1` until known
+
+    // ----> Startup
+    StartupReport mStartup;             //!< Phase durations of the last `initializeVideo`
+    uint64_t mStartupT0 = 0;            //!< Steady timestamp of the call of `initializeVideo`
+    std::atomic<uint64_t> mStartupFirstFrame{0}; //!< Time to the first frame [usec], set by the grabbing thread
+    std::atomic<uint64_t> mStartupCtrlReset{0};  //!< Duration of the control reset [usec], set by the control thread
+    std::shared_future<void> mControlReset;   //!< Completion of the asynchronous control reset
+    // <---- Startup
+
+    Frame mLastFrame;                   //!< Last grabbed frame, copied from the UVC buffer by `getLastFrame`
+    Frame mLatestFrame;                 //!< Last published frame, pointing to its UVC buffer
+    int mLatestBufIdx = -1;             //!< Index of the UVC buffer holding the last published frame
+    uint64_t mLastLeaseId = 0;          //!< Id of the last frame returned by `acquireFrame`
+    uint64_t mStreamGen = 0;            //!< Streaming session counter, used to invalidate old leases
+    std::vector<int> mBufRefCount;      //!< Number of references on each dequeued UVC buffer
+    uint8_t mBufCount = 4;              //!< UVC buffer count (see VideoParams::buffer_count)
+
+    // ----> Capture ring
+    struct RingSlot
+    {
+        int buf_idx = -1;               //!< Index of the UVC buffer holding the frame
+        Frame frame;                    //!< The stored frame
+    };
+
+    std::vector<RingSlot> mRing;        //!< Circular buffer of the grabbed frames not yet consumed
+    size_t mRingHead = 0;               //!< Index of the oldest frame in the ring
+    size_t mRingCount = 0;              //!< Number of frames in the ring
+    std::atomic<uint64_t> mRingDropped{0}; //!< Number of frames discarded because the ring was full. Read with no lock
+    bool mRingEnabled = false;          //!< Indicates that the ring has a consumer (see \ref enableCaptureRing)
+    std::condition_variable mRingCond;  //!< Signals free space in the ring to a blocked grabbing thread
+    std::condition_variable mFrameCond; //!< Signals a new published frame to the waiting consumers
+    // <---- Capture ring
+
+    // ----> Frame subscriptions
+    std::vector<std::shared_ptr<Subscriber>> mSubscribers; //!< The active subscriptions
+    std::mutex mSubMutex;               //!< Mutex for safe access to the subscriptions. Taken before `mBufMutex`
+    int mLastSubId = 0;                 //!< Last subscription identifier
+    // <---- Frame subscriptions
     uint8_t mCurrentIndex = 0;          //!< The index of the currect UVC buffer
     struct UVCBuffer *mBuffers = nullptr;  //!< UVC buffers
 
     uint64_t mStartTs=0;                //!< Initial System Timestamp, to calculate differences [nsec]
     uint64_t mInitTs=0;                 //!< Initial Device Timestamp, to calculate differences [usec]
 
+    ControlSnapshot mCtrlCache;         //!< Write-through cache of the camera control values
+    std::mutex mCtrlCacheMutex;         //!< Mutex for safe access to the control cache
+
     int mGainSegMax=0;                  //!< Maximum value of the raw gain to be used for conversion
     int mExpoureRawMax;                 //!< Maximum value of the raw exposure to be used for conversion
 
     std::thread mGrabThread;            //!< The video grabbing thread
+    JitterMeter mJitter;                //!< Frame arrival period statistics
+
+    // ----> Capture telemetry
+    std::atomic<uint64_t> mStatFrames{0};           //!< Number of published frames
+    std::atomic<uint64_t> mStatIncomplete{0};       //!< Number of incomplete frames
+    std::atomic<uint64_t> mStatMissedSeq{0};        //!< Number of V4L2 sequence numbers never received
+    std::atomic<uint64_t> mStatRequeueFail{0};      //!< Number of failed VIDIOC_QBUF
+    AtomicHistogram mStatDqbuf;                     //!< VIDIOC_DQBUF duration
+    AtomicHistogram mStatPublish;                   //!< Dequeue to publish latency
+    AtomicHistogram mStatUvcLatency;                //!< UVC timestamp to dequeue latency
+    // <---- Capture telemetry
+    bool mBuffersLocked=false;          //!< Indicates if the frame buffers are locked in RAM
+
+    // ----> Replay
+    bool mReplay=false;                 //!< Indicates that the frames are read from a recording file
+    std::atomic<bool> mReplayFinished{false}; //!< Indicates that the end of the recording file has been reached
+    FILE* mReplayFile=nullptr;          //!< The recording file
+    REPLAY_MODE mReplayMode=REPLAY_MODE::REALTIME; //!< The replay pacing
+    bool mReplayLoop=false;             //!< Restart the replay at the end of the file
+    int mReplaySerial=-1;               //!< Serial number of the recording camera
+    std::mutex mReplayMutex;            //!< Mutex for safe access to the free replay buffers
+    std::condition_variable mReplayCond;//!< Signals a free replay buffer or the shutdown request
+    std::deque<int> mReplayFree;        //!< Buffers ready to be filled with the next frame of the file
+    // <---- Replay
 
     bool mFirstFrame=true;              //!< Used to initialize the timestamp start point
 
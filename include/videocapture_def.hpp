@@ -75,6 +75,16 @@ enum class CAM_SENS_POS {
     LAST = 3
 };
 
+/*!
+ * \brief Behavior of the capture ring when a new frame is grabbed and the ring is full
+ */
+enum class FRAME_POLICY {
+    KEEP_NEWEST,    //!< The oldest frame is dropped to store the new one (lowest latency)
+    KEEP_ALL,       //!< The new frame is dropped, the stored frames are kept until consumed (throughput). When replaying, the replay thread waits instead: no frame is lost
+    BLOCK_PRODUCER  //!< The grabbing thread waits for a frame to be consumed with \ref VideoCapture::acquireNextFrame. Frames are then lost by the driver.
+                    //!< Only while the ring is enabled (see \ref VideoCapture::enableCaptureRing): `getLastFrame` and `acquireFrame` alone never block the grabbing thread
+};
+
 /*!
  * \brief The camera configuration parameters
  */
@@ -87,13 +97,206 @@ typedef struct VideoParams
         res = RESOLUTION::HD2K;
         fps = FPS::FPS_15;
         verbose= sl_oc::VERBOSITY::ERROR;
+        buffer_count = 4;
+        frame_policy = FRAME_POLICY::KEEP_NEWEST;
+        rt_priority = 0;
+        cpu_affinity_mask = 0;
+        lock_buffers = false;
+        async_control_reset = false;
     }
 
     RESOLUTION res; //!< Camera resolution
     FPS fps;        //!< Frames per second
     int verbose;   //!< Verbose mode
+    int buffer_count; //!< Number of UVC buffers in the range [2,32], 4 by default. The capture ring stores up to `buffer_count-2` frames (min 1)
+    FRAME_POLICY frame_policy; //!< Behavior of the capture ring when it is full (see \ref FRAME_POLICY)
+    int rt_priority; //!< `SCHED_FIFO` priority [1,99] of the grabbing thread. `0` for the default scheduling
+    uint64_t cpu_affinity_mask; //!< CPUs allowed for the grabbing thread (bit `i` for CPU `i`). `0` for no restriction
+    bool lock_buffers; //!< Lock the frame buffers in RAM with `mlock` so that they are never paged out
+    bool async_control_reset; //!< Reset the camera controls in the control thread: \ref VideoCapture::initializeVideo returns without waiting for it
 } VideoParams;
 
+/*!
+ * \brief Pacing of the frames read from a recording file (see \ref VideoCapture::initializeReplay)
+ */
+enum class REPLAY_MODE {
+    REALTIME,   //!< Frames are published respecting the intervals of their original timestamps
+    FAST        //!< Frames are published as fast as they are read. Use \ref FRAME_POLICY::KEEP_ALL and \ref VideoCapture::acquireNextFrame to consume all of them
+};
+
+#pragma pack(push,1)
+/*!
+ * \brief Header of a frame recording file
+ *
+ * The header is followed by the frames, each one stored as a \ref RecordFrameHeader followed by `size` bytes of
+ * side-by-side YUV 4:2:2 data. The last frame is followed by an end marker (a \ref RecordFrameHeader with `size`
+ * equal to `0`), by the seek index (one \ref RecordIndexEntry per frame, sorted by timestamp) and by a
+ * \ref RecordIndexFooter. All the values are little endian.
+ *
+ * \note A file whose recording was interrupted has no end marker and no index: it can still be replayed and
+ *       \ref RecordingReader rebuilds its index by scanning the frames.
+ */
+struct RecordFileHeader
+{
+    char magic[8];          //!< File signature (see \ref RECORD_MAGIC)
+    uint32_t version;       //!< Format version (see \ref RECORD_VERSION)
+    uint16_t width;         //!< Frame width (both images side by side)
+    uint16_t height;        //!< Frame height
+    uint8_t channels;       //!< Number of channels per pixel
+    uint8_t fps;            //!< Frames per second of the recording
+    uint16_t reserved;      //!< Not used, set to 0
+    int32_t serial_number;  //!< Serial number of the recording camera, to retrieve its calibration
+};
+
+/*!
+ * \brief Header of each frame stored in a recording file
+ */
+struct RecordFrameHeader
+{
+    uint64_t timestamp;     //!< Original timestamp of the frame in nanoseconds
+    uint64_t frame_id;      //!< Original index of the frame
+    uint32_t sequence;      //!< Original V4L2 sequence number of the frame
+    uint32_t size;          //!< Size of the frame data in bytes. `0` marks the end of the frames
+};
+
+/*!
+ * \brief Entry of the seek index stored at the end of a recording file
+ */
+struct RecordIndexEntry
+{
+    uint64_t timestamp;     //!< Original timestamp of the frame in nanoseconds
+    uint64_t frame_id;      //!< Original index of the frame
+    uint64_t offset;        //!< Offset of the \ref RecordFrameHeader of the frame from the beginning of the file
+};
+
+/*!
+ * \brief Last bytes of a recording file, locating the seek index
+ */
+struct RecordIndexFooter
+{
+    uint64_t index_offset;  //!< Offset of the first \ref RecordIndexEntry from the beginning of the file
+    uint64_t frame_count;   //!< Number of entries of the index
+    char magic[8];          //!< Index signature (see \ref RECORD_INDEX_MAGIC)
+};
+#pragma pack(pop)
+
+static const char RECORD_MAGIC[8] = {'Z','E','D','O','C','R','E','C'};       //!< Signature of the recording files
+static const char RECORD_INDEX_MAGIC[8] = {'Z','E','D','O','C','I','D','X'}; //!< Signature of the seek index
+static const uint32_t RECORD_VERSION = 2;                                     //!< Version of the recording file format
+
+/*!
+ * \brief Number of buckets of the capture latency histograms
+ */
+static const int CAPTURE_HIST_BUCKETS = 24;
+
+/*!
+ * \brief Histogram of latencies with logarithmic buckets: bucket `i` counts the values in [2^i, 2^(i+1)) microseconds,
+ * bucket 0 also counts the values smaller than 1 microsecond
+ */
+struct LatencyHistogram
+{
+    uint64_t count[CAPTURE_HIST_BUCKETS] = {0}; //!< Number of values in each bucket
+    uint64_t samples = 0;           //!< Total number of values
+    uint64_t sum_usec = 0;          //!< Sum of the values, to calculate the mean
+    uint64_t max_usec = 0;          //!< Largest value
+
+    /*!
+     * \brief Get the average value
+     * \return the average value in microseconds
+     */
+    inline double mean_usec() const {return samples?static_cast<double>(sum_usec)/samples:0.0;}
+
+    /*!
+     * \brief Add a value to the histogram
+     * \param usec the value in microseconds
+     */
+    inline void add(uint64_t usec)
+    {
+        int bucket = 0;
+        if(usec>1)
+        {
+            bucket = 63 - __builtin_clzll(usec);
+            if(bucket>=CAPTURE_HIST_BUCKETS)
+                bucket = CAPTURE_HIST_BUCKETS-1;
+        }
+        count[bucket]++;
+        samples++;
+        sum_usec += usec;
+        if(usec>max_usec)
+            max_usec = usec;
+    }
+
+    /*!
+     * \brief Get an upper bound of a percentile, at the resolution of the buckets
+     * \param p the percentile in the range [0,100]
+     * \return the upper limit of the bucket containing the percentile in microseconds
+     */
+    inline uint64_t percentile_usec(double p) const
+    {
+        uint64_t target = static_cast<uint64_t>(std::ceil(samples*p/100.0));
+        uint64_t acc = 0;
+        for(int i=0; i<CAPTURE_HIST_BUCKETS; i++)
+        {
+            acc += count[i];
+            if(acc>=target && acc>0)
+                return (i==CAPTURE_HIST_BUCKETS-1)?max_usec:(2ULL<<i);
+        }
+        return max_usec;
+    }
+};
+
+/*!
+ * \brief Telemetry of the grabbing thread (see \ref VideoCapture::getCaptureStats)
+ */
+struct CaptureStats
+{
+    uint64_t frames = 0;            //!< Number of published frames
+    uint64_t incomplete_frames = 0; //!< Number of frames discarded because not completely received
+    uint64_t missed_sequences = 0;  //!< Number of frames lost by the driver, from the gaps in the V4L2 sequence numbers
+    uint64_t requeue_failures = 0;  //!< Number of failed `VIDIOC_QBUF`: the buffer is lost for the capture
+    uint64_t ring_dropped = 0;      //!< Number of frames discarded because the capture ring was full
+
+    LatencyHistogram dqbuf_duration;        //!< Duration of the `VIDIOC_DQBUF` call
+    LatencyHistogram dequeue_to_publish;    //!< Time from the end of `VIDIOC_DQBUF` to the notification of the consumers
+    LatencyHistogram uvc_to_wall;           //!< Time from the UVC buffer timestamp to the end of `VIDIOC_DQBUF`
+};
+
+/*!
+ * \brief Duration of the phases of \ref VideoCapture::initializeVideo (see \ref VideoCapture::getStartupReport)
+ */
+struct StartupReport
+{
+    uint64_t discovery_usec = 0;    //!< Search of the camera: device cache lookup and probing of the `/dev/video*` devices
+    uint64_t serial_usec = 0;       //!< Retrieval of the serial number
+    uint64_t setup_usec = 0;        //!< Format, frame rate and buffers setup
+    uint64_t stream_start_usec = 0; //!< Start of the streaming and of the grabbing thread
+    uint64_t control_reset_usec = 0;//!< Reset of the camera controls. `0` while not completed
+    uint64_t first_frame_usec = 0;  //!< From the call of \ref VideoCapture::initializeVideo to the first frame. `0` while not received
+    bool serial_cached = false;     //!< The serial number was found in the device cache, with no USB transfer
+};
+
+/*!
+ * \brief Values of the camera controls, as known by the control cache of VideoCapture
+ *
+ * A value of `-1` indicates that the value is not known without querying the camera: it has never been set or read,
+ * or it is driven by an automatic mode (white balance with automatic white balance, gain and exposure with AEC/AGC).
+ */
+struct ControlSnapshot
+{
+    int brightness = -1;            //!< Brightness [0,8]
+    int sharpness = -1;             //!< Sharpness [0,8]
+    int contrast = -1;              //!< Contrast [0,8]
+    int hue = -1;                   //!< Hue [0,11]
+    int saturation = -1;            //!< Saturation [0,8]
+    int gamma = -1;                 //!< Gamma [1,9]
+    int white_balance = -1;         //!< White balance [2800,6500]
+    int auto_white_balance = -1;    //!< Automatic white balance status (0: off, 1: on)
+    int aec_agc = -1;               //!< Automatic Exposure and Gain control status (0: off, 1: on)
+    int gain[2] = {-1,-1};          //!< Gain [0,100] of the left and right sensors
+    int exposure[2] = {-1,-1};      //!< Exposure [0,100] of the left and right sensors
+    int led = -1;                   //!< LED status (0: off, 1: on)
+};
+
 /*!
  * \brief Resolution in pixel for each frame
  */
@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+
+#include "bandworkers.hpp"
+
+#include <algorithm>          // for std::min, std::max
+
+namespace sl_oc {
+
+namespace video {
+
+bool cpuSupportsAvx2()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+BandWorkers::~BandWorkers()
+{
+    stopWorkers();
+}
+
+void BandWorkers::setThreads(int threads)
+{
+    if( threads<=0 )
+        threads = std::min(4, std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+
+    stopWorkers();
+
+    // No job for the new workers until the next `run`
+    mThreads = threads;
+    mJobPosted = 0;
+    mStop = false;
+    for(int band=1; band<mThreads; band++)
+        mWorkers.emplace_back( &BandWorkers::workerFunc, this, band );
+}
+
+void BandWorkers::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mJobMutex);
+        mStop = true;
+    }
+    mJobCond.notify_all();
+
+    for(std::thread& t : mWorkers)
+        t.join();
+    mWorkers.clear();
+}
+
+void BandWorkers::runJob(int rows, Job job, void* ctx)
+{
+    int bands = std::max(1, std::min(mThreads, rows));
+    if( bands==1 )
+    {
+        job(ctx, 0, 0, rows);
+        return;
+    }
+
+    // ----> The other bands to the workers, the first one in the calling thread
+    {
+        std::lock_guard<std::mutex> lock(mJobMutex);
+        mJob = job;
+        mCtx = ctx;
+        mRows = rows;
+        mBands = bands;
+        mPending = static_cast<int>(mWorkers.size());
+        mJobPosted++;
+    }
+    mJobCond.notify_all();
+
+    job(ctx, 0, 0, rows/bands);
+
+    std::unique_lock<std::mutex> lock(mJobMutex);
+    mJobCond.wait( lock, [this]{return mPending==0;} );
+    // <---- The other bands to the workers, the first one in the calling thread
+}
+
+void BandWorkers::workerFunc(int band)
+{
+    uint64_t done = 0; // Jobs seen by this worker
+
+    for(;;)
+    {
+        Job job;
+        void* ctx;
+        int rows, bands;
+        {
+            std::unique_lock<std::mutex> lock(mJobMutex);
+            mJobCond.wait( lock, [this,done]{return mStop || mJobPosted!=done;} );
+            if(mStop)
+                return;
+
+            done = mJobPosted;
+            job = mJob;
+            ctx = mCtx;
+            rows = mRows;
+            bands = mBands;
+        }
+
+        // Fewer bands than threads when the image has fewer rows than threads
+        if( band<bands )
+            job(ctx, band, rows*band/bands, rows*(band+1)/bands);
+
+        {
+            std::lock_guard<std::mutex> lock(mJobMutex);
+            mPending--;
+        }
+        mJobCond.notify_all();
+    }
+}
+
+}
+
+}
@@ -0,0 +1,906 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+// Benchmark of the stages of the detectball pipeline, with no camera.
+//
+// Each stage runs on synthetic frames (textured stereo pair with a ball) or on
+// the frames of a recording file, at the requested resolutions, with the
+// cv::Mat and the cv::UMat (USE_OCV_TAPI) images. For each stage the
+// percentiles of the duration, the throughput, the heap allocations and the
+// reallocations of the output images are reported, as a table on the standard
+// output and optionally as CSV and JSON files to be compared across versions.
+//
+// The stereo engines (SGBM, BM, census) are then compared on a synthetic gray
+// pair with a known disparity, at the size processed by detectball: duration,
+// valid pixels, pixels with an error above 1 disparity and mean absolute error.
+//
+// Usage: camballtoe_bench [options]
+//   --res VGA,HD720,HD1080,HD2K  resolutions to test (default: all)
+//   --backend mat|umat|both      image type (default: both)
+//   --frames N                   measured frames per run (default: 100)
+//   --warmup N                   unmeasured frames before each run (default: 5)
+//   --record FILE                frames of a recording instead of synthetic
+//   --calib FILE                 calibration file instead of synthetic maps
+//   --engines sgbm,bm,census     stereo engines to compare (default: all)
+//   --no-simd                    scalar kernels for the gray rectification,
+//                                the census matcher and the depth conversion
+//   --csv FILE                   write the results as CSV
+//   --json FILE                  write the results as JSON
+
+// ----> Includes
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "depthconverter.hpp"
+#include "framerecorder.hpp"
+#include "stereorectifier.hpp"
+#include "videocapture.hpp"
+
+// OpenCV includes
+#include <opencv2/opencv.hpp>
+
+// Sample includes
+#include "calibration.hpp"
+#include "stereo.hpp"
+#include "stopwatch.hpp"
+// <---- Includes
+
+// ----> Heap allocation counter
+// Every `new` of the process is counted: std containers and OpenCV objects.
+// The pixel buffers of OpenCV use `cv::fastMalloc` and are tracked as output
+// reallocations instead (see `Stage::buffers`)
+static std::atomic<uint64_t> g_heap_allocs{0};
+
+void *operator new(std::size_t size) {
+  g_heap_allocs++;
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+// <---- Heap allocation counter
+
+namespace {
+
+// Size of a single image of the side-by-side frame
+struct BenchResolution {
+  std::string name;
+  int width;
+  int height;
+};
+
+const BenchResolution RESOLUTIONS[] = {{"VGA", 672, 376},
+                                       {"HD720", 1280, 720},
+                                       {"HD1080", 1920, 1080},
+                                       {"HD2K", 2208, 1242}};
+
+// Measures of one stage in one run
+struct StageResult {
+  std::string resolution;
+  std::string backend;
+  std::string stage;
+  int width = 0;
+  int height = 0;
+  std::vector<double> usec;  // Duration of each measured frame
+  uint64_t heap_allocs = 0;  // `new` calls during the measured frames
+  uint64_t reallocs = 0;     // Output images reallocated after the warmup
+
+  double percentile(double p) const {
+    if (usec.empty())
+      return 0.0;
+    std::vector<double> sorted = usec;
+    std::sort(sorted.begin(), sorted.end());
+    size_t idx = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, idx > 0 ? idx - 1 : 0)];
+  }
+  double mean() const {
+    double sum = 0;
+    for (double v : usec)
+      sum += v;
+    return usec.empty() ? 0.0 : sum / usec.size();
+  }
+  double fps() const { return mean() > 0 ? 1e6 / mean() : 0.0; }
+  double mpix_s() const { return fps() * width * height * 2 / 1e6; }
+  double allocs_per_frame() const {
+    return usec.empty() ? 0.0 : static_cast<double>(heap_allocs) / usec.size();
+  }
+};
+
+// Measures of one stereo engine on the synthetic pair with ground truth
+struct MatcherResult {
+  StageResult timing;       // `stage` is the engine
+  std::string name;         // Name given by the matcher
+  double valid_pct = 0.0;   // Pixels with a valid disparity
+  double bad1_pct = 0.0;    // Valid pixels with an error above 1 disparity
+  double mae = 0.0;         // Mean absolute error of the valid pixels
+};
+
+// One stage of the pipeline: `run` processes the current frame, `buffers`
+// returns the identity of the output images to detect their reallocations
+struct Stage {
+  std::string name;
+  std::function<void()> run;
+  std::function<std::vector<const void *>()> buffers;
+};
+
+inline const void *bufferId(const cv::Mat &m) { return m.data; }
+inline const void *bufferId(const cv::UMat &m) { return m.u; }
+
+inline cv::Mat readable(const cv::Mat &m) { return m; }
+inline cv::Mat readable(const cv::UMat &m) {
+  return m.getMat(cv::ACCESS_READ);
+}
+
+// The frame data as image, as done by detectball
+inline void wrapFrame(const cv::Mat &yuv, cv::Mat &frame) { frame = yuv; }
+inline void wrapFrame(const cv::Mat &yuv, cv::UMat &frame) {
+  frame = yuv.getUMat(cv::ACCESS_READ, cv::USAGE_ALLOCATE_HOST_MEMORY);
+}
+
+inline const char *backendName(const cv::Mat &) { return "Mat"; }
+inline const char *backendName(const cv::UMat &) { return "UMat"; }
+
+// ----> Synthetic input
+// BT.601 conversion of a BGR image to YUV 4:2:2 (Y0 U Y1 V)
+void bgrToYuyv(const cv::Mat &bgr, uint8_t *dst) {
+  for (int r = 0; r < bgr.rows; r++) {
+    const cv::Vec3b *row = bgr.ptr<cv::Vec3b>(r);
+    for (int c = 0; c < bgr.cols; c += 2) {
+      int yy[2], u = 0, v = 0;
+      for (int k = 0; k < 2; k++) {
+        double b = row[c + k][0], g = row[c + k][1], rr = row[c + k][2];
+        double y = 0.299 * rr + 0.587 * g + 0.114 * b;
+        yy[k] = cv::saturate_cast<uint8_t>(16 + y * 219.0 / 255.0);
+        u += cv::saturate_cast<uint8_t>(128 + (b - y) * 0.564 * 224.0 / 255.0);
+        v += cv::saturate_cast<uint8_t>(128 + (rr - y) * 0.713 * 224.0 / 255.0);
+      }
+      *dst++ = static_cast<uint8_t>(yy[0]);
+      *dst++ = static_cast<uint8_t>(u / 2);
+      *dst++ = static_cast<uint8_t>(yy[1]);
+      *dst++ = static_cast<uint8_t>(v / 2);
+    }
+  }
+}
+
+// Side-by-side frames of a textured wall with a bright ball, seen with a
+// disparity of 1/20 of the width. The ball moves from frame to frame
+std::vector<std::vector<uint8_t>> syntheticFrames(int width, int height,
+                                                  int count) {
+  cv::Mat texture(height, width + width / 10, CV_8UC3);
+  cv::RNG rng(1234);
+  rng.fill(texture, cv::RNG::UNIFORM, 40, 200);
+  cv::GaussianBlur(texture, texture, cv::Size(5, 5), 1.5);
+
+  int disparity = width / 20;
+  std::vector<std::vector<uint8_t>> frames;
+  for (int i = 0; i < count; i++) {
+    cv::Mat sbs(height, 2 * width, CV_8UC3);
+    texture(cv::Rect(disparity, 0, width, height))
+        .copyTo(sbs(cv::Rect(0, 0, width, height)));
+    texture(cv::Rect(0, 0, width, height))
+        .copyTo(sbs(cv::Rect(width, 0, width, height)));
+
+    int radius = height / 12;
+    cv::Point center(width / 4 + i * width / (2 * count), height / 2);
+    cv::circle(sbs, center, radius, cv::Scalar(250, 250, 250), cv::FILLED);
+    cv::circle(sbs, center + cv::Point(width - disparity, 0), radius,
+               cv::Scalar(250, 250, 250), cv::FILLED);
+
+    std::vector<uint8_t> yuyv(static_cast<size_t>(width) * 2 * height * 2);
+    bgrToYuyv(sbs, yuyv.data());
+    frames.push_back(std::move(yuyv));
+  }
+  return frames;
+}
+
+// Rectified gray pair at the matcher size: a textured wall at a constant
+// disparity and a textured ball in front of it. `gt` is the disparity of each
+// left pixel, 0 where the pixel is occluded in the right image
+void syntheticGrayPair(int width, int height, int numDisparities,
+                       cv::Mat &left, cv::Mat &right, cv::Mat &gt) {
+  int d_wall = std::max(1, width / 20);
+  int d_ball = std::max(d_wall + 1, std::min(numDisparities - 8, 3 * d_wall));
+
+  cv::RNG rng(4321);
+  cv::Mat wall(height, width + d_wall, CV_8UC1);
+  cv::Mat ball(height, width + d_ball, CV_8UC1);
+  rng.fill(wall, cv::RNG::UNIFORM, 40, 200);
+  rng.fill(ball, cv::RNG::UNIFORM, 100, 255);
+  cv::GaussianBlur(wall, wall, cv::Size(5, 5), 1.5);
+  cv::GaussianBlur(ball, ball, cv::Size(5, 5), 1.5);
+
+  // A scene point at `x` in the left image is at `x-d` in the right image
+  left = wall(cv::Rect(d_wall, 0, width, height)).clone();
+  right = wall(cv::Rect(0, 0, width, height)).clone();
+  gt = cv::Mat(height, width, CV_32FC1, cv::Scalar(d_wall));
+
+  int radius = height / 6;
+  cv::Point center(width / 2, height / 2);
+  cv::Mat disc_left = cv::Mat::zeros(height, width, CV_8UC1);
+  cv::Mat disc_right = cv::Mat::zeros(height, width, CV_8UC1);
+  cv::circle(disc_left, center, radius, cv::Scalar(255), cv::FILLED);
+  cv::circle(disc_right, center - cv::Point(d_ball, 0), radius, cv::Scalar(255),
+             cv::FILLED);
+  ball(cv::Rect(d_ball, 0, width, height)).copyTo(left, disc_left);
+  ball(cv::Rect(0, 0, width, height)).copyTo(right, disc_right);
+  gt.setTo(cv::Scalar(d_ball), disc_left);
+
+  // ----> Wall pixels hidden by the ball in the right image
+  for (int y = 0; y < height; y++) {
+    for (int x = d_wall; x < width; x++) {
+      if (!disc_left.at<uint8_t>(y, x) && disc_right.at<uint8_t>(y, x - d_wall))
+        gt.at<float>(y, x) = 0.f;
+    }
+  }
+  // <---- Wall pixels hidden by the ball in the right image
+}
+
+// Rectification maps of a camera with a typical wide angle distortion and a
+// small misalignment of the two sensors
+void syntheticMaps(int width, int height, cv::Mat maps[4], cv::Mat &P) {
+  double f = 0.8 * width;
+  cv::Mat K = (cv::Mat_<double>(3, 3) << f, 0, width / 2.0, 0, f,
+               height / 2.0, 0, 0, 1);
+  cv::Mat D = (cv::Mat_<double>(1, 5) << -0.17, 0.03, 0, 0, 0);
+  for (int side = 0; side < 2; side++) {
+    cv::Mat R;
+    double s = side == 0 ? 1.0 : -1.0;
+    cv::Rodrigues(cv::Vec3d(0.002 * s, -0.003 * s, 0.001 * s), R);
+    cv::Mat map_x, map_y;
+    cv::initUndistortRectifyMap(K, D, R, K, cv::Size(width, height), CV_32FC1,
+                                map_x, map_y);
+    cv::convertMaps(map_x, map_y, maps[2 * side], maps[2 * side + 1],
+                    CV_16SC2);
+  }
+  P = cv::Mat::zeros(3, 4, CV_64F);
+  K.copyTo(P(cv::Rect(0, 0, 3, 3)));
+}
+// <---- Synthetic input
+
+// Benchmark options
+struct BenchOptions {
+  std::vector<BenchResolution> resolutions;
+  bool mat = true;
+  bool umat = true;
+  int frames = 100;
+  int warmup = 5;
+  std::string record_file;
+  std::string calib_file;
+  bool simd = true;
+  std::vector<sl_oc::tools::STEREO_ENGINE> engines;
+  std::string csv_file;
+  std::string json_file;
+};
+
+// Run the detectball stages on the frames with the image type `M`
+template <class M>
+void runPipeline(const BenchOptions &opt, const BenchResolution &res,
+                 const std::vector<const uint8_t *> &frames, cv::Mat maps[4],
+                 const cv::Mat &P, std::vector<StageResult> &results) {
+  const int w = res.width;
+  const int h = res.height;
+  const bool is_umat = std::is_same<M, cv::UMat>::value;
+
+  // ----> Images, as declared by detectball
+  M frameYUV, frameBGR, left_raw, right_raw, left_rect, right_rect;
+  M left_for_matcher, right_for_matcher, left_disp_half;
+  cv::Mat left_depth_map, left_disp_image;
+  M map_lx, map_ly, map_rx, map_ry;
+  maps[0].copyTo(map_lx);
+  maps[1].copyTo(map_ly);
+  maps[2].copyTo(map_rx);
+  maps[3].copyTo(map_ry);
+  cv::Mat left_bin, left_blurred, cloudMat;
+  std::vector<cv::Vec3f> left_circles;
+  const uint8_t *frame_data = nullptr;
+  // <---- Images, as declared by detectball
+
+  // ----> Gray rectification of the library
+  sl_oc::video::RectifyMap map_left, map_right;
+  map_left.xy = maps[0].ptr<int16_t>();
+  map_left.frac = maps[1].ptr<uint16_t>();
+  map_right.xy = maps[2].ptr<int16_t>();
+  map_right.frac = maps[3].ptr<uint16_t>();
+  sl_oc::video::StereoRectifier gray_rectifier(
+      sl_oc::video::RECTIFY_FORMAT::GRAY);
+  gray_rectifier.setSimd(opt.simd);
+  gray_rectifier.setMaps(w, h, map_left, map_right);
+  cv::Mat left_gray(h, w, CV_8UC1,
+                    const_cast<uint8_t *>(gray_rectifier.getLeft()));
+  cv::Mat right_gray(h, w, CV_8UC1,
+                     const_cast<uint8_t *>(gray_rectifier.getRight()));
+  // <---- Gray rectification of the library
+
+  // ----> Stereo matcher, default parameters
+  sl_oc::tools::StereoSgbmPar stereoPar;
+  cv::Ptr<sl_oc::tools::IStereoMatcher> left_matcher =
+      sl_oc::tools::createStereoMatcher(stereoPar);
+  const double resize_fact = 0.5;
+  const double fx = P.at<double>(0, 0);
+  const double fy = P.at<double>(1, 1);
+  const double cx = P.at<double>(0, 2);
+  const double cy = P.at<double>(1, 2);
+  const double baseline = 120.0;
+  // <---- Stereo matcher, default parameters
+
+  // ----> Disparity to depth conversion, as detectball
+  cv::Mat disp_ramp(1, 256, CV_8UC1), disp_palette;
+  for (int i = 0; i < 256; i++)
+    disp_ramp.at<uint8_t>(0, i) = static_cast<uint8_t>(i);
+  cv::applyColorMap(disp_ramp, disp_palette, cv::COLORMAP_INFERNO);
+
+  const int disp_scale = cvRound(1. / resize_fact);
+  sl_oc::video::DepthConverter depth_converter;
+  depth_converter.setSimd(opt.simd);
+  depth_converter.setParams(static_cast<float>(fx * baseline), disp_scale);
+  depth_converter.setColorMap(
+      disp_palette.ptr<uint8_t>(),
+      static_cast<float>(stereoPar.minDisparity - 1),
+      static_cast<float>(stereoPar.minDisparity - 1 +
+                         stereoPar.numDisparities));
+  // <---- Disparity to depth conversion, as detectball
+
+  // ----> Stages, in the order of detectball
+  std::vector<Stage> stages;
+  stages.push_back(
+      {"yuyv_to_bgr",
+       [&] {
+         cv::Mat yuv(h, 2 * w, CV_8UC2, const_cast<uint8_t *>(frame_data));
+         wrapFrame(yuv, frameYUV);
+         cv::cvtColor(frameYUV, frameBGR, cv::COLOR_YUV2BGR_YUYV);
+       },
+       [&] {
+         return std::vector<const void *>{bufferId(frameBGR)};
+       }});
+  stages.push_back({"remap_bgr",
+                    [&] {
+                      left_raw = frameBGR(cv::Rect(0, 0, w, h));
+                      right_raw = frameBGR(cv::Rect(w, 0, w, h));
+                      cv::remap(left_raw, left_rect, map_lx, map_ly,
+                                cv::INTER_AREA);
+                      cv::remap(right_raw, right_rect, map_rx, map_ry,
+                                cv::INTER_AREA);
+                    },
+                    [&] {
+                      return std::vector<const void *>{bufferId(left_rect),
+                                                       bufferId(right_rect)};
+                    }});
+  stages.push_back({"rectify_gray",
+                    [&] { gray_rectifier.rectify(frame_data, 2 * w, h); },
+                    [&] {
+                      return std::vector<const void *>{
+                          gray_rectifier.getLeft(), gray_rectifier.getRight()};
+                    }});
+  stages.push_back(
+      {"resize",
+       [&] {
+         cv::resize(left_gray, left_for_matcher, cv::Size(), resize_fact,
+                    resize_fact, cv::INTER_AREA);
+         cv::resize(right_gray, right_for_matcher, cv::Size(), resize_fact,
+                    resize_fact, cv::INTER_AREA);
+       },
+       [&] {
+         return std::vector<const void *>{bufferId(left_for_matcher),
+                                          bufferId(right_for_matcher)};
+       }});
+  stages.push_back({"sgbm",
+                    [&] {
+                      left_matcher->compute(left_for_matcher,
+                                            right_for_matcher, left_disp_half);
+                    },
+                    [&] {
+                      return std::vector<const void *>{
+                          bufferId(left_disp_half)};
+                    }});
+  stages.push_back(
+      {"depth_convert",
+       [&] {
+         cv::Mat disp_raw = readable(left_disp_half);
+         cv::Size full_size(disp_raw.cols * disp_scale,
+                            disp_raw.rows * disp_scale);
+         left_depth_map.create(full_size, CV_32FC1);
+         left_disp_image.create(full_size, CV_8UC3);
+
+         sl_oc::video::DepthOutput out;
+         out.depth = left_depth_map.ptr<float>();
+         out.depth_stride = left_depth_map.step1();
+         out.color = left_disp_image.ptr<uint8_t>();
+         out.color_stride = left_disp_image.step;
+         depth_converter.convert(disp_raw.ptr<int16_t>(), disp_raw.cols,
+                                 disp_raw.rows, disp_raw.step1(),
+                                 left_matcher->getMinDisparity(), out);
+       },
+       [&] {
+         return std::vector<const void *>{bufferId(left_depth_map),
+                                          bufferId(left_disp_image)};
+       }});
+  stages.push_back({"threshold",
+                    [&] {
+                      cv::threshold(left_gray, left_bin, 50, 255,
+                                    cv::THRESH_BINARY);
+                    },
+                    [&] {
+                      return std::vector<const void *>{bufferId(left_bin)};
+                    }});
+  stages.push_back({"blur",
+                    [&] {
+                      cv::GaussianBlur(left_bin, left_blurred, cv::Size(9, 9),
+                                       2, 2);
+                    },
+                    [&] {
+                      return std::vector<const void *>{
+                          bufferId(left_blurred)};
+                    }});
+  stages.push_back({"hough_circles",
+                    [&] {
+                      cv::HoughCircles(left_blurred, left_circles,
+                                       cv::HOUGH_GRADIENT, 1,
+                                       left_blurred.rows / 8, 100, 35, 0, 0);
+                    },
+                    [&] { return std::vector<const void *>(); }});
+  stages.push_back(
+      {"point_cloud",
+       [&] {
+         const cv::Mat &depth_map_cpu = left_depth_map;
+         size_t buf_size = depth_map_cpu.total();
+         std::vector<cv::Vec3d> buffer(
+             buf_size,
+             cv::Vec3f::all(std::numeric_limits<float>::quiet_NaN()));
+         const float *depth_vec =
+             reinterpret_cast<const float *>(depth_map_cpu.data);
+#pragma omp parallel for
+         for (size_t idx = 0; idx < buf_size; idx++) {
+           size_t r = idx / depth_map_cpu.cols;
+           size_t c = idx % depth_map_cpu.cols;
+           double depth = static_cast<double>(depth_vec[idx]);
+           if (!std::isinf(depth) && depth > stereoPar.minDepth_mm &&
+               depth < stereoPar.maxDepth_mm) {
+             buffer[idx].val[2] = depth;
+             buffer[idx].val[0] = (c - cx) * depth / fx;
+             buffer[idx].val[1] = (r - cy) * depth / fy;
+           }
+         }
+         cloudMat = cv::Mat(depth_map_cpu.rows, depth_map_cpu.cols, CV_64FC3,
+                            &buffer[0])
+                        .clone();
+       },
+       [&] { return std::vector<const void *>{bufferId(cloudMat)}; }});
+  // <---- Stages, in the order of detectball
+
+  size_t first = results.size();
+  for (const Stage &stage : stages) {
+    StageResult r;
+    r.resolution = res.name;
+    r.backend = backendName(M());
+    r.stage = stage.name;
+    r.width = w;
+    r.height = h;
+    r.usec.reserve(opt.frames);
+    results.push_back(std::move(r));
+  }
+
+  std::vector<std::vector<const void *>> ids(stages.size());
+  for (int f = 0; f < opt.warmup + opt.frames; f++) {
+    frame_data = frames[f % frames.size()];
+    bool measured = f >= opt.warmup;
+
+    for (size_t s = 0; s < stages.size(); s++) {
+      uint64_t allocs = g_heap_allocs;
+      sl_oc::tools::StopWatch clock;
+      stages[s].run();
+      if (is_umat)
+        cv::ocl::finish(); // The OpenCL kernels are asynchronous
+      double usec = clock.toc() * 1e6;
+      uint64_t stage_allocs = g_heap_allocs - allocs;
+
+      std::vector<const void *> cur = stages[s].buffers();
+      StageResult &r = results[first + s];
+      if (measured) {
+        r.usec.push_back(usec);
+        r.heap_allocs += stage_allocs;
+        if (cur != ids[s])
+          r.reallocs++;
+      }
+      ids[s] = cur;
+    }
+  }
+}
+
+// Compare the stereo engines on the synthetic pair, at the size processed by
+// detectball (half resolution)
+void runMatchers(const BenchOptions &opt, const BenchResolution &res,
+                 std::vector<MatcherResult> &results) {
+  sl_oc::tools::StereoSgbmPar stereoPar;
+  const int w = res.width / 2;
+  const int h = res.height / 2;
+
+  cv::Mat left, right, gt, disparity;
+  syntheticGrayPair(w, h, stereoPar.numDisparities, left, right, gt);
+
+  for (sl_oc::tools::STEREO_ENGINE engine : opt.engines) {
+    stereoPar.engine = engine;
+    cv::Ptr<sl_oc::tools::IStereoMatcher> matcher =
+        sl_oc::tools::createStereoMatcher(stereoPar);
+    sl_oc::tools::CensusStereoMatcher *census =
+        dynamic_cast<sl_oc::tools::CensusStereoMatcher *>(matcher.get());
+    if (census)
+      census->getMatcher().setSimd(opt.simd);
+
+    MatcherResult r;
+    r.timing.resolution = res.name;
+    r.timing.backend = "Mat";
+    r.timing.stage = sl_oc::tools::stereoEngineToString(engine);
+    r.timing.width = w;
+    r.timing.height = h;
+    r.name = matcher->getName();
+
+    for (int f = 0; f < opt.warmup + opt.frames; f++) {
+      uint64_t allocs = g_heap_allocs;
+      sl_oc::tools::StopWatch clock;
+      matcher->compute(left, right, disparity);
+      double usec = clock.toc() * 1e6;
+      if (f >= opt.warmup) {
+        r.timing.usec.push_back(usec);
+        r.timing.heap_allocs += g_heap_allocs - allocs;
+      }
+    }
+
+    // ----> Quality w.r.t. the ground truth
+    // The left border, where no engine can match the whole range, is skipped
+    int x0 = std::max(0, matcher->getMinDisparity() +
+                             matcher->getNumDisparities()) +
+             matcher->getBlockSize() / 2;
+    float invalid = static_cast<float>(matcher->getMinDisparity() - 1);
+    uint64_t count = 0, valid = 0, bad = 0;
+    double abs_err = 0.0;
+    for (int y = 0; y < h; y++) {
+      const float *gt_row = gt.ptr<float>(y);
+      const int16_t *disp_row = disparity.ptr<int16_t>(y);
+      for (int x = x0; x < w; x++) {
+        if (gt_row[x] <= 0.f)
+          continue;
+        count++;
+        float d = disp_row[x] / 16.f;
+        if (d <= invalid)
+          continue;
+        valid++;
+        float err = std::fabs(d - gt_row[x]);
+        abs_err += err;
+        if (err > 1.f)
+          bad++;
+      }
+    }
+    r.valid_pct = count ? 100.0 * valid / count : 0.0;
+    r.bad1_pct = valid ? 100.0 * bad / valid : 0.0;
+    r.mae = valid ? abs_err / valid : 0.0;
+    // <---- Quality w.r.t. the ground truth
+
+    results.push_back(std::move(r));
+  }
+}
+
+bool parseOptions(int argc, char *argv[], BenchOptions &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--res" && has_value) {
+      std::stringstream list(argv[++i]);
+      std::string name;
+      while (std::getline(list, name, ',')) {
+        bool found = false;
+        for (const BenchResolution &r : RESOLUTIONS) {
+          if (r.name == name) {
+            opt.resolutions.push_back(r);
+            found = true;
+          }
+        }
+        if (!found) {
+          std::cerr << "Unknown resolution: " << name << std::endl;
+          return false;
+        }
+      }
+    } else if (arg == "--backend" && has_value) {
+      std::string b = argv[++i];
+      opt.mat = (b == "mat" || b == "both");
+      opt.umat = (b == "umat" || b == "both");
+      if (!opt.mat && !opt.umat) {
+        std::cerr << "Unknown backend: " << b << std::endl;
+        return false;
+      }
+    } else if (arg == "--frames" && has_value) {
+      opt.frames = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--warmup" && has_value) {
+      opt.warmup = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--record" && has_value) {
+      opt.record_file = argv[++i];
+    } else if (arg == "--calib" && has_value) {
+      opt.calib_file = argv[++i];
+    } else if (arg == "--engines" && has_value) {
+      std::stringstream list(argv[++i]);
+      std::string name;
+      while (std::getline(list, name, ',')) {
+        sl_oc::tools::STEREO_ENGINE engine;
+        if (!sl_oc::tools::stereoEngineFromString(name, engine)) {
+          std::cerr << "Unknown stereo engine: " << name << std::endl;
+          return false;
+        }
+        opt.engines.push_back(engine);
+      }
+    } else if (arg == "--no-simd") {
+      opt.simd = false;
+    } else if (arg == "--csv" && has_value) {
+      opt.csv_file = argv[++i];
+    } else if (arg == "--json" && has_value) {
+      opt.json_file = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--res VGA,HD720,HD1080,HD2K] [--backend mat|umat|both]"
+                   " [--frames N] [--warmup N] [--record FILE]"
+                   " [--calib FILE] [--engines sgbm,bm,census] [--no-simd]"
+                   " [--csv FILE] [--json FILE]"
+                << std::endl;
+      return false;
+    }
+  }
+
+  if (opt.resolutions.empty())
+    opt.resolutions.assign(std::begin(RESOLUTIONS), std::end(RESOLUTIONS));
+  if (opt.engines.empty())
+    opt.engines = {sl_oc::tools::STEREO_ENGINE::SGBM,
+                   sl_oc::tools::STEREO_ENGINE::BM,
+                   sl_oc::tools::STEREO_ENGINE::CENSUS};
+  return true;
+}
+
+std::string versionString() {
+  return std::to_string(ZED_OC_MAJOR_VERSION) + "." +
+         std::to_string(ZED_OC_MINOR_VERSION) + "." +
+         std::to_string(ZED_OC_PATCH_VERSION);
+}
+
+const double PERCENTILES[] = {50, 90, 99};
+
+void printTable(const std::vector<StageResult> &results) {
+  std::cout << std::left << std::setw(8) << "res" << std::setw(6) << "type"
+            << std::setw(17) << "stage" << std::right << std::setw(10)
+            << "mean[us]" << std::setw(10) << "p50[us]" << std::setw(10)
+            << "p90[us]" << std::setw(10) << "p99[us]" << std::setw(10)
+            << "fps" << std::setw(10) << "Mpix/s" << std::setw(9)
+            << "allocs" << std::setw(9) << "reallocs" << std::endl;
+
+  for (const StageResult &r : results) {
+    std::cout << std::left << std::setw(8) << r.resolution << std::setw(6)
+              << r.backend << std::setw(17) << r.stage << std::right
+              << std::fixed << std::setprecision(0) << std::setw(10)
+              << r.mean();
+    for (double p : PERCENTILES)
+      std::cout << std::setw(10) << r.percentile(p);
+    std::cout << std::setprecision(1) << std::setw(10) << r.fps()
+              << std::setw(10) << r.mpix_s() << std::setw(9)
+              << r.allocs_per_frame() << std::setw(9) << r.reallocs
+              << std::endl;
+  }
+}
+
+void printMatcherTable(const std::vector<MatcherResult> &results) {
+  std::cout << std::left << std::setw(8) << "res" << std::setw(10) << "size"
+            << std::setw(16) << "engine" << std::right << std::setw(10)
+            << "mean[us]" << std::setw(10) << "p50[us]" << std::setw(10)
+            << "p99[us]" << std::setw(10) << "fps" << std::setw(9) << "valid%"
+            << std::setw(9) << "bad1%" << std::setw(9) << "MAE" << std::endl;
+
+  for (const MatcherResult &r : results) {
+    const StageResult &t = r.timing;
+    std::cout << std::left << std::setw(8) << t.resolution << std::setw(10)
+              << (std::to_string(t.width) + "x" + std::to_string(t.height))
+              << std::setw(16) << r.name << std::right << std::fixed
+              << std::setprecision(0) << std::setw(10) << t.mean()
+              << std::setw(10) << t.percentile(50) << std::setw(10)
+              << t.percentile(99) << std::setprecision(1) << std::setw(10)
+              << t.fps() << std::setw(9) << r.valid_pct << std::setw(9)
+              << r.bad1_pct << std::setprecision(2) << std::setw(9) << r.mae
+              << std::endl;
+  }
+}
+
+bool writeCsv(const std::string &file,
+              const std::vector<StageResult> &results) {
+  std::ofstream out(file);
+  out << "version,resolution,width,height,backend,stage,frames,mean_usec,"
+         "p50_usec,p90_usec,p99_usec,max_usec,fps,mpix_s,allocs_per_frame,"
+         "reallocs"
+      << std::endl;
+  for (const StageResult &r : results) {
+    out << versionString() << "," << r.resolution << "," << r.width << ","
+        << r.height << "," << r.backend << "," << r.stage << ","
+        << r.usec.size() << "," << r.mean();
+    for (double p : PERCENTILES)
+      out << "," << r.percentile(p);
+    out << "," << r.percentile(100) << "," << r.fps() << "," << r.mpix_s()
+        << "," << r.allocs_per_frame() << "," << r.reallocs << std::endl;
+  }
+  return out.good();
+}
+
+bool writeJson(const std::string &file, const std::vector<StageResult> &results,
+               const std::vector<MatcherResult> &matchers,
+               const std::string &input, const std::string &kernel) {
+  std::ofstream out(file);
+  out << "{\n  \"version\": \"" << versionString() << "\",\n"
+      << "  \"opencv\": \"" << CV_VERSION << "\",\n"
+      << "  \"opencl\": " << (cv::ocl::useOpenCL() ? "true" : "false")
+      << ",\n"
+      << "  \"threads\": " << cv::getNumThreads() << ",\n"
+      << "  \"input\": \"" << input << "\",\n"
+      << "  \"gray_kernel\": \"" << kernel << "\",\n"
+      << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const StageResult &r = results[i];
+    out << "    {\"resolution\": \"" << r.resolution
+        << "\", \"width\": " << r.width << ", \"height\": " << r.height
+        << ", \"backend\": \"" << r.backend << "\", \"stage\": \"" << r.stage
+        << "\", \"frames\": " << r.usec.size()
+        << ", \"mean_usec\": " << r.mean()
+        << ", \"p50_usec\": " << r.percentile(50)
+        << ", \"p90_usec\": " << r.percentile(90)
+        << ", \"p99_usec\": " << r.percentile(99)
+        << ", \"max_usec\": " << r.percentile(100)
+        << ", \"fps\": " << r.fps() << ", \"mpix_s\": " << r.mpix_s()
+        << ", \"allocs_per_frame\": " << r.allocs_per_frame()
+        << ", \"reallocs\": " << r.reallocs << "}"
+        << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ],\n  \"matchers\": [\n";
+  for (size_t i = 0; i < matchers.size(); i++) {
+    const MatcherResult &m = matchers[i];
+    const StageResult &r = m.timing;
+    out << "    {\"resolution\": \"" << r.resolution
+        << "\", \"width\": " << r.width << ", \"height\": " << r.height
+        << ", \"engine\": \"" << r.stage << "\", \"name\": \"" << m.name
+        << "\", \"frames\": " << r.usec.size()
+        << ", \"mean_usec\": " << r.mean()
+        << ", \"p50_usec\": " << r.percentile(50)
+        << ", \"p99_usec\": " << r.percentile(99) << ", \"fps\": " << r.fps()
+        << ", \"allocs_per_frame\": " << r.allocs_per_frame()
+        << ", \"valid_pct\": " << m.valid_pct
+        << ", \"bad1_pct\": " << m.bad1_pct << ", \"mae\": " << m.mae << "}"
+        << (i + 1 < matchers.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+  return out.good();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchOptions opt;
+  if (!parseOptions(argc, argv, opt))
+    return EXIT_FAILURE;
+
+  // ----> Recorded frames
+  sl_oc::video::RecordingReader reader;
+  if (!opt.record_file.empty()) {
+    if (!reader.open(opt.record_file)) {
+      std::cerr << "Cannot open the recording " << opt.record_file
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    const sl_oc::video::RecordFileHeader &hdr = reader.getHeader();
+    opt.resolutions.assign(1, {"REC", hdr.width / 2, hdr.height});
+  }
+  // <---- Recorded frames
+
+  if (opt.umat && !cv::ocl::haveOpenCL())
+    std::cout << "OpenCL not available: the UMat images run on the CPU"
+              << std::endl;
+
+  std::vector<StageResult> results;
+  std::vector<MatcherResult> matchers;
+  std::string kernel;
+  for (const BenchResolution &res : opt.resolutions) {
+    // ----> Input frames
+    std::vector<std::vector<uint8_t>> synthetic;
+    std::vector<const uint8_t *> frames;
+    if (reader.isOpened()) {
+      for (size_t i = 0; i < reader.getFrameCount(); i++) {
+        sl_oc::video::Frame frame;
+        if (reader.getFrame(i, frame))
+          frames.push_back(frame.data);
+      }
+    } else {
+      synthetic = syntheticFrames(res.width, res.height, 8);
+      for (const std::vector<uint8_t> &f : synthetic)
+        frames.push_back(f.data());
+    }
+    if (frames.empty()) {
+      std::cerr << "No frame to process" << std::endl;
+      return EXIT_FAILURE;
+    }
+    // <---- Input frames
+
+    // ----> Rectification maps
+    cv::Mat maps[4], P;
+    if (!opt.calib_file.empty()) {
+      cv::Mat map_x[2], map_y[2], P_right;
+      if (!sl_oc::tools::initCalibration(
+              opt.calib_file, cv::Size(res.width, res.height), map_x[0],
+              map_y[0], map_x[1], map_y[1], P, P_right)) {
+        std::cerr << "Cannot load the calibration " << opt.calib_file
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+      for (int side = 0; side < 2; side++)
+        cv::convertMaps(map_x[side], map_y[side], maps[2 * side],
+                        maps[2 * side + 1], CV_16SC2);
+    } else {
+      syntheticMaps(res.width, res.height, maps, P);
+    }
+    // <---- Rectification maps
+
+    std::cout << "* " << res.name << " " << res.width << "x" << res.height
+              << ": " << frames.size() << " frames" << std::endl;
+
+    if (opt.mat)
+      runPipeline<cv::Mat>(opt, res, frames, maps, P, results);
+    if (opt.umat)
+      runPipeline<cv::UMat>(opt, res, frames, maps, P, results);
+    runMatchers(opt, res, matchers);
+  }
+
+  {
+    sl_oc::video::StereoRectifier probe(sl_oc::video::RECTIFY_FORMAT::GRAY);
+    probe.setSimd(opt.simd);
+    kernel = probe.getKernelName();
+  }
+
+  std::cout << std::endl
+            << "ZED Open Capture " << versionString() << " - OpenCV "
+            << CV_VERSION << " - gray kernel: " << kernel << std::endl;
+  printTable(results);
+  std::cout << std::endl << "Stereo engines on the synthetic pair:" << std::endl;
+  printMatcherTable(matchers);
+
+  std::string input = opt.record_file.empty() ? "synthetic" : opt.record_file;
+  if (!opt.csv_file.empty() && !writeCsv(opt.csv_file, results)) {
+    std::cerr << "Cannot write " << opt.csv_file << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!opt.json_file.empty() &&
+      !writeJson(opt.json_file, results, matchers, input, kernel)) {
+    std::cerr << "Cannot write " << opt.json_file << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
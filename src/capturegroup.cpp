@@ -0,0 +1,315 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "capturegroup.hpp"
+
+#include <algorithm>          // for std::min_element, std::max_element
+
+namespace sl_oc {
+
+namespace video {
+
+// Maximum number of frames of each camera waiting for a match
+#define GROUP_MAX_PENDING 2
+
+CaptureGroup::CaptureGroup(VideoParams params, uint64_t tolerance_usec, size_t queue_depth)
+{
+    if( params.buffer_count<GROUP_MIN_BUFFERS )
+    {
+        params.buffer_count = GROUP_MIN_BUFFERS;
+    }
+    mParams = params;
+
+    mToleranceParam = tolerance_usec*1000;
+    mToleranceNsec = mToleranceParam;
+    mQueueDepth = std::max<size_t>(queue_depth,1);
+}
+
+CaptureGroup::~CaptureGroup()
+{
+    stop();
+
+    // The VideoCapture destructors close the devices
+    mCameras.clear();
+}
+
+int CaptureGroup::addCamera( int devId )
+{
+    if( mStarted )
+    {
+        ERROR_OUT(mParams.verbose,"Cameras cannot be added to a started capture group");
+        return -1;
+    }
+
+    std::unique_ptr<VideoCapture> cap( new VideoCapture(mParams) );
+    if( !cap->initializeVideo(devId) )
+    {
+        ERROR_OUT(mParams.verbose,std::string("Cannot add the camera ") + std::to_string(devId) + " to the capture group");
+        return -1;
+    }
+
+    mCameras.push_back( std::move(cap) );
+
+    return static_cast<int>(mCameras.size()-1);
+}
+
+bool CaptureGroup::start()
+{
+    if( mStarted )
+        return true;
+
+    if( mCameras.empty() )
+    {
+        ERROR_OUT(mParams.verbose,"The capture group has no camera");
+        return false;
+    }
+
+    // ----> Matching tolerance
+    int min_fps = mCameras[0]->getFPS();
+    for( auto& cap : mCameras )
+    {
+        min_fps = std::min(min_fps, cap->getFPS());
+    }
+
+    uint64_t half_period = 500000000ULL/static_cast<uint64_t>(std::max(min_fps,1));
+    if( mToleranceParam==0 )
+    {
+        mToleranceNsec = half_period;
+    }
+    else
+    {
+        mToleranceNsec = mToleranceParam;
+        if( mToleranceNsec>half_period )
+        {
+            WARNING_OUT(mParams.verbose,"The matching tolerance is larger than half the frame period: frames may be wrongly matched");
+        }
+    }
+    // <---- Matching tolerance
+
+    // ----> Reset the matcher
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mPending.clear();
+        mPending.resize(mCameras.size());
+        mGroups.clear();
+        mGroupCount = 0;
+        mStats = CaptureGroupStats();
+        mStats.unmatched_frames.resize(mCameras.size(),0);
+        mStats.subscriber_dropped.resize(mCameras.size(),0);
+        mStarted = true;
+    }
+    // <---- Reset the matcher
+
+    // ----> Subscribe to the cameras
+    mSubIds.clear();
+    for( size_t i=0; i<mCameras.size(); i++ )
+    {
+        int id = mCameras[i]->subscribe( [this,i](const FrameLease& lease){ onFrame(i,lease); }, GROUP_MAX_PENDING );
+        if( id<0 )
+        {
+            ERROR_OUT(mParams.verbose,std::string("Cannot subscribe to the frames of the camera ") + std::to_string(i));
+            stop();
+            return false;
+        }
+        mSubIds.push_back(id);
+    }
+    // <---- Subscribe to the cameras
+
+    INFO_OUT(mParams.verbose,std::string("Capture group started with ") + std::to_string(mCameras.size()) +
+             " cameras, tolerance: " + std::to_string(mToleranceNsec/1000) + " usec");
+
+    return true;
+}
+
+void CaptureGroup::stop()
+{
+    // Joins the subscriber threads: no frame is received after this point
+    for( size_t i=0; i<mSubIds.size(); i++ )
+    {
+        mCameras[i]->unsubscribe(mSubIds[i]);
+    }
+    mSubIds.clear();
+
+    // Release the leases outside of the lock
+    std::vector<std::deque<FrameLease>> pending;
+    std::deque<FrameGroup> groups;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStarted = false;
+        pending.swap(mPending);
+        groups.swap(mGroups);
+    }
+    mGroupCond.notify_all();
+}
+
+void CaptureGroup::onFrame(size_t cam, const FrameLease& lease)
+{
+    std::vector<FrameLease> released; // Released outside of the lock
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if( !mStarted )
+            return;
+
+        std::deque<FrameLease>& queue = mPending[cam];
+        queue.push_back(lease);
+        if( queue.size()>GROUP_MAX_PENDING )
+        {
+            // The other cameras are not delivering: the oldest frame cannot be matched anymore
+            released.push_back( std::move(queue.front()) );
+            queue.pop_front();
+            mStats.unmatched_frames[cam]++;
+        }
+
+        matchPending(released);
+    }
+}
+
+void CaptureGroup::matchPending(std::vector<FrameLease>& released)
+{
+    const size_t n_cam = mPending.size();
+
+    while(true)
+    {
+        // ----> A frame of each camera is required
+        for( auto& queue : mPending )
+        {
+            if( queue.empty() )
+                return;
+        }
+        // <---- A frame of each camera is required
+
+        // The latest head frame: all the frames of its camera are at least as late
+        uint64_t t_ref = 0;
+        for( auto& queue : mPending )
+        {
+            t_ref = std::max(t_ref, queue.front().frame().timestamp);
+        }
+
+        // ----> Move each camera to its frame nearest to the reference
+        for( size_t i=0; i<n_cam; i++ )
+        {
+            std::deque<FrameLease>& queue = mPending[i];
+            while( queue.size()>1 )
+            {
+                uint64_t ts0 = queue[0].frame().timestamp;
+                uint64_t ts1 = queue[1].frame().timestamp;
+                uint64_t d0 = (ts0>t_ref)?(ts0-t_ref):(t_ref-ts0);
+                uint64_t d1 = (ts1>t_ref)?(ts1-t_ref):(t_ref-ts1);
+                if( d1>d0 )
+                    break;
+
+                released.push_back( std::move(queue.front()) );
+                queue.pop_front();
+                mStats.unmatched_frames[i]++;
+            }
+        }
+        // <---- Move each camera to its frame nearest to the reference
+
+        // ----> Skew of the candidate group
+        size_t earliest = 0;
+        uint64_t t_min = mPending[0].front().frame().timestamp;
+        uint64_t t_max = t_min;
+        for( size_t i=1; i<n_cam; i++ )
+        {
+            uint64_t ts = mPending[i].front().frame().timestamp;
+            if( ts<t_min )
+            {
+                t_min = ts;
+                earliest = i;
+            }
+            t_max = std::max(t_max, ts);
+        }
+        // <---- Skew of the candidate group
+
+        if( t_max-t_min > mToleranceNsec )
+        {
+            // The earliest frame is too old to be matched with any later frame of the other cameras
+            released.push_back( std::move(mPending[earliest].front()) );
+            mPending[earliest].pop_front();
+            mStats.unmatched_frames[earliest]++;
+            continue;
+        }
+
+        // ----> Emit the group
+        FrameGroup group;
+        group.frames.reserve(n_cam);
+        for( auto& queue : mPending )
+        {
+            group.frames.push_back( std::move(queue.front()) );
+            queue.pop_front();
+        }
+        group.group_id = mGroupCount++;
+        group.timestamp = t_max;
+        group.skew = t_max-t_min;
+
+        mStats.groups++;
+        mStats.skew.add(group.skew/1000);
+
+        mGroups.push_back( std::move(group) );
+        if( mGroups.size()>mQueueDepth )
+        {
+            for( auto& lease : mGroups.front().frames )
+                released.push_back( std::move(lease) );
+            mGroups.pop_front();
+            mStats.dropped_groups++;
+        }
+        // <---- Emit the group
+
+        mGroupCond.notify_one();
+    }
+}
+
+bool CaptureGroup::grab(FrameGroup& group, uint64_t timeout_msec)
+{
+    FrameGroup old; // The previous frames of `group` are released outside of the lock
+    std::swap(old, group);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    bool ready = mGroupCond.wait_for( lock, std::chrono::milliseconds(timeout_msec),
+                                      [this]{return !mGroups.empty() || !mStarted;} );
+    if( !ready || mGroups.empty() )
+        return false;
+
+    group = std::move(mGroups.front());
+    mGroups.pop_front();
+
+    return true;
+}
+
+CaptureGroupStats CaptureGroup::getStats()
+{
+    CaptureGroupStats stats;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        stats = mStats;
+    }
+
+    for( size_t i=0; i<mSubIds.size() && i<stats.subscriber_dropped.size(); i++ )
+    {
+        stats.subscriber_dropped[i] = mCameras[i]->getSubscriberDroppedFrames(mSubIds[i]);
+    }
+
+    return stats;
+}
+
+}
+
+}
@@ -0,0 +1,410 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "censusmatcher.hpp"
+
+#include <algorithm>          // for std::min, std::max
+#include <cstdlib>            // for std::abs
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CENSUS_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CENSUS_NEON
+#endif
+
+namespace sl_oc {
+
+namespace video {
+
+static const uint16_t COST_NONE = 0xFFFF;   // No cost for the disparity
+
+// ----> Hamming cost kernels
+// `colsum` is updated with modular 16 bit arithmetic: the sum of the window is always in [0,24*MAX_BLOCK_SIZE]
+
+static void updateCostScalar(const uint32_t* l_add, const uint32_t* r_add, const uint32_t* l_sub,
+                             const uint32_t* r_sub, int count, uint16_t* colsum)
+{
+    for(int i=0; i<count; i++)
+    {
+        int diff = __builtin_popcount(l_add[i]^r_add[i]) - __builtin_popcount(l_sub[i]^r_sub[i]);
+        colsum[i] = static_cast<uint16_t>(colsum[i]+diff);
+    }
+}
+
+#ifdef CENSUS_AVX2
+// Bit count of each 32 bit lane: nibble lookup, then sum of the four bytes
+__attribute__((target("avx2")))
+static inline __m256i popcount32Avx2(__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                         0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v,nibble));
+    __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v,4),nibble));
+    __m256i bytes = _mm256_add_epi8(lo,hi);
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(bytes,_mm256_set1_epi8(1)), _mm256_set1_epi16(1));
+}
+
+// 16 pixels per iteration
+__attribute__((target("avx2")))
+static void updateCostAvx2(const uint32_t* l_add, const uint32_t* r_add, const uint32_t* l_sub,
+                           const uint32_t* r_sub, int count, uint16_t* colsum)
+{
+    int i = 0;
+    for( ; i+16<=count; i+=16)
+    {
+        __m256i add_0 = popcount32Avx2(_mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(l_add+i)),
+                                                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r_add+i))));
+        __m256i add_1 = popcount32Avx2(_mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(l_add+i+8)),
+                                                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r_add+i+8))));
+        __m256i sub_0 = popcount32Avx2(_mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(l_sub+i)),
+                                                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r_sub+i))));
+        __m256i sub_1 = popcount32Avx2(_mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(l_sub+i+8)),
+                                                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(r_sub+i+8))));
+
+        // Packing works within the 128 bit lanes: the permutation restores the order of the pixels
+        __m256i diff = _mm256_packs_epi32(_mm256_sub_epi32(add_0,sub_0), _mm256_sub_epi32(add_1,sub_1));
+        diff = _mm256_permute4x64_epi64(diff, 0xD8);
+
+        __m256i sum = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colsum+i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(colsum+i), _mm256_add_epi16(sum,diff));
+    }
+
+    updateCostScalar(l_add+i, r_add+i, l_sub+i, r_sub+i, count-i, colsum+i);
+}
+#endif
+
+#ifdef CENSUS_NEON
+// Bit count of each 32 bit lane, narrowed to 16 bits
+static inline uint16x4_t popcount32Neon(uint32x4_t v)
+{
+    return vmovn_u32(vpaddlq_u16(vpaddlq_u8(vcntq_u8(vreinterpretq_u8_u32(v)))));
+}
+
+// 8 pixels per iteration
+static void updateCostNeon(const uint32_t* l_add, const uint32_t* r_add, const uint32_t* l_sub,
+                           const uint32_t* r_sub, int count, uint16_t* colsum)
+{
+    int i = 0;
+    for( ; i+8<=count; i+=8)
+    {
+        uint16x8_t add = vcombine_u16(popcount32Neon(veorq_u32(vld1q_u32(l_add+i), vld1q_u32(r_add+i))),
+                                      popcount32Neon(veorq_u32(vld1q_u32(l_add+i+4), vld1q_u32(r_add+i+4))));
+        uint16x8_t sub = vcombine_u16(popcount32Neon(veorq_u32(vld1q_u32(l_sub+i), vld1q_u32(r_sub+i))),
+                                      popcount32Neon(veorq_u32(vld1q_u32(l_sub+i+4), vld1q_u32(r_sub+i+4))));
+
+        vst1q_u16(colsum+i, vaddq_u16(vld1q_u16(colsum+i), vsubq_u16(add,sub)));
+    }
+
+    updateCostScalar(l_add+i, r_add+i, l_sub+i, r_sub+i, count-i, colsum+i);
+}
+#endif
+// <---- Hamming cost kernels
+
+CensusMatcher::CensusMatcher(VERBOSITY verbose_lvl)
+    : mVerbose(verbose_lvl)
+{
+    setSimd(true);
+    setThreads(0);
+}
+
+bool CensusMatcher::setParams(int minDisparity, int numDisparities, int blockSize, int uniquenessRatio)
+{
+    if( numDisparities<=0 || numDisparities>0x7FFF || std::abs(minDisparity)>0x7FF )
+    {
+        ERROR_OUT(mVerbose,std::string("Invalid disparity range: ") + std::to_string(minDisparity) + " + " + std::to_string(numDisparities));
+        return false;
+    }
+
+    if( blockSize<1 || blockSize>MAX_BLOCK_SIZE || (blockSize%2)!=1 )
+    {
+        ERROR_OUT(mVerbose,std::string("Invalid block size: ") + std::to_string(blockSize));
+        return false;
+    }
+
+    mMinDisparity = minDisparity;
+    mNumDisparities = numDisparities;
+    mBlockSize = blockSize;
+    mUniquenessRatio = std::max(0, std::min(99,uniquenessRatio));
+
+    mScratch.clear(); // Reallocated by the next `compute`
+
+    return true;
+}
+
+void CensusMatcher::setSimd(bool enable)
+{
+    CostKernel avx2 = nullptr;
+    CostKernel neon = nullptr;
+#if defined(CENSUS_AVX2)
+    avx2 = updateCostAvx2;
+#elif defined(CENSUS_NEON)
+    neon = updateCostNeon;
+#endif
+
+    mCostKernel = selectSimdKernel<CostKernel>(enable, updateCostScalar, avx2, neon, mKernelName);
+}
+
+void CensusMatcher::setThreads(int threads)
+{
+    mWorkers.setThreads(threads);
+    mScratch.clear(); // One per thread, reallocated by the next `compute`
+}
+
+bool CensusMatcher::compute(const uint8_t* left, const uint8_t* right, int width, int height, size_t stride,
+                            int16_t* disparity, size_t disp_stride)
+{
+    if( !left || !right || !disparity || width<=0 || height<=0 ||
+            stride<static_cast<size_t>(width) || disp_stride<static_cast<size_t>(width) )
+    {
+        ERROR_OUT(mVerbose,"Invalid images");
+        return false;
+    }
+
+    // ----> Buffers allocated once for all the frames of the same size
+    if( width!=mWidth || height!=mHeight || mScratch.empty() )
+    {
+        mWidth = width;
+        mHeight = height;
+
+        size_t size = static_cast<size_t>(width)*height;
+        mCensus[0].assign(size, 0);
+        mCensus[1].assign(size, 0);
+        mZero.assign(width, 0);
+
+        mScratch.resize(mWorkers.getThreads());
+        for(Scratch& s : mScratch)
+        {
+            s.colsum.assign(static_cast<size_t>(mNumDisparities)*width, 0);
+            s.cost.assign(static_cast<size_t>(mNumDisparities)*width, COST_NONE);
+            s.best.assign(width, 0);
+            s.second.assign(width, 0);
+            s.best_idx.assign(width, 0);
+        }
+
+        INFO_OUT(mVerbose,std::string("Census matcher buffers: ") + std::to_string(mWidth) + "x" + std::to_string(mHeight) +
+                 " - " + std::to_string(mNumDisparities) + " disparities - kernel: " + mKernelName);
+    }
+    // <---- Buffers allocated once for all the frames of the same size
+
+    // The matching of a band needs the descriptors of the rows around it: all the descriptors are computed first
+    mWorkers.run(mHeight, [&](int, int y0, int y1) {
+        censusRows(left, stride, y0, y1, mCensus[0].data());
+        censusRows(right, stride, y0, y1, mCensus[1].data());
+    });
+
+    mWorkers.run(mHeight, [&](int band, int y0, int y1) {
+        matchRows(y0, y1, mScratch[band], disparity, disp_stride);
+    });
+
+    return true;
+}
+
+void CensusMatcher::censusRows(const uint8_t* src, size_t stride, int y0, int y1, uint32_t* dst)
+{
+    const int r = CENSUS_RADIUS;
+    const int w = mWidth;
+    const int h = mHeight;
+
+    for(int y=y0; y<y1; y++)
+    {
+        // Replicated border
+        const uint8_t* rows[2*r+1];
+        for(int k=-r; k<=r; k++)
+            rows[k+r] = src + std::max(0, std::min(h-1, y+k))*stride;
+
+        const uint8_t* center = rows[r];
+        uint32_t* desc = dst + static_cast<size_t>(y)*w;
+
+        // ----> Inner pixels, vectorized by the compiler
+        for(int x=r; x<w-r; x++)
+            desc[x] = 0;
+        for(int dy=0; dy<=2*r; dy++)
+        {
+            for(int dx=-r; dx<=r; dx++)
+            {
+                if( dy==r && dx==0 )
+                    continue;
+                const uint8_t* nb = rows[dy]+dx;
+                for(int x=r; x<w-r; x++)
+                    desc[x] = (desc[x]<<1) | (nb[x]<center[x] ? 1u : 0u);
+            }
+        }
+        // <---- Inner pixels, vectorized by the compiler
+
+        // ----> Border pixels
+        for(int x=0; x<w; x++)
+        {
+            if( x==r && w-r>r )
+                x = w-r; // Inner pixels done
+            uint32_t d = 0;
+            for(int dy=0; dy<=2*r; dy++)
+            {
+                for(int dx=-r; dx<=r; dx++)
+                {
+                    if( dy==r && dx==0 )
+                        continue;
+                    int xx = std::max(0, std::min(w-1, x+dx));
+                    d = (d<<1) | (rows[dy][xx]<center[x] ? 1u : 0u);
+                }
+            }
+            desc[x] = d;
+        }
+        // <---- Border pixels
+    }
+}
+
+void CensusMatcher::matchRows(int y0, int y1, Scratch& s, int16_t* disparity, size_t disp_stride)
+{
+    const int w = mWidth;
+    const int h = mHeight;
+    const int r = mBlockSize/2;
+    const int num_d = mNumDisparities;
+    const int min_d = mMinDisparity;
+    const int max_d = min_d+num_d-1;
+    const int16_t invalid = static_cast<int16_t>((min_d-1)*DISP_SCALE);
+
+    // ----> Valid columns: the window of all the disparities is inside both images
+    const int xv0 = std::max(0, max_d) + r;
+    const int xv1 = w - std::max(0, -min_d) - r;
+    // <---- Valid columns: the window of all the disparities is inside both images
+
+    const uint32_t* census_l = mCensus[0].data();
+    const uint32_t* census_r = mCensus[1].data();
+    const uint32_t* zero = mZero.data();
+
+    // Add the costs of row `y_add` and remove the ones of row `y_sub`, rows outside the image have no cost
+    auto slide = [&](int y_add, int y_sub) {
+        const uint32_t* l_add = (y_add>=0 && y_add<h) ? census_l + static_cast<size_t>(y_add)*w : nullptr;
+        const uint32_t* r_add = (y_add>=0 && y_add<h) ? census_r + static_cast<size_t>(y_add)*w : nullptr;
+        const uint32_t* l_sub = (y_sub>=0 && y_sub<h) ? census_l + static_cast<size_t>(y_sub)*w : nullptr;
+        const uint32_t* r_sub = (y_sub>=0 && y_sub<h) ? census_r + static_cast<size_t>(y_sub)*w : nullptr;
+        if( !l_add && !l_sub )
+            return;
+
+        for(int k=0; k<num_d; k++)
+        {
+            int d = min_d+k;
+            int xs = std::max(0, d);
+            int xe = std::min(w, w+d);
+            if( xe<=xs )
+                continue;
+
+            mCostKernel( l_add ? l_add+xs : zero, l_add ? r_add+xs-d : zero,
+                         l_sub ? l_sub+xs : zero, l_sub ? r_sub+xs-d : zero,
+                         xe-xs, s.colsum.data()+static_cast<size_t>(k)*w+xs );
+        }
+    };
+
+    // ----> Window of the row before the band, moved down by the first iteration
+    std::fill(s.colsum.begin(), s.colsum.end(), 0);
+    for(int y=y0-r-1; y<y0+r; y++)
+        slide(y, -1);
+    // <---- Window of the row before the band, moved down by the first iteration
+
+    for(int y=y0; y<y1; y++)
+    {
+        slide(y+r, y-r-1);
+
+        int16_t* disp_row = disparity + static_cast<size_t>(y)*disp_stride;
+        std::fill(disp_row, disp_row+w, invalid);
+        if( xv1<=xv0 )
+            continue;
+
+        std::fill(s.best.begin(), s.best.end(), COST_NONE);
+        std::fill(s.best_idx.begin(), s.best_idx.end(), -1);
+
+        // ----> Winner takes all, keeping the costs of the row
+        for(int k=0; k<num_d; k++)
+        {
+            const uint16_t* colsum = s.colsum.data()+static_cast<size_t>(k)*w;
+            uint16_t* cost = s.cost.data()+static_cast<size_t>(k)*w;
+
+            uint32_t sum = 0;
+            for(int x=xv0-r; x<xv0+r; x++)
+                sum += colsum[x];
+
+            for(int x=xv0; x<xv1; x++)
+            {
+                sum += colsum[x+r];
+                uint16_t c = static_cast<uint16_t>(sum);
+                sum -= colsum[x-r];
+
+                cost[x] = c;
+                if( c<s.best[x] )
+                {
+                    s.best[x] = c;
+                    s.best_idx[x] = static_cast<int16_t>(k);
+                }
+            }
+        }
+        // <---- Winner takes all, keeping the costs of the row
+
+        // ----> Minimum cost of the disparities not adjacent to the best one
+        std::fill(s.second.begin(), s.second.end(), COST_NONE);
+        if( mUniquenessRatio>0 )
+        {
+            for(int k=0; k<num_d; k++)
+            {
+                const uint16_t* cost = s.cost.data()+static_cast<size_t>(k)*w;
+                const int16_t* best_idx = s.best_idx.data();
+                uint16_t* second = s.second.data();
+                for(int x=xv0; x<xv1; x++)
+                {
+                    // Branchless, vectorized by the compiler: `k` is adjacent if `k-best_idx+1` is in [0,2]
+                    bool adjacent = static_cast<uint16_t>(k-best_idx[x]+1)<=2;
+                    uint16_t c = adjacent ? COST_NONE : cost[x];
+                    second[x] = std::min(second[x], c);
+                }
+            }
+        }
+        // <---- Minimum cost of the disparities not adjacent to the best one
+
+        // ----> Uniqueness check and sub-pixel refinement, as OpenCV
+        for(int x=xv0; x<xv1; x++)
+        {
+            int k = s.best_idx[x];
+            int best = s.best[x];
+            if( k<0 )
+                continue;
+
+            if( s.second[x]!=COST_NONE && s.second[x]*(100-mUniquenessRatio)<best*100 )
+                continue;
+
+            int disp = (min_d+k)*DISP_SCALE;
+            if( k>0 && k<num_d-1 )
+            {
+                int c_m = s.cost[static_cast<size_t>(k-1)*w+x];
+                int c_p = s.cost[static_cast<size_t>(k+1)*w+x];
+                int denom2 = std::max(c_m+c_p-2*best, 1);
+                disp += ((c_m-c_p)*DISP_SCALE + denom2)/(denom2*2);
+            }
+            disp_row[x] = static_cast<int16_t>(disp);
+        }
+        // <---- Uniqueness check and sub-pixel refinement, as OpenCV
+    }
+}
+
+}
+
+}
@@ -0,0 +1,344 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "depthconverter.hpp"
+
+#include <algorithm>          // for std::min, std::max
+#include <cmath>              // for std::lrint
+#include <cstring>            // for std::memcpy
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DEPTH_AVX2
+#elif defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define DEPTH_NEON          // `vdivq_f32` and `vcvtnq_s32_f32` are AArch64 only
+#endif
+
+namespace sl_oc {
+
+namespace video {
+
+// ----> Row kernels
+// The same operations in the same order in all the kernels: the SIMD kernels give the result of the scalar one
+
+static void convertRowScalar(const int16_t* disparity, const float* offset, const uint8_t* invalid, int count,
+                             const DepthConverter::RowParams& par, float* depth, float* disp, uint8_t* color_idx)
+{
+    for(int x=0; x<count; x++)
+    {
+        float d = static_cast<float>(disparity[x])*par.dispScale + offset[x]*par.offsetScale;
+        bool valid = disparity[x]>par.invalid && invalid[x]==0 && d>0.f;
+
+        float t = std::min(std::max((d-par.colorMin)*par.colorScale, 0.f), 255.f);
+
+        depth[x] = valid ? par.focalBaseline/d : 0.f;
+        disp[x] = valid ? d : 0.f;
+        color_idx[x] = valid ? static_cast<uint8_t>(std::lrint(t)) : 0;
+    }
+}
+
+#ifdef DEPTH_AVX2
+// 8 pixels per iteration
+__attribute__((target("avx2")))
+static void convertRowAvx2(const int16_t* disparity, const float* offset, const uint8_t* invalid, int count,
+                           const DepthConverter::RowParams& par, float* depth, float* disp, uint8_t* color_idx)
+{
+    const __m256i inv = _mm256_set1_epi32(par.invalid);
+    const __m256 disp_scale = _mm256_set1_ps(par.dispScale);
+    const __m256 offset_scale = _mm256_set1_ps(par.offsetScale);
+    const __m256 focal_baseline = _mm256_set1_ps(par.focalBaseline);
+    const __m256 color_min = _mm256_set1_ps(par.colorMin);
+    const __m256 color_scale = _mm256_set1_ps(par.colorScale);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 max_idx = _mm256_set1_ps(255.f);
+
+    int x = 0;
+    for( ; x+8<=count; x+=8)
+    {
+        __m256i raw = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(disparity+x)));
+        __m256i mask = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(invalid+x)));
+
+        __m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(raw), disp_scale),
+                                 _mm256_mul_ps(_mm256_loadu_ps(offset+x), offset_scale));
+
+        __m256i valid_i = _mm256_and_si256(_mm256_cmpgt_epi32(raw, inv), _mm256_cmpeq_epi32(mask, _mm256_setzero_si256()));
+        __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(valid_i), _mm256_cmp_ps(d, zero, _CMP_GT_OQ));
+
+        __m256 t = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(d, color_min), color_scale), zero), max_idx);
+
+        _mm256_storeu_ps(depth+x, _mm256_and_ps(_mm256_div_ps(focal_baseline, d), valid));
+        _mm256_storeu_ps(disp+x, _mm256_and_ps(d, valid));
+
+        __m256i idx = _mm256_and_si256(_mm256_cvtps_epi32(t), _mm256_castps_si256(valid));
+        __m128i idx_16 = _mm_packus_epi32(_mm256_castsi256_si128(idx), _mm256_extracti128_si256(idx, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(color_idx+x), _mm_packus_epi16(idx_16, idx_16));
+    }
+
+    convertRowScalar(disparity+x, offset+x, invalid+x, count-x, par, depth+x, disp+x, color_idx+x);
+}
+#endif
+
+#ifdef DEPTH_NEON
+// 4 pixels, `valid` from the integer tests
+static inline uint16x4_t convertQuadNeon(int32x4_t raw, uint32x4_t valid, float32x4_t off,
+                                         const DepthConverter::RowParams& par, float* depth, float* disp)
+{
+    float32x4_t d = vaddq_f32(vmulq_f32(vcvtq_f32_s32(raw), vdupq_n_f32(par.dispScale)),
+                              vmulq_f32(off, vdupq_n_f32(par.offsetScale)));
+    valid = vandq_u32(valid, vcgtq_f32(d, vdupq_n_f32(0.f)));
+
+    float32x4_t t = vsubq_f32(d, vdupq_n_f32(par.colorMin));
+    t = vminq_f32(vmaxq_f32(vmulq_f32(t, vdupq_n_f32(par.colorScale)), vdupq_n_f32(0.f)), vdupq_n_f32(255.f));
+
+    float32x4_t z = vdivq_f32(vdupq_n_f32(par.focalBaseline), d);
+    vst1q_f32(depth, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(z), valid)));
+    vst1q_f32(disp, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(d), valid)));
+
+    return vmovn_u32(vandq_u32(vreinterpretq_u32_s32(vcvtnq_s32_f32(t)), valid));
+}
+
+// 8 pixels per iteration
+static void convertRowNeon(const int16_t* disparity, const float* offset, const uint8_t* invalid, int count,
+                           const DepthConverter::RowParams& par, float* depth, float* disp, uint8_t* color_idx)
+{
+    const int16x8_t inv = vdupq_n_s16(static_cast<int16_t>(par.invalid));
+
+    int x = 0;
+    for( ; x+8<=count; x+=8)
+    {
+        int16x8_t raw = vld1q_s16(disparity+x);
+        uint16x8_t valid = vandq_u16(vcgtq_s16(raw, inv), vceqq_u16(vmovl_u8(vld1_u8(invalid+x)), vdupq_n_u16(0)));
+
+        // Sign extension of the 16 bit masks
+        uint32x4_t valid_lo = vreinterpretq_u32_s32(vmovl_s16(vreinterpret_s16_u16(vget_low_u16(valid))));
+        uint32x4_t valid_hi = vreinterpretq_u32_s32(vmovl_s16(vreinterpret_s16_u16(vget_high_u16(valid))));
+
+        uint16x4_t idx_lo = convertQuadNeon(vmovl_s16(vget_low_s16(raw)), valid_lo, vld1q_f32(offset+x), par,
+                                            depth+x, disp+x);
+        uint16x4_t idx_hi = convertQuadNeon(vmovl_s16(vget_high_s16(raw)), valid_hi, vld1q_f32(offset+x+4), par,
+                                            depth+x+4, disp+x+4);
+
+        vst1_u8(color_idx+x, vmovn_u16(vcombine_u16(idx_lo, idx_hi)));
+    }
+
+    convertRowScalar(disparity+x, offset+x, invalid+x, count-x, par, depth+x, disp+x, color_idx+x);
+}
+#endif
+// <---- Row kernels
+
+// Replicate each element `scale` times
+template<class T>
+static void expandRow(const T* src, int width, int scale, T* dst)
+{
+    for(int x=0; x<width; x++)
+        for(int k=0; k<scale; k++)
+            *dst++ = src[x];
+}
+
+DepthConverter::DepthConverter(VERBOSITY verbose_lvl)
+    : mVerbose(verbose_lvl)
+{
+    // Gray ramp until a palette is set
+    for(int i=0; i<256; i++)
+        mPalette[3*i] = mPalette[3*i+1] = mPalette[3*i+2] = static_cast<uint8_t>(i);
+
+    setSimd(true);
+    setThreads(0);
+}
+
+bool DepthConverter::setParams(float focalBaseline, int scale)
+{
+    if( !(focalBaseline>0.f) || scale<1 || scale>MAX_SCALE )
+    {
+        ERROR_OUT(mVerbose,std::string("Invalid conversion parameters: ") + std::to_string(focalBaseline) + " - scale " + std::to_string(scale));
+        return false;
+    }
+
+    mFocalBaseline = focalBaseline;
+    mScale = scale;
+
+    return true;
+}
+
+bool DepthConverter::setColorMap(const uint8_t* palette, float minDisparity, float maxDisparity)
+{
+    if( !palette || !(maxDisparity>minDisparity) )
+    {
+        ERROR_OUT(mVerbose,"Invalid color map");
+        return false;
+    }
+
+    std::memcpy(mPalette, palette, sizeof(mPalette));
+    mColorMin = minDisparity;
+    mColorScale = 255.f/(maxDisparity-minDisparity);
+
+    return true;
+}
+
+void DepthConverter::setSimd(bool enable)
+{
+    RowKernel avx2 = nullptr;
+    RowKernel neon = nullptr;
+#if defined(DEPTH_AVX2)
+    avx2 = convertRowAvx2;
+#elif defined(DEPTH_NEON)
+    neon = convertRowNeon;
+#endif
+
+    mRowKernel = selectSimdKernel<RowKernel>(enable, convertRowScalar, avx2, neon, mKernelName);
+}
+
+void DepthConverter::setThreads(int threads)
+{
+    mWorkers.setThreads(threads);
+    mScratch.clear(); // One per thread, reallocated by the next `convert`
+}
+
+bool DepthConverter::convert(const int16_t* disparity, int width, int height, size_t stride, int minDisparity,
+                             const DepthOutput& out, const DisparityOffset* offset)
+{
+    const size_t out_width = static_cast<size_t>(width)*mScale;
+
+    if( !disparity || width<=0 || height<=0 || stride<static_cast<size_t>(width) ||
+            (out.depth && out.depth_stride<out_width) ||
+            (out.disparity && out.disparity_stride<out_width) ||
+            (out.color && out.color_stride<3*out_width) )
+    {
+        ERROR_OUT(mVerbose,"Invalid images");
+        return false;
+    }
+
+    // ----> Buffers allocated once for all the maps of the same width
+    if( width!=mWidth || mScratch.empty() )
+    {
+        mWidth = width;
+        mZeroOffset.assign(width, 0.f);
+        mZeroMask.assign(width, 0);
+
+        mScratch.resize(mWorkers.getThreads());
+        for(Scratch& s : mScratch)
+        {
+            s.depth.assign(width, 0.f);
+            s.disp.assign(width, 0.f);
+            s.color_idx.assign(width, 0);
+        }
+
+        INFO_OUT(mVerbose,std::string("Depth converter buffers: ") + std::to_string(width) + " - scale: " +
+                 std::to_string(mScale) + " - kernel: " + mKernelName);
+    }
+    // <---- Buffers allocated once for all the maps of the same width
+
+    // ----> Current conversion
+    mDisp = disparity;
+    mDispStride = stride;
+    mHeight = height;
+    mOut = out;
+
+    // A null stride repeats the row of zeros
+    mOffset = DisparityOffset();
+    if( offset )
+        mOffset = *offset;
+    if( !mOffset.offset )
+    {
+        mOffset.offset = mZeroOffset.data();
+        mOffset.offset_stride = 0;
+    }
+    if( !mOffset.invalid )
+    {
+        mOffset.invalid = mZeroMask.data();
+        mOffset.invalid_stride = 0;
+    }
+
+    mPar.invalid = std::max(-0x8000, std::min(0x7FFF, (minDisparity-1)*(1<<DISP_SHIFT)));
+    mPar.dispScale = static_cast<float>(mScale)/(1<<DISP_SHIFT);
+    mPar.offsetScale = static_cast<float>(mScale);
+    mPar.focalBaseline = mFocalBaseline;
+    mPar.colorMin = mColorMin;
+    mPar.colorScale = mColorScale;
+    // <---- Current conversion
+
+    mWorkers.run(mHeight, [this](int band, int y0, int y1) {
+        convertRows(y0, y1, mScratch[band]);
+    });
+
+    return true;
+}
+
+void DepthConverter::convertRows(int y0, int y1, Scratch& s)
+{
+    const int w = mWidth;
+    const int scale = mScale;
+    const size_t out_width = static_cast<size_t>(w)*scale;
+
+    for(int y=y0; y<y1; y++)
+    {
+        const size_t oy = static_cast<size_t>(y)*scale;
+        float* depth_row = mOut.depth ? mOut.depth + oy*mOut.depth_stride : nullptr;
+        float* disp_row = mOut.disparity ? mOut.disparity + oy*mOut.disparity_stride : nullptr;
+        uint8_t* color_row = mOut.color ? mOut.color + oy*mOut.color_stride : nullptr;
+
+        // Without scaling the kernel writes straight into the output
+        float* depth = (scale==1 && depth_row) ? depth_row : s.depth.data();
+        float* disp = (scale==1 && disp_row) ? disp_row : s.disp.data();
+
+        mRowKernel(mDisp + static_cast<size_t>(y)*mDispStride,
+                   mOffset.offset + static_cast<size_t>(y)*mOffset.offset_stride,
+                   mOffset.invalid + static_cast<size_t>(y)*mOffset.invalid_stride,
+                   w, mPar, depth, disp, s.color_idx.data());
+
+        // ----> First output row
+        if( depth_row && scale>1 )
+            expandRow(depth, w, scale, depth_row);
+        if( disp_row && scale>1 )
+            expandRow(disp, w, scale, disp_row);
+        if( color_row )
+        {
+            uint8_t* dst = color_row;
+            for(int x=0; x<w; x++)
+            {
+                const uint8_t* c = mPalette + 3*s.color_idx[x];
+                for(int k=0; k<scale; k++, dst+=3)
+                {
+                    dst[0] = c[0];
+                    dst[1] = c[1];
+                    dst[2] = c[2];
+                }
+            }
+        }
+        // <---- First output row
+
+        // ----> Copies of the first output row
+        for(int k=1; k<scale; k++)
+        {
+            if( depth_row )
+                std::memcpy(depth_row + k*mOut.depth_stride, depth_row, out_width*sizeof(float));
+            if( disp_row )
+                std::memcpy(disp_row + k*mOut.disparity_stride, disp_row, out_width*sizeof(float));
+            if( color_row )
+                std::memcpy(color_row + k*mOut.color_stride, color_row, out_width*3);
+        }
+        // <---- Copies of the first output row
+    }
+}
+
+}
+
+}
@@ -25,8 +25,15 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #include "videocapture.hpp"
+#include "stereorectifier.hpp"
+#include "depthconverter.hpp"
 
 // OpenCV includes
 #include <opencv2/opencv.hpp>
@@ -42,22 +49,61 @@
 // Sample includes
 #include "calibration.hpp"
 #include "ocv_display.hpp"
+#include "pipeline.hpp"
 #include "stereo.hpp"
 #include "stopwatch.hpp"
+#include "triangulation.hpp"
 // <---- Includes
 
 #define USE_OCV_TAPI // Comment to use "normal" cv::Mat instead of CV::UMat
 #define USE_HALF_SIZE_DISP // Comment to compute depth matching on full image
                            // frames
 
+#define PIPELINE_QUEUE_DEPTH 2 // Frames waiting for the stereo and detection stages
+
 // Define a no-op mouse callback function
 void noop(int event, int x, int y, int flags, void *userdata) {}
 
+// Data of a frame, filled by the pipeline stages
+struct FramePacket {
+  uint64_t frame_id = 0;   // Index of the frame
+  uint64_t timestamp = 0;  // Timestamp of the frame [nsec]
+  uint64_t start_time = 0; // Steady clock at the start of the processing [nsec]
+
+  cv::Mat left_rect;  // Left rectified BGR image, for visualization
+  cv::Mat left_gray;  // Left rectified gray image
+  cv::Mat right_gray; // Right rectified gray image
+  std::string remap_info;
+
+  cv::Mat left_disp_image; // Normalized and color remapped disparity map
+  cv::Mat left_depth_map;  // Depth map in float32
+  cv::Mat left_disp_map;   // Disparity map in float32, until the wall is known
+  std::string stereo_info;
+
+  std::vector<cv::Vec3f> circles; // Balls detected in the left image
+  cv::Mat cloudMat;               // Point cloud
+};
+
 int main(int argc, char *argv[]) {
-  // ----> Silence unused warning
-  (void)argc;
-  (void)argv;
-  // <---- Silence unused warning
+  // ----> Command line: detectball [recording_file [fast]] [--sparse]
+  std::string replay_file;
+  sl_oc::video::REPLAY_MODE replay_mode = sl_oc::video::REPLAY_MODE::REALTIME;
+  // Sparse mode: once the wall is defined, the depth of the balls is
+  // triangulated from the circles detected in both images, with no dense
+  // disparity map
+  bool sparse_mode = false;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--sparse")
+      sparse_mode = true;
+    else
+      args.push_back(argv[i]);
+  }
+  if (args.size() > 0)
+    replay_file = args[0];
+  if (args.size() > 1 && args[1] == "fast")
+    replay_mode = sl_oc::video::REPLAY_MODE::FAST;
+  // <---- Command line
 
   sl_oc::VERBOSITY verbose = sl_oc::VERBOSITY::INFO;
 
@@ -65,16 +111,96 @@ int main(int argc, char *argv[]) {
   sl_oc::video::VideoParams params;
 #ifdef EMBEDDED_ARM
   params.res = sl_oc::video::RESOLUTION::VGA;
+  // Keep the grabbing thread away from the OpenCV workers (requires CAP_SYS_NICE, a warning is printed otherwise)
+  params.rt_priority = 50;
+  params.cpu_affinity_mask = 0x8; // CPU 3
+  params.lock_buffers = true;
 #else
   params.res = sl_oc::video::RESOLUTION::HD720;
 #endif
   params.fps = sl_oc::video::FPS::FPS_30;
+  if (sparse_mode) {
+    // Without the dense matching the sensor limit is reachable
+    params.res = sl_oc::video::RESOLUTION::VGA;
+    params.fps = sl_oc::video::FPS::FPS_100;
+  }
   params.verbose = verbose;
+  // A recording is consumed frame by frame: the replay thread waits for the
+  // pipeline instead of dropping frames
+  if (!replay_file.empty())
+    params.frame_policy = sl_oc::video::FRAME_POLICY::KEEP_ALL;
   // <---- Set Video parameters
 
+  // ----> Calibration loading
+  // Lookup of the calibration file (local folders and embedded bundle first,
+  // then download) and rectification maps, mapped from the cache file or
+  // computed on the first run
+  struct CalibrationData {
+    bool valid = false;
+    std::shared_ptr<sl_oc::tools::RectificationMaps> maps;
+  };
+  auto load_calibration = [](int sn, cv::Size image_size) {
+    CalibrationData calib;
+    calib.maps = std::make_shared<sl_oc::tools::RectificationMaps>();
+    sl_oc::tools::CalibrationProvider provider;
+    std::string calibration_file = provider.resolve(sn).get();
+    if (calibration_file.empty()) {
+      std::cerr << "Could not find the calibration file of the camera "
+                << sn << std::endl;
+      return calib;
+    }
+    std::cout << "Calibration file found. Loading..." << std::endl;
+
+    calib.valid = calib.maps->load(sn, calibration_file, image_size);
+    if (calib.valid && calib.maps->fromCache())
+      std::cout << "Rectification maps loaded from the cache" << std::endl;
+    return calib;
+  };
+  // <---- Calibration loading
+
+  // ----> Start loading the calibration while the camera is opened
+  // The serial number of the camera is known in advance if it is in the
+  // device cache of a previous run: the camera with this serial number is
+  // opened.
+  const sl_oc::video::Resolution &res_size =
+      sl_oc::video::cameraResolution[static_cast<int>(params.res)];
+  cv::Size image_size(static_cast<int>(res_size.width),
+                      static_cast<int>(res_size.height));
+
+  int cached_sn = -1;
+  if (replay_file.empty()) {
+    for (int id = 0; id < 64 && cached_sn < 0; id++)
+      cached_sn = sl_oc::video::VideoCapture::lookupSerialNumber(id);
+  }
+
+  std::future<CalibrationData> calib_future;
+  if (cached_sn > 0)
+    calib_future =
+        std::async(std::launch::async, load_calibration, cached_sn, image_size);
+  // <---- Start loading the calibration while the camera is opened
+
   // ----> Create Video Capture
+  // The camera controls are reset in background: the first frame does not
+  // wait for them
+  params.async_control_reset = true;
+
   sl_oc::video::VideoCapture cap(params);
-  if (!cap.initializeVideo(-1)) {
+  bool opened = false;
+  if (!replay_file.empty()) {
+    cap.enableCaptureRing(true); // Stores the first frame of the replay too
+    opened = cap.initializeReplay(replay_file, replay_mode);
+  }
+  else if (cached_sn > 0) {
+    opened = cap.initializeVideoBySerial(cached_sn);
+    if (!opened) {
+      // Stale device cache: any camera, its calibration is reloaded below
+      std::cerr << "Camera sn " << cached_sn << " not found, opening the first available camera" << std::endl;
+      opened = cap.initializeVideo(-1);
+    }
+  }
+  else
+    opened = cap.initializeVideo(-1);
+  if (!opened) {
     std::cerr << "Cannot open camera video capture" << std::endl;
     std::cerr << "See verbosity level for more details." << std::endl;
 
@@ -84,31 +210,33 @@ int main(int argc, char *argv[]) {
   std::cout << "Connected to camera sn: " << sn << std::endl;
   // <---- Create Video Capture
 
-  // ----> Retrieve calibration file from Stereolabs server
-  std::string calibration_file;
-  // ZED Calibration
-  unsigned int serial_number = sn;
-  // Download camera calibration file
-  if (!sl_oc::tools::downloadCalibrationFile(serial_number, calibration_file)) {
-    std::cerr << "Could not load calibration file from Stereolabs servers"
-              << std::endl;
-    return EXIT_FAILURE;
-  }
-  std::cout << "Calibration file found. Loading..." << std::endl;
-
   // ----> Frame size
   int w, h;
   cap.getFrameSize(w, h);
   // <---- Frame size
 
   // ----> Initialize calibration
-  cv::Mat map_left_x, map_left_y;
-  cv::Mat map_right_x, map_right_y;
-  cv::Mat cameraMatrix_left, cameraMatrix_right;
-  double baseline = 0;
-  sl_oc::tools::initCalibration(
-      calibration_file, cv::Size(w / 2, h), map_left_x, map_left_y, map_right_x,
-      map_right_y, cameraMatrix_left, cameraMatrix_right, &baseline);
+  sl_oc::tools::StopWatch calib_clock;
+  CalibrationData calib;
+  if (calib_future.valid())
+    calib = calib_future.get();
+  if (sn != cached_sn || image_size != cv::Size(w / 2, h))
+    calib = load_calibration(sn, cv::Size(w / 2, h));
+  if (!calib.valid)
+    return EXIT_FAILURE;
+  std::cout << "Calibration ready after the camera opening: "
+            << calib_clock.toc() * 1e3 << " msec" << std::endl;
+
+  // Fixed-point maps: the "x" maps hold the CV_16SC2 pixel coordinates, the
+  // "y" maps the CV_16UC1 interpolation table indexes. `calib` keeps them
+  // mapped until the end of the program
+  cv::Mat map_left_x = calib.maps->map_left_1,
+          map_left_y = calib.maps->map_left_2;
+  cv::Mat map_right_x = calib.maps->map_right_1,
+          map_right_y = calib.maps->map_right_2;
+  cv::Mat cameraMatrix_left = calib.maps->cameraMatrix_left;
+  cv::Mat cameraMatrix_right = calib.maps->cameraMatrix_right;
+  double baseline = calib.maps->baseline;
 
   double fx = cameraMatrix_left.at<double>(0, 0);
   double fy = cameraMatrix_left.at<double>(1, 1);
@@ -122,50 +250,31 @@ int main(int argc, char *argv[]) {
             << cameraMatrix_right << std::endl
             << std::endl;
 
-#ifdef USE_OCV_TAPI
-  cv::UMat map_left_x_gpu =
-      map_left_x.getUMat(cv::ACCESS_READ, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
-  cv::UMat map_left_y_gpu =
-      map_left_y.getUMat(cv::ACCESS_READ, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
-  cv::UMat map_right_x_gpu =
-      map_right_x.getUMat(cv::ACCESS_READ, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
-  cv::UMat map_right_y_gpu =
-      map_right_y.getUMat(cv::ACCESS_READ, cv::USAGE_ALLOCATE_DEVICE_MEMORY);
-#endif
-  // ----> Initialize calibration
+  // <---- Initialize calibration
+
+  // ----> Initialize gray rectification
+  // Ball detection and stereo matching only need the intensity: the Y channel
+  // of the raw frame is sampled through the fixed-point maps straight into
+  // the rectified gray images, with no BGR conversion
+  sl_oc::video::RectifyMap gray_map_left, gray_map_right;
+  gray_map_left.xy = map_left_x.ptr<int16_t>();
+  gray_map_left.frac = map_left_y.ptr<uint16_t>();
+  gray_map_right.xy = map_right_x.ptr<int16_t>();
+  gray_map_right.frac = map_right_y.ptr<uint16_t>();
+
+  sl_oc::video::StereoRectifier gray_rectifier(
+      sl_oc::video::RECTIFY_FORMAT::GRAY, verbose);
+  if (!gray_rectifier.setMaps(w / 2, h, gray_map_left, gray_map_right))
+    return EXIT_FAILURE;
+  std::cout << "Gray rectification kernel: "
+            << gray_rectifier.getKernelName() << std::endl;
 
-  // ----> Declare OpenCV images
-#ifdef USE_OCV_TAPI
-  cv::UMat frameYUV; // Full frame side-by-side in YUV 4:2:2 format
-  cv::UMat frameBGR(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Full frame side-by-side in BGR
-                                         // format
-  cv::UMat left_raw(cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Left unrectified image
-  cv::UMat right_raw(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Right unrectified image
-  cv::UMat left_rect(cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Left rectified image
-  cv::UMat right_rect(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Right rectified image
-  cv::UMat left_for_matcher(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Left image for the stereo matcher
-  cv::UMat right_for_matcher(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Right image for the stereo matcher
-  cv::UMat left_disp_half(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Half sized disparity map
-  cv::UMat left_disp(cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Full output disparity
-  cv::UMat left_disp_float(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Final disparity map in float32
-  cv::UMat left_disp_image(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Normalized and color remapped
-                                         // disparity map to be displayed
-  cv::UMat left_depth_map(
-      cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Depth map in float32
-#else
-  cv::Mat frameBGR, left_raw, left_rect, right_raw, right_rect, frameYUV,
-      left_for_matcher, right_for_matcher, left_disp_half, left_disp,
-      left_disp_float, left_disp_vis;
-#endif
-  // <---- Declare OpenCV images
+  // Wrapping the buffers of the rectifier, no copy
+  cv::Mat left_gray(h, w / 2, CV_8UC1,
+                    const_cast<uint8_t *>(gray_rectifier.getLeft()));
+  cv::Mat right_gray(h, w / 2, CV_8UC1,
+                     const_cast<uint8_t *>(gray_rectifier.getRight()));
+  // <---- Initialize gray rectification
 
   // ----> Stereo matcher initialization
   sl_oc::tools::StereoSgbmPar stereoPar;
@@ -176,328 +285,370 @@ int main(int argc, char *argv[]) {
     stereoPar.save(); // Save default parameters.
   }
 
-  cv::Ptr<cv::StereoSGBM> left_matcher = cv::StereoSGBM::create(
-      stereoPar.minDisparity, stereoPar.numDisparities, stereoPar.blockSize);
-  left_matcher->setMinDisparity(stereoPar.minDisparity);
-  left_matcher->setNumDisparities(stereoPar.numDisparities);
-  left_matcher->setBlockSize(stereoPar.blockSize);
-  left_matcher->setP1(stereoPar.P1);
-  left_matcher->setP2(stereoPar.P2);
-  left_matcher->setDisp12MaxDiff(stereoPar.disp12MaxDiff);
-  left_matcher->setMode(stereoPar.mode);
-  left_matcher->setPreFilterCap(stereoPar.preFilterCap);
-  left_matcher->setUniquenessRatio(stereoPar.uniquenessRatio);
-  left_matcher->setSpeckleWindowSize(stereoPar.speckleWindowSize);
-  left_matcher->setSpeckleRange(stereoPar.speckleRange);
+  // The engine (SGBM, BM or census) is selected by `stereoEngine`
+  cv::Ptr<sl_oc::tools::IStereoMatcher> left_matcher =
+      sl_oc::tools::createStereoMatcher(stereoPar);
 
   stereoPar.print();
+  std::cout << "Stereo matcher: " << left_matcher->getName() << std::endl;
+
+  // Once the wall is defined, the disparities are searched only in a band
+  // around the wall plane: `wallBandMargin` behind it, the others in front
+  cv::Ptr<sl_oc::tools::IStereoMatcher> band_matcher;
+  if (stereoPar.wallBandDisparities > 0) {
+    sl_oc::tools::StereoSgbmPar bandPar = stereoPar;
+    bandPar.minDisparity = -stereoPar.wallBandMargin;
+    bandPar.numDisparities = stereoPar.wallBandDisparities;
+    band_matcher = sl_oc::tools::createStereoMatcher(bandPar);
+  }
   // <---- Stereo matcher initialization
 
-  // ----> Point Cloud
-  cv::Mat cloudMat;
-
-#ifdef HAVE_OPENCV_VIZ
-  cv::viz::Viz3d pc_viewer = cv::viz::Viz3d("Point Cloud");
+  // ----> Disparity to depth conversion
+  // A single pass turns the disparities of the matcher into the full size
+  // depth map, float disparity map and disparity image
+#ifdef USE_HALF_SIZE_DISP
+  const int disp_scale = 2;
+#else
+  const int disp_scale = 1;
 #endif
-  // <---- Point Cloud
-
-  uint64_t last_ts = 0; // Used to check new frame arrival
-
-  int target_wall_defined = 0;
-
-  // Infinite video grabbing loop
-  while (1) {
-
-    // ----> frame buffer
-
-    // buffer to store circles from several frames to find ball
-    std::vector<cv::Vec3f> left_circles_frames;
-    int n_buffer_frames = 10;
-
-    // fill buffer to detect circle
-    for (int i = 0; i < n_buffer_frames; i++) {
-
-      // Get a new frame from camera
-      const sl_oc::video::Frame frame = cap.getLastFrame();
+  cv::Mat disp_ramp(1, 256, CV_8UC1), disp_palette;
+  for (int i = 0; i < 256; i++)
+    disp_ramp.at<uint8_t>(0, i) = static_cast<uint8_t>(i);
+  cv::applyColorMap(disp_ramp, disp_palette, cv::COLORMAP_INFERNO);
+
+  sl_oc::video::DepthConverter depth_converter(verbose);
+  depth_converter.setParams(static_cast<float>(fx * baseline), disp_scale);
+  depth_converter.setColorMap(
+      disp_palette.ptr<uint8_t>(),
+      static_cast<float>(stereoPar.minDisparity - 1),
+      static_cast<float>(stereoPar.minDisparity - 1 +
+                         stereoPar.numDisparities));
+  std::cout << "Depth conversion kernel: " << depth_converter.getKernelName()
+            << std::endl;
+  // <---- Disparity to depth conversion
+
+  // ----> Pipeline
+  // Each stage runs in its own thread and passes the frames to the next one
+  // through a bounded queue. When a stage falls behind, the oldest frames
+  // waiting for it are dropped: the display always shows the freshest result.
+  //   rectify -> [stereo_queue] -> stereo -> [detect_queue] -> detect ->
+  //   [display_queue] -> display (main thread, required by the GUI)
+  sl_oc::tools::LatestQueue<FramePacket> stereo_queue(PIPELINE_QUEUE_DEPTH);
+  sl_oc::tools::LatestQueue<FramePacket> detect_queue(PIPELINE_QUEUE_DEPTH);
+  sl_oc::tools::LatestQueue<FramePacket> display_queue(1);
+  std::atomic<bool> running(true);
+  // The dense depth is always required to define the wall
+  std::atomic<bool> dense_required(true);
+
+  // Disparity plane of the wall, published by the display when the wall is
+  // defined and used by the stereo stage from the next frame
+  std::mutex wall_mutex;
+  std::shared_ptr<const sl_oc::tools::WallPlanePrior> wall_prior;
+  std::vector<cv::Rect> wall_rois; // Regions to be matched, all if empty
+
+  // ROI statistics of the stereo stage, read after it has been joined
+  uint64_t roi_frames = 0;     // Frames matched
+  uint64_t roi_pixels = 0;     // Pixels with a disparity
+  uint64_t matched_pixels = 0; // Pixels processed by the matcher
+  uint64_t image_pixels = 0;   // Pixels of the matcher images
+
+  // ----> Stage 1: grab and rectification
+  std::thread rectify_thread([&] {
+    cv::Mat left_raw; // Left unrectified image
+
+    const bool replay = cap.isReplay();
+
+    while (running) {
+      // Read before waiting for a frame: when the replay is finished, all its
+      // frames are already in the capture ring
+      bool replay_finished = cap.isReplayFinished();
+
+      // Replay: every frame of the recording, in order. Camera: lease on the
+      // last received frame, the frames received while this stage is busy are
+      // skipped
+      sl_oc::video::FrameLease lease =
+          replay ? cap.acquireNextFrame(100) : cap.acquireFrame(100);
+      if (!lease.isValid()) {
+        if (replay_finished)
+          break; // All the frames of the recording have been processed
+        continue;
+      }
+      const sl_oc::video::Frame &frame = lease.frame();
+
+      std::unique_ptr<FramePacket> packet(new FramePacket);
+      packet->frame_id = frame.frame_id;
+      packet->timestamp = frame.timestamp;
+      packet->start_time = getSteadyTimestamp();
+
+      sl_oc::tools::StopWatch remap_clock;
+
+      // ----> Left BGR image for visualization, conversion of the left half only
+      cv::Mat frameYUV(frame.height, frame.width, CV_8UC2, frame.data);
+      cv::cvtColor(frameYUV(cv::Rect(0, 0, frame.width / 2, frame.height)),
+                   left_raw, cv::COLOR_YUV2BGR_YUYV);
+      cv::remap(left_raw, packet->left_rect, map_left_x, map_left_y,
+                cv::INTER_AREA);
+      // <---- Left BGR image for visualization, conversion of the left half only
+
+      // ----> Gray images for the stereo matching and the ball detection
+      gray_rectifier.rectify(frame);
+      lease.release(); // The UVC buffer is no longer needed
+
+      // Copied: the buffers of the rectifier are rewritten by the next frame
+      left_gray.copyTo(packet->left_gray);
+      right_gray.copyTo(packet->right_gray);
+      // <---- Gray images for the stereo matching and the ball detection
+
+      double remap_elapsed = remap_clock.toc();
+      std::stringstream remapElabInfo;
+      remapElabInfo << "Rectif. processing: " << remap_elapsed
+                    << " sec - Freq: " << 1. / remap_elapsed;
+      packet->remap_info = remapElabInfo.str();
+
+      stereo_queue.push(std::move(packet));
+    }
 
-      // ----> If the frame is valid we can convert, rectify and display it
-      if (frame.data != nullptr && frame.timestamp != last_ts) {
-        last_ts = frame.timestamp;
+    stereo_queue.close();
+  });
+  // <---- Stage 1: grab and rectification
 
-        // ----> Conversion from YUV 4:2:2 to BGR for visualization
+  // ----> Stage 2: stereo matching and depth
+  std::thread stereo_thread([&] {
+    // ----> Declare OpenCV images
+    // The OpenCL images stay in this thread
 #ifdef USE_OCV_TAPI
-        cv::Mat frameYUV_cpu =
-            cv::Mat(frame.height, frame.width, CV_8UC2, frame.data);
-        frameYUV = frameYUV_cpu.getUMat(cv::ACCESS_READ,
-                                        cv::USAGE_ALLOCATE_HOST_MEMORY);
+    cv::UMat left_for_matcher(
+        cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Left image for the stereo matcher
+    cv::UMat right_for_matcher(
+        cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Right image for the stereo matcher
+    cv::UMat left_disp_half(
+        cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Half sized disparity map
+    cv::UMat roi_disp(
+        cv::USAGE_ALLOCATE_DEVICE_MEMORY); // Disparity map of the ROIs
 #else
-        frameYUV = cv::Mat(frame.height, frame.width, CV_8UC2, frame.data);
+    cv::Mat left_for_matcher, right_for_matcher, left_disp_half, roi_disp;
 #endif
-        cv::cvtColor(frameYUV, frameBGR, cv::COLOR_YUV2BGR_YUYV);
-        // <---- Conversion from YUV 4:2:2 to BGR for visualization
-
-        // ----> Extract left and right images from side-by-side
-        left_raw = frameBGR(cv::Rect(0, 0, frameBGR.cols / 2, frameBGR.rows));
-        right_raw = frameBGR(
-            cv::Rect(frameBGR.cols / 2, 0, frameBGR.cols / 2, frameBGR.rows));
-        // <---- Extract left and right images from side-by-side
+    // <---- Declare OpenCV images
 
-        // ----> Apply rectification
-        sl_oc::tools::StopWatch remap_clock;
+    // ----> Wall band images
+    // Rebuilt when a new wall plane is published
+    std::shared_ptr<const sl_oc::tools::WallPlanePrior> band_prior;
+    cv::Mat band_warp_1, band_warp_2, band_plane_disp, band_outside;
 #ifdef USE_OCV_TAPI
-        cv::remap(left_raw, left_rect, map_left_x_gpu, map_left_y_gpu,
-                  cv::INTER_AREA);
-        cv::remap(right_raw, right_rect, map_right_x_gpu, map_right_y_gpu,
-                  cv::INTER_AREA);
-#else
-        cv::remap(left_raw, left_rect, map_left_x, map_left_y, cv::INTER_AREA);
-        cv::remap(right_raw, right_rect, map_right_x, map_right_y,
-                  cv::INTER_AREA);
-#endif
-        double remap_elapsed = remap_clock.toc();
-        std::stringstream remapElabInfo;
-        remapElabInfo << "Rectif. processing: " << remap_elapsed
-                      << " sec - Freq: " << 1. / remap_elapsed;
-        // <---- Apply rectification
-
-        // ----> Stereo matching
-        sl_oc::tools::StopWatch stereo_clock;
-        double resize_fact = 1.0;
-#ifdef USE_HALF_SIZE_DISP
-        resize_fact = 0.5;
-        // Resize the original images to improve performances
-        cv::resize(left_rect, left_for_matcher, cv::Size(), resize_fact,
-                   resize_fact, cv::INTER_AREA);
-        cv::resize(right_rect, right_for_matcher, cv::Size(), resize_fact,
-                   resize_fact, cv::INTER_AREA);
+    cv::UMat band_warp_1_gpu, band_warp_2_gpu, right_warped;
 #else
-        left_for_matcher = left_rect;   // No data copy
-        right_for_matcher = right_rect; // No data copy
+    cv::Mat &band_warp_1_gpu = band_warp_1, &band_warp_2_gpu = band_warp_2;
+    cv::Mat right_warped;
 #endif
-        // Apply stereo matching
-        left_matcher->compute(left_for_matcher, right_for_matcher,
-                              left_disp_half);
+    // <---- Wall band images
+
+    for (;;) {
+      std::unique_ptr<FramePacket> packet = stereo_queue.pop(100);
+      if (!packet) {
+        if (stereo_queue.isClosed())
+          break;
+        continue;
+      }
 
-        left_disp_half.convertTo(left_disp_float, CV_32FC1);
-        cv::multiply(
-            left_disp_float, 1. / 16.,
-            left_disp_float); // Last 4 bits of SGBM disparity are decimal
+      // Sparse mode: the detection stage triangulates the balls
+      if (!dense_required) {
+        detect_queue.push(std::move(packet));
+        continue;
+      }
 
+      // ----> Stereo matching
+      sl_oc::tools::StopWatch stereo_clock;
+      double resize_fact = 1.0;
 #ifdef USE_HALF_SIZE_DISP
-        cv::multiply(
-            left_disp_float, 2.,
-            left_disp_float); // Last 4 bits of SGBM disparity are decimal
-        cv::UMat tmp = left_disp_float; // Required for OpenCV 3.2
-        cv::resize(tmp, left_disp_float, cv::Size(), 1. / resize_fact,
-                   1. / resize_fact, cv::INTER_AREA);
+      resize_fact = 0.5;
+      // Resize the original images to improve performances
+      cv::resize(packet->left_gray, left_for_matcher, cv::Size(), resize_fact,
+                 resize_fact, cv::INTER_AREA);
+      cv::resize(packet->right_gray, right_for_matcher, cv::Size(),
+                 resize_fact, resize_fact, cv::INTER_AREA);
 #else
-        left_disp = left_disp_float;
+      packet->left_gray.copyTo(left_for_matcher);
+      packet->right_gray.copyTo(right_for_matcher);
 #endif
+      // ----> Wall plane prior and ROIs
+      std::shared_ptr<const sl_oc::tools::WallPlanePrior> prior;
+      std::vector<cv::Rect> rois;
+      {
+        std::lock_guard<std::mutex> lock(wall_mutex);
+        if (band_matcher)
+          prior = wall_prior;
+        rois = wall_rois;
+      }
+      if (prior != band_prior) {
+        band_prior = prior;
+        if (band_prior) {
+          band_prior->buildMaps(left_for_matcher.size(), resize_fact,
+                                band_warp_1, band_warp_2, band_plane_disp,
+                                band_outside);
+#ifdef USE_OCV_TAPI
+          band_warp_1.copyTo(band_warp_1_gpu);
+          band_warp_2.copyTo(band_warp_2_gpu);
+#endif
+        }
+      }
 
-        double elapsed = stereo_clock.toc();
-        std::stringstream stereoElabInfo;
-        stereoElabInfo << "Stereo processing: " << elapsed
-                       << " sec - Freq: " << 1. / elapsed;
-        // <---- Stereo matching
-
-        // ----> Show disparity image
-        cv::add(left_disp_float,
-                -static_cast<double>(stereoPar.minDisparity - 1),
-                left_disp_float); // Minimum disparity offset correction
-        cv::multiply(left_disp_float, 1. / stereoPar.numDisparities,
-                     left_disp_image, 255.,
-                     CV_8UC1); // Normalization and rescaling
-
-        cv::applyColorMap(left_disp_image, left_disp_image,
-                          cv::COLORMAP_INFERNO);
-        // <---- Show disparity image
-
-        // ----> Extract Depth map
-        // The DISPARITY MAP can be now transformed in DEPTH MAP using the
-        // formula depth = (f * B) / disparity where 'f' is the camera focal,
-        // 'B' is the camera baseline, 'disparity' is the pixel disparity
-
-        double num = static_cast<double>(fx * baseline);
-        cv::divide(num, left_disp_float, left_depth_map);
-
-        float central_depth =
-            left_depth_map.getMat(cv::ACCESS_READ)
-                .at<float>(left_depth_map.rows / 2, left_depth_map.cols / 2);
-        std::cout << "Depth of the central pixel: " << central_depth << " mm"
-                  << std::endl;
-        // <---- Extract Depth map
-
-        // ----> define target wall
-        while (target_wall_defined == 0) {
-          // display left_rect
-          cv::namedWindow("Define Target Wall", cv::WINDOW_NORMAL);
-          cv::imshow("Define Target Wall", left_rect);
-
-          //   store original left_rect if having to redo corners
-          cv::UMat left_rect_original = left_rect.clone();
-
-          // Define a struct to hold the variables you need to access in the
-          // callback
-          struct CallbackData {
-            cv::UMat *left_rect;
-            std::vector<cv::Point> *points;
-          };
-
-          // Define a vector to store the points
-          std::vector<cv::Point> points;
-
-          // Create an instance of the struct and set the variables
-          CallbackData data;
-          data.left_rect = &left_rect;
-          data.points = &points;
-
-          // Define the callback function
-          auto MouseCallback = [](int event, int x, int y, int,
-                                  void *userdata) {
-            // Cast userdata to CallbackData*
-            CallbackData *data = reinterpret_cast<CallbackData *>(userdata);
-
-            if (event == cv::EVENT_LBUTTONDOWN) {
-              data->points->push_back(cv::Point(x, y));
-
-              // Draw a large red X on the location that was clicked
-              cv::line(*data->left_rect, cv::Point(x - 10, y - 10),
-                       cv::Point(x + 10, y + 10), cv::Scalar(0, 0, 255), 2);
-              cv::line(*data->left_rect, cv::Point(x - 10, y + 10),
-                       cv::Point(x + 10, y - 10), cv::Scalar(0, 0, 255), 2);
-
-              // Update the image display
-              cv::imshow("Define Target Wall", *data->left_rect);
-            }
-          };
-
-          // Define the points
-          cv::Point bottomLeft, bottomRight, topRight;
-
-          // Set the mouse callback function
-          cv::setMouseCallback("Define Target Wall", MouseCallback, &data);
-
-          // Get the bottom left point
-          std::cout
-              << "Left click on the bottom left corner of the playing wall"
-              << std::endl;
-          while (points.empty()) {
-            cv::waitKey(1);
-          }
-          bottomLeft = points.back();
-          points.clear();
-
-          // Get the bottom right point
-          std::cout
-              << "Left click on the bottom right corner of the playing wall"
-              << std::endl;
-          while (points.empty()) {
-            cv::waitKey(1);
-          }
-          bottomRight = points.back();
-          points.clear();
-
-          // Get the top right point
-          std::cout << "Left click on the top right corner of the playing wall"
-                    << std::endl;
-          while (points.empty()) {
-            cv::waitKey(1);
-          }
-          topRight = points.back();
-          points.clear();
-
-          // Deactivate the mouse callback function
-          cv::setMouseCallback("Define Target Wall", noop, nullptr);
-
-          // Print the coordinates of the points
-          std::cout << "Bottom Left: (" << bottomLeft.x << ", " << bottomLeft.y
-                    << ")" << std::endl;
-          std::cout << "Bottom Right: (" << bottomRight.x << ", "
-                    << bottomRight.y << ")" << std::endl;
-          std::cout << "Top Right: (" << topRight.x << ", " << topRight.y << ")"
-                    << std::endl;
-
-          //   get missing corner of parallelogram
-          cv::Point topLeft;
-          topLeft.x = bottomLeft.x + (topRight.x - bottomRight.x);
-          topLeft.y = bottomLeft.y + (topRight.y - bottomRight.y);
-
-          //   draw target playing wall
-          cv::line(left_rect, bottomLeft, bottomRight, cv::Scalar(0, 0, 255),
-                   2);
-          cv::line(left_rect, bottomRight, topRight, cv::Scalar(0, 0, 255), 2);
-          cv::line(left_rect, topRight, topLeft, cv::Scalar(0, 0, 255), 2);
-          cv::line(left_rect, topLeft, bottomLeft, cv::Scalar(0, 0, 255), 2);
-
-          //  update image with playing area
-          cv::imshow("Define Target Wall", left_rect);
-
-          // ----> distance of 4 corners, top bottom left right
-          float bottomLeft_depth = left_depth_map.getMat(cv::ACCESS_READ)
-                                       .at<float>(bottomLeft.x, bottomLeft.y);
-          float bottomRight_depth =
-              left_depth_map.getMat(cv::ACCESS_READ)
-                  .at<float>(bottomRight.x, bottomRight.y);
-          float topRight_depth = left_depth_map.getMat(cv::ACCESS_READ)
-                                     .at<float>(topRight.x, topRight.y);
-          float topLeft_depth = left_depth_map.getMat(cv::ACCESS_READ)
-                                    .at<float>(topLeft.x, topLeft.y);
-
-          // Check if any depth value is negative
-          if (bottomLeft_depth < 0 || bottomRight_depth < 0 ||
-              topRight_depth < 0 || topLeft_depth < 0) {
-            std::cout << "Negative depth value detected, skipping frame..."
-                      << std::endl;
+      // The ROIs are defined on the rectified images
+      for (cv::Rect &roi : rois)
+        roi = cv::Rect(cvFloor(roi.x * resize_fact),
+                       cvFloor(roi.y * resize_fact),
+                       cvCeil(roi.width * resize_fact),
+                       cvCeil(roi.height * resize_fact));
+      // <---- Wall plane prior and ROIs
+
+      // Apply stereo matching
+      cv::Ptr<sl_oc::tools::IStereoMatcher> matcher = left_matcher;
+      if (band_prior) {
+        // The right image is warped on the wall plane: the matcher searches
+        // only the residual disparity w.r.t. the wall
+        cv::remap(right_for_matcher, right_warped, band_warp_1_gpu,
+                  band_warp_2_gpu, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+        matcher = band_matcher;
+      }
+      auto &right_matched = band_prior ? right_warped : right_for_matcher;
+
+      // ----> ROI restricted matching
+      // Only the bounding region of the ROIs is processed, padded for the
+      // block size and the disparity range. The disparities outside the
+      // ROIs are invalid
+      cv::Rect valid_rect;
+      cv::Rect match_rect = sl_oc::tools::getStereoMatchingRegion(
+          rois, left_for_matcher.size(), matcher->getBlockSize(),
+          matcher->getMinDisparity(), matcher->getNumDisparities(),
+          valid_rect);
+
+      if (match_rect.area() == left_for_matcher.size().area()) {
+        matcher->compute(left_for_matcher, right_matched, left_disp_half);
+      } else {
+        matcher->compute(left_for_matcher(match_rect),
+                         right_matched(match_rect), roi_disp);
+
+        left_disp_half.create(left_for_matcher.size(), CV_16SC1);
+        left_disp_half.setTo(
+            cv::Scalar((matcher->getMinDisparity() - 1) * 16)); // Invalid
+        roi_disp(cv::Rect(valid_rect.x - match_rect.x,
+                          valid_rect.y - match_rect.y, valid_rect.width,
+                          valid_rect.height))
+            .copyTo(left_disp_half(valid_rect));
+      }
 
-            //  use left_rect_original to overwrite left_rect
-            left_rect = left_rect_original.clone();
+      roi_frames++;
+      roi_pixels += static_cast<uint64_t>(valid_rect.area());
+      matched_pixels += static_cast<uint64_t>(match_rect.area());
+      image_pixels += static_cast<uint64_t>(left_for_matcher.size().area());
+      // <---- ROI restricted matching
+
+      // ----> Disparity to depth
+      // The DISPARITY MAP is transformed in DEPTH MAP using the formula
+      // depth = (f * B) / disparity where 'f' is the camera focal, 'B' is the
+      // camera baseline, 'disparity' is the pixel disparity. The disparities
+      // are scaled to the full size, the disparity image is colored and the
+      // float disparity map (used by the display to fit the wall plane) is
+      // written in the same pass
+      cv::Size full_size(left_disp_half.cols * disp_scale,
+                         left_disp_half.rows * disp_scale);
+      packet->left_depth_map.create(full_size, CV_32FC1);
+      packet->left_disp_image.create(full_size, CV_8UC3);
+
+      sl_oc::video::DepthOutput depth_out;
+      depth_out.depth = packet->left_depth_map.ptr<float>();
+      depth_out.depth_stride = packet->left_depth_map.step1();
+      depth_out.color = packet->left_disp_image.ptr<uint8_t>();
+      depth_out.color_stride = packet->left_disp_image.step;
+      if (!band_prior) {
+        packet->left_disp_map.create(full_size, CV_32FC1);
+        depth_out.disparity = packet->left_disp_map.ptr<float>();
+        depth_out.disparity_stride = packet->left_disp_map.step1();
+      }
 
-            // clear image to redo corner definition
-            cv::imshow("Define Target Wall", left_rect);
+      // With the wall band, the matcher found the residual disparity w.r.t.
+      // the wall plane. Outside the wall the plane is meaningless: the
+      // pixels are reported as invalid, as by the full matcher
+      sl_oc::video::DisparityOffset band_offset;
+      if (band_prior) {
+        band_offset.offset = band_plane_disp.ptr<float>();
+        band_offset.offset_stride = band_plane_disp.step1();
+        band_offset.invalid = band_outside.ptr<uint8_t>();
+        band_offset.invalid_stride = band_outside.step;
+      }
 
-            continue; // continue with the next frame to redo corners
-          }
-          std::cout << "Depth of the bottom left corner: " << bottomLeft_depth
-                    << " mm" << std::endl;
-          std::cout << "Depth of the bottom right corner: " << bottomRight_depth
-                    << " mm" << std::endl;
-          std::cout << "Depth of the top right corner: " << topRight_depth
-                    << " mm" << std::endl;
-          std::cout << "Depth of the top left corner: " << topLeft_depth
-                    << " mm" << std::endl;
-          // <---- distance of 4 corners
-
-          target_wall_defined = 1;
-          // <---- define target wall
-        }
+      {
+#ifdef USE_OCV_TAPI
+        cv::Mat disp_raw = left_disp_half.getMat(cv::ACCESS_READ);
+#else
+        const cv::Mat &disp_raw = left_disp_half;
+#endif
+        depth_converter.convert(disp_raw.ptr<int16_t>(), disp_raw.cols,
+                                disp_raw.rows, disp_raw.step1(),
+                                matcher->getMinDisparity(), depth_out,
+                                band_prior ? &band_offset : nullptr);
+      }
+      // <---- Disparity to depth
+
+      double elapsed = stereo_clock.toc();
+      std::stringstream stereoElabInfo;
+      stereoElabInfo << "Stereo processing: " << elapsed
+                     << " sec - Freq: " << 1. / elapsed;
+      packet->stereo_info = stereoElabInfo.str();
+      // <---- Stereo matching
+
+      // `0` if the disparity of the central pixel is invalid
+      float central_depth = packet->left_depth_map.at<float>(
+          packet->left_depth_map.rows / 2, packet->left_depth_map.cols / 2);
+      std::cout << "Depth of the central pixel: " << central_depth << " mm"
+                << std::endl;
+
+      detect_queue.push(std::move(packet));
+    }
 
-        // ----> Detect ball
-        // tuning parameters
-        int threshold_bin_min = 40;
-        int threshold_bin_max = 255;
-        int threshold_diameter_min = 0;
-        int threshold_diameter_max = 0;
-        int HoughCircles_EdgeDetect =
-            100; // usually 100-200, lower = more edges detected
-        int HoughCircles_CircleDetect =
-            35; // usually 20-100, lower = more circles detected
-        int GaussianBlur_kernel = 9; // 9 size of Gaussian kernel
-        int GaussianBlur_std = 2; // 2 standard deviation in X and Y directions
-
-        // Convert image to grayscale
-        cv::Mat left_gray;
-        cv::Mat right_gray;
-        cv::cvtColor(right_rect, right_gray, cv::COLOR_BGR2GRAY);
-        cv::cvtColor(left_rect, left_gray, cv::COLOR_BGR2GRAY);
+    detect_queue.close();
+  });
+  // <---- Stage 2: stereo matching and depth
+
+  // ----> Stage 3: ball detection and point cloud
+  // Sparse mode: the balls closer than the minimum depth are discarded
+  sl_oc::tools::BallMatchPar ball_par;
+  ball_par.maxDisparity =
+      static_cast<float>(fx * baseline / stereoPar.minDepth_mm);
+
+  std::thread detect_thread([&] {
+    for (;;) {
+      std::unique_ptr<FramePacket> packet = detect_queue.pop(100);
+      if (!packet) {
+        if (detect_queue.isClosed())
+          break;
+        continue;
+      }
 
+      // ----> Detect ball
+      // tuning parameters
+      // The gray images are the limited-range luma [16,235] of the frame: 50
+      // is the level 40 of the full-range BGR2GRAY conversion (16+40*219/255)
+      int threshold_bin_min = 50;
+      int threshold_bin_max = 255;
+      int threshold_diameter_min = 0;
+      int threshold_diameter_max = 0;
+      int HoughCircles_EdgeDetect =
+          100; // usually 100-200, lower = more edges detected
+      int HoughCircles_CircleDetect =
+          35; // usually 20-100, lower = more circles detected
+      int GaussianBlur_kernel = 9; // 9 size of Gaussian kernel
+      int GaussianBlur_std = 2; // 2 standard deviation in X and Y directions
+
+      // The rectified grayscale images come from `gray_rectifier`
+      auto detect_circles = [&](const cv::Mat &gray) {
         // Apply a binary threshold to the grayscale image
-        cv::Mat left_bin;
-        cv::threshold(left_gray, left_bin, threshold_bin_min, threshold_bin_max,
+        cv::Mat bin;
+        cv::threshold(gray, bin, threshold_bin_min, threshold_bin_max,
                       cv::THRESH_BINARY);
 
         // Blur the binary grayscale image
-        cv::Mat left_blurred;
-        cv::GaussianBlur(left_bin, left_blurred,
+        cv::Mat blurred;
+        cv::GaussianBlur(bin, blurred,
                          cv::Size(GaussianBlur_kernel, GaussianBlur_kernel),
                          GaussianBlur_std, GaussianBlur_std);
 
@@ -507,11 +658,42 @@ int main(int argc, char *argv[]) {
 
         // detect circles (x, y, radius) by using
         // Hough Circle Transform of binary image
-        std::vector<cv::Vec3f> left_circles;
-        cv::HoughCircles(left_blurred, left_circles, cv::HOUGH_GRADIENT, 1,
-                         left_blurred.rows / 8, HoughCircles_EdgeDetect,
+        std::vector<cv::Vec3f> circles;
+        cv::HoughCircles(blurred, circles, cv::HOUGH_GRADIENT, 1,
+                         blurred.rows / 8, HoughCircles_EdgeDetect,
                          HoughCircles_CircleDetect, radius_min, radius_max);
+        return circles;
+      };
+
+      std::vector<cv::Vec3f> left_circles = detect_circles(packet->left_gray);
+
+      const cv::Mat &left_depth_map = packet->left_depth_map;
+
+      if (left_depth_map.empty()) {
+        // ----> Sparse depth
+        // The balls are matched along the epipolar rows of the right image
+        // and their centers triangulated
+        std::vector<cv::Vec3f> right_circles =
+            detect_circles(packet->right_gray);
+
+        std::vector<sl_oc::tools::BallObservation> balls =
+            sl_oc::tools::matchBalls(left_circles, right_circles,
+                                     packet->left_gray, packet->right_gray,
+                                     cameraMatrix_left, baseline, ball_par);
+
+        for (const sl_oc::tools::BallObservation &ball : balls) {
+          std::cout << "Circle " << ball.left_index << " at (x,y,z) = ("
+                    << cvRound(ball.left.x) << ", " << cvRound(ball.left.y)
+                    << ", " << ball.position.z << ") with diameter "
+                    << cvRound(ball.radius) * 2
+                    << " - disparity: " << ball.disparity << " px"
+                    << std::endl;
 
+          // Drawn on the original image by the display
+          packet->circles.push_back(left_circles[ball.left_index]);
+        }
+        // <---- Sparse depth
+      } else {
         // find circle and calculate its depth using the depth map
         for (size_t i = 0; i < left_circles.size(); i++) {
           cv::Point center(cvRound(left_circles[i][0]),
@@ -533,61 +715,330 @@ int main(int argc, char *argv[]) {
           }
 
           // using left_depth_map get depth at circle position x,y
-          float depth = left_depth_map.getMat(cv::ACCESS_READ)
-                            .at<float>(center.y, center.x);
+          float depth = left_depth_map.at<float>(center.y, center.x);
 
-          // Print circle position, diameter and distance using left_disp_image
-          std::cout << "Circle " << i << " at (x,y,z) = (" << center.x << ", "
-                    << center.y << ", " << depth << ") with diameter "
-                    << diameter << std::endl;
-
-          // Draw the circle on the original image
-          int line_thickness = 5; // [pixels]
-          int line_type = 8;      // 8-connected line
-          cv::circle(left_rect, center, radius, cv::Scalar(0, 0, 255),
-                     line_thickness, line_type, 0);
+          // Print circle position, diameter and distance using
+          // left_disp_image
+          std::cout << "Circle " << i << " at (x,y,z) = (" << center.x
+                    << ", " << center.y << ", " << depth
+                    << ") with diameter " << diameter << std::endl;
 
-          // Show the image, now including the detected circle
-          sl_oc::tools::showImage("Left rect.", left_rect, params.res, true,
-                                  remapElabInfo.str());
+          // Drawn on the original image by the display
+          packet->circles.push_back(left_circles[i]);
         }
+      }
+      // <---- Detect ball
 
-        // <---- Detect ball
+      // ----> Create Point Cloud
+      if (left_depth_map.empty()) {
+        // No dense depth in sparse mode
+        display_queue.push(std::move(packet));
+        continue;
+      }
 
-        // ----> Create Point Cloud
-        sl_oc::tools::StopWatch pc_clock;
-        size_t buf_size =
-            static_cast<size_t>(left_depth_map.cols * left_depth_map.rows);
-        std::vector<cv::Vec3d> buffer(
-            buf_size, cv::Vec3f::all(std::numeric_limits<float>::quiet_NaN()));
-        cv::Mat depth_map_cpu = left_depth_map.getMat(cv::ACCESS_READ);
-        float *depth_vec = (float *)(&(depth_map_cpu.data[0]));
+      size_t buf_size =
+          static_cast<size_t>(left_depth_map.cols * left_depth_map.rows);
+      std::vector<cv::Vec3d> buffer(
+          buf_size, cv::Vec3f::all(std::numeric_limits<float>::quiet_NaN()));
+      const float *depth_vec = (const float *)(&(left_depth_map.data[0]));
 
 #pragma omp parallel for
-        for (size_t idx = 0; idx < buf_size; idx++) {
-          size_t r = idx / left_depth_map.cols;
-          size_t c = idx % left_depth_map.cols;
-          double depth = static_cast<double>(depth_vec[idx]);
-          // std::cout << depth << " ";
-          if (!isinf(depth) && depth >= 0 && depth > stereoPar.minDepth_mm &&
-              depth < stereoPar.maxDepth_mm) {
-            buffer[idx].val[2] = depth;                 // Z
-            buffer[idx].val[0] = (c - cx) * depth / fx; // X
-            buffer[idx].val[1] = (r - cy) * depth / fy; // Y
+      for (size_t idx = 0; idx < buf_size; idx++) {
+        size_t r = idx / left_depth_map.cols;
+        size_t c = idx % left_depth_map.cols;
+        double depth = static_cast<double>(depth_vec[idx]);
+        // std::cout << depth << " ";
+        if (!isinf(depth) && depth >= 0 && depth > stereoPar.minDepth_mm &&
+            depth < stereoPar.maxDepth_mm) {
+          buffer[idx].val[2] = depth;                 // Z
+          buffer[idx].val[0] = (c - cx) * depth / fx; // X
+          buffer[idx].val[1] = (r - cy) * depth / fy; // Y
+        }
+      }
+
+      packet->cloudMat = cv::Mat(left_depth_map.rows, left_depth_map.cols,
+                                 CV_64FC3, &buffer[0])
+                             .clone();
+      // <---- Create Point Cloud
+
+      display_queue.push(std::move(packet));
+    }
+
+    display_queue.close();
+  });
+  // <---- Stage 3: ball detection and point cloud
+  // <---- Pipeline
+
+  // ----> Point Cloud
+  cv::Mat cloudMat;
+  cv::Mat cloudColors;
+
+#ifdef HAVE_OPENCV_VIZ
+  cv::viz::Viz3d pc_viewer = cv::viz::Viz3d("Point Cloud");
+#endif
+  // <---- Point Cloud
+
+  uint64_t last_frame_id = 0; // Used to check the frame order
+  uint64_t displayed_frames = 0;
+  sl_oc::video::LatencyHistogram pipeline_latency;
+
+  int target_wall_defined = 0;
+
+  bool startup_reported = false; // The startup report is printed once
+
+  // ----> Stage 4: display, in the main thread
+  for (;;) {
+    std::unique_ptr<FramePacket> packet = display_queue.pop(5);
+    if (!packet && display_queue.isClosed())
+      break; // End of the recording file when replaying
+
+    if (packet) {
+      // The queues deliver the frames in order
+      if (displayed_frames > 0 && packet->frame_id <= last_frame_id)
+        std::cerr << "Frame " << packet->frame_id << " out of order"
+                  << std::endl;
+      last_frame_id = packet->frame_id;
+      displayed_frames++;
+
+      // ----> Startup timing report
+      if (!startup_reported && !cap.isReplay()) {
+        startup_reported = true;
+        sl_oc::video::StartupReport startup = cap.getStartupReport();
+        std::cout << "Startup [msec] - discovery: "
+                  << startup.discovery_usec / 1e3
+                  << " - serial number: " << startup.serial_usec / 1e3
+                  << (startup.serial_cached ? " (cached)" : "")
+                  << " - setup: " << startup.setup_usec / 1e3
+                  << " - stream start: " << startup.stream_start_usec / 1e3
+                  << " - first frame: " << startup.first_frame_usec / 1e3
+                  << " - controls reset: "
+                  << (cap.waitControlReset(0)
+                          ? std::to_string(startup.control_reset_usec / 1e3)
+                          : std::string("pending"))
+                  << std::endl;
+      }
+      // <---- Startup timing report
+
+      cv::Mat &left_rect = packet->left_rect;
+      const cv::Mat &left_depth_map = packet->left_depth_map;
+
+      // ----> define target wall
+      while (target_wall_defined == 0) {
+        // display left_rect
+        cv::namedWindow("Define Target Wall", cv::WINDOW_NORMAL);
+        cv::imshow("Define Target Wall", left_rect);
+
+        //   store original left_rect if having to redo corners
+        cv::Mat left_rect_original = left_rect.clone();
+
+        // Define a struct to hold the variables you need to access in the
+        // callback
+        struct CallbackData {
+          cv::Mat *left_rect;
+          std::vector<cv::Point> *points;
+        };
+
+        // Define a vector to store the points
+        std::vector<cv::Point> points;
+
+        // Create an instance of the struct and set the variables
+        CallbackData data;
+        data.left_rect = &left_rect;
+        data.points = &points;
+
+        // Define the callback function
+        auto MouseCallback = [](int event, int x, int y, int,
+                                void *userdata) {
+          // Cast userdata to CallbackData*
+          CallbackData *data = reinterpret_cast<CallbackData *>(userdata);
+
+          if (event == cv::EVENT_LBUTTONDOWN) {
+            data->points->push_back(cv::Point(x, y));
+
+            // Draw a large red X on the location that was clicked
+            cv::line(*data->left_rect, cv::Point(x - 10, y - 10),
+                     cv::Point(x + 10, y + 10), cv::Scalar(0, 0, 255), 2);
+            cv::line(*data->left_rect, cv::Point(x - 10, y + 10),
+                     cv::Point(x + 10, y - 10), cv::Scalar(0, 0, 255), 2);
+
+            // Update the image display
+            cv::imshow("Define Target Wall", *data->left_rect);
+          }
+        };
+
+        // Define the points
+        cv::Point bottomLeft, bottomRight, topRight;
+
+        // Set the mouse callback function
+        cv::setMouseCallback("Define Target Wall", MouseCallback, &data);
+
+        // Get the bottom left point
+        std::cout << "Left click on the bottom left corner of the playing wall"
+                  << std::endl;
+        while (points.empty()) {
+          cv::waitKey(1);
+        }
+        bottomLeft = points.back();
+        points.clear();
+
+        // Get the bottom right point
+        std::cout
+            << "Left click on the bottom right corner of the playing wall"
+            << std::endl;
+        while (points.empty()) {
+          cv::waitKey(1);
+        }
+        bottomRight = points.back();
+        points.clear();
+
+        // Get the top right point
+        std::cout << "Left click on the top right corner of the playing wall"
+                  << std::endl;
+        while (points.empty()) {
+          cv::waitKey(1);
+        }
+        topRight = points.back();
+        points.clear();
+
+        // Deactivate the mouse callback function
+        cv::setMouseCallback("Define Target Wall", noop, nullptr);
+
+        // Print the coordinates of the points
+        std::cout << "Bottom Left: (" << bottomLeft.x << ", " << bottomLeft.y
+                  << ")" << std::endl;
+        std::cout << "Bottom Right: (" << bottomRight.x << ", "
+                  << bottomRight.y << ")" << std::endl;
+        std::cout << "Top Right: (" << topRight.x << ", " << topRight.y << ")"
+                  << std::endl;
+
+        //   get missing corner of parallelogram
+        cv::Point topLeft;
+        topLeft.x = bottomLeft.x + (topRight.x - bottomRight.x);
+        topLeft.y = bottomLeft.y + (topRight.y - bottomRight.y);
+
+        //   draw target playing wall
+        cv::line(left_rect, bottomLeft, bottomRight, cv::Scalar(0, 0, 255), 2);
+        cv::line(left_rect, bottomRight, topRight, cv::Scalar(0, 0, 255), 2);
+        cv::line(left_rect, topRight, topLeft, cv::Scalar(0, 0, 255), 2);
+        cv::line(left_rect, topLeft, bottomLeft, cv::Scalar(0, 0, 255), 2);
+
+        //  update image with playing area
+        cv::imshow("Define Target Wall", left_rect);
+
+        // ----> distance of 4 corners, top bottom left right
+        // `0` for the invalid disparities and for the corners outside the
+        // image (the computed top left corner)
+        auto depth_at = [&](const cv::Point &pt) {
+          if (!cv::Rect(0, 0, left_depth_map.cols, left_depth_map.rows)
+                   .contains(pt))
+            return 0.f;
+          return left_depth_map.at<float>(pt.y, pt.x);
+        };
+        float bottomLeft_depth = depth_at(bottomLeft);
+        float bottomRight_depth = depth_at(bottomRight);
+        float topRight_depth = depth_at(topRight);
+        float topLeft_depth = depth_at(topLeft);
+
+        // Check if any depth value is invalid
+        if (bottomLeft_depth <= 0 || bottomRight_depth <= 0 ||
+            topRight_depth <= 0 || topLeft_depth <= 0) {
+          std::cout << "Invalid depth value detected, skipping frame..."
+                    << std::endl;
+
+          //  use left_rect_original to overwrite left_rect
+          left_rect = left_rect_original.clone();
+
+          // clear image to redo corner definition
+          cv::imshow("Define Target Wall", left_rect);
+
+          continue; // continue with the next frame to redo corners
+        }
+        std::cout << "Depth of the bottom left corner: " << bottomLeft_depth
+                  << " mm" << std::endl;
+        std::cout << "Depth of the bottom right corner: " << bottomRight_depth
+                  << " mm" << std::endl;
+        std::cout << "Depth of the top right corner: " << topRight_depth
+                  << " mm" << std::endl;
+        std::cout << "Depth of the top left corner: " << topLeft_depth
+                  << " mm" << std::endl;
+        // <---- distance of 4 corners
+
+        target_wall_defined = 1;
+
+        std::vector<cv::Point> wall_polygon = {bottomLeft, bottomRight,
+                                               topRight, topLeft};
+
+        // ----> Wall plane prior
+        std::shared_ptr<sl_oc::tools::WallPlanePrior> prior;
+        if (band_matcher) {
+          prior = std::make_shared<sl_oc::tools::WallPlanePrior>();
+          if (prior->fit(packet->left_disp_map, wall_polygon)) {
+            std::cout << "Wall disparity plane: "
+                      << prior->getInliers() << " samples - RMS error: "
+                      << prior->getRmsError() << " px - search band: "
+                      << stereoPar.wallBandDisparities << " instead of "
+                      << stereoPar.numDisparities << " disparities"
+                      << std::endl;
+          } else {
+            std::cout << "Wall disparity plane fitting failed, the full "
+                         "disparity range is searched"
+                      << std::endl;
+            prior.reset();
           }
         }
+        // <---- Wall plane prior
+
+        // ----> Stereo ROIs
+        // The disparities are required only on the wall and around it. With
+        // the wall band the pixels outside the wall polygon are invalid: the
+        // margin would be matched for nothing
+        std::vector<cv::Rect> rois;
+        if (stereoPar.roiMargin >= 0) {
+          int margin = prior ? 0 : stereoPar.roiMargin;
+          cv::Rect wall_rect = cv::boundingRect(wall_polygon);
+          rois.push_back(cv::Rect(wall_rect.x - margin, wall_rect.y - margin,
+                                  wall_rect.width + 2 * margin,
+                                  wall_rect.height + 2 * margin));
+        }
+        // <---- Stereo ROIs
 
-        cloudMat = cv::Mat(left_depth_map.rows, left_depth_map.cols, CV_64FC3,
-                           &buffer[0])
-                       .clone();
+        {
+          std::lock_guard<std::mutex> lock(wall_mutex);
+          wall_prior = prior;
+          wall_rois = rois;
+        }
 
-        double pc_elapsed = stereo_clock.toc();
-        std::stringstream pcElabInfo;
-        // <---- Create Point Cloud
+        if (sparse_mode) {
+          std::cout << "Sparse mode: the dense depth is no longer computed"
+                    << std::endl;
+          dense_required = false;
+        }
+        // <---- define target wall
       }
-    }
 
-    // // <---- frame buffer
+      // ----> Show the detected balls
+      if (!packet->circles.empty()) {
+        for (const cv::Vec3f &circle : packet->circles) {
+          // Draw the circle on the original image
+          int line_thickness = 5; // [pixels]
+          int line_type = 8;      // 8-connected line
+          cv::circle(left_rect,
+                     cv::Point(cvRound(circle[0]), cvRound(circle[1])),
+                     cvRound(circle[2]), cv::Scalar(0, 0, 255),
+                     line_thickness, line_type, 0);
+        }
+
+        // Show the image, now including the detected circles
+        sl_oc::tools::showImage("Left rect.", left_rect, params.res, true,
+                                packet->remap_info);
+      }
+      // <---- Show the detected balls
+
+      cloudMat = packet->cloudMat;
+      cloudColors = left_rect;
+
+      pipeline_latency.add((getSteadyTimestamp() - packet->start_time) / 1000);
+    }
 
     // ----> Keyboard handling
     int key = cv::waitKey(5);
@@ -597,9 +1048,11 @@ int main(int argc, char *argv[]) {
 
 #ifdef HAVE_OPENCV_VIZ
     // ----> Show Point Cloud
-    cv::viz::WCloud cloudWidget(cloudMat, left_rect);
-    cloudWidget.setRenderingProperty(cv::viz::POINT_SIZE, 1);
-    pc_viewer.showWidget("Point Cloud", cloudWidget);
+    if (!cloudMat.empty()) {
+      cv::viz::WCloud cloudWidget(cloudMat, cloudColors);
+      cloudWidget.setRenderingProperty(cv::viz::POINT_SIZE, 1);
+      pc_viewer.showWidget("Point Cloud", cloudWidget);
+    }
     pc_viewer.spinOnce(1);
 
     if (pc_viewer.wasStopped())
@@ -607,6 +1060,50 @@ int main(int argc, char *argv[]) {
       // <---- Show Point Cloud
 #endif
   }
+  // <---- Stage 4: display, in the main thread
+
+  // ----> Pipeline shutdown
+  // The first stage stops and closes its queue, the others follow
+  running = false;
+  rectify_thread.join();
+  stereo_thread.join();
+  detect_thread.join();
+  // <---- Pipeline shutdown
+
+  // ----> Pipeline report
+  std::cout << "Displayed frames: " << displayed_frames
+            << " - latency from grab to display [msec] mean: "
+            << pipeline_latency.mean_usec() / 1e3
+            << " - p99: " << pipeline_latency.percentile_usec(99) / 1e3
+            << std::endl;
+  if (roi_frames > 0 && image_pixels > 0)
+    std::cout << "Stereo ROI - pixels with disparity per frame: "
+              << roi_pixels / roi_frames
+              << " - pixels matched per frame: " << matched_pixels / roi_frames
+              << " (" << 100. * matched_pixels / image_pixels
+              << "% of the images)" << std::endl;
+  const char *queue_names[] = {"stereo", "detect", "display"};
+  const sl_oc::tools::QueueStats queue_stats[] = {
+      stereo_queue.getStats(), detect_queue.getStats(),
+      display_queue.getStats()};
+  for (int q = 0; q < 3; q++) {
+    std::cout << "Queue " << queue_names[q]
+              << " - pushed: " << queue_stats[q].pushed
+              << " - popped: " << queue_stats[q].popped
+              << " - dropped (full): " << queue_stats[q].dropped_full
+              << " - dropped (stale): " << queue_stats[q].dropped_stale
+              << " - occupancy mean/max: " << queue_stats[q].mean_occupancy
+              << "/" << queue_stats[q].max_occupancy << std::endl;
+  }
+  // <---- Pipeline report
+
+  // ----> Frame arrival jitter report
+  sl_oc::JitterStats jitter = cap.getJitterStats();
+  std::cout << "Frame period: " << jitter.mean_period_usec << " usec (nominal "
+            << jitter.nominal_period_usec << " usec), jitter: " << jitter.stddev_usec
+            << " usec, min/max: " << jitter.min_period_usec << "/" << jitter.max_period_usec
+            << " usec, late frames: " << jitter.late_count << "/" << jitter.samples << std::endl;
+  // <---- Frame arrival jitter report
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,463 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "framerecorder.hpp"
+
+#include <fcntl.h>            // for open, O_CREAT, O_RDWR
+#include <unistd.h>           // for close, ftruncate, pwrite, sysconf
+#include <sys/mman.h>         // for mmap, munmap, msync, madvise
+#include <sys/stat.h>         // for fstat
+
+#include <algorithm>          // for std::lower_bound
+#include <cstring>            // for memcpy, memcmp
+
+namespace sl_oc {
+
+namespace video {
+
+// Default size of the memory mapped chunks of a recording file
+#define RECORD_CHUNK_SIZE (64*1024*1024)
+
+// Write a buffer at a given file offset, retrying on partial writes
+static bool writeAt(int fd, const void* buf, size_t len, uint64_t offset)
+{
+    const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+    while( len>0 )
+    {
+        ssize_t res = pwrite(fd, ptr, len, static_cast<off_t>(offset));
+        if( res<0 )
+        {
+            if( errno==EINTR )
+                continue;
+            return false;
+        }
+        ptr += res;
+        len -= static_cast<size_t>(res);
+        offset += static_cast<uint64_t>(res);
+    }
+    return true;
+}
+
+FrameRecorder::FrameRecorder()
+{
+    mRecordedFrames = 0;
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    close();
+}
+
+bool FrameRecorder::open(const std::string& filename, VideoCapture& cap, size_t queue_depth)
+{
+    if( mCap )
+    {
+        ERROR_OUT(mVerbose,"A recording is already in progress");
+        return false;
+    }
+
+    mVerbose = static_cast<VERBOSITY>(cap.getVerbosity());
+
+    int width, height;
+    cap.getFrameSize(width,height);
+    if( width<=0 || height<=0 )
+    {
+        ERROR_OUT(mVerbose,"The camera to be recorded is not initialized");
+        return false;
+    }
+
+    mFd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if( mFd<0 )
+    {
+        ERROR_OUT(mVerbose,std::string("Cannot create the recording file '") + filename + "': " + strerror(errno));
+        return false;
+    }
+    mFilename = filename;
+
+    // ----> File header
+    RecordFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    header.version = RECORD_VERSION;
+    header.width = static_cast<uint16_t>(width);
+    header.height = static_cast<uint16_t>(height);
+    header.channels = 2;
+    header.fps = static_cast<uint8_t>(cap.getFPS());
+    header.serial_number = cap.getSerialNumber();
+
+    if( !writeAt(mFd, &header, sizeof(header), 0) )
+    {
+        ERROR_OUT(mVerbose,std::string("Cannot write the recording file '") + filename + "': " + strerror(errno));
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+    // <---- File header
+
+    // ----> Chunk size
+    // A chunk holds at least a few frames and is a multiple of the page size
+    mFrameSize = static_cast<uint32_t>(width*height*header.channels);
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    mChunkSize = std::max<size_t>(RECORD_CHUNK_SIZE, 4*(sizeof(RecordFrameHeader)+mFrameSize));
+    mChunkSize = ((mChunkSize+page-1)/page)*page;
+    // <---- Chunk size
+
+    mWriteOffset = sizeof(header);
+    mWriteError = false;
+    mIndex.clear();
+    mIndex.reserve(static_cast<size_t>(cap.getFPS())*60);
+    mRecordedFrames = 0;
+
+    mSubId = cap.subscribe( [this](const FrameLease& lease){ writeFrame(lease.frame()); }, queue_depth );
+    if( mSubId<0 )
+    {
+        ERROR_OUT(mVerbose,"Cannot subscribe to the frames of the camera");
+        ::close(mFd);
+        mFd = -1;
+        return false;
+    }
+    mCap = &cap;
+
+    INFO_OUT(mVerbose,std::string("Recording to '") + filename + "'");
+
+    return true;
+}
+
+bool FrameRecorder::mapChunk(uint64_t offset, size_t min_size)
+{
+    unmapChunk();
+
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = (offset/page)*page;
+    size_t len = std::max(mChunkSize, static_cast<size_t>(offset-start)+min_size);
+
+    if( ftruncate(mFd, static_cast<off_t>(start+len))!=0 )
+    {
+        ERROR_OUT(mVerbose,std::string("Cannot grow the recording file: ") + strerror(errno));
+        return false;
+    }
+
+    void* ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, static_cast<off_t>(start));
+    if( ptr==MAP_FAILED )
+    {
+        ERROR_OUT(mVerbose,std::string("Cannot map the recording file: ") + strerror(errno));
+        return false;
+    }
+
+    // The chunk is written once, front to back
+    madvise(ptr, len, MADV_SEQUENTIAL);
+
+    mChunk = static_cast<uint8_t*>(ptr);
+    mChunkOffset = start;
+    mChunkLen = len;
+
+    return true;
+}
+
+void FrameRecorder::unmapChunk()
+{
+    if( !mChunk )
+        return;
+
+    // Start the write-back now, without waiting for it
+    msync(mChunk, mChunkLen, MS_ASYNC);
+    munmap(mChunk, mChunkLen);
+
+    mChunk = nullptr;
+    mChunkLen = 0;
+}
+
+void FrameRecorder::writeFrame(const Frame& frame)
+{
+    if( mWriteError )
+        return;
+
+    uint32_t size = static_cast<uint32_t>(frame.width*frame.height*frame.channels);
+    if( size!=mFrameSize )
+        return;
+
+    size_t rec_size = sizeof(RecordFrameHeader)+size;
+    if( !mChunk || mWriteOffset+rec_size > mChunkOffset+mChunkLen )
+    {
+        if( !mapChunk(mWriteOffset, rec_size) )
+        {
+            mWriteError = true;
+            return;
+        }
+    }
+
+    uint8_t* dst = mChunk + (mWriteOffset-mChunkOffset);
+
+    RecordFrameHeader fh;
+    fh.timestamp = frame.timestamp;
+    fh.frame_id = frame.frame_id;
+    fh.sequence = frame.sequence;
+    fh.size = size;
+    memcpy(dst, &fh, sizeof(fh));
+    memcpy(dst+sizeof(fh), frame.data, size);
+
+    RecordIndexEntry entry;
+    entry.timestamp = frame.timestamp;
+    entry.frame_id = frame.frame_id;
+    entry.offset = mWriteOffset;
+    mIndex.push_back(entry);
+
+    mWriteOffset += rec_size;
+    mRecordedFrames++;
+}
+
+uint64_t FrameRecorder::getDroppedFrames()
+{
+    if( !mCap )
+        return 0;
+
+    return mCap->getSubscriberDroppedFrames(mSubId);
+}
+
+void FrameRecorder::close()
+{
+    if( !mCap )
+        return;
+
+    // Joins the subscriber thread: no frame is written after this point
+    mCap->unsubscribe(mSubId);
+    mSubId = -1;
+    mCap = nullptr;
+
+    unmapChunk();
+
+    // ----> End marker, seek index and footer
+    // Frames are written in grab order, but the index must be sorted for the binary search
+    std::stable_sort( mIndex.begin(), mIndex.end(),
+                      [](const RecordIndexEntry& a, const RecordIndexEntry& b){return a.timestamp<b.timestamp;} );
+
+    RecordFrameHeader end_marker;
+    memset(&end_marker, 0, sizeof(end_marker));
+
+    RecordIndexFooter footer;
+    footer.index_offset = mWriteOffset+sizeof(end_marker);
+    footer.frame_count = mIndex.size();
+    memcpy(footer.magic, RECORD_INDEX_MAGIC, sizeof(RECORD_INDEX_MAGIC));
+
+    uint64_t index_size = mIndex.size()*sizeof(RecordIndexEntry);
+    uint64_t file_size = footer.index_offset + index_size + sizeof(footer);
+
+    bool ok = writeAt(mFd, &end_marker, sizeof(end_marker), mWriteOffset) &&
+            (index_size==0 || writeAt(mFd, mIndex.data(), index_size, footer.index_offset)) &&
+            writeAt(mFd, &footer, sizeof(footer), footer.index_offset+index_size) &&
+            ftruncate(mFd, static_cast<off_t>(file_size))==0; // Remove the unused tail of the last chunk
+    // <---- End marker, seek index and footer
+
+    if( !ok || mWriteError )
+    {
+        ERROR_OUT(mVerbose,std::string("Error writing the recording file '") + mFilename + "'");
+    }
+    else
+    {
+        INFO_OUT(mVerbose,std::string("Recording '") + mFilename + "' closed: " +
+                 std::to_string(mRecordedFrames) + " frames");
+    }
+
+    ::close(mFd);
+    mFd = -1;
+
+    mIndex.clear();
+    mIndex.shrink_to_fit();
+}
+
+RecordingReader::RecordingReader(VERBOSITY verbose_lvl)
+    : mVerbose(verbose_lvl)
+{
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+RecordingReader::~RecordingReader()
+{
+    close();
+}
+
+bool RecordingReader::open(const std::string& filename)
+{
+    close();
+
+    mFd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if( mFd<0 )
+    {
+        ERROR_OUT(mVerbose,std::string("Cannot open the recording file '") + filename + "': " + strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if( fstat(mFd, &st)!=0 || static_cast<size_t>(st.st_size)<sizeof(RecordFileHeader) )
+    {
+        ERROR_OUT(mVerbose,std::string("Invalid recording file '") + filename + "'");
+        close();
+        return false;
+    }
+
+    mMapLen = static_cast<size_t>(st.st_size);
+    void* ptr = mmap(nullptr, mMapLen, PROT_READ, MAP_SHARED, mFd, 0);
+    if( ptr==MAP_FAILED )
+    {
+        ERROR_OUT(mVerbose,std::string("Cannot map the recording file '") + filename + "': " + strerror(errno));
+        mMapLen = 0;
+        close();
+        return false;
+    }
+    mMap = static_cast<uint8_t*>(ptr);
+
+    // Frames are mostly accessed after a seek, not sequentially
+    madvise(mMap, mMapLen, MADV_RANDOM);
+
+    memcpy(&mHeader, mMap, sizeof(mHeader));
+    if( memcmp(mHeader.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC))!=0 ||
+            mHeader.version!=RECORD_VERSION )
+    {
+        ERROR_OUT(mVerbose,std::string("'") + filename + "' is not a supported recording file");
+        close();
+        return false;
+    }
+
+    // ----> Seek index
+    bool index_ok = false;
+    if( mMapLen >= sizeof(RecordFileHeader)+sizeof(RecordIndexFooter) )
+    {
+        RecordIndexFooter footer;
+        memcpy(&footer, mMap+mMapLen-sizeof(footer), sizeof(footer));
+
+        index_ok = memcmp(footer.magic, RECORD_INDEX_MAGIC, sizeof(RECORD_INDEX_MAGIC))==0 &&
+                footer.index_offset>=sizeof(RecordFileHeader) &&
+                footer.index_offset + footer.frame_count*sizeof(RecordIndexEntry) + sizeof(footer) == mMapLen;
+
+        if( index_ok )
+        {
+            mIndex = reinterpret_cast<const RecordIndexEntry*>(mMap+footer.index_offset);
+            mFrameCount = static_cast<size_t>(footer.frame_count);
+        }
+    }
+
+    if( !index_ok )
+    {
+        WARNING_OUT(mVerbose,std::string("The recording file '") + filename + "' has no seek index, rebuilding it");
+        if( !rebuildIndex() )
+        {
+            close();
+            return false;
+        }
+    }
+    // <---- Seek index
+
+    return true;
+}
+
+bool RecordingReader::rebuildIndex()
+{
+    mRebuiltIndex.clear();
+
+    uint64_t offset = sizeof(RecordFileHeader);
+    while( offset+sizeof(RecordFrameHeader) <= mMapLen )
+    {
+        RecordFrameHeader fh;
+        memcpy(&fh, mMap+offset, sizeof(fh));
+
+        // End marker, or last frame truncated by the interruption
+        if( fh.size==0 || offset+sizeof(fh)+fh.size > mMapLen )
+            break;
+
+        RecordIndexEntry entry;
+        entry.timestamp = fh.timestamp;
+        entry.frame_id = fh.frame_id;
+        entry.offset = offset;
+        mRebuiltIndex.push_back(entry);
+
+        offset += sizeof(fh)+fh.size;
+    }
+
+    std::stable_sort( mRebuiltIndex.begin(), mRebuiltIndex.end(),
+                      [](const RecordIndexEntry& a, const RecordIndexEntry& b){return a.timestamp<b.timestamp;} );
+
+    mIndex = mRebuiltIndex.data();
+    mFrameCount = mRebuiltIndex.size();
+
+    return true;
+}
+
+void RecordingReader::close()
+{
+    if( mMap )
+    {
+        munmap(mMap, mMapLen);
+        mMap = nullptr;
+    }
+    mMapLen = 0;
+
+    if( mFd>=0 )
+    {
+        ::close(mFd);
+        mFd = -1;
+    }
+
+    mIndex = nullptr;
+    mFrameCount = 0;
+    mRebuiltIndex.clear();
+}
+
+long RecordingReader::seek(uint64_t timestamp)
+{
+    if( !mIndex )
+        return -1;
+
+    const RecordIndexEntry* end = mIndex+mFrameCount;
+    const RecordIndexEntry* it = std::lower_bound( mIndex, end, timestamp,
+                                                   [](const RecordIndexEntry& e, uint64_t ts){return e.timestamp<ts;} );
+    if( it==end )
+        return -1;
+
+    return static_cast<long>(it-mIndex);
+}
+
+bool RecordingReader::getFrame(size_t index, Frame& frame)
+{
+    if( !mIndex || index>=mFrameCount )
+        return false;
+
+    uint64_t offset = mIndex[index].offset;
+    if( offset+sizeof(RecordFrameHeader) > mMapLen )
+        return false;
+
+    RecordFrameHeader fh;
+    memcpy(&fh, mMap+offset, sizeof(fh));
+    if( offset+sizeof(fh)+fh.size > mMapLen )
+        return false;
+
+    frame.frame_id = fh.frame_id;
+    frame.timestamp = fh.timestamp;
+    frame.sequence = fh.sequence;
+    frame.width = mHeader.width;
+    frame.height = mHeader.height;
+    frame.channels = mHeader.channels;
+    frame.data = mMap+offset+sizeof(fh);
+
+    return true;
+}
+
+}
+
+}
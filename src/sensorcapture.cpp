@@ -28,6 +28,7 @@
 #include <sstream>
 #include <cmath>              // for round
 #include <unistd.h>           // for usleep, close
+#include <sys/mman.h>         // for mlock, munlock
 
 namespace sl_oc {
 
@@ -273,11 +274,110 @@ bool SensorCapture::startCapture()
         return false;
     }
 
+    mJitter.reset(1e6/400.);
+
+    // Allocated once: the queues never grow while grabbing
+    mSysTsQueue.reserve(TS_SHIFT_VAL_COUNT);
+    mMcuTsQueue.reserve(TS_SHIFT_VAL_COUNT);
+
+    if( mLockBuffers )
+    {
+        lockBuffers();
+    }
+
     mGrabThread = std::thread( &SensorCapture::grabThreadFunc,this );
 
+    if( mRtPriority>0 || mCpuAffinityMask!=0 )
+    {
+        setThreadScheduling(mRtPriority, mCpuAffinityMask);
+    }
+
+    return true;
+}
+
+bool SensorCapture::setThreadScheduling(int rt_priority, uint64_t cpu_affinity_mask)
+{
+    mRtPriority = rt_priority;
+    mCpuAffinityMask = cpu_affinity_mask;
+
+    if( !mGrabThread.joinable() )
+    {
+        return true; // Applied when the grabbing thread is started
+    }
+
+    int err = sl_oc::setThreadScheduling(mGrabThread, mRtPriority, mCpuAffinityMask);
+    if( err!=0 )
+    {
+        std::string msg = std::string("Cannot set the scheduling of the grabbing thread: [")
+                + std::to_string(err) +std::string("] ") + std::string(strerror(err));
+        WARNING_OUT(mVerbose,msg);
+        return false;
+    }
+
+    return true;
+}
+
+bool SensorCapture::setBufferLock(bool enable)
+{
+    mLockBuffers = enable;
+
+    if( !mGrabThread.joinable() )
+    {
+        return true; // Applied when the grabbing thread is started
+    }
+
+    if( !enable )
+    {
+        unlockBuffers();
+        return true;
+    }
+
+    return mBuffersLocked || lockBuffers();
+}
+
+bool SensorCapture::lockBuffers()
+{
+    // The queues are reserved by `startCapture`: their storage does not move while grabbing
+    int res = mlock(this, sizeof(SensorCapture));
+    if( res==0 )
+    {
+        res = mlock(mSysTsQueue.data(), TS_SHIFT_VAL_COUNT*sizeof(uint64_t));
+    }
+    if( res==0 )
+    {
+        res = mlock(mMcuTsQueue.data(), TS_SHIFT_VAL_COUNT*sizeof(uint64_t));
+    }
+
+    if( res!=0 )
+    {
+        std::string msg = std::string("Cannot lock the sensor data buffers in RAM: [")
+                + std::to_string(errno) +std::string("] ") + std::string(strerror(errno))
+                + std::string(". Check RLIMIT_MEMLOCK (ulimit -l)");
+        WARNING_OUT(mVerbose,msg);
+
+        // Release the pages locked before the failure
+        mBuffersLocked = true;
+        unlockBuffers();
+        return false;
+    }
+
+    mBuffersLocked = true;
     return true;
 }
 
+void SensorCapture::unlockBuffers()
+{
+    if( !mBuffersLocked )
+    {
+        return;
+    }
+
+    munlock(this, sizeof(SensorCapture));
+    munlock(mSysTsQueue.data(), TS_SHIFT_VAL_COUNT*sizeof(uint64_t));
+    munlock(mMcuTsQueue.data(), TS_SHIFT_VAL_COUNT*sizeof(uint64_t));
+    mBuffersLocked = false;
+}
+
 void SensorCapture::close()
 {
     mStopCapture = true;
@@ -287,6 +387,8 @@ void SensorCapture::close()
         mGrabThread.join();
     }
 
+    unlockBuffers();
+
     enableDataStream(false);
 
     if( mDevHandle ) {
@@ -322,9 +424,6 @@ void SensorCapture::grabThreadFunc()
 
     uint64_t rel_mcu_ts = 0;
 
-    mSysTsQueue.reserve(TS_SHIFT_VAL_COUNT);
-    mMcuTsQueue.reserve(TS_SHIFT_VAL_COUNT);
-
     while (!mStopCapture)
     {
         // ----> Keep data stream alive
@@ -350,6 +449,8 @@ void SensorCapture::grabThreadFunc()
         }
         // <---- Data received?
 
+        mJitter.addSample(getSteadyTimestamp());
+
         // ----> Received data are correct?
         int target_struct_id = 0;
         if (mDevPid==SL_USB_PROD_MCU_ZED2_REVA || mDevPid==SL_USB_PROD_MCU_ZED2i_REVA)
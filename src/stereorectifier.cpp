@@ -0,0 +1,452 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "stereorectifier.hpp"
+
+#include <algorithm>          // for std::max
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RECTIFY_AVX2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RECTIFY_NEON
+#endif
+
+namespace sl_oc {
+
+namespace video {
+
+// ----> BT.601 YUV to RGB fixed-point coefficients, as used by OpenCV
+#define YUV_SHIFT 20
+#define YUV_CY  1220542
+#define YUV_CUB 2116026
+#define YUV_CUG -409993
+#define YUV_CVG -852492
+#define YUV_CVR 1673527
+// <---- BT.601 YUV to RGB fixed-point coefficients, as used by OpenCV
+
+static inline uint8_t saturate(int v)
+{
+    return static_cast<uint8_t>(v<0?0:(v>255?255:v));
+}
+
+// Bilinear remap with fixed-point maps and constant black border
+template<int CN>
+static void remapBilinear(const uint8_t* src, int width, int height, const RectifyMap& map, uint8_t* dst)
+{
+    const int bits = StereoRectifier::RECTIFY_INTER_BITS;
+    const int tab = StereoRectifier::RECTIFY_INTER_TAB;
+    const int stride = width*CN;
+    const size_t count = static_cast<size_t>(width)*height;
+
+    for(size_t i=0; i<count; i++)
+    {
+        int sx = map.xy[2*i];
+        int sy = map.xy[2*i+1];
+        int fx = map.frac[i] & (tab-1);
+        int fy = (map.frac[i] >> bits) & (tab-1);
+
+        int w00 = (tab-fx)*(tab-fy);
+        int w01 = fx*(tab-fy);
+        int w10 = (tab-fx)*fy;
+        int w11 = fx*fy;
+
+        uint8_t* d = dst + i*CN;
+
+        if( static_cast<unsigned>(sx)<static_cast<unsigned>(width-1) &&
+                static_cast<unsigned>(sy)<static_cast<unsigned>(height-1) )
+        {
+            const uint8_t* p = src + sy*stride + sx*CN;
+            for(int c=0; c<CN; c++)
+            {
+                d[c] = static_cast<uint8_t>((p[c]*w00 + p[c+CN]*w01 + p[c+stride]*w10 + p[c+stride+CN]*w11 +
+                                             (1<<(2*bits-1))) >> (2*bits));
+            }
+        }
+        else
+        {
+            // At least one of the four neighbours is outside the image: its value is black
+            const int w[4] = {w00,w01,w10,w11};
+            int acc[CN] = {0};
+            for(int k=0; k<4; k++)
+            {
+                int x = sx + (k&1);
+                int y = sy + (k>>1);
+                if( w[k]==0 || x<0 || x>=width || y<0 || y>=height )
+                    continue;
+                const uint8_t* p = src + y*stride + x*CN;
+                for(int c=0; c<CN; c++)
+                    acc[c] += p[c]*w[k];
+            }
+            for(int c=0; c<CN; c++)
+                d[c] = static_cast<uint8_t>((acc[c] + (1<<(2*bits-1))) >> (2*bits));
+        }
+    }
+}
+
+// ----> Fused YUV 4:2:2 to rectified luma kernels
+// `src` points to the first Y byte of the half frame: the Y value of the pixel (x,y) is `src[y*stride + 2*x]`.
+// All the kernels give the same result, bit by bit.
+
+// One rectified luma pixel, with constant black border
+static inline uint8_t lumaPixel(const uint8_t* src, size_t stride, int width, int height, int sx, int sy, int frac)
+{
+    const int bits = StereoRectifier::RECTIFY_INTER_BITS;
+    const int tab = StereoRectifier::RECTIFY_INTER_TAB;
+    int fx = frac & (tab-1);
+    int fy = (frac >> bits) & (tab-1);
+
+    int p[4] = {0,0,0,0};
+    for(int k=0; k<4; k++)
+    {
+        int x = sx + (k&1);
+        int y = sy + (k>>1);
+        if( x>=0 && x<width && y>=0 && y<height )
+            p[k] = src[y*stride + 2*x];
+    }
+
+    // Horizontal then vertical interpolation, as the SIMD kernels
+    int top = p[0]*(tab-fx) + p[1]*fx;
+    int bot = p[2]*(tab-fx) + p[3]*fx;
+    return static_cast<uint8_t>((top*(tab-fy) + bot*fy + (1<<(2*bits-1))) >> (2*bits));
+}
+
+static void remapLumaScalar(const uint8_t* src, size_t stride, int width, int height, const RectifyMap& map, uint8_t* dst)
+{
+    const size_t count = static_cast<size_t>(width)*height;
+    for(size_t i=0; i<count; i++)
+        dst[i] = lumaPixel(src, stride, width, height, map.xy[2*i], map.xy[2*i+1], map.frac[i]);
+}
+
+#ifdef RECTIFY_AVX2
+// 8 pixels per iteration: one 32 bit gather per row loads the two horizontal neighbours (Y0 C Y1 C)
+__attribute__((target("avx2")))
+static void remapLumaAvx2(const uint8_t* src, size_t stride, int width, int height, const RectifyMap& map, uint8_t* dst)
+{
+    const int bits = StereoRectifier::RECTIFY_INTER_BITS;
+    const int tab = StereoRectifier::RECTIFY_INTER_TAB;
+    const size_t count = static_cast<size_t>(width)*height;
+
+    const __m256i v_stride = _mm256_set1_epi32(static_cast<int>(stride));
+    const __m256i v_xmax = _mm256_set1_epi32(width-1);
+    const __m256i v_ymax = _mm256_set1_epi32(height-1);
+    const __m256i v_neg = _mm256_set1_epi32(-1);
+    const __m256i v_tab = _mm256_set1_epi32(tab);
+    const __m256i v_fmask = _mm256_set1_epi32(tab-1);
+    const __m256i v_bmask = _mm256_set1_epi32(0xFF);
+    const __m256i v_round = _mm256_set1_epi32(1<<(2*bits-1));
+    const int* base_top = reinterpret_cast<const int*>(src);
+    const int* base_bot = reinterpret_cast<const int*>(src+stride);
+
+    size_t i = 0;
+    for( ; i+8<=count; i+=8)
+    {
+        __m256i xy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(map.xy+2*i));
+        __m256i sx = _mm256_srai_epi32(_mm256_slli_epi32(xy,16),16);
+        __m256i sy = _mm256_srai_epi32(xy,16);
+
+        // ----> The four neighbours of all the pixels must be inside the image
+        __m256i in_x = _mm256_and_si256(_mm256_cmpgt_epi32(v_xmax,sx), _mm256_cmpgt_epi32(sx,v_neg));
+        __m256i in_y = _mm256_and_si256(_mm256_cmpgt_epi32(v_ymax,sy), _mm256_cmpgt_epi32(sy,v_neg));
+        if( _mm256_movemask_epi8(_mm256_and_si256(in_x,in_y))!=-1 )
+        {
+            for(size_t k=i; k<i+8; k++)
+                dst[k] = lumaPixel(src, stride, width, height, map.xy[2*k], map.xy[2*k+1], map.frac[k]);
+            continue;
+        }
+        // <---- The four neighbours of all the pixels must be inside the image
+
+        __m256i off = _mm256_add_epi32(_mm256_mullo_epi32(sy,v_stride), _mm256_slli_epi32(sx,1));
+        __m256i top = _mm256_i32gather_epi32(base_top, off, 1);
+        __m256i bot = _mm256_i32gather_epi32(base_bot, off, 1);
+
+        __m256i f = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(map.frac+i)));
+        __m256i fx = _mm256_and_si256(f, v_fmask);
+        __m256i fy = _mm256_and_si256(_mm256_srli_epi32(f,bits), v_fmask);
+        __m256i ifx = _mm256_sub_epi32(v_tab, fx);
+        __m256i ify = _mm256_sub_epi32(v_tab, fy);
+
+        __m256i h_top = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(top,v_bmask), ifx),
+                                         _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(top,16),v_bmask), fx));
+        __m256i h_bot = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_and_si256(bot,v_bmask), ifx),
+                                         _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(bot,16),v_bmask), fx));
+        __m256i res = _mm256_add_epi32(_mm256_mullo_epi32(h_top,ify), _mm256_mullo_epi32(h_bot,fy));
+        res = _mm256_srli_epi32(_mm256_add_epi32(res,v_round), 2*bits);
+
+        // Packing works within the 128 bit lanes: pixels 0-3 in the low lane, 4-7 in the high lane
+        __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(res,res), _mm256_setzero_si256());
+        uint32_t lo = static_cast<uint32_t>(_mm256_cvtsi256_si32(packed));
+        uint32_t hi = static_cast<uint32_t>(_mm256_extract_epi32(packed,4));
+        memcpy(dst+i, &lo, 4);
+        memcpy(dst+i+4, &hi, 4);
+    }
+
+    for( ; i<count; i++)
+        dst[i] = lumaPixel(src, stride, width, height, map.xy[2*i], map.xy[2*i+1], map.frac[i]);
+}
+#endif
+
+#ifdef RECTIFY_NEON
+// 8 pixels per iteration: the neighbours are loaded lane by lane, the interpolation is vectorized
+static void remapLumaNeon(const uint8_t* src, size_t stride, int width, int height, const RectifyMap& map, uint8_t* dst)
+{
+    const int bits = StereoRectifier::RECTIFY_INTER_BITS;
+    const int tab = StereoRectifier::RECTIFY_INTER_TAB;
+    const size_t count = static_cast<size_t>(width)*height;
+
+    const int16x8_t v_xmax = vdupq_n_s16(static_cast<int16_t>(width-1));
+    const int16x8_t v_ymax = vdupq_n_s16(static_cast<int16_t>(height-1));
+    const int16x8_t v_zero = vdupq_n_s16(0);
+    const uint16x8_t v_tab = vdupq_n_u16(tab);
+    const uint16x8_t v_fmask = vdupq_n_u16(tab-1);
+
+    int16_t sx[8], sy[8];
+    uint16_t p00[8], p01[8], p10[8], p11[8];
+
+    size_t i = 0;
+    for( ; i+8<=count; i+=8)
+    {
+        int16x8x2_t xy = vld2q_s16(map.xy+2*i);
+
+        // ----> The four neighbours of all the pixels must be inside the image
+        uint16x8_t in = vandq_u16(vandq_u16(vcltq_s16(xy.val[0],v_xmax), vcgeq_s16(xy.val[0],v_zero)),
+                                  vandq_u16(vcltq_s16(xy.val[1],v_ymax), vcgeq_s16(xy.val[1],v_zero)));
+        uint64x2_t in64 = vreinterpretq_u64_u16(in);
+        if( (vgetq_lane_u64(in64,0) & vgetq_lane_u64(in64,1))!=~0ULL )
+        {
+            for(size_t k=i; k<i+8; k++)
+                dst[k] = lumaPixel(src, stride, width, height, map.xy[2*k], map.xy[2*k+1], map.frac[k]);
+            continue;
+        }
+        // <---- The four neighbours of all the pixels must be inside the image
+
+        vst1q_s16(sx, xy.val[0]);
+        vst1q_s16(sy, xy.val[1]);
+        for(int k=0; k<8; k++)
+        {
+            const uint8_t* p = src + sy[k]*stride + 2*sx[k];
+            p00[k] = p[0];
+            p01[k] = p[2];
+            p10[k] = p[stride];
+            p11[k] = p[stride+2];
+        }
+
+        uint16x8_t f = vld1q_u16(map.frac+i);
+        uint16x8_t fx = vandq_u16(f, v_fmask);
+        uint16x8_t fy = vandq_u16(vshrq_n_u16(f,bits), v_fmask);
+        uint16x8_t ifx = vsubq_u16(v_tab, fx);
+        uint16x8_t ify = vsubq_u16(v_tab, fy);
+
+        // 255*32 fits 16 bits, the vertical step needs 32 bits
+        uint16x8_t h_top = vmlaq_u16(vmulq_u16(vld1q_u16(p00),ifx), vld1q_u16(p01), fx);
+        uint16x8_t h_bot = vmlaq_u16(vmulq_u16(vld1q_u16(p10),ifx), vld1q_u16(p11), fx);
+        uint32x4_t r_lo = vmlal_u16(vmull_u16(vget_low_u16(h_top),vget_low_u16(ify)), vget_low_u16(h_bot), vget_low_u16(fy));
+        uint32x4_t r_hi = vmlal_u16(vmull_u16(vget_high_u16(h_top),vget_high_u16(ify)), vget_high_u16(h_bot), vget_high_u16(fy));
+
+        uint16x8_t res = vcombine_u16(vrshrn_n_u32(r_lo,2*bits), vrshrn_n_u32(r_hi,2*bits));
+        vst1_u8(dst+i, vqmovn_u16(res));
+    }
+
+    for( ; i<count; i++)
+        dst[i] = lumaPixel(src, stride, width, height, map.xy[2*i], map.xy[2*i+1], map.frac[i]);
+}
+#endif
+// <---- Fused YUV 4:2:2 to rectified luma kernels
+
+StereoRectifier::StereoRectifier(RECTIFY_FORMAT format, VERBOSITY verbose_lvl)
+    : mFormat(format)
+    , mVerbose(verbose_lvl)
+{
+    setSimd(true);
+
+    mWorkers.setThreads(2);
+}
+
+StereoRectifier::~StereoRectifier()
+{
+}
+
+bool StereoRectifier::setMaps(uint16_t width, uint16_t height, const RectifyMap& left, const RectifyMap& right)
+{
+    if( width==0 || height==0 || (width%2)!=0 )
+    {
+        ERROR_OUT(mVerbose,std::string("Invalid rectification map size: ") + std::to_string(width) + "x" + std::to_string(height));
+        return false;
+    }
+
+    if( !left.xy || !left.frac || !right.xy || !right.frac )
+    {
+        ERROR_OUT(mVerbose,"Missing rectification map");
+        return false;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mMap[0] = left;
+    mMap[1] = right;
+
+    // ----> Buffers allocated once for all the frames
+    // The gray images are sampled straight from the frame: no converted halves
+    size_t size = static_cast<size_t>(mWidth)*mHeight*getChannels();
+    for(int side=0; side<2; side++)
+    {
+        if( mFormat==RECTIFY_FORMAT::BGR )
+            mRaw[side].assign(size, 0);
+        else
+            mRaw[side].clear();
+        mRect[side].assign(size, 0);
+    }
+    // <---- Buffers allocated once for all the frames
+
+    INFO_OUT(mVerbose,std::string("Rectification maps set: ") + std::to_string(mWidth) + "x" + std::to_string(mHeight));
+
+    return true;
+}
+
+bool StereoRectifier::rectify(const uint8_t* yuyv, uint16_t width, uint16_t height)
+{
+    if( mWidth==0 )
+    {
+        ERROR_OUT(mVerbose,"Rectification maps not set");
+        return false;
+    }
+
+    if( !yuyv || width!=2*mWidth || height!=mHeight )
+    {
+        ERROR_OUT(mVerbose,std::string("The frame size ") + std::to_string(width) + "x" + std::to_string(height) +
+                  " does not match the rectification maps");
+        return false;
+    }
+
+    uint64_t start = getSteadyTimestamp();
+
+    // ----> Right half to the worker, left half in the calling thread
+    mSrc = yuyv;
+    mSrcStride = static_cast<size_t>(width)*2;
+
+    // One band per side
+    mWorkers.run(2, [this](int, int side, int) {
+        processSide(side);
+    });
+
+    mSrc = nullptr;
+    // <---- Right half to the worker, left half in the calling thread
+
+    uint64_t total = (getSteadyTimestamp()-start)/1000;
+
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    mStats.frames++;
+    for(int side=0; side<2; side++)
+    {
+        mStats.convert[side].add(mConvertUsec[side]);
+        mStats.remap[side].add(mRemapUsec[side]);
+    }
+    mStats.total.add(total);
+
+    return true;
+}
+
+void StereoRectifier::setSimd(bool enable)
+{
+    LumaKernel avx2 = nullptr;
+    LumaKernel neon = nullptr;
+#if defined(RECTIFY_AVX2)
+    avx2 = remapLumaAvx2;
+#elif defined(RECTIFY_NEON)
+    neon = remapLumaNeon;
+#endif
+
+    mLumaKernel = selectSimdKernel<LumaKernel>(enable, remapLumaScalar, avx2, neon, mKernelName);
+}
+
+void StereoRectifier::processSide(int side)
+{
+    uint64_t t0 = getSteadyTimestamp();
+
+    if( mFormat==RECTIFY_FORMAT::GRAY )
+    {
+        // Conversion and remap fused: the Y channel is sampled through the maps
+        const uint8_t* src = mSrc + side*mWidth*2;
+        mLumaKernel( src, mSrcStride, mWidth, mHeight, mMap[side], mRect[side].data() );
+
+        mConvertUsec[side] = 0;
+        mRemapUsec[side] = (getSteadyTimestamp()-t0)/1000;
+        return;
+    }
+
+    convertSide(side);
+    uint64_t t1 = getSteadyTimestamp();
+    remapSide(side);
+    uint64_t t2 = getSteadyTimestamp();
+
+    mConvertUsec[side] = (t1-t0)/1000;
+    mRemapUsec[side] = (t2-t1)/1000;
+}
+
+void StereoRectifier::convertSide(int side)
+{
+    uint8_t* dst = mRaw[side].data();
+
+    for(int y=0; y<mHeight; y++)
+    {
+        const uint8_t* src = mSrc + y*mSrcStride + side*mWidth*2;
+
+        // Two pixels per Y0 U Y1 V macropixel
+        for(int x=0; x<mWidth; x+=2, src+=4)
+        {
+            int u = src[1]-128;
+            int v = src[3]-128;
+
+            int ruv = (1<<(YUV_SHIFT-1)) + YUV_CVR*v;
+            int guv = (1<<(YUV_SHIFT-1)) + YUV_CVG*v + YUV_CUG*u;
+            int buv = (1<<(YUV_SHIFT-1)) + YUV_CUB*u;
+
+            for(int k=0; k<2; k++)
+            {
+                int yy = std::max(0, src[2*k]-16)*YUV_CY;
+                *dst++ = saturate((yy+buv) >> YUV_SHIFT);
+                *dst++ = saturate((yy+guv) >> YUV_SHIFT);
+                *dst++ = saturate((yy+ruv) >> YUV_SHIFT);
+            }
+        }
+    }
+}
+
+void StereoRectifier::remapSide(int side)
+{
+    remapBilinear<3>( mRaw[side].data(), mWidth, mHeight, mMap[side], mRect[side].data() );
+}
+
+RectifierStats StereoRectifier::getStats()
+{
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    return mStats;
+}
+
+void StereoRectifier::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    mStats = RectifierStats();
+}
+
+}
+
+}
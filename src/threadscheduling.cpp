@@ -0,0 +1,63 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2021, STEREOLABS.
+//
+// All rights reserved.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "defines.hpp"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace sl_oc {
+
+int setThreadScheduling(std::thread& thread, int rt_priority, uint64_t cpu_affinity_mask)
+{
+#if defined(__linux__)
+    int err = 0;
+
+    if(cpu_affinity_mask!=0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for(int cpu=0; cpu<64 && cpu<CPU_SETSIZE; cpu++)
+        {
+            if(cpu_affinity_mask & (1ULL<<cpu))
+                CPU_SET(cpu, &cpuset);
+        }
+        err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+    }
+
+    if(rt_priority>0)
+    {
+        struct sched_param param;
+        param.sched_priority = rt_priority;
+        int res = pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+        if(err==0)
+            err = res;
+    }
+
+    return err;
+#else
+    (void)thread;
+    return (rt_priority>0 || cpu_affinity_mask!=0) ? ENOSYS : 0;
+#endif
+}
+
+}
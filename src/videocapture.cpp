@@ -34,14 +34,23 @@
 #include <linux/videodev2.h>  // for v4l2_buffer, v4l2_queryctrl, V4L2_BUF_T...
 #include <sys/mman.h>         // for mmap, munmap, MAP_SHARED, PROT_READ
 #include <sys/ioctl.h>        // for ioctl
+#include <sys/eventfd.h>      // for eventfd, EFD_NONBLOCK, EFD_CLOEXEC
+#include <poll.h>             // for poll, pollfd, POLLIN, POLLERR, POLLHUP
 
 #include <sstream>
 #include <fstream>            // for char_traits, basic_istream::operator>>
+#include <climits>            // for PATH_MAX
+#include <cstdlib>            // for getenv, realpath
 
 #include <cmath>              // for round
+#include <algorithm>          // for std::min, std::max
 
 #define IOCTL_RETRY 3
 
+#define GRAB_POLL_TIMEOUT_MSEC 2000
+#define GRAB_RETRY_MIN_MSEC 10     // First wait after a device error, doubled at each consecutive error
+#define GRAB_RETRY_MAX_MSEC 1000
+
 #define READ_MODE   1
 #define WRITE_MODE  2
 
@@ -107,6 +116,12 @@
 #define EXP_RAW_MIN         2
 // <---- Camera Control
 
+// ----> Device cache
+#define DEVICE_CACHE_DIR    "zed-open-capture"       // In $HOME/.cache
+#define DEVICE_CACHE_FILE   "devices"
+#define DEVICE_CACHE_ENV    "ZED_OC_DEVICE_CACHE"    // Overrides the path of the cache file
+// <---- Device cache
+
 
 namespace sl_oc {
 
@@ -114,7 +129,7 @@ namespace video {
 
 VideoCapture::VideoCapture(VideoParams params)
 {
-    memcpy( &mParams, &params, sizeof(VideoParams) );
+    mParams = params;
 
     if( mParams.verbose )
     {
@@ -129,6 +144,12 @@ VideoCapture::VideoCapture(VideoParams params)
     // Check that FPS is coherent with user resolution
     checkResFps( );
 
+    // UVC buffers: at least one for the driver and one for the last published frame
+    if( mParams.buffer_count < 2 )
+        mParams.buffer_count = 2;
+    if( mParams.buffer_count > 32 )
+        mParams.buffer_count = 32;
+
     // Calculate gain zones (required because the raw gain control is not continuous in the range of values)
     mGainSegMax = (GAIN_ZONE4_MAX-GAIN_ZONE4_MIN)+(GAIN_ZONE3_MAX-GAIN_ZONE3_MIN)+(GAIN_ZONE2_MAX-GAIN_ZONE2_MIN)+(GAIN_ZONE1_MAX-GAIN_ZONE1_MIN);
 
@@ -141,18 +162,76 @@ VideoCapture::VideoCapture(VideoParams params)
         mExpoureRawMax = EXP_RAW_MAX_60FPS;
     else
         mExpoureRawMax = EXP_RAW_MAX_100FPS;
+
+    // Event file descriptors, kept open for the whole life of the object
+    mWakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    mFrameEventFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+
+    resetCaptureStats();
+
+    mCtrlThread = std::thread( &VideoCapture::controlThreadFunc,this );
 }
 
 VideoCapture::~VideoCapture()
 {
+    // ----> Cancel the subscriptions, releasing their frames
+    mSubMutex.lock();
+    std::vector<int> sub_ids;
+    for( auto& sub : mSubscribers )
+        sub_ids.push_back(sub->id);
+    mSubMutex.unlock();
+
+    for( int id : sub_ids )
+        unsubscribe(id);
+    // <---- Cancel the subscriptions, releasing their frames
+
     reset();
+
+    // ----> Stop the control thread, after the execution of the pending requests
+    mCtrlQueueMutex.lock();
+    mCtrlStop = true;
+    mCtrlQueueMutex.unlock();
+    mCtrlQueueCond.notify_one();
+
+    if( mCtrlThread.joinable() )
+    {
+        mCtrlThread.join();
+    }
+    // <---- Stop the control thread, after the execution of the pending requests
+
+    close(mWakeFd);
+    close(mFrameEventFd);
+}
+
+void VideoCapture::stopCapture()
+{
+    mBufMutex.lock();
+    mStopCapture = true;
+    mRingCond.notify_all(); // Wake up the grabbing thread if blocked on a full ring
+    mBufMutex.unlock();
+
+    // Wake up the replay thread if waiting for a free buffer or for the time of the next frame
+    mReplayMutex.lock();
+    mReplayMutex.unlock();
+    mReplayCond.notify_all();
+
+    // Wake up the grabbing thread if waiting for a frame
+    uint64_t one = 1;
+    if( write(mWakeFd, &one, sizeof(one)) < 0 ) {} // Only fails if a request is already pending
 }
 
 void VideoCapture::reset()
 {
+    // The pending controls reset must not run on the closed device
+    if( mControlReset.valid() )
+    {
+        mControlReset.wait();
+        mControlReset = std::shared_future<void>();
+    }
+
     setLEDstatus( false );
 
-    mStopCapture = true;
+    stopCapture();
 
     if( mGrabThread.joinable() )
     {
@@ -165,11 +244,31 @@ void VideoCapture::reset()
         xioctl(mFileDesc, VIDIOC_STREAMOFF, &type);
     // <---- Stop capturing
 
+    // The subscribers keep their subscription, but the frames of this stream must not survive the unmapping
+    clearSubscriberQueues();
+
+    // ----> Invalidate buffer references
+    mBufMutex.lock();
+    mStreamGen++;
+    mLatestBufIdx = -1;
+    mLatestFrame = Frame();
+    mBufRefCount.clear();
+    mRing.clear();
+    mRingHead = 0;
+    mRingCount = 0;
+    mBufMutex.unlock();
+    // <---- Invalidate buffer references
+
     // ----> deinit device
     if( mInitialized && mBuffers)
     {
         for (unsigned int i = 0; i < mBufCount; ++i)
-            munmap(mBuffers[i].start, mBuffers[i].length);
+        {
+            if(mReplay)
+                free(mBuffers[i].start);
+            else
+                munmap(mBuffers[i].start, mBuffers[i].length);
+        }
         if (mBuffers)
             free(mBuffers);
 
@@ -177,6 +276,16 @@ void VideoCapture::reset()
     }
     // <---- deinit device
 
+    // ----> Close the recording file
+    if( mReplayFile )
+    {
+        fclose(mReplayFile);
+        mReplayFile = nullptr;
+    }
+    mReplay = false;
+    mReplayFree.clear();
+    // <---- Close the recording file
+
     if (mFileDesc)
     {
         close(mFileDesc);
@@ -185,9 +294,24 @@ void VideoCapture::reset()
 
     if(mLastFrame.data)
     {
+        if(mBuffersLocked)
+        {
+            munlock(mLastFrame.data, mLastFrame.width * mLastFrame.height * mLastFrame.channels);
+        }
         delete [] mLastFrame.data;
-        mLastFrame.data = nullptr;
     }
+    mBuffersLocked = false; // The UVC buffers are unlocked by munmap
+    mLastFrame = Frame();
+    mLastLeaseId = 0;
+
+    // The cached control values are not valid for the next opened device
+    {
+        const std::lock_guard<std::mutex> lock(mCtrlCacheMutex);
+        mCtrlCache = ControlSnapshot();
+    }
+    mSerialNumber = -1;
+    mCameraModel = SL_DEVICE::NONE;
+    mStartupT0 = 0;
 
     if( mParams.verbose && mInitialized)
     {
@@ -273,24 +397,197 @@ void VideoCapture::checkResFps()
     }
 }
 
+// ----> Device cache
+struct DeviceCacheEntry
+{
+    int dev_id;             // Index of the `/dev/video*` device
+    int serial;             // Serial number of the camera
+    std::string usb_id;     // Identity of the USB device when the entry was stored
+};
+
+static std::mutex sDeviceCacheMutex; // Serializes the accesses to the cache file of this process
+
+static std::string deviceCachePath()
+{
+    const char* env = getenv(DEVICE_CACHE_ENV);
+    if( env && *env )
+        return std::string(env);
+
+    const char* home = getenv("HOME");
+    if( !home || !*home )
+        return std::string();
+
+    return std::string(home) + "/.cache/" + DEVICE_CACHE_DIR + "/" + DEVICE_CACHE_FILE;
+}
+
+// The USB device of a video node, identified by its sysfs path, its bus/device numbers and the boot id.
+// The device number changes each time the camera is plugged, the boot id on each reboot.
+static std::string usbIdentity( int devId )
+{
+    std::string link = "/sys/class/video4linux/video" + std::to_string(devId) + "/device/..";
+    char path[PATH_MAX];
+    if( !realpath(link.c_str(), path) )
+        return std::string();
+
+    std::string busnum, devnum, boot_id;
+    if( !(std::ifstream(std::string(path) + "/busnum") >> busnum) ||
+            !(std::ifstream(std::string(path) + "/devnum") >> devnum) ||
+            !(std::ifstream("/proc/sys/kernel/random/boot_id") >> boot_id) )
+        return std::string();
+
+    return std::string(path) + "@" + busnum + ":" + devnum + "@" + boot_id;
+}
+
+static std::vector<DeviceCacheEntry> loadDeviceCache()
+{
+    std::vector<DeviceCacheEntry> entries;
+
+    std::string path = deviceCachePath();
+    if( path.empty() )
+        return entries;
+
+    std::ifstream file(path);
+    DeviceCacheEntry entry;
+    while( file >> entry.dev_id >> entry.serial >> entry.usb_id )
+    {
+        entries.push_back(entry);
+    }
+
+    return entries;
+}
+
+static void storeDeviceCache( int devId, int sn, const std::string& usb_id )
+{
+    std::string path = deviceCachePath();
+    if( path.empty() || usb_id.empty() || sn<=0 )
+        return;
+
+    const std::lock_guard<std::mutex> lock(sDeviceCacheMutex);
+
+    // ----> Replace the entries of the device and of the camera
+    std::vector<DeviceCacheEntry> entries = loadDeviceCache();
+    std::vector<DeviceCacheEntry> updated;
+    for( auto& entry : entries )
+    {
+        if( entry.dev_id!=devId && entry.serial!=sn )
+            updated.push_back(entry);
+    }
+    updated.push_back( {devId, sn, usb_id} );
+    // <---- Replace the entries of the device and of the camera
+
+    // ----> Create the default cache folder
+    if( !getenv(DEVICE_CACHE_ENV) )
+    {
+        std::string dir = std::string(getenv("HOME")) + "/.cache";
+        mkdir(dir.c_str(), 0755);
+        dir += std::string("/") + DEVICE_CACHE_DIR;
+        mkdir(dir.c_str(), 0755);
+    }
+    // <---- Create the default cache folder
+
+    // Written to a temporary file and renamed: a concurrent reader never sees a partial file
+    std::string tmp_path = path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        for( auto& entry : updated )
+        {
+            file << entry.dev_id << " " << entry.serial << " " << entry.usb_id << std::endl;
+        }
+        if( !file )
+        {
+            remove(tmp_path.c_str());
+            return;
+        }
+    }
+
+    if( rename(tmp_path.c_str(), path.c_str())!=0 )
+    {
+        remove(tmp_path.c_str());
+    }
+}
+
+int VideoCapture::lookupSerialNumber( int devId )
+{
+    std::vector<DeviceCacheEntry> entries;
+    {
+        const std::lock_guard<std::mutex> lock(sDeviceCacheMutex);
+        entries = loadDeviceCache();
+    }
+
+    for( auto& entry : entries )
+    {
+        if( entry.dev_id==devId )
+            return (entry.usb_id==usbIdentity(devId))?entry.serial:-1;
+    }
+
+    return -1;
+}
+
+int VideoCapture::lookupDeviceId( int sn )
+{
+    std::vector<DeviceCacheEntry> entries;
+    {
+        const std::lock_guard<std::mutex> lock(sDeviceCacheMutex);
+        entries = loadDeviceCache();
+    }
+
+    for( auto& entry : entries )
+    {
+        if( entry.serial==sn )
+            return (entry.usb_id==usbIdentity(entry.dev_id))?entry.dev_id:-1;
+    }
+
+    return -1;
+}
+// <---- Device cache
+
 bool VideoCapture::initializeVideo( int devId/*=-1*/ )
+{
+    return initializeDevice( devId, -1 );
+}
+
+bool VideoCapture::initializeDevice( int devId, int sn )
 {
     reset();
 
+    mStartup = StartupReport();
+    mStartupFirstFrame = 0;
+    mStartupCtrlReset = 0;
+    mStartupT0 = getSteadyTimestamp();
+
     bool opened=false;
+    uint64_t open_start = mStartupT0;
 
     if( devId==-1 )
     {
+        // ----> Cached cameras first
+        std::vector<DeviceCacheEntry> entries;
+        {
+            const std::lock_guard<std::mutex> lock(sDeviceCacheMutex);
+            entries = loadDeviceCache();
+        }
+
+        for( auto& entry : entries )
+        {
+            if( entry.dev_id<0 || entry.dev_id>=64 || entry.usb_id!=usbIdentity(entry.dev_id) )
+                continue;
+
+            open_start = getSteadyTimestamp();
+            opened = openCamera( static_cast<uint8_t>(entry.dev_id) );
+            if(opened) break;
+        }
+        // <---- Cached cameras first
+
         // Try to open all the devices until the first success (max allowed by v4l: 64)
-        for( uint8_t id=0; id<64; id++ )
+        for( uint8_t id=0; id<64 && !opened; id++ )
         {
+            open_start = getSteadyTimestamp();
             opened = openCamera( id );
-            if(opened) break;
         }
     }
     else
     {
-        opened = openCamera( static_cast<uint8_t>(devId) );
+        opened = openCamera( static_cast<uint8_t>(devId), sn );
     }
 
     if(!opened)
@@ -298,14 +595,82 @@ bool VideoCapture::initializeVideo( int devId/*=-1*/ )
         return false;
     }
 
+    uint64_t open_end = getSteadyTimestamp();
+    mStartup.discovery_usec = (open_start-mStartupT0)/1000;
+    mStartup.setup_usec = (open_end-open_start)/1000 - mStartup.serial_usec;
+
     mInitialized = startCapture();
 
+    uint64_t stream_end = getSteadyTimestamp();
+    mStartup.stream_start_usec = (stream_end-open_end)/1000;
+
     if( mParams.verbose && mInitialized)
     {
         std::string msg = "Device '" + mDevName + "' opened";
         INFO_OUT(mParams.verbose,msg );
     }
 
+    // ----> Camera controls reset
+    if( mParams.async_control_reset )
+    {
+        mControlReset = postControlRequest<void>( [this,stream_end](){
+            resetControls();
+            mStartupCtrlReset = (getSteadyTimestamp()-stream_end)/1000;
+        } ).share();
+    }
+    else
+    {
+        resetControls();
+        mStartupCtrlReset = (getSteadyTimestamp()-stream_end)/1000;
+    }
+    // <---- Camera controls reset
+
+    return mInitialized;
+}
+
+bool VideoCapture::initializeVideoBySerial( int sn )
+{
+    // ----> Cached device
+    int cached_id = lookupDeviceId(sn);
+    if( cached_id>=0 && initializeDevice(cached_id, sn) )
+    {
+        return true;
+    }
+    // <---- Cached device
+
+    // ----> Probe the devices
+    for( int id=0; id<64; id++ )
+    {
+        if( id==cached_id )
+            continue;
+
+        // Skip the devices known to be other cameras
+        int cached_sn = lookupSerialNumber(id);
+        if( cached_sn>0 && cached_sn!=sn )
+            continue;
+
+        // Not a Stereolabs camera
+        if( getCameraModel(std::string("/dev/video") + std::to_string(id))==SL_DEVICE::NONE )
+            continue;
+
+        // The serial number is checked before starting the capture: the other cameras are left untouched
+        if( initializeDevice(id, sn) )
+        {
+            return true;
+        }
+    }
+    // <---- Probe the devices
+
+    reset();
+
+    std::string msg = std::string("Camera with SN ") + std::to_string(sn) + " not found";
+    ERROR_OUT(mParams.verbose,msg);
+
+    return false;
+}
+
+void VideoCapture::resetControls()
+{
     setLEDstatus( true );
 
     resetAECAGC();
@@ -316,11 +681,26 @@ bool VideoCapture::initializeVideo( int devId/*=-1*/ )
     resetHue();
     resetSaturation();
     resetSharpness();
+}
 
-    return mInitialized;
+bool VideoCapture::waitControlReset( uint64_t timeout_msec )
+{
+    if( !mControlReset.valid() )
+        return true;
+
+    return mControlReset.wait_for( std::chrono::milliseconds(timeout_msec) )==std::future_status::ready;
 }
 
-bool VideoCapture::openCamera( uint8_t devId )
+StartupReport VideoCapture::getStartupReport()
+{
+    StartupReport report = mStartup;
+    report.control_reset_usec = mStartupCtrlReset;
+    report.first_frame_usec = mStartupFirstFrame;
+
+    return report;
+}
+
+bool VideoCapture::openCamera( uint8_t devId, int sn )
 {
     mDevId = devId;
 
@@ -399,13 +779,39 @@ bool VideoCapture::openCamera( uint8_t devId )
     }
     // <---- Open
 
-    int sn = getSerialNumber();
+    // ----> Serial number, from the device cache if possible
+    uint64_t serial_start = getSteadyTimestamp();
+    std::string usb_id = usbIdentity(mDevId);
+    mSerialNumber = lookupSerialNumber(mDevId);
+    mStartup.serial_cached = (mSerialNumber>0);
+    if( !mStartup.serial_cached )
+    {
+        mSerialNumber = readSerialNumber();
+        storeDeviceCache(mDevId, mSerialNumber, usb_id);
+    }
+    mStartup.serial_usec = (getSteadyTimestamp()-serial_start)/1000;
+
     if(mParams.verbose)
     {
-        std::string msg = std::string("Opened camera with SN: ") + std::to_string(sn);
+        std::string msg = std::string("Opened camera with SN: ") + std::to_string(mSerialNumber) +
+                (mStartup.serial_cached?" (cached)":"");
         INFO_OUT(mParams.verbose,msg);
     }
 
+    if( sn>0 && mSerialNumber!=sn )
+    {
+        if(mParams.verbose)
+        {
+            std::string msg = "The device '" + mDevName + "' is not the camera with SN " + std::to_string(sn);
+            INFO_OUT(mParams.verbose,msg);
+        }
+
+        close(mFileDesc);
+        mFileDesc = -1;
+        return false;
+    }
+    // <---- Serial number, from the device cache if possible
+
     // ----> Init
     struct v4l2_capability cap;
     memset(&cap, 0, sizeof (v4l2_capability));
@@ -485,12 +891,16 @@ bool VideoCapture::openCamera( uint8_t devId )
     mLastFrame.channels = mChannels;
     int bufSize = mLastFrame.width * mLastFrame.height * mLastFrame.channels;
     mLastFrame.data = new unsigned char[bufSize];
+
+    mLatestFrame.width = mWidth;
+    mLatestFrame.height = mHeight;
+    mLatestFrame.channels = mChannels;
     // <---- Output frame allocation
 
     struct v4l2_requestbuffers req;
     memset(&req, 0, sizeof (v4l2_requestbuffers));
 
-    req.count = mBufCount;
+    req.count = mParams.buffer_count;
 
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
@@ -540,75 +950,302 @@ bool VideoCapture::openCamera( uint8_t devId )
     }
 
     mBufCount = req.count;
+
+    // ----> Keep the frame buffers in RAM
+    if( mParams.lock_buffers )
+    {
+        int res = mlock(mLastFrame.data, bufSize);
+        for (unsigned int i = 0; i < mBufCount && res==0; ++i)
+        {
+            res = mlock(mBuffers[i].start, mBuffers[i].length);
+        }
+
+        if(res==0)
+        {
+            mBuffersLocked = true;
+        }
+        else
+        {
+            std::string msg = std::string("Cannot lock the frame buffers in RAM: [")
+                    + std::to_string(errno) +std::string("] ") + std::string(strerror(errno))
+                    + std::string(". Check RLIMIT_MEMLOCK (ulimit -l)");
+            WARNING_OUT(mParams.verbose,msg);
+
+            // Release the pages locked before the failure
+            munlock(mLastFrame.data, bufSize);
+            for (unsigned int i = 0; i < mBufCount; ++i)
+            {
+                munlock(mBuffers[i].start, mBuffers[i].length);
+            }
+        }
+    }
+    // <---- Keep the frame buffers in RAM
+
+    initBufferRefs();
     // <---- Init
 
     return true;
 }
 
-int VideoCapture::getSerialNumber()
+void VideoCapture::initBufferRefs()
 {
-    /*if(!mInitialized)
-        return -1;*/
-
-    int ulValue = -1;
+    mBufMutex.lock();
+    mBufRefCount.assign(mBufCount, 0);
+    mRing.assign(mBufCount>2?mBufCount-2:1, RingSlot());
+    mRingHead = 0;
+    mRingCount = 0;
+    mRingDropped.store(0, std::memory_order_relaxed);
+    mBufMutex.unlock();
+}
 
-    uint8_t UNIQUE_BUF[384];
-    memset(UNIQUE_BUF, 0, 384);
+bool VideoCapture::initializeReplay( const std::string& filename, REPLAY_MODE mode, bool loop )
+{
+    reset();
 
-    int res = -1;
+    // ----> Open the recording file
+    FILE* file = fopen(filename.c_str(), "rb");
+    if( !file )
+    {
+        std::string msg = std::string("Cannot open the recording file '") + filename + "': ["
+                + std::to_string(errno) +std::string("] ") + std::string(strerror(errno));
+        ERROR_OUT(mParams.verbose,msg);
+        return false;
+    }
 
-    int try_count = 0;
-    while(res!=0)
+    RecordFileHeader header;
+    if( fread(&header, sizeof(header), 1, file)!=1 ||
+            memcmp(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC))!=0 ||
+            header.version!=RECORD_VERSION ||
+            header.width==0 || header.height==0 || header.channels==0 || header.fps==0 )
     {
-        res = ll_SPI_FlashProgramRead(&UNIQUE_BUF[0], UNIQUE_ID_START, 64, true);
+        ERROR_OUT(mParams.verbose,std::string("'") + filename + "' is not a valid recording file");
+        fclose(file);
+        return false;
+    }
+    // <---- Open the recording file
 
-        //check bytes read
-        if (UNIQUE_BUF[0] != 'O') {
-            res =  -1;
-        }
-        if (UNIQUE_BUF[1] != 'V') {
-            res =  -1;
-        }
+    mReplay = true;
+    mReplayFile = file;
+    mReplayMode = mode;
+    mReplayLoop = loop;
+    mReplaySerial = header.serial_number;
+    mReplayFinished = false;
 
-        try_count++;
-        if (try_count>500)
-            break;
-        usleep(1000);
-    }
+    mDevId = -1;
+    mDevName = filename;
+    mWidth = header.width;
+    mHeight = header.height;
+    mChannels = header.channels;
+    mFps = header.fps;
 
-    if (res != 0)
-        return -1;
+    // ----> Output frame allocation
+    mLastFrame.width = mWidth;
+    mLastFrame.height = mHeight;
+    mLastFrame.channels = mChannels;
+    int bufSize = mLastFrame.width * mLastFrame.height * mLastFrame.channels;
+    mLastFrame.data = new unsigned char[bufSize];
 
-    //check bytes read
-    if (UNIQUE_BUF[0] != 'O') {
-        return -1;
-    }
-    if (UNIQUE_BUF[1] != 'V') {
-        return -1;
+    mLatestFrame.width = mWidth;
+    mLatestFrame.height = mHeight;
+    mLatestFrame.channels = mChannels;
+    // <---- Output frame allocation
+
+    // ----> Replay buffers, replacing the UVC buffers
+    mBufCount = mParams.buffer_count;
+    mBuffers = (UVCBuffer*) calloc(mBufCount, sizeof(*mBuffers));
+    mReplayFree.clear();
+    for (unsigned int i = 0; i < mBufCount; ++i)
+    {
+        mBuffers[i].length = bufSize;
+        mBuffers[i].start = malloc(bufSize);
+        mReplayFree.push_back(i);
     }
 
-    ulValue = (UNIQUE_BUF[2] << 24) + (UNIQUE_BUF[3] << 16) + (UNIQUE_BUF[4] << 8) + UNIQUE_BUF[5];
+    initBufferRefs();
+    // <---- Replay buffers, replacing the UVC buffers
 
-    char buff[128];
-    memset(buff, 0, 128);
-    sprintf(buff, "%x", ulValue);
-    return (int) atoi(buff);
+    // Discard a shutdown request left by a previous session
+    uint64_t val;
+    if( read(mWakeFd, &val, sizeof(val)) < 0 ) {} // EAGAIN if no request is pending
+
+    mJitter.reset(1e6/mFps);
+    resetCaptureStats();
+
+    mStopCapture = false;
+    mInitialized = true;
+    mGrabThread = std::thread( &VideoCapture::replayThreadFunc,this );
+
+    if( mParams.verbose )
+    {
+        std::string msg = "Replaying '" + mDevName + "' (" + std::to_string(mWidth) + "x" + std::to_string(mHeight)
+                + "@" + std::to_string(mFps) + ((mReplayMode==REPLAY_MODE::REALTIME)?", real-time)":", fast)");
+        INFO_OUT(mParams.verbose,msg );
+    }
+
+    return true;
 }
 
-bool VideoCapture::startCapture()
+void VideoCapture::replayThreadFunc()
 {
-    // ----> Start capturing
-    enum v4l2_buf_type type;
-    for (unsigned int i = 0; i < mBufCount; ++i)
+    const long first_frame_pos = sizeof(RecordFileHeader);
+
+    uint64_t first_ts = 0;      // Timestamp of the first frame of the current pass
+    uint64_t start_ts = 0;      // Steady timestamp of the publication of the first frame
+    bool frames_found = false;  // Indicates that the file contains at least one frame
+
+    mGrabRunning=true;
+
+    while (!mStopCapture)
     {
-        struct v4l2_buffer buf = {0};
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-        if( -1==xioctl(mFileDesc, VIDIOC_QBUF, &buf) )
+        // ----> Wait for a free buffer
+        int idx = -1;
         {
-            if(mParams.verbose)
-            {
+            std::unique_lock<std::mutex> lock(mReplayMutex);
+            mReplayCond.wait( lock, [this]{return !mReplayFree.empty() || mStopCapture;} );
+            if( mStopCapture )
+                break;
+
+            idx = mReplayFree.front();
+            mReplayFree.pop_front();
+        }
+        // <---- Wait for a free buffer
+
+        // ----> Read the next frame
+        RecordFrameHeader fh;
+        bool header_ok = fread(&fh, sizeof(fh), 1, mReplayFile)==1;
+        bool end_marker = header_ok && fh.size==0; // The seek index follows, not a frame
+        bool valid = header_ok && !end_marker &&
+                fh.size==mBuffers[idx].length &&
+                fread(mBuffers[idx].start, fh.size, 1, mReplayFile)==1;
+
+        if( !valid )
+        {
+            queueBuffer(idx);
+
+            if( mReplayLoop && frames_found )
+            {
+                fseek(mReplayFile, first_frame_pos, SEEK_SET);
+                first_ts = 0;
+                continue;
+            }
+
+            if( !end_marker && !feof(mReplayFile) )
+            {
+                WARNING_OUT(mParams.verbose,std::string("Invalid frame in the recording file '") + mDevName + "'");
+            }
+            INFO_OUT(mParams.verbose,std::string("End of the recording file '") + mDevName + "'");
+            mReplayFinished = true;
+            break;
+        }
+        frames_found = true;
+        // <---- Read the next frame
+
+        // ----> Real-time pacing
+        if( mReplayMode==REPLAY_MODE::REALTIME )
+        {
+            if( first_ts==0 || fh.timestamp<first_ts )
+            {
+                first_ts = fh.timestamp;
+                start_ts = getSteadyTimestamp();
+            }
+
+            std::chrono::steady_clock::time_point due( std::chrono::nanoseconds(start_ts + (fh.timestamp-first_ts)) );
+
+            std::unique_lock<std::mutex> lock(mReplayMutex);
+            if( mReplayCond.wait_until( lock, due, [this]{return mStopCapture;} ) )
+            {
+                lock.unlock();
+                queueBuffer(idx);
+                break;
+            }
+        }
+        // <---- Real-time pacing
+
+        uint64_t pub_ts = getSteadyTimestamp();
+        mJitter.addSample(pub_ts);
+
+        publishFrame(idx, fh.timestamp, fh.sequence, pub_ts);
+    }
+
+    mGrabRunning = false;
+}
+
+int VideoCapture::getSerialNumber()
+{
+    if( mReplay )
+        return mReplaySerial;
+
+    // Read once per opened device
+    if( mSerialNumber<=0 )
+        mSerialNumber = readSerialNumber();
+
+    return mSerialNumber;
+}
+
+int VideoCapture::readSerialNumber()
+{
+    /*if(!mInitialized)
+        return -1;*/
+
+    int ulValue = -1;
+
+    uint8_t UNIQUE_BUF[384];
+    memset(UNIQUE_BUF, 0, 384);
+
+    int res = -1;
+
+    int try_count = 0;
+    while(res!=0)
+    {
+        res = ll_SPI_FlashProgramRead(&UNIQUE_BUF[0], UNIQUE_ID_START, 64, true);
+
+        //check bytes read
+        if (UNIQUE_BUF[0] != 'O') {
+            res =  -1;
+        }
+        if (UNIQUE_BUF[1] != 'V') {
+            res =  -1;
+        }
+
+        try_count++;
+        if (try_count>500)
+            break;
+        usleep(1000);
+    }
+
+    if (res != 0)
+        return -1;
+
+    //check bytes read
+    if (UNIQUE_BUF[0] != 'O') {
+        return -1;
+    }
+    if (UNIQUE_BUF[1] != 'V') {
+        return -1;
+    }
+
+    ulValue = (UNIQUE_BUF[2] << 24) + (UNIQUE_BUF[3] << 16) + (UNIQUE_BUF[4] << 8) + UNIQUE_BUF[5];
+
+    char buff[128];
+    memset(buff, 0, 128);
+    sprintf(buff, "%x", ulValue);
+    return (int) atoi(buff);
+}
+
+bool VideoCapture::startCapture()
+{
+    // ----> Start capturing
+    enum v4l2_buf_type type;
+    for (unsigned int i = 0; i < mBufCount; ++i)
+    {
+        struct v4l2_buffer buf = {0};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if( -1==xioctl(mFileDesc, VIDIOC_QBUF, &buf) )
+        {
+            if(mParams.verbose)
+            {
                 std::string msg = std::string("Cannot queue buffer for '") + mDevName + "': ["
                         + std::to_string(errno) +std::string("] ") + std::string(strerror(errno));
                 ERROR_OUT(mParams.verbose,msg);
@@ -647,8 +1284,36 @@ bool VideoCapture::startCapture()
     }
     // <---- Start capturing
 
+    // Discard a shutdown request left by a previous session
+    uint64_t val;
+    if( read(mWakeFd, &val, sizeof(val)) < 0 ) {} // EAGAIN if no request is pending
+
+    mJitter.reset(1e6/mFps);
+    resetCaptureStats();
+
+    mStopCapture = false;
     mGrabThread = std::thread( &VideoCapture::grabThreadFunc,this );
 
+    // ----> Real-time scheduling of the grabbing thread
+    if( mParams.rt_priority>0 || mParams.cpu_affinity_mask!=0 )
+    {
+        int err = setThreadScheduling(mGrabThread, mParams.rt_priority, mParams.cpu_affinity_mask);
+        if( err!=0 )
+        {
+            std::string msg = std::string("Cannot set the scheduling of the grabbing thread: [")
+                    + std::to_string(err) +std::string("] ") + std::string(strerror(err));
+            WARNING_OUT(mParams.verbose,msg);
+        }
+        else if( mParams.verbose )
+        {
+            std::stringstream msg;
+            msg << "Grabbing thread scheduling: SCHED_FIFO priority " << mParams.rt_priority
+                << ", CPU mask 0x" << std::hex << mParams.cpu_affinity_mask;
+            INFO_OUT(mParams.verbose,msg.str());
+        }
+    }
+    // <---- Real-time scheduling of the grabbing thread
+
     return true;
 }
 
@@ -756,21 +1421,16 @@ SL_DEVICE VideoCapture::getCameraModel( std::string dev_name)
 
 void VideoCapture::grabThreadFunc()
 {
-    mNewFrame = false;
-    mStopCapture = false;
-
-    fd_set fds;
-    struct timeval tv = {0};
-
-    FD_ZERO(&fds);
-
     if (mFileDesc < 0)
         return;
 
-    FD_SET(mFileDesc, &fds);
-    tv.tv_sec = 2;
-    tv.tv_usec = 0;
-    select(mFileDesc + 1, &fds, nullptr, nullptr, &tv);
+    // ----> Wait for frames on the device and for the shutdown request on the wakeup eventfd
+    struct pollfd fds[2];
+    fds[0].fd = mFileDesc;
+    fds[0].events = POLLIN;
+    fds[1].fd = mWakeFd;
+    fds[1].events = POLLIN;
+    // <---- Wait for frames on the device and for the shutdown request on the wakeup eventfd
 
     struct v4l2_buffer buf;
     memset(&(buf), 0, sizeof (buf));
@@ -782,18 +1442,101 @@ void VideoCapture::grabThreadFunc()
     uint64_t rel_ts = 0;
     int capture_frame_count = 0;
 
+    bool first_seq = true;
+    uint32_t last_seq = 0;
+
+    int retry_msec = 0; // Wait before polling the device again after an error, 0 if no error
+
     mFirstFrame=true;
 
     while (!mStopCapture)
     {
         mGrabRunning=true;
 
-        mComMutex.lock();
+        // ----> Back off after a device error, still woken up by the shutdown request
+        if( retry_msec>0 )
+        {
+            if( poll(&fds[1], 1, retry_msec)>0 && (fds[1].revents & POLLIN) )
+            {
+                break; // Shutdown requested
+            }
+            retry_msec = std::min(2*retry_msec, GRAB_RETRY_MAX_MSEC);
+        }
+        // <---- Back off after a device error, still woken up by the shutdown request
+
+        int pr = poll(fds, 2, GRAB_POLL_TIMEOUT_MSEC);
+        if( pr<0 )
+        {
+            if( errno==EINTR )
+                continue;
+
+            if(mParams.verbose)
+            {
+                std::string msg = std::string("Cannot poll '") + mDevName + "': ["
+                        + std::to_string(errno) +std::string("] ") + std::string(strerror(errno));
+                ERROR_OUT(mParams.verbose,msg);
+            }
+            retry_msec = std::max(retry_msec, GRAB_RETRY_MIN_MSEC);
+            continue;
+        }
+        if( pr==0 )
+        {
+            WARNING_OUT(mParams.verbose,"No frame received in the last " + std::to_string(GRAB_POLL_TIMEOUT_MSEC) + " msec");
+            continue;
+        }
+        if( fds[1].revents & POLLIN )
+        {
+            break; // Shutdown requested
+        }
+        if( fds[0].revents & (POLLERR|POLLHUP|POLLNVAL) )
+        {
+            // Also reported while the consumers hold all the buffers: the capture resumes once one is re-queued
+            if( retry_msec==0 )
+            {
+                ERROR_OUT(mParams.verbose,"Device '" + mDevName + "' error while grabbing, retrying");
+            }
+            retry_msec = std::max(retry_msec, GRAB_RETRY_MIN_MSEC);
+            continue;
+        }
+        if( !(fds[0].revents & POLLIN) )
+        {
+            continue;
+        }
+
+        // Streaming ioctls are serialized by the driver: no need to wait for control transfers
+        uint64_t dq_start = getSteadyTimestamp();
         int ret = ioctl(mFileDesc, VIDIOC_DQBUF, &buf);
-        mComMutex.unlock();
+        uint64_t dq_end = getSteadyTimestamp();
+        mStatDqbuf.add((dq_end-dq_start)/1000);
 
         if (buf.bytesused == buf.length && ret == 0 && buf.index < mBufCount)
         {
+            if( retry_msec>0 )
+            {
+                INFO_OUT(mParams.verbose,"Device '" + mDevName + "' grabbing again");
+                retry_msec = 0;
+            }
+
+            mJitter.addSample(dq_end);
+
+            // ----> Capture telemetry
+            if( !first_seq && buf.sequence>last_seq+1 )
+            {
+                mStatMissedSeq.fetch_add(buf.sequence-last_seq-1, std::memory_order_relaxed);
+            }
+            first_seq = false;
+            last_seq = buf.sequence;
+
+            if( (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)==V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC )
+            {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                uint64_t now_usec = static_cast<uint64_t>(now.tv_sec)*1000000ULL + now.tv_nsec/1000;
+                uint64_t buf_usec = static_cast<uint64_t>(buf.timestamp.tv_sec)*1000000ULL + buf.timestamp.tv_usec;
+                mStatUvcLatency.add( now_usec>buf_usec ? now_usec-buf_usec : 0 );
+            }
+            // <---- Capture telemetry
+
             mCurrentIndex = buf.index;
             // get buffer timestamp in us
 
@@ -820,65 +1563,56 @@ void VideoCapture::grabThreadFunc()
             // cvt to ns
             rel_ts *= 1000;
 
-            mBufMutex.lock();
-            if (mLastFrame.data != nullptr && mWidth != 0 && mHeight != 0 && mBuffers[mCurrentIndex].start != nullptr)
-            {
-                mLastFrame.frame_id++;
-                memcpy(mLastFrame.data, (unsigned char*) mBuffers[mCurrentIndex].start, mBuffers[mCurrentIndex].length);
-                mLastFrame.timestamp = mStartTs + rel_ts;
+            uint64_t frame_ts = mStartTs + rel_ts;
 
-                //                static uint64_t last_ts=0;
-                //                std::cout << "[Video] Frame TS: " << static_cast<double>(mLastFrame.timestamp)/1e9 << " sec" << std::endl;
-                //                double dT = static_cast<double>(mLastFrame.timestamp-last_ts)/1e9;
-                //                last_ts = mLastFrame.timestamp;
-                //                std::cout << "[Video] Frame FPS: " << 1./dT << std::endl;
+            publishFrame(mCurrentIndex, frame_ts, buf.sequence, dq_end);
+
+            //                static uint64_t last_ts=0;
+            //                std::cout << "[Video] Frame TS: " << static_cast<double>(frame_ts)/1e9 << " sec" << std::endl;
+            //                double dT = static_cast<double>(frame_ts-last_ts)/1e9;
+            //                last_ts = frame_ts;
+            //                std::cout << "[Video] Frame FPS: " << 1./dT << std::endl;
 
 #ifdef SENSORS_MOD_AVAILABLE
-                if(mSensReadyToSync)
-                {
-                    mSensReadyToSync = false;
-                    mSensPtr->updateTimestampOffset(mLastFrame.timestamp);
-                }
+            if(mSensReadyToSync)
+            {
+                mSensReadyToSync = false;
+                mSensPtr->updateTimestampOffset(frame_ts);
+            }
 #endif
 
 #ifdef SENSOR_LOG_AVAILABLE
-                // ----> AEC/AGC register logging
-                if(mLogEnable)
-                {
-                    static int frame_count =0;
+            // ----> AEC/AGC register logging
+            if(mLogEnable)
+            {
+                static int frame_count =0;
 
 
-                    if((++frame_count)==mLogFrameSkip)
-                        frame_count = 0;
+                if((++frame_count)==mLogFrameSkip)
+                    frame_count = 0;
 
-                    if(frame_count==0)
-                    {
+                if(frame_count==0)
+                {
+                    // Register reading is slow: it's done by the control thread
+                    postControlRequest<void>( [this](){
                         saveLogDataLeft();
                         saveLogDataRight();
-                    }
+                    } );
                 }
-                // <---- AEC/AGC register logging
-#endif
-
-                mNewFrame=true;
             }
-            mBufMutex.unlock();
-
-            mComMutex.lock();
-            ioctl(mFileDesc, VIDIOC_QBUF, &buf);
-            mComMutex.unlock();
+            // <---- AEC/AGC register logging
+#endif
 
             capture_frame_count++;
         }
         else
         {
-            if (buf.bytesused != buf.length)
+            if (ret == 0)
             {
-                mComMutex.lock();
-                ioctl(mFileDesc, VIDIOC_QBUF, &buf);
-                mComMutex.unlock();
+                // Incomplete frame: give the buffer back to the driver
+                mStatIncomplete.fetch_add(1, std::memory_order_relaxed);
+                queueBuffer(buf.index);
             }
-            usleep(200);
             buf.bytesused = -1;
             buf.length = 0;
         }
@@ -887,25 +1621,698 @@ void VideoCapture::grabThreadFunc()
     mGrabRunning = false;
 }
 
+bool VideoCapture::publishFrame(int idx, uint64_t frame_ts, uint32_t sequence, uint64_t dequeue_ts)
+{
+    // ----> Publish the frame, keeping its UVC buffer dequeued
+    int to_requeue[2] = {-1,-1};
+    bool published = false;
+    uint64_t gen = 0;
+    Frame published_frame;
+
+    std::unique_lock<std::mutex> lock(mBufMutex);
+    if (mWidth != 0 && mHeight != 0 && mBuffers[idx].start != nullptr)
+    {
+        // Block only while a consumer empties the ring: the other consumers never stall the capture.
+        // A replay loses no frame by waiting: KEEP_ALL waits too instead of dropping the new frame
+        bool wait_ring = mParams.frame_policy==FRAME_POLICY::BLOCK_PRODUCER ||
+                (mReplay && mParams.frame_policy==FRAME_POLICY::KEEP_ALL);
+        if( mRingEnabled && wait_ring )
+        {
+            mRingCond.wait( lock, [this]{return mRingCount<mRing.size() || !mRingEnabled || mStopCapture;} );
+        }
+
+        mLatestFrame.frame_id++;
+        mLatestFrame.data = (unsigned char*) mBuffers[idx].start;
+        mLatestFrame.timestamp = frame_ts;
+        mLatestFrame.sequence = sequence;
+
+        // The "latest frame" slot owns a reference on the new buffer and drops the one on the previous
+        mBufRefCount[idx]++;
+        if( mLatestBufIdx>=0 && (--mBufRefCount[mLatestBufIdx])==0 )
+        {
+            to_requeue[0] = mLatestBufIdx;
+        }
+        mLatestBufIdx = idx;
+
+        // ----> Capture ring
+        bool store = mRingEnabled;
+        if( store && mRingCount==mRing.size() )
+        {
+            mRingDropped.fetch_add(1, std::memory_order_relaxed);
+
+            if( mParams.frame_policy==FRAME_POLICY::KEEP_NEWEST )
+            {
+                // Drop the oldest frame
+                RingSlot& oldest = mRing[mRingHead];
+                if( (--mBufRefCount[oldest.buf_idx])==0 )
+                {
+                    to_requeue[1] = oldest.buf_idx;
+                }
+                mRingHead = (mRingHead+1)%mRing.size();
+                mRingCount--;
+            }
+            else
+            {
+                // Drop the new frame (KEEP_ALL, or BLOCK_PRODUCER while stopping)
+                store = false;
+            }
+        }
+
+        if( store )
+        {
+            RingSlot& slot = mRing[(mRingHead+mRingCount)%mRing.size()];
+            slot.buf_idx = idx;
+            slot.frame = mLatestFrame;
+            mBufRefCount[idx]++;
+            mRingCount++;
+        }
+        // <---- Capture ring
+
+        published = true;
+        gen = mStreamGen;
+        published_frame = mLatestFrame;
+    }
+    else
+    {
+        to_requeue[0] = idx;
+    }
+    lock.unlock();
+
+    // The reference of the "latest frame" slot keeps the buffer alive until the next frame is published
+    if( published )
+    {
+        publishToSubscribers(idx, gen, published_frame);
+
+        // Wake up the consumers waiting for a new frame
+        mFrameCond.notify_all();
+        uint64_t one = 1;
+        if( write(mFrameEventFd, &one, sizeof(one)) < 0 ) {} // Only fails if the counter is saturated
+    }
+    // <---- Publish the frame, keeping its UVC buffer dequeued
+
+    if( published )
+    {
+        mStatFrames.fetch_add(1, std::memory_order_relaxed);
+        mStatPublish.add((getSteadyTimestamp()-dequeue_ts)/1000);
+
+        // Time to first frame of the startup report. `mStartupT0` is set before the grabbing thread starts
+        if( mStartupT0!=0 && mStartupFirstFrame.load(std::memory_order_relaxed)==0 )
+        {
+            mStartupFirstFrame.store((dequeue_ts-mStartupT0)/1000, std::memory_order_relaxed);
+        }
+    }
+
+    for( int req_idx : to_requeue )
+    {
+        if(req_idx>=0)
+        {
+            queueBuffer(req_idx);
+        }
+    }
+
+    return published;
+}
+
+int VideoCapture::queueBuffer(int idx)
+{
+    if( mReplay )
+    {
+        // The buffer can be filled with the next frame of the recording file
+        mReplayMutex.lock();
+        mReplayFree.push_back(idx);
+        mReplayMutex.unlock();
+        mReplayCond.notify_one();
+        return 0;
+    }
+
+    struct v4l2_buffer buf;
+    memset(&(buf), 0, sizeof (buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = idx;
+
+    int ret = ioctl(mFileDesc, VIDIOC_QBUF, &buf);
+    if( ret!=0 )
+    {
+        mStatRequeueFail.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+void VideoCapture::retainBuffer(int idx, uint64_t gen)
+{
+    const std::lock_guard<std::mutex> lock(mBufMutex);
+    if( gen!=mStreamGen || idx<0 || idx>=static_cast<int>(mBufRefCount.size()) )
+        return;
+
+    mBufRefCount[idx]++;
+}
+
+void VideoCapture::releaseBuffer(int idx, uint64_t gen)
+{
+    mBufMutex.lock();
+    if( gen!=mStreamGen || idx<0 || idx>=static_cast<int>(mBufRefCount.size()) )
+    {
+        // The buffer belongs to a closed streaming session
+        mBufMutex.unlock();
+        return;
+    }
+
+    bool requeue = (--mBufRefCount[idx])==0;
+    mBufMutex.unlock();
+
+    if(requeue)
+    {
+        queueBuffer(idx);
+    }
+}
+
 const Frame& VideoCapture::getLastFrame( uint64_t timeout_msec )
 {
-    // ----> Wait for a new frame
-    uint64_t time_count = timeout_msec*10;
-    while( !mNewFrame )
+    uint64_t frame_id;
+    {
+        const std::lock_guard<std::mutex> lock(mLastFrameMutex);
+        frame_id = mLastFrame.frame_id;
+    }
+    return waitForFrameAfter( frame_id, timeout_msec );
+}
+
+const Frame& VideoCapture::waitForFrameAfter( uint64_t frame_id, uint64_t timeout_msec )
+{
+    // ----> Wait for a new frame and get a reference on its buffer
+    std::unique_lock<std::mutex> lock(mBufMutex);
+    if( !mFrameCond.wait_for( lock, std::chrono::milliseconds(timeout_msec),
+                              [this,frame_id]{return mLatestBufIdx>=0 && mLatestFrame.frame_id>frame_id;} ) )
+    {
+        return mLastFrame;
+    }
+
+    int idx = mLatestBufIdx;
+    uint64_t gen = mStreamGen;
+    Frame latest = mLatestFrame;
+    mBufRefCount[idx]++;
+    lock.unlock();
+    // <---- Wait for a new frame and get a reference on its buffer
+
+    // Compatibility path: copy the frame so that it remains valid after the buffer is re-queued.
+    // The consumers share `mLastFrame`: one copy at a time, data and metadata together
+    {
+        const std::lock_guard<std::mutex> copy_lock(mLastFrameMutex);
+        if (mLastFrame.data != nullptr && mLastFrame.frame_id != latest.frame_id)
+        {
+            memcpy(mLastFrame.data, latest.data, mBuffers[idx].length);
+            mLastFrame.frame_id = latest.frame_id;
+            mLastFrame.timestamp = latest.timestamp;
+            mLastFrame.sequence = latest.sequence;
+        }
+    }
+
+    releaseBuffer(idx, gen);
+
+    return mLastFrame;
+}
+
+FrameLease VideoCapture::acquireFrame( uint64_t timeout_msec )
+{
+    FrameLease lease;
+
+    // ----> Wait for a frame newer than the last leased one
+    std::unique_lock<std::mutex> lock(mBufMutex);
+    if( !mFrameCond.wait_for( lock, std::chrono::milliseconds(timeout_msec),
+                              [this]{return mLatestBufIdx>=0 && mLatestFrame.frame_id!=mLastLeaseId;} ) )
+    {
+        return lease;
+    }
+    // <---- Wait for a frame newer than the last leased one
+
+    mBufRefCount[mLatestBufIdx]++;
+    lease.mCap = this;
+    lease.mBufIdx = mLatestBufIdx;
+    lease.mStreamGen = mStreamGen;
+    lease.mFrame = mLatestFrame;
+    mLastLeaseId = mLatestFrame.frame_id;
+
+    return lease;
+}
+
+FrameLease VideoCapture::acquireNextFrame( uint64_t timeout_msec )
+{
+    FrameLease lease;
+
+    // ----> Wait for a frame in the ring
+    std::unique_lock<std::mutex> lock(mBufMutex);
+    mRingEnabled = true;
+    if( !mFrameCond.wait_for( lock, std::chrono::milliseconds(timeout_msec),
+                              [this]{return mRingCount>0;} ) )
+    {
+        return lease;
+    }
+    // <---- Wait for a frame in the ring
+
+    // The reference owned by the ring is moved to the lease
+    RingSlot& oldest = mRing[mRingHead];
+    lease.mCap = this;
+    lease.mBufIdx = oldest.buf_idx;
+    lease.mStreamGen = mStreamGen;
+    lease.mFrame = oldest.frame;
+    mRingHead = (mRingHead+1)%mRing.size();
+    mRingCount--;
+    mRingCond.notify_one();
+
+    return lease;
+}
+
+void VideoCapture::enableCaptureRing( bool enable )
+{
+    std::vector<int> to_requeue;
+
+    std::unique_lock<std::mutex> lock(mBufMutex);
+    mRingEnabled = enable;
+    if( !enable )
+    {
+        // Release the stored frames
+        for( ; mRingCount>0; mRingCount-- )
+        {
+            RingSlot& oldest = mRing[mRingHead];
+            if( (--mBufRefCount[oldest.buf_idx])==0 )
+            {
+                to_requeue.push_back(oldest.buf_idx);
+            }
+            mRingHead = (mRingHead+1)%mRing.size();
+        }
+        mRingCond.notify_all(); // Wake up the grabbing thread if blocked on a full ring
+    }
+    lock.unlock();
+
+    for( int idx : to_requeue )
+    {
+        queueBuffer(idx);
+    }
+}
+
+uint64_t VideoCapture::getRingDroppedFrames()
+{
+    return mRingDropped.load(std::memory_order_relaxed);
+}
+
+// ----> Capture telemetry
+void VideoCapture::AtomicHistogram::add(uint64_t usec)
+{
+    int bucket = 0;
+    if( usec>1 )
+    {
+        bucket = 63 - __builtin_clzll(usec);
+        if( bucket>=CAPTURE_HIST_BUCKETS )
+            bucket = CAPTURE_HIST_BUCKETS-1;
+    }
+
+    count[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum_usec.fetch_add(usec, std::memory_order_relaxed);
+    if( usec>max_usec.load(std::memory_order_relaxed) )
+    {
+        max_usec.store(usec, std::memory_order_relaxed); // Single writer: no need for a CAS loop
+    }
+    samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+void VideoCapture::AtomicHistogram::reset()
+{
+    for( auto& c : count )
+        c.store(0, std::memory_order_relaxed);
+    samples.store(0, std::memory_order_relaxed);
+    sum_usec.store(0, std::memory_order_relaxed);
+    max_usec.store(0, std::memory_order_relaxed);
+}
+
+void VideoCapture::AtomicHistogram::copyTo(LatencyHistogram& hist) const
+{
+    for( int i=0; i<CAPTURE_HIST_BUCKETS; i++ )
+        hist.count[i] = count[i].load(std::memory_order_relaxed);
+    hist.samples = samples.load(std::memory_order_relaxed);
+    hist.sum_usec = sum_usec.load(std::memory_order_relaxed);
+    hist.max_usec = max_usec.load(std::memory_order_relaxed);
+}
+
+void VideoCapture::resetCaptureStats()
+{
+    mStatFrames.store(0, std::memory_order_relaxed);
+    mStatIncomplete.store(0, std::memory_order_relaxed);
+    mStatMissedSeq.store(0, std::memory_order_relaxed);
+    mStatRequeueFail.store(0, std::memory_order_relaxed);
+    mStatDqbuf.reset();
+    mStatPublish.reset();
+    mStatUvcLatency.reset();
+}
+
+CaptureStats VideoCapture::getCaptureStats()
+{
+    CaptureStats stats;
+    stats.frames = mStatFrames.load(std::memory_order_relaxed);
+    stats.incomplete_frames = mStatIncomplete.load(std::memory_order_relaxed);
+    stats.missed_sequences = mStatMissedSeq.load(std::memory_order_relaxed);
+    stats.requeue_failures = mStatRequeueFail.load(std::memory_order_relaxed);
+    stats.ring_dropped = getRingDroppedFrames();
+    mStatDqbuf.copyTo(stats.dqbuf_duration);
+    mStatPublish.copyTo(stats.dequeue_to_publish);
+    mStatUvcLatency.copyTo(stats.uvc_to_wall);
+    return stats;
+}
+// <---- Capture telemetry
+
+// ----> Frame subscriptions
+int VideoCapture::subscribe(size_t queue_depth)
+{
+    if(queue_depth==0)
+        return -1;
+
+    std::shared_ptr<Subscriber> sub = std::make_shared<Subscriber>();
+    sub->depth = queue_depth;
+
+    const std::lock_guard<std::mutex> lock(mSubMutex);
+    sub->id = ++mLastSubId;
+    mSubscribers.push_back(sub);
+
+    return sub->id;
+}
+
+int VideoCapture::subscribe(std::function<void(const FrameLease&)> callback, size_t queue_depth)
+{
+    if(queue_depth==0 || !callback)
+        return -1;
+
+    std::shared_ptr<Subscriber> sub = std::make_shared<Subscriber>();
+    sub->depth = queue_depth;
+    sub->callback = callback;
+
+    const std::lock_guard<std::mutex> lock(mSubMutex);
+    sub->id = ++mLastSubId;
+    sub->thread = std::thread( &VideoCapture::subscriberThreadFunc, this, sub );
+    mSubscribers.push_back(sub);
+
+    return sub->id;
+}
+
+bool VideoCapture::unsubscribe(int sub_id)
+{
+    std::shared_ptr<Subscriber> sub;
+    std::deque<FrameLease> pending;
+
+    mSubMutex.lock();
+    for( auto it=mSubscribers.begin(); it!=mSubscribers.end(); ++it )
+    {
+        if( (*it)->id==sub_id )
+        {
+            sub = *it;
+            mSubscribers.erase(it);
+            break;
+        }
+    }
+    if( sub )
+    {
+        sub->stop = true;
+        pending.swap(sub->queue);
+        sub->cond.notify_all();
+    }
+    mSubMutex.unlock();
+
+    if( !sub )
+        return false;
+
+    pending.clear(); // Release the queued frames outside the lock
+
+    if( sub->thread.joinable() )
+    {
+        // The subscription can be cancelled by its own callback
+        if( sub->thread.get_id()==std::this_thread::get_id() )
+            sub->thread.detach();
+        else
+            sub->thread.join();
+    }
+
+    return true;
+}
+
+FrameLease VideoCapture::popFrame(int sub_id, uint64_t timeout_msec)
+{
+    FrameLease lease;
+
+    std::unique_lock<std::mutex> lock(mSubMutex);
+    std::shared_ptr<Subscriber> sub = getSubscriber(sub_id);
+    if( !sub || sub->callback )
+        return lease;
+
+    if( !sub->cond.wait_for( lock, std::chrono::milliseconds(timeout_msec),
+                             [&sub]{return !sub->queue.empty() || sub->stop;} ) )
+    {
+        return lease;
+    }
+
+    if( !sub->queue.empty() )
+    {
+        lease = std::move(sub->queue.front());
+        sub->queue.pop_front();
+    }
+
+    return lease;
+}
+
+uint64_t VideoCapture::getSubscriberDroppedFrames(int sub_id)
+{
+    const std::lock_guard<std::mutex> lock(mSubMutex);
+    std::shared_ptr<Subscriber> sub = getSubscriber(sub_id);
+    return sub?sub->dropped:0;
+}
+
+std::shared_ptr<VideoCapture::Subscriber> VideoCapture::getSubscriber(int sub_id)
+{
+    for( auto& sub : mSubscribers )
+    {
+        if( sub->id==sub_id )
+            return sub;
+    }
+    return nullptr;
+}
+
+void VideoCapture::subscriberThreadFunc(std::shared_ptr<Subscriber> sub)
+{
+    while(true)
+    {
+        FrameLease lease;
+
+        {
+            std::unique_lock<std::mutex> lock(mSubMutex);
+            sub->cond.wait( lock, [&sub]{return !sub->queue.empty() || sub->stop;} );
+
+            if( sub->stop )
+                break;
+
+            lease = std::move(sub->queue.front());
+            sub->queue.pop_front();
+        }
+
+        sub->callback(lease);
+    }
+}
+
+void VideoCapture::publishToSubscribers(int idx, uint64_t gen, const Frame& frame)
+{
+    std::vector<FrameLease> dropped;
+
+    mSubMutex.lock();
+    if( mSubscribers.empty() )
+    {
+        mSubMutex.unlock();
+        return;
+    }
+
+    for( auto& sub : mSubscribers )
+    {
+        if( sub->queue.size()>=sub->depth )
+        {
+            dropped.push_back( std::move(sub->queue.front()) );
+            sub->queue.pop_front();
+            sub->dropped++;
+        }
+
+        // Each subscriber owns a reference on the buffer: the frame data is shared, not copied
+        FrameLease lease;
+        retainBuffer(idx, gen);
+        lease.mCap = this;
+        lease.mBufIdx = idx;
+        lease.mStreamGen = gen;
+        lease.mFrame = frame;
+        sub->queue.push_back( std::move(lease) );
+        sub->cond.notify_one();
+    }
+    mSubMutex.unlock();
+
+    // The dropped leases are released here, outside the lock, possibly re-queuing their buffers
+}
+
+void VideoCapture::clearSubscriberQueues()
+{
+    std::vector<FrameLease> pending;
+
+    mSubMutex.lock();
+    for( auto& sub : mSubscribers )
+    {
+        for( auto& lease : sub->queue )
+        {
+            pending.push_back( std::move(lease) );
+        }
+        sub->queue.clear();
+    }
+    mSubMutex.unlock();
+}
+// <---- Frame subscriptions
+
+// ----> FrameLease
+FrameLease::FrameLease(const FrameLease& other)
+{
+    *this = other;
+}
+
+FrameLease::FrameLease(FrameLease&& other)
+{
+    *this = std::move(other);
+}
+
+FrameLease& FrameLease::operator=(const FrameLease& other)
+{
+    if(this==&other)
+        return *this;
+
+    release();
+
+    if(other.mCap)
     {
-        if(time_count==0)
+        other.mCap->retainBuffer(other.mBufIdx, other.mStreamGen);
+    }
+
+    mCap = other.mCap;
+    mBufIdx = other.mBufIdx;
+    mStreamGen = other.mStreamGen;
+    mFrame = other.mFrame;
+
+    return *this;
+}
+
+FrameLease& FrameLease::operator=(FrameLease&& other)
+{
+    if(this==&other)
+        return *this;
+
+    release();
+
+    mCap = other.mCap;
+    mBufIdx = other.mBufIdx;
+    mStreamGen = other.mStreamGen;
+    mFrame = other.mFrame;
+
+    other.mCap = nullptr;
+    other.mBufIdx = -1;
+    other.mFrame = Frame();
+
+    return *this;
+}
+
+FrameLease::~FrameLease()
+{
+    release();
+}
+
+void FrameLease::release()
+{
+    if(!mCap)
+        return;
+
+    mCap->releaseBuffer(mBufIdx, mStreamGen);
+
+    mCap = nullptr;
+    mBufIdx = -1;
+    mFrame = Frame();
+}
+// <---- FrameLease
+
+void VideoCapture::controlThreadFunc()
+{
+    while(true)
+    {
+        std::function<void()> request;
+
         {
-            return mLastFrame;
+            std::unique_lock<std::mutex> lock(mCtrlQueueMutex);
+            mCtrlQueueCond.wait( lock, [this]{return !mCtrlQueue.empty() || mCtrlStop;} );
+
+            if( mCtrlQueue.empty() )
+                break; // Stop requested and no more pending requests
+
+            request = std::move(mCtrlQueue.front());
+            mCtrlQueue.pop_front();
         }
-        time_count--;
-        usleep(100);
+
+        request();
     }
-    // <---- Wait for a new frame
+}
+
+template<typename R>
+std::future<R> VideoCapture::postControlRequest( std::function<R()> request )
+{
+    // std::function requires a copyable target: the task is shared
+    auto task = std::make_shared<std::packaged_task<R()>>( std::move(request) );
+    std::future<R> result = task->get_future();
+
+    mCtrlQueueMutex.lock();
+    mCtrlQueue.push_back( [task](){(*task)();} );
+    mCtrlQueueMutex.unlock();
+    mCtrlQueueCond.notify_one();
+
+    return result;
+}
+
+std::future<int> VideoCapture::setLEDstatusAsync(bool status)
+{
+    return postControlRequest<int>( [this,status](){return setLEDstatus(status);} );
+}
+
+std::future<void> VideoCapture::setBrightnessAsync(int brightness)
+{
+    return postControlRequest<void>( [this,brightness](){setBrightness(brightness);} );
+}
+
+std::future<void> VideoCapture::setWhiteBalanceAsync(int wb)
+{
+    return postControlRequest<void>( [this,wb](){setWhiteBalance(wb);} );
+}
+
+std::future<void> VideoCapture::setGammaAsync(int gamma)
+{
+    return postControlRequest<void>( [this,gamma](){setGamma(gamma);} );
+}
+
+std::future<int> VideoCapture::setAECAGCAsync(bool active)
+{
+    return postControlRequest<int>( [this,active](){return setAECAGC(active);} );
+}
+
+std::future<bool> VideoCapture::setROIforAECAGCAsync(CAM_SENS_POS side, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    return postControlRequest<bool>( [this,side,x,y,w,h](){return setROIforAECAGC(side,x,y,w,h);} );
+}
+
+std::future<bool> VideoCapture::resetROIforAECAGCAsync(CAM_SENS_POS side)
+{
+    return postControlRequest<bool>( [this,side](){return resetROIforAECAGC(side);} );
+}
+
+std::future<void> VideoCapture::setGainAsync(CAM_SENS_POS cam, int gain)
+{
+    return postControlRequest<void>( [this,cam,gain](){setGain(cam,gain);} );
+}
 
-    // Get the frame mutex
-    const std::lock_guard<std::mutex> lock(mBufMutex);
-    mNewFrame = false;
-    return mLastFrame;
+std::future<void> VideoCapture::setExposureAsync(CAM_SENS_POS cam, int exposure)
+{
+    return postControlRequest<void>( [this,cam,exposure](){setExposure(cam,exposure);} );
 }
 
 int VideoCapture::ll_VendorControl(uint8_t *buf, int len, int readMode, bool safe, bool force)
@@ -916,6 +2323,21 @@ int VideoCapture::ll_VendorControl(uint8_t *buf, int len, int readMode, bool saf
     if (!force && !mInitialized)
         return -3;
 
+    const std::lock_guard<std::mutex> lock(mCtrlMutex);
+
+    //std::cerr << "[ll_VendorControl] '" << mDevName << "' [" << mDevId << "] - mFileDesc: " << mFileDesc << std::endl;
+
+    len = ll_VendorQueryLen();
+    if (len < 0)
+    {
+        return -4;
+    }
+
+    return ll_VendorTransfer(buf, len, readMode, safe);
+}
+
+int VideoCapture::ll_VendorQueryLen()
+{
     unsigned char tmp[2] = {0};
     struct uvc_xu_control_query xu_query_info;
     xu_query_info.unit = cbs_xu_unit_id;
@@ -924,22 +2346,18 @@ int VideoCapture::ll_VendorControl(uint8_t *buf, int len, int readMode, bool saf
     xu_query_info.size = 2;
     xu_query_info.data = tmp;
 
-    const std::lock_guard<std::mutex> lock(mComMutex);
-
     int io_err = ioctl(mFileDesc, UVCIOC_CTRL_QUERY, &xu_query_info);
-
-    //std::cerr << "[ll_VendorControl] '" << mDevName << "' [" << mDevId << "] - mFileDesc: " << mFileDesc << std::endl;
-
     if (io_err != 0)
     {
         return -4;
     }
-    else
-    {
-        len = (xu_query_info.data[1] << 8) + xu_query_info.data[0];
-    }
 
-    //len should be now 384 for USB3 and 64 for USB2
+    //len should be 384 for USB3 and 64 for USB2
+    return (xu_query_info.data[1] << 8) + xu_query_info.data[0];
+}
+
+int VideoCapture::ll_VendorTransfer(uint8_t *buf, int len, int readMode, bool safe)
+{
     // we use the UVC_SET_CUR to write the cmd
     struct uvc_xu_control_query xu_query_send;
     xu_query_send.unit = cbs_xu_unit_id;
@@ -948,7 +2366,7 @@ int VideoCapture::ll_VendorControl(uint8_t *buf, int len, int readMode, bool saf
     xu_query_send.size = static_cast<__u16> (len); //64 for USB2
     xu_query_send.data = buf;
 
-    io_err = ioctl(mFileDesc, UVCIOC_CTRL_QUERY, &xu_query_send);
+    int io_err = ioctl(mFileDesc, UVCIOC_CTRL_QUERY, &xu_query_send);
     if (io_err != 0)
     {
         int res = errno;
@@ -1107,39 +2525,17 @@ int VideoCapture::ll_set_gpio_direction(int gpio_number, int direction)
     return hr;
 }
 
-int VideoCapture::ll_read_system_register(uint64_t address, uint8_t *value)
-{
-    unsigned char xu_buf[384];
-    memset(xu_buf, 0, 384);
-
-    //Set xubuf
-    xu_buf[0] = XU_TASK_GET;
-    xu_buf[1] = 0xA2;
-    xu_buf[2] = 0;
-    xu_buf[3] = 0x04; //Address width in bytes
-    xu_buf[4] = 0x01; //data width in bytes
-
-    xu_buf[5] = ((address) >> 24) & 0xff;
-    xu_buf[6] = ((address) >> 16) & 0xff;
-    xu_buf[7] = ((address) >> 8) & 0xff;
-    xu_buf[8] = (address) & 0xff;
-    xu_buf[9] = 0x00;
-    xu_buf[10] = 0x01;
-    xu_buf[11] = 0x00;
-    xu_buf[12] = 0x01;
+#define ASIC_INT_NULL_I2C    0xa3
+#define ASIC_INT_I2C         0xa5
 
-    int hr = ll_VendorControl(xu_buf, 384, READ_MODE);
-    *value = xu_buf[17];
-    return hr;
-}
+#define XU_REG_WRITE_DATA   16 // Offset of the data written in the XU buffer
+#define XU_REG_READ_DATA    17 // Offset of the data read in the XU buffer
 
-int VideoCapture::ll_write_system_register(uint64_t address, uint8_t value)
+// Fill the XU command to access `count` contiguous ISP registers starting from `address`.
+// `count` is 1 except for the experimental burst writes (see `VideoCapture::setRegisterBurst`)
+static void setSystemRegisterCmd(uint8_t* xu_buf, bool read, uint64_t address, uint16_t count)
 {
-    unsigned char xu_buf[384];
-    memset(xu_buf, 0, 384);
-
-    //Set xubuf
-    xu_buf[0] = XU_TASK_SET;
+    xu_buf[0] = read?XU_TASK_GET:XU_TASK_SET;
     xu_buf[1] = 0xA2;
     xu_buf[2] = 0;
     xu_buf[3] = 0x04; //Address width in bytes
@@ -1149,27 +2545,16 @@ int VideoCapture::ll_write_system_register(uint64_t address, uint8_t value)
     xu_buf[6] = ((address) >> 16) & 0xff;
     xu_buf[7] = ((address) >> 8) & 0xff;
     xu_buf[8] = (address) & 0xff;
-    xu_buf[9] = 0x00;
-    xu_buf[10] = 0x01;
-    xu_buf[11] = 0x00;
-    xu_buf[12] = 0x01;
-    xu_buf[16] = value;
-
-    int hr = ll_VendorControl(xu_buf, 384, 0);
-    return hr;
+    xu_buf[9] = (count >> 8) & 0xff;
+    xu_buf[10] = count & 0xff;
+    xu_buf[11] = (count >> 8) & 0xff;
+    xu_buf[12] = count & 0xff;
 }
 
-#define ASIC_INT_NULL_I2C    0xa3
-#define ASIC_INT_I2C         0xa5
-
-int VideoCapture::ll_read_sensor_register(int side, int sscb_id, uint64_t address, uint8_t* value)
+// Fill the XU command to access a single sensor register through the I2C bridge
+static void setSensorRegisterCmd(uint8_t* xu_buf, bool read, int side, int sscb_id, uint64_t address)
 {
-    unsigned char xu_buf[384];
-    memset(xu_buf, 0, 384);
-
-
-    //Set xubuf
-    xu_buf[0] = XU_TASK_GET;
+    xu_buf[0] = read?XU_TASK_GET:XU_TASK_SET;
     if (side == 0)
         xu_buf[1] = ASIC_INT_NULL_I2C;
     else
@@ -1183,68 +2568,219 @@ int VideoCapture::ll_read_sensor_register(int side, int sscb_id, uint64_t addres
     xu_buf[7] = ((address) >> 8) & 0xff;
     xu_buf[8] = (address) & 0xff;
 
-    xu_buf[9] = 0x00;
-    xu_buf[10] = 0x01;
-    xu_buf[11] = 0x00;
-    xu_buf[12] = 0x01;
-
     int limit = 1;
-
     xu_buf[9] = (limit >> 8) & 0xff;
     xu_buf[10] = (limit >> 0) & 0xff;
+    xu_buf[11] = 0x00;
+    xu_buf[12] = 0x01;
 
     //set page addr
     xu_buf[9] = xu_buf[9] & 0x0f;
     xu_buf[9] = xu_buf[9] | 0x10;
     xu_buf[9] = xu_buf[9] | 0x80;
+}
+
+int VideoCapture::ll_read_system_register(uint64_t address, uint8_t *value)
+{
+    unsigned char xu_buf[384];
+    memset(xu_buf, 0, 384);
+
+    setSystemRegisterCmd(xu_buf, true, address, 1);
 
     int hr = ll_VendorControl(xu_buf, 384, READ_MODE);
-    *value = xu_buf[17];
+    *value = xu_buf[XU_REG_READ_DATA];
+    return hr;
+}
+
+int VideoCapture::ll_write_system_register(uint64_t address, uint8_t value)
+{
+    unsigned char xu_buf[384];
+    memset(xu_buf, 0, 384);
+
+    setSystemRegisterCmd(xu_buf, false, address, 1);
+    xu_buf[XU_REG_WRITE_DATA] = value;
+
+    int hr = ll_VendorControl(xu_buf, 384, 0);
+    return hr;
+}
+
+int VideoCapture::ll_read_sensor_register(int side, int sscb_id, uint64_t address, uint8_t* value)
+{
+    unsigned char xu_buf[384];
+    memset(xu_buf, 0, 384);
+
+    setSensorRegisterCmd(xu_buf, true, side, sscb_id, address);
+
+    int hr = ll_VendorControl(xu_buf, 384, READ_MODE);
+    *value = xu_buf[XU_REG_READ_DATA];
     return hr;
 }
 
 int VideoCapture::ll_write_sensor_register(int side, int sscb_id, uint64_t address, uint8_t value)
 {
+    unsigned char xu_buf[384];
+    memset(xu_buf, 0, 384);
+
+    setSensorRegisterCmd(xu_buf, false, side, sscb_id, address);
+    xu_buf[XU_REG_WRITE_DATA] = value;
+
+    int hr = ll_VendorControl(xu_buf, 384, 0);
+    return hr;
+}
 
+int VideoCapture::ll_RegisterTransfer(int xuLen, const RegisterBatch::Access* acc, int count)
+{
     unsigned char xu_buf[384];
     memset(xu_buf, 0, 384);
 
-    //Set xubuf
-    xu_buf[0] = XU_TASK_SET;
-    if (side == 0)
-        xu_buf[1] = ASIC_INT_NULL_I2C;
+    if (acc[0].sensor)
+        setSensorRegisterCmd(xu_buf, acc[0].read, acc[0].side, 1, acc[0].address);
     else
-        xu_buf[1] = ASIC_INT_I2C;
-    xu_buf[2] = 0x6c;
-    xu_buf[3] = sscb_id + 1; //Address width in bytes
-    xu_buf[4] = 0x01; //data width in bytes
+        setSystemRegisterCmd(xu_buf, acc[0].read, acc[0].address, static_cast<uint16_t>(count));
 
-    xu_buf[5] = ((address) >> 24) & 0xff;
-    xu_buf[6] = ((address) >> 16) & 0xff;
-    xu_buf[7] = ((address) >> 8) & 0xff;
-    xu_buf[8] = (address) & 0xff;
-    xu_buf[9] = 0x00;
-    xu_buf[10] = 0x01;
-    xu_buf[11] = 0x00;
-    xu_buf[12] = 0x01;
-    xu_buf[16] = value;
+    if (!acc[0].read)
+    {
+        for (int i = 0; i < count; i++)
+            xu_buf[XU_REG_WRITE_DATA+i] = acc[i].value;
+    }
 
+    int hr = ll_VendorTransfer(xu_buf, xuLen, acc[0].read?READ_MODE:0, false);
 
-    xu_buf[9] = 0x00;
-    xu_buf[10] = 0x01;
-    xu_buf[11] = 0x00;
-    xu_buf[12] = 0x01;
+    if (hr==0 && acc[0].read)
+    {
+        for (int i = 0; i < count; i++)
+            *acc[i].dest = xu_buf[XU_REG_READ_DATA+i];
+    }
+    return hr;
+}
 
-    int limit = 1;
-    xu_buf[9] = (limit >> 8) & 0xff;
-    xu_buf[10] = (limit >> 0) & 0xff;
+void RegisterBatch::writeSystemRegister(uint64_t address, uint8_t value)
+{
+    Access acc;
+    acc.address = address;
+    acc.value = value;
+    mAccesses.push_back(acc);
+}
 
-    //set page addr
-    xu_buf[9] = xu_buf[9] & 0x0f;
-    xu_buf[9] = xu_buf[9] | 0x10;
-    xu_buf[9] = xu_buf[9] | 0x80;
-    memcpy(&xu_buf[16], &value, sizeof (uint8_t));
-    int hr = ll_VendorControl(xu_buf, 384, 0);
+void RegisterBatch::readSystemRegister(uint64_t address, uint8_t* value)
+{
+    Access acc;
+    acc.read = true;
+    acc.address = address;
+    acc.dest = value;
+    mAccesses.push_back(acc);
+}
+
+void RegisterBatch::writeSensorRegister(int side, uint64_t address, uint8_t value)
+{
+    Access acc;
+    acc.sensor = true;
+    acc.side = side;
+    acc.address = address;
+    acc.value = value;
+    mAccesses.push_back(acc);
+}
+
+void RegisterBatch::readSensorRegister(int side, uint64_t address, uint8_t* value)
+{
+    Access acc;
+    acc.sensor = true;
+    acc.read = true;
+    acc.side = side;
+    acc.address = address;
+    acc.dest = value;
+    mAccesses.push_back(acc);
+}
+
+void VideoCapture::setRegisterBurst(bool enable)
+{
+    const std::lock_guard<std::mutex> lock(mCtrlMutex);
+    mRegisterBurst = enable;
+}
+
+int VideoCapture::applyRegisterBatch(const RegisterBatch& batch, RegisterBatchStats* stats)
+{
+    if (!mInitialized)
+        return -3;
+
+    RegisterBatchStats batchStats;
+    batchStats.accesses = static_cast<int>(batch.mAccesses.size());
+
+    uint64_t start = getSteadyTimestamp();
+
+    int hr = 0;
+    {
+        const std::lock_guard<std::mutex> lock(mCtrlMutex);
+
+        // The transfer length does not change while the camera is connected: query it once for the whole batch
+        int xuLen = ll_VendorQueryLen();
+        if (xuLen < 0)
+            hr = -4;
+
+        // A burst must fit the XU buffer: 64 bytes for USB2, 384 for USB3
+        int maxBurst = std::min(xuLen, 384) - XU_REG_READ_DATA;
+
+        const std::vector<RegisterBatch::Access>& acc = batch.mAccesses;
+        int n = (hr==0) ? static_cast<int>(acc.size()) : 0;
+        int i = 0;
+        while (i < n)
+        {
+            // ----> Coalesce the following writes to contiguous ISP registers
+            int count = 1;
+            if (mRegisterBurst && !acc[i].sensor && !acc[i].read)
+            {
+                while (i+count < n && count < maxBurst &&
+                       !acc[i+count].sensor && !acc[i+count].read &&
+                       acc[i+count].address == acc[i].address+count)
+                {
+                    count++;
+                }
+            }
+            // <---- Coalesce the following writes to contiguous ISP registers
+
+            int res = ll_RegisterTransfer(xuLen, &acc[i], count);
+            batchStats.transfers++;
+
+            if (count > 1)
+            {
+                // ----> Read back the last register of the burst with a single transfer
+                uint8_t check = 0;
+                RegisterBatch::Access last = acc[i+count-1];
+                last.read = true;
+                last.dest = &check;
+                if (res == 0)
+                {
+                    res = ll_RegisterTransfer(xuLen, &last, 1);
+                    batchStats.transfers++;
+                }
+                // <---- Read back the last register of the burst with a single transfer
+
+                if (res != 0 || check != acc[i+count-1].value)
+                {
+                    // The burst has not been applied: write one register at a time from now on
+                    batchStats.fallbacks++;
+                    mRegisterBurst = false;
+                    WARNING_OUT(mParams.verbose, std::string("Burst register transfer not applied, retrying ") +
+                                std::to_string(count) + std::string(" single transfers. Burst transfers disabled"));
+
+                    res = 0;
+                    for (int k = 0; k < count; k++)
+                    {
+                        res += ll_RegisterTransfer(xuLen, &acc[i+k], 1);
+                        batchStats.transfers++;
+                    }
+                }
+            }
+
+            hr += res;
+            i += count;
+        }
+    }
+
+    batchStats.latency_usec = (getSteadyTimestamp() - start)/1000;
+
+    if (stats)
+        *stats = batchStats;
 
     return hr;
 }
@@ -1412,6 +2948,8 @@ int VideoCapture::setLEDstatus(bool status)
         hr += ll_set_gpio_value(2, 0);
     }
 
+    setCachedControl(mCtrlCache.led, (hr==0)?(status?1:0):-1);
+
     return hr;
 }
 
@@ -1422,10 +2960,19 @@ int VideoCapture::getLEDstatus(bool *status)
         return -1;
     }
 
+    int cached = getCachedControl(mCtrlCache.led);
+    if(cached>=0)
+    {
+        *status = cached!=0;
+        return 0;
+    }
+
     uint8_t val;
     int hr = ll_set_gpio_direction(2, 1);
     hr += ll_get_gpio_value(2, &val);
     *status = val!=0;
+    if(hr==0)
+        setCachedControl(mCtrlCache.led, *status?1:0);
     return hr;
 }
 
@@ -1470,7 +3017,7 @@ int VideoCapture::getCameraControlSettings(int ctrl_id)
     return res;
 }
 
-void VideoCapture::setCameraControlSettings(int ctrl_id, int ctrl_val) {
+int VideoCapture::setCameraControlSettings(int ctrl_id, int ctrl_val) {
     struct v4l2_control control_s;
     struct v4l2_queryctrl queryctrl;
     memset(&queryctrl, 0, sizeof (queryctrl));
@@ -1507,12 +3054,13 @@ void VideoCapture::setCameraControlSettings(int ctrl_id, int ctrl_val) {
 
 
         if (ioctl(mFileDesc, VIDIOC_S_CTRL, &control_s) == 0)
-            return;
-    } else
-        return;
+            return 0;
+    }
+
+    return -1;
 }
 
-void VideoCapture::resetCameraControlSettings(int ctrl_id) {
+int VideoCapture::resetCameraControlSettings(int ctrl_id) {
 
     struct v4l2_control control_s;
     struct v4l2_queryctrl queryctrl;
@@ -1521,13 +3069,45 @@ void VideoCapture::resetCameraControlSettings(int ctrl_id) {
     int val_def;
     // save_controls(fd);
     queryctrl.id = ctrl_id;
-    ioctl(mFileDesc, VIDIOC_QUERYCTRL, &queryctrl);
+    if (0 != ioctl(mFileDesc, VIDIOC_QUERYCTRL, &queryctrl))
+        return -1;
     val_def = queryctrl.default_value;
 
     control_s.id = ctrl_id;
     control_s.value = val_def;
-    ioctl(mFileDesc, VIDIOC_S_CTRL, &control_s);
-    return;
+    if (0 != ioctl(mFileDesc, VIDIOC_S_CTRL, &control_s))
+        return -1;
+    return val_def;
+}
+
+int VideoCapture::getCachedControl(const int& entry)
+{
+    const std::lock_guard<std::mutex> lock(mCtrlCacheMutex);
+    return entry;
+}
+
+void VideoCapture::setCachedControl(int& entry, int value)
+{
+    const std::lock_guard<std::mutex> lock(mCtrlCacheMutex);
+    entry = value;
+}
+
+int VideoCapture::getCachedCameraControl(int& entry, int ctrl_id)
+{
+    int value = getCachedControl(entry);
+    if (value >= 0)
+        return value;
+
+    value = getCameraControlSettings(ctrl_id);
+    if (value >= 0)
+        setCachedControl(entry, value);
+    return value;
+}
+
+ControlSnapshot VideoCapture::getControlSnapshot()
+{
+    const std::lock_guard<std::mutex> lock(mCtrlCacheMutex);
+    return mCtrlCache;
 }
 
 int VideoCapture::setGammaPreset(int side, int value)
@@ -1545,28 +3125,37 @@ int VideoCapture::setGammaPreset(int side, int value)
     if (side == 1)
         ulAddr = 0x80181D00;
 
-    int hr = 0;
+    // ----> Gamma table: a single batch, verified by reading the registers back
+    uint8_t valRead[15] = {0};
 
+    RegisterBatch batch;
     for (int i = 0; i < 15; i++) {
-        hr += ll_write_system_register(ulAddr, PRESET_GAMMA[value-1][i]);
-        usleep(10);
-        uint8_t valRead = 0x0;
-        hr += ll_read_system_register(ulAddr, &valRead);
-        if (valRead != PRESET_GAMMA[value-1][i]) {
+        batch.writeSystemRegister(ulAddr+i, PRESET_GAMMA[value-1][i]);
+    }
+    for (int i = 0; i < 15; i++) {
+        batch.readSystemRegister(ulAddr+i, &valRead[i]);
+    }
+
+    int hr = applyRegisterBatch(batch);
+
+    for (int i = 0; i < 15; i++) {
+        if (valRead[i] != PRESET_GAMMA[value-1][i]) {
             return -3;
         }
-        ulAddr++;
     }
+    // <---- Gamma table: a single batch, verified by reading the registers back
 
     ulAddr = 0x80181510;
 
     if (side == 1)
         ulAddr = 0x80181D10;
-    hr += ll_write_system_register(ulAddr, 0x01);
-    usleep(10);
-    uint8_t valRead = 0x0;
-    hr += ll_read_system_register(ulAddr, &valRead);
-    if (valRead != 0x01)
+
+    uint8_t enRead = 0x0;
+    batch.clear();
+    batch.writeSystemRegister(ulAddr, 0x01);
+    batch.readSystemRegister(ulAddr, &enRead);
+    hr += applyRegisterBatch(batch);
+    if (enRead != 0x01)
         return -2;
 
     return hr;
@@ -1574,82 +3163,91 @@ int VideoCapture::setGammaPreset(int side, int value)
 
 void VideoCapture::setBrightness(int brightness)
 {
-    setCameraControlSettings(LINUX_CTRL_BRIGHTNESS, brightness);
+    if(setCameraControlSettings(LINUX_CTRL_BRIGHTNESS, brightness)==0)
+        setCachedControl(mCtrlCache.brightness, brightness);
 }
 
 void VideoCapture::resetBrightness()
 {
-    resetCameraControlSettings(LINUX_CTRL_BRIGHTNESS);
+    setCachedControl(mCtrlCache.brightness, resetCameraControlSettings(LINUX_CTRL_BRIGHTNESS));
 }
 
 int VideoCapture::getBrightness()
 {
-    return getCameraControlSettings(LINUX_CTRL_BRIGHTNESS);
+    return getCachedCameraControl(mCtrlCache.brightness, LINUX_CTRL_BRIGHTNESS);
 }
 
 void VideoCapture::setSharpness(int sharpness)
 {
-    setCameraControlSettings(LINUX_CTRL_SHARPNESS, sharpness);
+    if(setCameraControlSettings(LINUX_CTRL_SHARPNESS, sharpness)==0)
+        setCachedControl(mCtrlCache.sharpness, sharpness);
 }
 
 void VideoCapture::resetSharpness()
 {
-    resetCameraControlSettings(LINUX_CTRL_SHARPNESS);
+    setCachedControl(mCtrlCache.sharpness, resetCameraControlSettings(LINUX_CTRL_SHARPNESS));
 }
 
 int VideoCapture::getSharpness()
 {
-    return getCameraControlSettings(LINUX_CTRL_SHARPNESS);
+    return getCachedCameraControl(mCtrlCache.sharpness, LINUX_CTRL_SHARPNESS);
 }
 
 void VideoCapture::setContrast(int contrast)
 {
-    setCameraControlSettings(LINUX_CTRL_CONTRAST, contrast);
+    if(setCameraControlSettings(LINUX_CTRL_CONTRAST, contrast)==0)
+        setCachedControl(mCtrlCache.contrast, contrast);
 }
 
 void VideoCapture::resetContrast()
 {
-    resetCameraControlSettings(LINUX_CTRL_CONTRAST);
+    setCachedControl(mCtrlCache.contrast, resetCameraControlSettings(LINUX_CTRL_CONTRAST));
 }
 
 int VideoCapture::getContrast()
 {
-    return getCameraControlSettings(LINUX_CTRL_CONTRAST);
+    return getCachedCameraControl(mCtrlCache.contrast, LINUX_CTRL_CONTRAST);
 }
 
 void VideoCapture::setHue(int hue)
 {
-    setCameraControlSettings(LINUX_CTRL_HUE, hue);
+    if(setCameraControlSettings(LINUX_CTRL_HUE, hue)==0)
+        setCachedControl(mCtrlCache.hue, hue);
 }
 
 void VideoCapture::resetHue()
 {
-    resetCameraControlSettings(LINUX_CTRL_HUE);
+    setCachedControl(mCtrlCache.hue, resetCameraControlSettings(LINUX_CTRL_HUE));
 }
 
 int VideoCapture::getHue()
 {
-    return getCameraControlSettings(LINUX_CTRL_HUE);
+    return getCachedCameraControl(mCtrlCache.hue, LINUX_CTRL_HUE);
 }
 
 void VideoCapture::setSaturation(int saturation)
 {
-    setCameraControlSettings(LINUX_CTRL_SATURATION, saturation);
+    if(setCameraControlSettings(LINUX_CTRL_SATURATION, saturation)==0)
+        setCachedControl(mCtrlCache.saturation, saturation);
 }
 
 void VideoCapture::resetSaturation()
 {
-    resetCameraControlSettings(LINUX_CTRL_SATURATION);
+    setCachedControl(mCtrlCache.saturation, resetCameraControlSettings(LINUX_CTRL_SATURATION));
 }
 
 int VideoCapture::getSaturation()
 {
-    return getCameraControlSettings(LINUX_CTRL_SATURATION);
+    return getCachedCameraControl(mCtrlCache.saturation, LINUX_CTRL_SATURATION);
 }
 
 int VideoCapture::getWhiteBalance()
 {
-    return getCameraControlSettings(LINUX_CTRL_AWB);
+    // The value changes continuously while the automatic white balance is active
+    if (getAutoWhiteBalance())
+        return getCameraControlSettings(LINUX_CTRL_AWB);
+
+    return getCachedCameraControl(mCtrlCache.white_balance, LINUX_CTRL_AWB);
 }
 
 void VideoCapture::setWhiteBalance(int wb)
@@ -1658,17 +3256,22 @@ void VideoCapture::setWhiteBalance(int wb)
     if (getAutoWhiteBalance() != 0)
         setAutoWhiteBalance(false);
 
-    setCameraControlSettings(LINUX_CTRL_AWB, wb);
+    if(setCameraControlSettings(LINUX_CTRL_AWB, wb)==0)
+        setCachedControl(mCtrlCache.white_balance, wb);
 }
 
 bool VideoCapture::getAutoWhiteBalance()
 {
-    return (getCameraControlSettings(LINUX_CTRL_AWB_AUTO)!=0);
+    return (getCachedCameraControl(mCtrlCache.auto_white_balance, LINUX_CTRL_AWB_AUTO)!=0);
 }
 
 void VideoCapture::setAutoWhiteBalance(bool active)
 {
-    setCameraControlSettings(LINUX_CTRL_AWB_AUTO, active?1:0);
+    int res = setCameraControlSettings(LINUX_CTRL_AWB_AUTO, active?1:0);
+
+    const std::lock_guard<std::mutex> lock(mCtrlCacheMutex);
+    mCtrlCache.auto_white_balance = (res==0)?(active?1:0):-1;
+    mCtrlCache.white_balance = -1; // Driven by the camera while active, unknown when deactivated
 }
 
 void VideoCapture::resetAutoWhiteBalance()
@@ -1678,13 +3281,16 @@ void VideoCapture::resetAutoWhiteBalance()
 
 void VideoCapture::setGamma(int gamma)
 {
-    int current_gamma = getCameraControlSettings(LINUX_CTRL_GAMMA);
+    int current_gamma = getGamma();
 
     if (gamma!=current_gamma)
     {
         setGammaPreset(0,gamma);
         setGammaPreset(1,gamma);
-        setCameraControlSettings(LINUX_CTRL_GAMMA, gamma);
+        if(setCameraControlSettings(LINUX_CTRL_GAMMA, gamma)==0)
+            setCachedControl(mCtrlCache.gamma, gamma);
+        else
+            setCachedControl(mCtrlCache.gamma, -1);
     }
 }
 
@@ -1693,11 +3299,14 @@ void VideoCapture::resetGamma()
     int def_value = DEFAULT_GAMMA_NOECT;
     setGammaPreset(0,def_value);
     setGammaPreset(1,def_value);
-    setCameraControlSettings(LINUX_CTRL_GAMMA, def_value);
+    if(setCameraControlSettings(LINUX_CTRL_GAMMA, def_value)==0)
+        setCachedControl(mCtrlCache.gamma, def_value);
+    else
+        setCachedControl(mCtrlCache.gamma, -1);
 }
 
 int VideoCapture::getGamma() {
-    return getCameraControlSettings(LINUX_CTRL_GAMMA);
+    return getCachedCameraControl(mCtrlCache.gamma, LINUX_CTRL_GAMMA);
 }
 
 int VideoCapture::setAECAGC(bool active)
@@ -1705,14 +3314,28 @@ int VideoCapture::setAECAGC(bool active)
     int res = 0;
     res += ll_isp_aecagc_enable(0, active);
     res += ll_isp_aecagc_enable(1, active);
+
+    const std::lock_guard<std::mutex> lock(mCtrlCacheMutex);
+    mCtrlCache.aec_agc = (res==0)?(active?1:0):-1;
+    // Driven by the camera while active, unknown when deactivated
+    mCtrlCache.gain[0] = mCtrlCache.gain[1] = -1;
+    mCtrlCache.exposure[0] = mCtrlCache.exposure[1] = -1;
+
     return res;
 }
 
 bool VideoCapture::getAECAGC()
 {
+    int cached = getCachedControl(mCtrlCache.aec_agc);
+    if(cached>=0)
+        return cached!=0;
+
     int resL = ll_isp_is_aecagc(0);
     int resR = ll_isp_is_aecagc(1);
-    return (resL && resR);
+    bool active = (resL && resR);
+    if(resL>=0 && resR>=0)
+        setCachedControl(mCtrlCache.aec_agc, active?1:0);
+    return active;
 }
 
 void VideoCapture::resetAECAGC()
@@ -1753,14 +3376,17 @@ bool VideoCapture::setROIforAECAGC(CAM_SENS_POS side, uint16_t x, uint16_t y, ui
     if (static_cast<int>(side)==1)
         ulAddr= 0x801818C0;
 
-    int r = ll_write_system_register(ulAddr,static_cast<uint8_t>(x_start_high));ulAddr++;usleep(100);
-    r += ll_write_system_register(ulAddr,static_cast<uint8_t>(x_start_low));ulAddr++;usleep(100);
-    r += ll_write_system_register(ulAddr,static_cast<uint8_t>(y_start_high));ulAddr++;usleep(100);
-    r += ll_write_system_register(ulAddr,static_cast<uint8_t>(y_start_low));ulAddr++;usleep(100);
-    r += ll_write_system_register(ulAddr,static_cast<uint8_t>(w_start_high));ulAddr++;usleep(100);
-    r += ll_write_system_register(ulAddr,static_cast<uint8_t>(w_start_low));ulAddr++;usleep(100);
-    r += ll_write_system_register(ulAddr,static_cast<uint8_t>(h_start_high));ulAddr++;usleep(100);
-    r += ll_write_system_register(ulAddr,static_cast<uint8_t>(h_start_low));ulAddr++;usleep(100);
+    RegisterBatch batch;
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(x_start_high));
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(x_start_low));
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(y_start_high));
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(y_start_low));
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(w_start_high));
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(w_start_low));
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(h_start_high));
+    batch.writeSystemRegister(ulAddr++,static_cast<uint8_t>(h_start_low));
+
+    int r = applyRegisterBatch(batch);
 
     return (r==0);
 }
@@ -1783,14 +3409,17 @@ bool VideoCapture::getROIforAECAGC(CAM_SENS_POS side, uint16_t &x, uint16_t &y,
     uint32_t ulAddr = 0x801810C0;
     if (static_cast<int>(side)==1)
         ulAddr= 0x801818C0;
-    int r =  ll_read_system_register(ulAddr,&x_start_high);ulAddr++;usleep(100);
-    r +=  ll_read_system_register(ulAddr,&x_start_low);ulAddr++;usleep(100);
-    r +=   ll_read_system_register(ulAddr,&y_start_high);ulAddr++;usleep(100);
-    r +=   ll_read_system_register(ulAddr,&y_start_low);ulAddr++;usleep(100);
-    r +=   ll_read_system_register(ulAddr,&w_start_high);ulAddr++;usleep(100);
-    r +=   ll_read_system_register(ulAddr,&w_start_low);ulAddr++;usleep(100);
-    r +=   ll_read_system_register(ulAddr,&h_start_high);ulAddr++;usleep(100);
-    r +=   ll_read_system_register(ulAddr,&h_start_low);ulAddr++;usleep(100);
+    RegisterBatch batch;
+    batch.readSystemRegister(ulAddr++,&x_start_high);
+    batch.readSystemRegister(ulAddr++,&x_start_low);
+    batch.readSystemRegister(ulAddr++,&y_start_high);
+    batch.readSystemRegister(ulAddr++,&y_start_low);
+    batch.readSystemRegister(ulAddr++,&w_start_high);
+    batch.readSystemRegister(ulAddr++,&w_start_low);
+    batch.readSystemRegister(ulAddr++,&h_start_high);
+    batch.readSystemRegister(ulAddr++,&h_start_low);
+
+    int r = applyRegisterBatch(batch);
 
     x = x_start_high*256 + x_start_low;
     y = y_start_high*256 + y_start_low;
@@ -1800,8 +3429,21 @@ bool VideoCapture::getROIforAECAGC(CAM_SENS_POS side, uint16_t &x, uint16_t &y,
     return (r==0);
 }
 
+bool VideoCapture::isSensorPosValid(CAM_SENS_POS cam)
+{
+    // The control cache has an entry for each sensor
+    if(cam==CAM_SENS_POS::LEFT || cam==CAM_SENS_POS::RIGHT)
+        return true;
+
+    ERROR_OUT(mParams.verbose,std::string("Invalid sensor position: ") + std::to_string(static_cast<int>(cam)));
+    return false;
+}
+
 void VideoCapture::setGain(CAM_SENS_POS cam, int gain)
 {
+    if(!isSensorPosValid(cam))
+        return;
+
     if(getAECAGC())
         setAECAGC(false);
 
@@ -1818,28 +3460,50 @@ void VideoCapture::setGain(CAM_SENS_POS cam, int gain)
 
     ucGainM = (rawGain >> 8) & 0xff;
     ucGainL = rawGain & 0xff;
-    ll_isp_set_gain(ucGainH, ucGainM, ucGainL, sensorId);
+    int r = ll_isp_set_gain(ucGainH, ucGainM, ucGainL, sensorId);
+
+    // Cache the value that `getGain` would read back, after the conversion to raw gain
+    setCachedControl(mCtrlCache.gain[sensorId], (r==0)?calcGainValue(rawGain):-1);
 
 }
 
 int VideoCapture::getGain(CAM_SENS_POS cam)
 {
+    if(!isSensorPosValid(cam))
+        return -1;
+
     int rawGain=0;
 
     uint8_t val[3];
     memset(val, 0, 3);
 
     int sensorId = static_cast<int>(cam);
+
+    // The value changes continuously while AEC/AGC is active
+    bool aecagc = getAECAGC();
+    if(!aecagc)
+    {
+        int cached = getCachedControl(mCtrlCache.gain[sensorId]);
+        if(cached>=0)
+            return cached;
+    }
+
     int r = ll_isp_get_gain(val, sensorId);
     if(r<0)
         return r;
 
     rawGain = (int) ((val[1] << 8) + val[0]);
-    return calcGainValue(rawGain);
+    int gain = calcGainValue(rawGain);
+    if(!aecagc)
+        setCachedControl(mCtrlCache.gain[sensorId], gain);
+    return gain;
 }
 
 void VideoCapture::setExposure(CAM_SENS_POS cam, int exposure)
 {
+    if(!isSensorPosValid(cam))
+        return;
+
     unsigned char ucExpH, ucExpM, ucExpL;
 
     if(getAECAGC())
@@ -1861,11 +3525,18 @@ void VideoCapture::setExposure(CAM_SENS_POS cam, int exposure)
     ucExpH = (rawExp >> 12) & 0xff;
     ucExpM = (rawExp >> 4) & 0xff;
     ucExpL = (rawExp << 4) & 0xf0;
-    ll_isp_set_exposure(ucExpH, ucExpM, ucExpL, sensorId);
+    int r = ll_isp_set_exposure(ucExpH, ucExpM, ucExpL, sensorId);
+
+    // Cache the value that `getExposure` would read back, after the conversion to raw exposure
+    int cached = static_cast<int>(std::round((100.0*rawExp)/mExpoureRawMax));
+    setCachedControl(mCtrlCache.exposure[sensorId], (r==0)?cached:-1);
 }
 
 int VideoCapture::getExposure(CAM_SENS_POS cam)
 {
+    if(!isSensorPosValid(cam))
+        return -1;
+
     int rawExp=0;
 
     unsigned char val[3];
@@ -1873,6 +3544,15 @@ int VideoCapture::getExposure(CAM_SENS_POS cam)
 
     int sensorId = static_cast<int>(cam);
 
+    // The value changes continuously while AEC/AGC is active
+    bool aecagc = getAECAGC();
+    if(!aecagc)
+    {
+        int cached = getCachedControl(mCtrlCache.exposure[sensorId]);
+        if(cached>=0)
+            return cached;
+    }
+
     int r = ll_isp_get_exposure(val, sensorId);
     if(r<0)
         return r;
@@ -1881,6 +3561,8 @@ int VideoCapture::getExposure(CAM_SENS_POS cam)
     //std::cout << "Get Raw Exp: " << rawExp << std::endl;
 
     int exposure = static_cast<int>(std::round((100.0*rawExp)/mExpoureRawMax));
+    if(!aecagc)
+        setCachedControl(mCtrlCache.exposure[sensorId], exposure);
     return exposure;
 }
 
@@ -2090,7 +3772,7 @@ void VideoCapture::saveLogDataLeft()
         res += ll_read_sensor_register( 0, 1, addr, &values[idx++]);
     }
 
-    mLogFileLeft << std::dec << mLastFrame.timestamp << LOG_SEP;
+    mLogFileLeft << std::dec << mLatestFrame.timestamp << LOG_SEP;
     for(int i=0; i<reg_count; i++)
     {
         mLogFileLeft << "0x" << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(values[i]);
@@ -2124,7 +3806,7 @@ void VideoCapture::saveLogDataRight()
         res += ll_read_sensor_register( 1, 1, addr, &values[idx++]);
     }
 
-    mLogFileRight << std::dec << mLastFrame.timestamp << LOG_SEP;
+    mLogFileRight << std::dec << mLatestFrame.timestamp << LOG_SEP;
     for(int i=0; i<reg_count; i++)
     {
         mLogFileRight << "0x" << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(values[i]);
@@ -2136,12 +3818,18 @@ void VideoCapture::saveLogDataRight()
 }
 
 bool VideoCapture::resetAGCAECregisters() {
-    int res = 0;
-
-    res += ll_write_sensor_register( 0, 1, 0x3503, 0x04);
-    res += ll_write_sensor_register( 1, 1, 0x3503, 0x04);
-    res += ll_write_sensor_register( 0, 1, 0x3505, 0x00);
-    res += ll_write_sensor_register( 1, 1, 0x3505, 0x00);
+    RegisterBatch batch;
+    batch.writeSensorRegister( 0, 0x3503, 0x04);
+    batch.writeSensorRegister( 1, 0x3503, 0x04);
+    batch.writeSensorRegister( 0, 0x3505, 0x00);
+    batch.writeSensorRegister( 1, 0x3505, 0x00);
+
+    int res = applyRegisterBatch(batch);
+
+    const std::lock_guard<std::mutex> lock(mCtrlCacheMutex);
+    mCtrlCache.aec_agc = -1;
+    mCtrlCache.gain[0] = mCtrlCache.gain[1] = -1;
+    mCtrlCache.exposure[0] = mCtrlCache.exposure[1] = -1;
 
     return res==0;
 }